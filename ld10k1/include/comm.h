@@ -22,6 +22,8 @@
 #ifndef __COMM_H
 #define __COMM_H
 
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,6 +41,29 @@ struct msg_resp
 	int size;
 };
 
+/*
+ * v2 framing - request or response data starts with section table (msg_v2
+ * followed by count section sizes), then sections follow. Table and sections are padded
+ * to COMM_V2_ALIGN, so receiver can use sections in place.
+ */
+#define COMM_V2_MAGIC 0x3256314C
+#define COMM_V2_MAX_SECT 16
+#define COMM_V2_ALIGN 8
+#define COMM_V2_PAD(size) (((size) + COMM_V2_ALIGN - 1) & ~(COMM_V2_ALIGN - 1))
+#define COMM_V2_MAX_RESP 256
+
+struct msg_v2
+{
+	int magic;
+	int count;
+};
+
+struct msg_v2_table
+{
+	struct msg_v2 v2;
+	int size[COMM_V2_MAX_SECT + 1];
+};
+
 #define COMM_TYPE_LOCAL 0
 #define COMM_TYPE_IP 1
 
@@ -56,6 +81,22 @@ int connect_comm(int conn_num, comm_param *param);
 int listen_comm(int conn_num);
 int accept_comm(int conn_num);
 int free_comm(int conn_num);
+
+/* buffered non-blocking server connections */
+#define COMM_BUF_MIN_SIZE 4096
+#define COMM_BUF_MAX_OUT (4 * 1024 * 1024)
+
+int nonblock_comm(int conn_num);
+int attach_buf_comm(int conn_num);
+void detach_buf_comm(int conn_num);
+int fill_buf_comm(int conn_num, int max_in);
+int in_buf_comm(int conn_num);
+int request_ready_comm(int conn_num);
+int request_op_comm(int conn_num);
+int flush_buf_comm(int conn_num);
+int pending_out_comm(int conn_num);
+int cork_comm(int conn_num, int cork);
+
 int send_request(int conn_num, int op, void *data, int data_size);
 int send_response(int conn_num, int op, int err, void *data, int data_size);
 int send_msg_data(int conn_num, void *data, int data_size);
@@ -64,6 +105,11 @@ int receive_response(int conn_num, int *op, int *data_size);
 int receive_msg_data(int conn_num, void *data, int data_size);
 void *receive_msg_data_malloc(int conn_num, int data_size);
 
+int send_request_v2(int conn_num, int op, struct iovec *sect, int sect_count);
+int send_response_v2(int conn_num, int op, int err, struct iovec *sect, int sect_count);
+int receive_msg_v2(int conn_num, int data_size, void **arena, struct iovec *sect, int max_sect);
+int receive_response_v2(int conn_num, void *data, int data_size);
+
 #ifdef __cplusplus
 }
 #endif
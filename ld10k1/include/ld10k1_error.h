@@ -101,4 +101,22 @@
 
 #define LD10K1_ERR_UNKNOWN_POINT -66 /*  */
 
+#define LD10K1_ERR_BATCH_ACTIVE -67 /* batch already started */
+#define LD10K1_ERR_BATCH_NOT_ACTIVE -68 /* no batch started */
+#define LD10K1_ERR_BATCH_OP -69 /* operation not allowed in batch */
+#define LD10K1_ERR_BATCH_FAILED -70 /* previous operation in batch failed */
+
+#define LD10K1_ERR_ASYNC_UNKNOWN_REQ -71 /* unknown asynchronous request */
+
+#define LD10K1_ERR_EMU_NOT_ACTIVE -72 /* ld10k1 is not running with dsp emulator */
+#define LD10K1_ERR_EMU_REG -73 /* wrong emulator input or output register */
+
+#define LD10K1_ERR_UNKNOWN_CARD -74 /* card is not managed by ld10k1 */
+
+#define LD10K1_ERR_SNAPSHOT -75 /* wrong or damaged dsp state snapshot */
+
+#define LD10K1_ERR_DRIVER_CTL_WRITE -76 /* unable to write control value */
+
+#define LD10K1_ERR_EMU_INEXACT -77 /* emulator can't run LOG, EXP or bass/treble control exactly */
+
 #endif /* __LD10K1_ERROR_H */
@@ -52,7 +52,7 @@
 #define EMU10K1_REG_TRAM_DATA(datanum) (EMU10K1_REG_TYPE(EMU10K1_REG_TYPE_TRAM_DATA) | ((datanum) & 0xFF))
 #define EMU10K1_REG_TRAM_ADDR(addrnum) (EMU10K1_REG_TYPE(EMU10K1_REG_TYPE_TRAM_ADDR) | ((addrnum) & 0xFF))
 #define EMU10K1_REG_NORMAL(num) (EMU10K1_REG_TYPE(EMU10K1_REG_TYPE_NORMAL) | ((num) & 0x1FF))
-#define EMU10K1_REG_CONST(num) (EMU10K1_REG_TYPE(EMU10K1_REG_TYPE_CONST) | ((num) & 0x2ff))
+#define EMU10K1_REG_CONST(num) (EMU10K1_REG_TYPE(EMU10K1_REG_TYPE_CONST) | ((num) & 0x3ff))
 #define EMU10K1_REG_ALL(num) (EMU10K1_REG_TYPE(EMU10K1_REG_TYPE_ALL) | ((num) & 0x7FF))
 #define EMU10K1_REG_NAMED(num) (EMU10K1_REG_TYPE(EMU10K1_REG_TYPE_ALL) | ((num) & 0xFFFFFFF))
 
@@ -290,6 +290,27 @@ typedef struct {
 	int where;
 } ld10k1_fnc_patch_del_t;
 
+typedef struct {
+	int patch_num;
+	int loop_break;
+} ld10k1_fnc_patch_loop_break_t;
+
+/*
+ * FNC_PATCH_GPR_WRITE - header is followed by count values. Register is
+ * static (EMU10K1_PREG_STA) or control (EMU10K1_PREG_CTL) register of patch.
+ */
+#define GPR_WRITE_MAX 0x200
+
+typedef struct {
+	unsigned int reg;
+	unsigned int val;
+} ld10k1_fnc_gpr_value_t;
+
+typedef struct {
+	int patch_id;
+	unsigned int count;
+} ld10k1_fnc_gpr_write_t;
+
 typedef struct {
 	int what;
 	int multi;
@@ -318,8 +339,18 @@ typedef struct {
 	char patch_name[MAX_NAME_LEN];
 } ld10k1_fnc_patches_info_t;
 
+/* highest wire protocol supported by daemon is advertised in FNC_VERSION */
+#define LD10K1_PROTO_MAGIC 0x50524F54
+#define LD10K1_PROTO_V1 1
+#define LD10K1_PROTO_V2 2
+/* FNC_GET_STATE */
+#define LD10K1_PROTO_V3 3
+
 typedef struct {
-	char ld10k1_version[MAX_NAME_LEN];
+	char ld10k1_version[MAX_NAME_LEN - 2 * sizeof(int)];
+	/* older daemons don't set magic */
+	int proto_magic;
+	int proto;
 } ld10k1_fnc_version_t;
 
 #define CHIP_LIVE 0
@@ -329,6 +360,86 @@ typedef struct {
 	unsigned int chip_type;
 } ld10k1_fnc_dsp_info_t;
 
+typedef struct {
+	unsigned int chip_type;
+	unsigned int fx_count;
+	unsigned int in_count;
+	unsigned int out_count;
+	unsigned int patch_count;
+	unsigned int point_count;
+} ld10k1_fnc_state_t;
+
+/* change events for FNC_SUBSCRIBE, mask of wanted events is sent */
+#define EVENT_PATCH_ADD 0x01
+#define EVENT_PATCH_DEL 0x02
+#define EVENT_PATCH_RENAME 0x04
+#define EVENT_CONNECTION 0x08
+#define EVENT_IO_RENAME 0x10
+#define EVENT_CTL_ADD 0x20
+#define EVENT_RESET 0x40
+/* some events were lost, everything must be read again */
+#define EVENT_RESYNC 0x80
+#define EVENT_ALL 0xFF
+
+typedef struct {
+	int type;
+	/* FNC_CONNECTION_ADD/DEL or rename op */
+	int what;
+	/* -1 for events not related to patch */
+	int patch_num;
+	/* patch id or point id for EVENT_CONNECTION */
+	int id;
+	/* io index or control count */
+	int index;
+} ld10k1_fnc_event_t;
+
+/*
+ * FNC_PEEK_SUBSCRIBE - header is followed by count patch registers, count 0
+ * ends feed. Every interval ms ld10k1 reads all registers with one code peek
+ * and pushes FNC_PEEK_DATA with ld10k1_fnc_peek_data_t followed by count
+ * values in order of subscription. Value of register which can't be read
+ * (patch was unloaded) is 0.
+ */
+#define PEEK_REG_MAX 0x100
+#define PEEK_INTERVAL_MIN 5
+
+typedef struct {
+	int patch_id;
+	unsigned int reg;
+} ld10k1_fnc_peek_reg_t;
+
+typedef struct {
+	unsigned int interval;
+	unsigned int count;
+} ld10k1_fnc_peek_t;
+
+typedef struct {
+	/* frame number, gaps mean frames skipped because client was slow */
+	unsigned int seq;
+	unsigned int count;
+} ld10k1_fnc_peek_data_t;
+
+/*
+ * FNC_CARD_SELECT - int card, index of card in ld10k1 command line. All
+ * following requests, events and peek feed of connection are for this card.
+ * Connection starts with card 0.
+ */
+#define CARD_MAX 8
+
+/*
+ * FNC_EMU_RUN - header is followed by in_count input registers (FX or IN),
+ * out_count output registers (OUT) and frames * in_count interleaved input
+ * samples. Response carries frames * out_count interleaved output samples.
+ * Samples are raw 32 bit register values.
+ */
+#define EMU_RUN_IO_MAX 0x40
+
+typedef struct {
+	unsigned int frames;
+	unsigned int in_count;
+	unsigned int out_count;
+} ld10k1_fnc_emu_run_t;
+
 #define FNC_PATCH_ADD 1
 #define FNC_PATCH_DEL 2
 
@@ -337,6 +448,8 @@ typedef struct {
 
 #define FNC_PATCH_RENAME 5
 #define FNC_PATCH_FIND 6
+#define FNC_PATCH_LOOP_BREAK 7
+#define FNC_PATCH_GPR_WRITE 8
 
 #define FNC_GET_FX 11
 #define FNC_GET_IN 12
@@ -359,6 +472,7 @@ typedef struct {
 
 #define FNC_GET_PATCHES_INFO 40
 #define FNC_GET_PATCH 41
+#define FNC_GET_STATE 42
 
 #define FNC_FX_FIND 50
 #define FNC_IN_FIND 51
@@ -371,6 +485,16 @@ typedef struct {
 #define FNC_GET_POINTS_INFO 70
 #define FNC_GET_POINT_INFO 71
 
+#define FNC_BATCH_BEGIN 80
+#define FNC_BATCH_COMMIT 81
+#define FNC_BATCH_ABORT 82
+
+#define FNC_SUBSCRIBE 90
+#define FNC_PEEK_SUBSCRIBE 91
+
+#define FNC_EMU_RUN 95
+#define FNC_CARD_SELECT 96
+
 #define FNC_GET_DSP_INFO 97
 
 #define FNC_VERSION 98
@@ -380,7 +504,36 @@ typedef struct {
 #define FNC_ERR 101
 #define FNC_CONTINUE 102
 #define FNC_CLOSE_CONN 103
+/* pushed to subscribed clients, not a response to request */
+#define FNC_EVENT 104
+#define FNC_PEEK_DATA 105
 
 #define FNC_DEBUG 200
 
+/* sections of FNC_PATCH_ADD in v2 framing */
+#define PATCH_ADD_SECT_INFO 0
+#define PATCH_ADD_SECT_IN 1
+#define PATCH_ADD_SECT_OUT 2
+#define PATCH_ADD_SECT_CONST 3
+#define PATCH_ADD_SECT_STA 4
+#define PATCH_ADD_SECT_HW 5
+#define PATCH_ADD_SECT_TRAM_GRP 6
+#define PATCH_ADD_SECT_TRAM_ACC 7
+#define PATCH_ADD_SECT_CTL 8
+#define PATCH_ADD_SECT_INSTR 9
+#define PATCH_ADD_SECT_COUNT 10
+
+/*
+ * sections of FNC_GET_STATE response in v2 framing - patches are sent in
+ * patch order, each as ld10k1_dsp_patch_t followed by its parts in
+ * PATCH_ADD_SECT order, points have patch index into this list instead of id
+ */
+#define STATE_SECT_INFO 0
+#define STATE_SECT_FX 1
+#define STATE_SECT_IN 2
+#define STATE_SECT_OUT 3
+#define STATE_SECT_PATCH 4
+#define STATE_SECT_POINT 5
+#define STATE_SECT_COUNT 6
+
 #endif /* __LD10K1_FNC_H */
@@ -73,6 +73,7 @@ void liblo10k1_connection_init(liblo10k1_connection_t *conn);
 int liblo10k1_connect(liblo10k1_param *param, liblo10k1_connection_t *conn);
 int liblo10k1_is_open(liblo10k1_connection_t *conn);
 int liblo10k1_disconnect(liblo10k1_connection_t *conn);
+int liblo10k1_get_proto(liblo10k1_connection_t *conn);
 
 liblo10k1_dsp_patch_t *liblo10k1_patch_alloc(int in_count, int out_count, int const_count, int sta_count, int dyn_count, int hw_count, int tram_count, int tram_acc_count, int ctl_count, int instr_count);
 void liblo10k1_patch_free(liblo10k1_dsp_patch_t *patch);
@@ -90,12 +91,20 @@ int liblo10k1_patch_set_instr_count(liblo10k1_dsp_patch_t *p, int count);
 
 int liblo10k1_patch_load(liblo10k1_connection_t *conn, liblo10k1_dsp_patch_t *patch, int before, int *loaded, int *loaded_id);
 int liblo10k1_patch_unload(liblo10k1_connection_t *conn, int patch_num);
+int liblo10k1_patch_loop_break(liblo10k1_connection_t *conn, int patch_num, int loop_break);
+/* registers are uploaded together with other writes daemon gets in the same moment */
+int liblo10k1_patch_gpr_write(liblo10k1_connection_t *conn, int patch_id, int count, unsigned int *regs, unsigned int *vals);
+int liblo10k1_patch_find_gpr(liblo10k1_dsp_patch_t *patch, char *name, unsigned int *reg);
 int liblo10k1_patch_get(liblo10k1_connection_t *conn, int patch_num, liblo10k1_dsp_patch_t **patch);
 
 int liblo10k1_debug(liblo10k1_connection_t *conn, int deb, void (*prn_fnc)(char *));
 
 int liblo10k1_dsp_init(liblo10k1_connection_t *conn);
 
+int liblo10k1_batch_begin(liblo10k1_connection_t *conn);
+int liblo10k1_batch_commit(liblo10k1_connection_t *conn);
+int liblo10k1_batch_abort(liblo10k1_connection_t *conn);
+
 int liblo10k1_find_patch(liblo10k1_connection_t *conn, char *patch_name, int *out);
 int liblo10k1_find_fx(liblo10k1_connection_t *conn, char *fx_name, int *out);
 int liblo10k1_find_in(liblo10k1_connection_t *conn, char *in_name, int *out);
@@ -133,6 +142,14 @@ int liblo10k1_check_version(liblo10k1_connection_t *conn);
 
 int liblo10k1_get_dsp_info(liblo10k1_connection_t *conn, liblo10k1_dsp_info_t *info);
 
+/* next requests of connection go to card with this index in ld10k1 command line */
+int liblo10k1_card_select(liblo10k1_connection_t *conn, int card);
+
+/* run frames through ld10k1 started with -e, samples are 32 bit register values */
+int liblo10k1_emu_run(liblo10k1_connection_t *conn, int frames,
+	int in_count, int *in_regs, int *in,
+	int out_count, int *out_regs, int *out);
+
 char *liblo10k1_error_str(int error);
 
 #ifdef __cplusplus
@@ -0,0 +1,69 @@
+/*
+ *  EMU10k1 loader lib
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __LIBLO10K1ASYNC_H
+#define __LIBLO10K1ASYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Non-blocking client mode. Requests are queued and pipelined on one socket,
+ * ld10k1 answers them in order, so responses are matched to request ids
+ * by position in queue. Data of all FNC_CONTINUE responses of one request
+ * is collected and passed to completion callback together with result of
+ * final response. Requests without callback keep result until
+ * liblo10k1_async_wait collects it, so caller of liblo10k1_async_submit
+ * without callback must wait for every request. Subscribe and peek keep
+ * only result of last request, older results are freed.
+ *
+ * Change events of FNC_SUBSCRIBE are pushed by ld10k1 between responses,
+ * so subscription is possible only in this mode. Register values of
+ * FNC_PEEK_SUBSCRIBE feed are pushed the same way.
+ */
+
+typedef struct liblo10k1_async_tag liblo10k1_async_t;
+
+typedef void (*liblo10k1_async_cb_t)(liblo10k1_async_t *async, int req_id, int err, void *data, int data_size, void *user);
+typedef void (*liblo10k1_async_event_cb_t)(liblo10k1_async_t *async, ld10k1_fnc_event_t *event, void *user);
+typedef void (*liblo10k1_async_peek_cb_t)(liblo10k1_async_t *async, unsigned int seq, unsigned int count, unsigned int *values, void *user);
+
+int liblo10k1_async_open(liblo10k1_connection_t *conn, liblo10k1_async_t **async);
+void liblo10k1_async_close(liblo10k1_async_t *async);
+
+int liblo10k1_async_fd(liblo10k1_async_t *async);
+int liblo10k1_async_events(liblo10k1_async_t *async);
+int liblo10k1_async_pending(liblo10k1_async_t *async);
+
+int liblo10k1_async_submit(liblo10k1_async_t *async, int op, void *data, int data_size, liblo10k1_async_cb_t cb, void *user);
+int liblo10k1_async_dispatch(liblo10k1_async_t *async, int revents);
+int liblo10k1_async_wait(liblo10k1_async_t *async, int req_id, void **data, int *data_size);
+
+int liblo10k1_async_subscribe(liblo10k1_async_t *async, int events, liblo10k1_async_event_cb_t cb, void *user);
+int liblo10k1_async_peek(liblo10k1_async_t *async, unsigned int interval, int count, int *patch_ids, unsigned int *regs,
+	liblo10k1_async_peek_cb_t cb, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBLO10K1ASYNC_H */
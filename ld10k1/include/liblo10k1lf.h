@@ -98,6 +98,9 @@ typedef struct {
 #define LD10K1_FP_FILE_INFO_COPYRIGHT 34
 #define LD10K1_FP_FILE_INFO_LICENCE 35
 
+/* table of contents - last part in file, readers can ignore it */
+#define LD10K1_FP_TOC 36
+
 /* file contains whole dsp config */
 #define LD10K1_FP_INFO_FILE_TYPE_DSP_SETUP 0
 /* file contains only 1 patch */
@@ -175,7 +178,26 @@ typedef struct {
 	unsigned int instr_count;
 } liblo10k1_file_patch_info_t;
 
+/* one entry for every part before table of contents */
+typedef struct {
+	unsigned int part_type;
+	unsigned int part_id;
+	unsigned int part_length;
+	/* offset of part data in file */
+	unsigned int offset;
+	/* index of part after this one (after its end part for start part) */
+	unsigned int next;
+} liblo10k1_file_toc_entry_t;
+
+/* table of contents part ends with this, it is at end of file */
+#define LD10K1_FILE_TOC_SIGNATURE "LD10KTOC"
+typedef struct {
+	unsigned int entry_count;
+	char signature[8];
+} liblo10k1_file_toc_end_t;
+
 int liblo10k1lf_get_dsp_config(liblo10k1_connection_t *conn, liblo10k1_file_dsp_setup_t **setup);
+int liblo10k1lf_get_dsp_state(liblo10k1_connection_t *conn, liblo10k1_file_dsp_setup_t **setup);
 int liblo10k1lf_put_dsp_config(liblo10k1_connection_t *conn, liblo10k1_file_dsp_setup_t *setup);
 
 liblo10k1_file_dsp_setup_t *liblo10k1lf_dsp_config_alloc();
@@ -34,6 +34,7 @@ extern "C" {
 #include <lo10k1/liblo10k1.h>
 #include <lo10k1/liblo10k1ef.h>
 #include <lo10k1/liblo10k1lf.h>
+#include <lo10k1/liblo10k1async.h>
 
 #ifdef __cplusplus
 }
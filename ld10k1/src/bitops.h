@@ -53,4 +53,38 @@ static inline int test_bit(unsigned int nr, unsigned long * addr)
 	return ((mask & *addr) != 0);
 }
 
+/* returns size if there is no set bit from offset */
+static inline unsigned int find_next_bit(unsigned long * addr, unsigned int size, unsigned int offset)
+{
+	unsigned int bits = sizeof(unsigned long) * 8;
+	unsigned long word;
+
+	while (offset < size) {
+		word = addr[offset / bits] >> (offset % bits);
+		if (word) {
+			offset += __builtin_ctzl(word);
+			return offset < size ? offset : size;
+		}
+		offset = (offset / bits + 1) * bits;
+	}
+	return size;
+}
+
+/* returns first bit set in addr and not set in mask, size if there is none */
+static inline unsigned int find_next_bit_andnot(unsigned long * addr, unsigned long * mask, unsigned int size, unsigned int offset)
+{
+	unsigned int bits = sizeof(unsigned long) * 8;
+	unsigned long word;
+
+	while (offset < size) {
+		word = (addr[offset / bits] & ~mask[offset / bits]) >> (offset % bits);
+		if (word) {
+			offset += __builtin_ctzl(word);
+			return offset < size ? offset : size;
+		}
+		offset = (offset / bits + 1) * bits;
+	}
+	return size;
+}
+
 #endif /* _PZ_GENERIC_BITOPS_H */
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -147,7 +148,7 @@ int connect_comm(int conn_num, comm_param *param)
 
 int listen_comm(int conn_num)
 {
-	if (listen(conn_num, 1) < 0)
+	if (listen(conn_num, SOMAXCONN) < 0)
 		return -1;
 	return 0;
 }
@@ -170,6 +171,7 @@ int accept_comm(int conn_num)
 
 int free_comm(int conn_num)
 {	
+	detach_buf_comm(conn_num);
 	if (shutdown(conn_num, 2))
 		return -1;
 	if (close(conn_num) < 0)
@@ -178,14 +180,350 @@ int free_comm(int conn_num)
 	return 0;
 }
 
+int nonblock_comm(int conn_num)
+{
+	int flags;
+
+	flags = fcntl(conn_num, F_GETFL, 0);
+	if (flags < 0)
+		return -1;
+	if (fcntl(conn_num, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Per connection buffers used by server on non-blocking sockets.
+ * Input is read ahead by event loop, so request handler is called only when
+ * whole request is here. Output, which can't be written immediately, is
+ * queued and flushed when socket is writable again.
+ */
+typedef struct
+{
+	char *data;
+	int start;
+	int end;
+	int size;
+} comm_fifo_t;
+
+typedef struct
+{
+	comm_fifo_t in;
+	comm_fifo_t out;
+	/* queue all output until uncorked */
+	int cork;
+} comm_buf_t;
+
+static comm_buf_t **comm_bufs = NULL;
+static int comm_bufs_count = 0;
+
+static comm_buf_t *comm_buf_get(int conn_num)
+{
+	if (conn_num < 0 || conn_num >= comm_bufs_count)
+		return NULL;
+	return comm_bufs[conn_num];
+}
+
+static int comm_fifo_len(comm_fifo_t *fifo)
+{
+	return fifo->end - fifo->start;
+}
+
+/* make place for at least need bytes at end of fifo */
+static int comm_fifo_reserve(comm_fifo_t *fifo, int need)
+{
+	int len;
+	int new_size;
+	char *new_data;
+
+	if (fifo->size - fifo->end >= need)
+		return 0;
+
+	len = comm_fifo_len(fifo);
+	if (fifo->start > 0) {
+		memmove(fifo->data, fifo->data + fifo->start, len);
+		fifo->start = 0;
+		fifo->end = len;
+		if (fifo->size - fifo->end >= need)
+			return 0;
+	}
+
+	new_size = fifo->size ? fifo->size : COMM_BUF_MIN_SIZE;
+	while (new_size - len < need)
+		new_size *= 2;
+	new_data = (char *)realloc(fifo->data, new_size);
+	if (!new_data)
+		return -1;
+	fifo->data = new_data;
+	fifo->size = new_size;
+	return 0;
+}
+
+static int comm_fifo_put(comm_fifo_t *fifo, void *data, int data_size)
+{
+	if (comm_fifo_reserve(fifo, data_size) < 0)
+		return -1;
+	memcpy(fifo->data + fifo->end, data, data_size);
+	fifo->end += data_size;
+	return 0;
+}
+
+static int comm_fifo_get(comm_fifo_t *fifo, void *data, int data_size)
+{
+	int len = comm_fifo_len(fifo);
+
+	if (data_size > len)
+		data_size = len;
+	memcpy(data, fifo->data + fifo->start, data_size);
+	fifo->start += data_size;
+	if (fifo->start == fifo->end)
+		fifo->start = fifo->end = 0;
+	return data_size;
+}
+
+int attach_buf_comm(int conn_num)
+{
+	comm_buf_t **new_bufs;
+	int new_count;
+
+	if (conn_num < 0)
+		return -1;
+
+	if (conn_num >= comm_bufs_count) {
+		new_count = comm_bufs_count ? comm_bufs_count : 16;
+		while (new_count <= conn_num)
+			new_count *= 2;
+		new_bufs = (comm_buf_t **)realloc(comm_bufs, sizeof(comm_buf_t *) * new_count);
+		if (!new_bufs)
+			return -1;
+		memset(new_bufs + comm_bufs_count, 0, sizeof(comm_buf_t *) * (new_count - comm_bufs_count));
+		comm_bufs = new_bufs;
+		comm_bufs_count = new_count;
+	}
+
+	if (comm_bufs[conn_num])
+		return 0;
+
+	comm_bufs[conn_num] = (comm_buf_t *)malloc(sizeof(comm_buf_t));
+	if (!comm_bufs[conn_num])
+		return -1;
+	memset(comm_bufs[conn_num], 0, sizeof(comm_buf_t));
+	return 0;
+}
+
+void detach_buf_comm(int conn_num)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+
+	if (!buf)
+		return;
+
+	free(buf->in.data);
+	free(buf->out.data);
+	free(buf);
+	comm_bufs[conn_num] = NULL;
+}
+
+/* client which sends more than max_in bytes without reading responses is refused */
+int fill_buf_comm(int conn_num, int max_in)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+	int readed;
+	int total = 0;
+
+	if (!buf)
+		return LD10K1_ERR_COMM_READ;
+
+	while (1) {
+		if (comm_fifo_reserve(&(buf->in), COMM_BUF_MIN_SIZE) < 0)
+			return LD10K1_ERR_NO_MEM;
+		readed = read(conn_num, buf->in.data + buf->in.end, buf->in.size - buf->in.end);
+		if (readed < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return LD10K1_ERR_COMM_READ;
+		}
+		if (readed == 0)
+			/* connection closed, report it only if there is nothing to process */
+			return total ? total : 0;
+		buf->in.end += readed;
+		total += readed;
+		if (comm_fifo_len(&(buf->in)) > max_in)
+			return LD10K1_ERR_COMM_READ;
+	}
+
+	/* nothing new, but connection is still alive */
+	return total ? total : 1;
+}
+
+/* count of buffered input bytes */
+int in_buf_comm(int conn_num)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+
+	if (!buf)
+		return 0;
+	return comm_fifo_len(&(buf->in));
+}
+
+int request_ready_comm(int conn_num)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+	struct msg_req header;
+
+	if (!buf || comm_fifo_len(&(buf->in)) < (int)sizeof(header))
+		return 0;
+
+	memcpy(&header, buf->in.data + buf->in.start, sizeof(header));
+	if (header.size < 0 || header.size > COMM_BUF_MAX_OUT)
+		/* let request handler report error */
+		return 1;
+	return comm_fifo_len(&(buf->in)) - (int)sizeof(header) >= header.size;
+}
+
+/* op of buffered request, -1 - no request header */
+int request_op_comm(int conn_num)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+	struct msg_req header;
+
+	if (!buf || comm_fifo_len(&(buf->in)) < (int)sizeof(header))
+		return -1;
+
+	memcpy(&header, buf->in.data + buf->in.start, sizeof(header));
+	return header.op;
+}
+
+int flush_buf_comm(int conn_num)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+	int writed;
+
+	if (!buf)
+		return 0;
+
+	while (comm_fifo_len(&(buf->out)) > 0) {
+		writed = write(conn_num, buf->out.data + buf->out.start, comm_fifo_len(&(buf->out)));
+		if (writed < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return LD10K1_ERR_COMM_WRITE;
+		}
+		buf->out.start += writed;
+	}
+
+	if (buf->out.start == buf->out.end)
+		buf->out.start = buf->out.end = 0;
+	return comm_fifo_len(&(buf->out));
+}
+
+int pending_out_comm(int conn_num)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+
+	if (!buf)
+		return 0;
+	return comm_fifo_len(&(buf->out));
+}
+
+/* responses to all requests processed at once are written with one write */
+int cork_comm(int conn_num, int cork)
+{
+	comm_buf_t *buf = comm_buf_get(conn_num);
+
+	if (!buf)
+		return 0;
+
+	buf->cork = cork;
+	if (!cork)
+		return flush_buf_comm(conn_num);
+	return 0;
+}
+
 #define MAX_ATEMPT 5
 
+/*
+ * Requests are processed only when they are whole in buffer, so missing
+ * data is not waited for - other clients would wait too.
+ */
+static int read_all_buf(int conn_num, comm_buf_t *buf, void *data, int data_size)
+{
+	int offset;
+	int readed;
+
+	offset = comm_fifo_get(&(buf->in), data, data_size);
+
+	while (offset < data_size) {
+		readed = read(conn_num, ((char *)data) + offset, data_size - offset);
+		if (readed > 0) {
+			offset += readed;
+			continue;
+		}
+		if (readed < 0 && errno == EINTR)
+			continue;
+		return LD10K1_ERR_COMM_READ;
+	}
+
+	return data_size;
+}
+
+/* write what is possible, queue rest */
+static int write_all_buf(int conn_num, comm_buf_t *buf, void *data, int data_size)
+{
+	int offset = 0;
+	int writed;
+
+	if (buf->cork) {
+		if (comm_fifo_len(&(buf->out)) + data_size > COMM_BUF_MAX_OUT)
+			return LD10K1_ERR_COMM_WRITE;
+		if (comm_fifo_put(&(buf->out), data, data_size) < 0)
+			return LD10K1_ERR_COMM_WRITE;
+		/* don't hold too much */
+		if (comm_fifo_len(&(buf->out)) >= COMM_BUF_MIN_SIZE * 16 &&
+			flush_buf_comm(conn_num) < 0)
+			return LD10K1_ERR_COMM_WRITE;
+		return data_size;
+	}
+
+	if (comm_fifo_len(&(buf->out)) == 0) {
+		while (offset < data_size) {
+			writed = write(conn_num, ((char *)data) + offset, data_size - offset);
+			if (writed < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				return LD10K1_ERR_COMM_WRITE;
+			}
+			offset += writed;
+		}
+	}
+
+	if (offset < data_size) {
+		if (comm_fifo_len(&(buf->out)) + data_size - offset > COMM_BUF_MAX_OUT)
+			/* client doesn't read responses */
+			return LD10K1_ERR_COMM_WRITE;
+		if (comm_fifo_put(&(buf->out), ((char *)data) + offset, data_size - offset) < 0)
+			return LD10K1_ERR_COMM_WRITE;
+	}
+
+	return data_size;
+}
+
 int read_all(int conn_num, void *data, int data_size)
 {
 	int offset = 0;
 	int how_much = data_size;
 	int atempt = 0;
 	int readed = 0;
+	comm_buf_t *buf;
+
+	if ((buf = comm_buf_get(conn_num)))
+		return read_all_buf(conn_num, buf, data, data_size);
 	
 	while (atempt < MAX_ATEMPT && how_much > 0)	{
 		readed = read(conn_num, ((char *)data) + offset, how_much);
@@ -210,6 +548,10 @@ int write_all(int conn_num, void *data, int data_size)
 	int how_much = data_size;
 	int atempt = 0;
 	int writed = 0;
+	comm_buf_t *buf;
+
+	if ((buf = comm_buf_get(conn_num)))
+		return write_all_buf(conn_num, buf, data, data_size);
 	
 	while (atempt < MAX_ATEMPT && how_much > 0)	{
 		writed = write(conn_num, ((char *)data) + offset, how_much);
@@ -347,3 +689,204 @@ void *receive_msg_data_malloc(int conn_num, int data_size)
 	}
 	return tmp;
 }
+
+static int writev_all(int conn_num, struct iovec *iov, int count)
+{
+	int writed;
+
+	while (count > 0) {
+		writed = writev(conn_num, iov, count);
+		if (writed < 0) {
+			if (errno == EINTR)
+				continue;
+			return LD10K1_ERR_COMM_WRITE;
+		}
+		/* skip written parts */
+		while (count > 0 && writed >= (int)iov->iov_len) {
+			writed -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = ((char *)iov->iov_base) + writed;
+			iov->iov_len -= writed;
+		}
+	}
+	return 0;
+}
+
+/* fill section table and iovs of padded sections, iov[0] is left for header */
+static int build_msg_v2(struct msg_v2_table *table, struct iovec *sect, int sect_count, struct iovec *iov, int *iov_count, int *table_size)
+{
+	static char pad[COMM_V2_ALIGN];
+	int i, count;
+	int data_size;
+
+	if (sect_count < 0 || sect_count > COMM_V2_MAX_SECT)
+		return LD10K1_ERR_PROTOCOL;
+
+	*table_size = COMM_V2_PAD(sizeof(struct msg_v2) + sizeof(int) * sect_count);
+	data_size = *table_size;
+
+	table->v2.magic = COMM_V2_MAGIC;
+	table->v2.count = sect_count;
+	memset(table->size, 0, sizeof(table->size));
+
+	count = 1;
+	for (i = 0; i < sect_count; i++) {
+		table->size[i] = sect[i].iov_len;
+		if (sect[i].iov_len) {
+			iov[count].iov_base = sect[i].iov_base;
+			iov[count].iov_len = sect[i].iov_len;
+			count++;
+		}
+		if (COMM_V2_PAD(sect[i].iov_len) != sect[i].iov_len) {
+			iov[count].iov_base = pad;
+			iov[count].iov_len = COMM_V2_PAD(sect[i].iov_len) - sect[i].iov_len;
+			count++;
+		}
+		data_size += COMM_V2_PAD(sect[i].iov_len);
+	}
+
+	*iov_count = count;
+	return data_size;
+}
+
+/* whole request is written with one writev */
+int send_request_v2(int conn_num, int op, struct iovec *sect, int sect_count)
+{
+	struct {
+		struct msg_req req;
+		struct msg_v2_table table;
+	} header;
+	struct iovec iov[COMM_V2_MAX_SECT * 2 + 1];
+	int count;
+	int table_size;
+	int data_size;
+
+	data_size = build_msg_v2(&header.table, sect, sect_count, iov, &count, &table_size);
+	if (data_size < 0)
+		return data_size;
+
+	header.req.op = op;
+	header.req.size = data_size;
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(struct msg_req) + table_size;
+
+	return writev_all(conn_num, iov, count);
+}
+
+/* response in same framing as request, parts are queued by write_all */
+int send_response_v2(int conn_num, int op, int err, struct iovec *sect, int sect_count)
+{
+	struct {
+		struct msg_resp resp;
+		struct msg_v2_table table;
+	} header;
+	struct iovec iov[COMM_V2_MAX_SECT * 2 + 1];
+	int i, count;
+	int table_size;
+	int data_size;
+	int nbytes;
+
+	data_size = build_msg_v2(&header.table, sect, sect_count, iov, &count, &table_size);
+	if (data_size < 0)
+		return data_size;
+
+	header.resp.op = op;
+	header.resp.err = err;
+	header.resp.size = data_size;
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(struct msg_resp) + table_size;
+
+	for (i = 0; i < count; i++) {
+		nbytes = write_all(conn_num, iov[i].iov_base, iov[i].iov_len);
+		if (nbytes < 0)
+			return nbytes;
+	}
+	return 0;
+}
+
+/* whole request data is read into one buffer, sections point into it */
+int receive_msg_v2(int conn_num, int data_size, void **arena, struct iovec *sect, int max_sect)
+{
+	char *data;
+	struct msg_v2 *v2;
+	int *size;
+	int i, offset;
+
+	*arena = NULL;
+	if (data_size < (int)sizeof(struct msg_v2))
+		return LD10K1_ERR_PROTOCOL;
+
+	if (!(data = (char *)receive_msg_data_malloc(conn_num, data_size)))
+		return LD10K1_ERR_PROTOCOL;
+
+	v2 = (struct msg_v2 *)data;
+	if (v2->magic != COMM_V2_MAGIC || v2->count < 0 || v2->count > max_sect)
+		goto error;
+
+	offset = COMM_V2_PAD(sizeof(struct msg_v2) + sizeof(int) * v2->count);
+	if (offset > data_size)
+		goto error;
+
+	size = (int *)(v2 + 1);
+	for (i = 0; i < v2->count; i++) {
+		/* size is checked before padding, padding of huge size overflows */
+		if (size[i] < 0 || size[i] > data_size - offset ||
+			COMM_V2_PAD(size[i]) > data_size - offset)
+			goto error;
+		sect[i].iov_base = data + offset;
+		sect[i].iov_len = size[i];
+		offset += COMM_V2_PAD(size[i]);
+	}
+
+	*arena = data;
+	return v2->count;
+error:
+	free(data);
+	return LD10K1_ERR_PROTOCOL;
+}
+
+/* receive response with data followed by final response, usually with one read */
+int receive_response_v2(int conn_num, void *data, int data_size)
+{
+	char buf[2 * sizeof(struct msg_resp) + COMM_V2_MAX_RESP];
+	struct msg_resp header;
+	int total, got;
+	int readed;
+
+	if (data_size < 0 || data_size > COMM_V2_MAX_RESP)
+		return LD10K1_ERR_PROTOCOL;
+
+	total = 2 * sizeof(struct msg_resp) + data_size;
+	got = 0;
+	while (got < total) {
+		readed = read(conn_num, buf + got, total - got);
+		if (readed < 0) {
+			if (errno == EINTR)
+				continue;
+			return LD10K1_ERR_COMM_READ;
+		}
+		if (readed == 0)
+			return LD10K1_ERR_COMM_READ;
+		got += readed;
+
+		if (got >= (int)sizeof(struct msg_resp)) {
+			memcpy(&header, buf, sizeof(struct msg_resp));
+			/* error response has no data */
+			if (header.err < 0)
+				return header.err;
+			if (header.size != data_size)
+				return LD10K1_ERR_PROTOCOL;
+		}
+	}
+
+	memcpy(data, buf + sizeof(struct msg_resp), data_size);
+	memcpy(&header, buf + sizeof(struct msg_resp) + data_size, sizeof(struct msg_resp));
+	if (header.err < 0)
+		return header.err;
+	return 0;
+}
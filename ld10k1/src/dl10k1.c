@@ -45,6 +45,11 @@
 #include "ld10k1_dump_file.h"
 
 #define DL10K1_SIGNATURE "DUMP Image (dl10k1)"
+
+/* registers and instructions which driver can peek and poke */
+#define DSP_GPR_COUNT(audigy) ((audigy) ? 0x200 : 0x100)
+#define DSP_TRAM_COUNT(audigy) ((audigy) ? 0x100 : 0xa0)
+#define DSP_INSTR_COUNT(audigy) ((audigy) ? 0x400 : 0x200)
 int card = 0;
 snd_hwdep_t *handle;
 const char *card_proc_id;
@@ -68,6 +73,8 @@ static void help(char *command)
 		"  -h, --help        this help\n"
 		"  -c, --card        select card number, default = 0\n"
 		"  -d, --dump        file with dump\n"
+		"  -f, --full        reinitialize dsp and load whole dump\n"
+		"  -v, --verify      check dsp state after load\n"
 		, command);
 }
 
@@ -126,6 +133,54 @@ err:
 	return -1;
 }
 
+void set_nop_instr(int audigy, unsigned int *iptr)
+{
+	if (audigy) {
+		*iptr = ((0xcf & 0x7ff) << 12) | (0xc0 & 0x7ff);
+		*(iptr + 1) = ((0x0f & 0x0f) << 24) | ((0xc0 & 0x7ff) << 12) | (0xc0 & 0x7ff);
+	} else {
+		*iptr = ((0x40 & 0x3ff) << 10) | (0x40 & 0x3ff);
+		*(iptr + 1) = ((0x06 & 0x0f) << 20) | ((0x40 & 0x3ff) << 10) | (0x40 & 0x3ff);
+	}
+}
+
+/* peek whole dsp with list of controls, list is returned in ctrl */
+int driver_peek_code(emu10k1_fx8010_code_t *code, emu10k1_fx8010_control_gpr_t **ctrl)
+{
+	*ctrl = NULL;
+
+	/* get count of controls */
+	code->gpr_list_control_count = 0;
+	code->gpr_list_controls = NULL;
+	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_PEEK, code) < 0) {
+		error("unable to peek code");
+		return 1;
+	}
+
+	if (code->gpr_list_control_total) {
+		*ctrl = (emu10k1_fx8010_control_gpr_t *)calloc(code->gpr_list_control_total, sizeof(emu10k1_fx8010_control_gpr_t));
+		if (!*ctrl) {
+			error("no mem");
+			return 1;
+		}
+	}
+
+	code->gpr_list_control_count = code->gpr_list_control_total;
+	code->gpr_list_controls = *ctrl;
+	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_PEEK, code) < 0) {
+		error("unable to peek code");
+		if (*ctrl)
+			free(*ctrl);
+		*ctrl = NULL;
+		return 1;
+	}
+
+	/* driver lists at most count controls */
+	if (code->gpr_list_control_total < code->gpr_list_control_count)
+		code->gpr_list_control_count = code->gpr_list_control_total;
+	return 0;
+}
+
 int driver_init_dsp(int audigy)
 {
 	int i;
@@ -246,7 +301,260 @@ int driver_init_dsp(int audigy)
 	return 0;
 }
 
-int dump_load(int audigy, char *file_name)
+/* registers written by dsp program - their values are changed by dsp itself */
+static void dsp_written_regs(int audigy, emu10k1_fx8010_code_t *code,
+	unsigned long *gpr_written, unsigned long *tram_written)
+{
+	unsigned int *iptr;
+	unsigned int reg;
+	int i;
+
+	for (iptr = code->code, i = 0; i < DSP_INSTR_COUNT(audigy); i++, iptr += 2) {
+		if (audigy) {
+			reg = (*(iptr + 1) >> 12) & 0x7ff;
+			if (reg >= 0x400 && reg < 0x400 + DSP_GPR_COUNT(audigy))
+				set_bit(reg - 0x400, gpr_written);
+		} else {
+			reg = (*(iptr + 1) >> 10) & 0x3ff;
+			if (reg >= 0x100 && reg < 0x100 + DSP_GPR_COUNT(audigy))
+				set_bit(reg - 0x100, gpr_written);
+		}
+		/* tram address registers */
+		if (reg >= 0x300 && reg < 0x300 + DSP_TRAM_COUNT(audigy))
+			set_bit(reg - 0x300, tram_written);
+	}
+}
+
+/* registers of controls - driver holds translated value, control compare covers them */
+static void ctrl_regs(int audigy, emu10k1_fx8010_control_gpr_t *ctrl, int count,
+	unsigned long *gpr_ctrl)
+{
+	int i, j;
+
+	for (i = 0; i < count; i++)
+		for (j = 0; j < ctrl[i].count && j < 32; j++)
+			if (ctrl[i].gpr[j] < DSP_GPR_COUNT(audigy))
+				set_bit(ctrl[i].gpr[j], gpr_ctrl);
+}
+
+static emu10k1_fx8010_control_gpr_t *find_ctrl(emu10k1_fx8010_control_gpr_t *list, int count,
+	emu10k1_fx8010_control_gpr_t *ctrl)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (list[i].id.iface == ctrl->id.iface &&
+			list[i].id.index == ctrl->id.index &&
+			strcmp((char *)list[i].id.name, (char *)ctrl->id.name) == 0)
+			return &(list[i]);
+	return NULL;
+}
+
+static int ctrl_equal(emu10k1_fx8010_control_gpr_t *a, emu10k1_fx8010_control_gpr_t *b)
+{
+	int i;
+
+	if (a->vcount != b->vcount || a->count != b->count || a->count > 32 ||
+		a->min != b->min || a->max != b->max || a->translation != b->translation)
+		return 0;
+	for (i = 0; i < a->count; i++)
+		if (a->gpr[i] != b->gpr[i] || a->value[i] != b->value[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Poke only what differs from current dsp state. Registers written by dsp
+ * program are compared only if program is changed. Control registers are
+ * set by driver when changed control is added again.
+ * Returns 0 - ok, 1 - error, -1 - dsp must be reinitialized.
+ */
+static int dump_load_delta(int audigy, emu10k1_fx8010_code_t *code, int tram_size)
+{
+	emu10k1_fx8010_info_t info;
+	emu10k1_fx8010_code_t cur;
+	emu10k1_fx8010_control_gpr_t *cur_ctrl = NULL;
+	emu10k1_fx8010_control_gpr_t *tmp;
+	emu10k1_fx8010_control_gpr_t *add = NULL;
+	emu10k1_ctl_elem_id_t *del = NULL;
+	emu10k1_fx8010_pcm_t ipcm;
+	unsigned long gpr_written[0x200 / (sizeof(unsigned long) * 8)];
+	unsigned long tram_written[0x100 / (sizeof(unsigned long) * 8)];
+	int i, changes = 0, code_changed = 0;
+	int add_count = 0, del_count = 0;
+	int res = 1;
+
+	/* tram size change reallocates tram */
+	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_INFO, &info) < 0 ||
+		info.external_tram_size != tram_size)
+		return -1;
+
+	if (alloc_code_struct(&cur) < 0) {
+		error("no mem");
+		return 1;
+	}
+	if (driver_peek_code(&cur, &cur_ctrl)) {
+		free_code_struct(&cur);
+		return -1;
+	}
+
+	memset(code->gpr_valid, 0, sizeof(code->gpr_valid));
+	memset(code->tram_valid, 0, sizeof(code->tram_valid));
+	memset(code->code_valid, 0, sizeof(code->code_valid));
+
+	for (i = 0; i < DSP_INSTR_COUNT(audigy); i++)
+		if (code->code[i * 2] != cur.code[i * 2] ||
+			code->code[i * 2 + 1] != cur.code[i * 2 + 1]) {
+			set_bit(i, code->code_valid);
+			code_changed = 1;
+			changes++;
+		}
+
+	memset(gpr_written, 0, sizeof(gpr_written));
+	memset(tram_written, 0, sizeof(tram_written));
+	if (!code_changed)
+		dsp_written_regs(audigy, code, gpr_written, tram_written);
+	ctrl_regs(audigy, code->gpr_add_controls, code->gpr_add_control_count, gpr_written);
+
+	for (i = 0; i < DSP_GPR_COUNT(audigy); i++)
+		if (!test_bit(i, gpr_written) && code->gpr_map[i] != cur.gpr_map[i]) {
+			set_bit(i, code->gpr_valid);
+			changes++;
+		}
+
+	/* tram data are changed by dsp all time */
+	for (i = 0; i < DSP_TRAM_COUNT(audigy); i++)
+		if (!test_bit(i, tram_written) &&
+			(code->tram_addr_map[i] != cur.tram_addr_map[i] ||
+			(code_changed && code->tram_data_map[i] != cur.tram_data_map[i]))) {
+			set_bit(i, code->tram_valid);
+			changes++;
+		}
+
+	/* changed controls are replaced, controls not in dump are removed */
+	if (code->gpr_add_control_count) {
+		add = (emu10k1_fx8010_control_gpr_t *)malloc(sizeof(emu10k1_fx8010_control_gpr_t) * code->gpr_add_control_count);
+		if (!add) {
+			error("no mem");
+			goto end;
+		}
+	}
+	if (cur.gpr_list_control_count) {
+		del = (emu10k1_ctl_elem_id_t *)malloc(sizeof(emu10k1_ctl_elem_id_t) * cur.gpr_list_control_count);
+		if (!del) {
+			error("no mem");
+			goto end;
+		}
+	}
+
+	for (i = 0; i < code->gpr_add_control_count; i++) {
+		tmp = find_ctrl(cur_ctrl, cur.gpr_list_control_count, &(code->gpr_add_controls[i]));
+		if (!tmp || !ctrl_equal(tmp, &(code->gpr_add_controls[i])))
+			memcpy(&(add[add_count++]), &(code->gpr_add_controls[i]), sizeof(emu10k1_fx8010_control_gpr_t));
+	}
+	for (i = 0; i < cur.gpr_list_control_count; i++)
+		if (!find_ctrl(code->gpr_add_controls, code->gpr_add_control_count, &(cur_ctrl[i])))
+			memcpy(&(del[del_count++]), &(cur_ctrl[i].id), sizeof(emu10k1_ctl_elem_id_t));
+	changes += add_count + del_count;
+
+	if (changes) {
+		code->gpr_add_control_count = add_count;
+		code->gpr_add_controls = add;
+		code->gpr_del_control_count = del_count;
+		code->gpr_del_controls = del;
+		if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_POKE, code) < 0) {
+			error("unable to poke code");
+			goto end;
+		}
+	}
+
+	/* tram pcm dsp part is removed as by dsp init */
+	if (!audigy) {
+		for (i = 0; i < EMU10K1_FX8010_PCM_COUNT; i++) {
+			memset(&ipcm, 0, sizeof(ipcm));
+			ipcm.substream = i;
+			if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_PCM_PEEK, &ipcm) < 0 ||
+				!ipcm.channels)
+				continue;
+			memset(&ipcm, 0, sizeof(ipcm));
+			ipcm.substream = i;
+			if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_PCM_POKE, &ipcm) < 0) {
+				error("unable to poke code");
+				goto end;
+			}
+		}
+	}
+	res = 0;
+end:
+	free_code_struct(&cur);
+	if (cur_ctrl)
+		free(cur_ctrl);
+	if (add)
+		free(add);
+	if (del)
+		free(del);
+	return res;
+}
+
+/* compare dsp with dump, registers written by dsp program or owned by controls are skipped */
+static int dump_verify(int audigy, emu10k1_fx8010_code_t *code,
+	emu10k1_fx8010_control_gpr_t *ctrl, int ctl_count)
+{
+	emu10k1_fx8010_code_t cur;
+	emu10k1_fx8010_control_gpr_t *cur_ctrl = NULL;
+	emu10k1_fx8010_control_gpr_t *tmp;
+	unsigned long gpr_written[0x200 / (sizeof(unsigned long) * 8)];
+	unsigned long tram_written[0x100 / (sizeof(unsigned long) * 8)];
+	int i, instr_diff = 0, gpr_diff = 0, tram_diff = 0, ctl_diff = 0, ctl_found = 0;
+
+	if (alloc_code_struct(&cur) < 0) {
+		error("no mem");
+		return 1;
+	}
+	if (driver_peek_code(&cur, &cur_ctrl)) {
+		free_code_struct(&cur);
+		return 1;
+	}
+
+	memset(gpr_written, 0, sizeof(gpr_written));
+	memset(tram_written, 0, sizeof(tram_written));
+	dsp_written_regs(audigy, code, gpr_written, tram_written);
+	ctrl_regs(audigy, ctrl, ctl_count, gpr_written);
+
+	for (i = 0; i < DSP_INSTR_COUNT(audigy); i++)
+		if (code->code[i * 2] != cur.code[i * 2] ||
+			code->code[i * 2 + 1] != cur.code[i * 2 + 1])
+			instr_diff++;
+	for (i = 0; i < DSP_GPR_COUNT(audigy); i++)
+		if (!test_bit(i, gpr_written) && code->gpr_map[i] != cur.gpr_map[i])
+			gpr_diff++;
+	for (i = 0; i < DSP_TRAM_COUNT(audigy); i++)
+		if (!test_bit(i, tram_written) && code->tram_addr_map[i] != cur.tram_addr_map[i])
+			tram_diff++;
+	for (i = 0; i < ctl_count; i++) {
+		tmp = find_ctrl(cur_ctrl, cur.gpr_list_control_count, &(ctrl[i]));
+		if (tmp)
+			ctl_found++;
+		if (!tmp || !ctrl_equal(tmp, &(ctrl[i])))
+			ctl_diff++;
+	}
+	/* controls not in dump */
+	ctl_diff += cur.gpr_list_control_count - ctl_found;
+
+	free_code_struct(&cur);
+	if (cur_ctrl)
+		free(cur_ctrl);
+
+	if (instr_diff || gpr_diff || tram_diff || ctl_diff) {
+		error("verify failed - differs %d instructions, %d registers, %d tram accesses, %d controls",
+			instr_diff, gpr_diff, tram_diff, ctl_diff);
+		return 1;
+	}
+	printf("DSP matches dump\n");
+	return 0;
+}
+
+int dump_load(int audigy, char *file_name, int full, int verify)
 {
 	struct stat dump_stat;
 	void *dump_data, *ptr;
@@ -259,6 +567,7 @@ int dump_load(int audigy, char *file_name)
 	int i, j;
 	unsigned int vaddr, addr;
 	int op;
+	int res;
 	
 	unsigned int *iptr;
 
@@ -266,6 +575,8 @@ int dump_load(int audigy, char *file_name)
 
 	ld10k1_dump_t *header = NULL;
 
+	memset(&code, 0, sizeof(code));
+
 	/* first load patch to mem */
 	if (stat(file_name, &dump_stat)) {
 		error("unable to load patch %s", file_name);
@@ -344,7 +655,7 @@ int dump_load(int audigy, char *file_name)
 
 	if (alloc_code_struct(&code) < 0) {
 		error("no mem");
-		return 1;
+		goto err1;
 	}
 	
 
@@ -420,50 +731,55 @@ int dump_load(int audigy, char *file_name)
 
 	ptr += sizeof(ld10k1_tram_dump_t) * header->tram_count;
 	finstr = (ld10k1_instr_dump_t *)ptr;
-	for (iptr = code.code, i = 0; i < header->instr_count; i++, iptr += 2) {
-		set_bit(i, code.code_valid);
-		if (finstr[i].used) {
+	/* whole image - rest of dsp is as after init */
+	for (iptr = code.code, i = 0; i < DSP_INSTR_COUNT(audigy); i++, iptr += 2) {
+		if (i < header->instr_count)
+			set_bit(i, code.code_valid);
+		if (i < header->instr_count && finstr[i].used) {
 			if (audigy) {
 				*iptr = ((finstr[i].arg[2] & 0x7ff) << 12) | (finstr[i].arg[3] & 0x7ff);
 				*(iptr + 1) = ((finstr[i].op & 0x0f) << 24) | ((finstr[i].arg[0] & 0x7ff) << 12) | (finstr[i].arg[1] & 0x7ff);
 			} else {
-				if (i < 0x200) {
-					*iptr = ((finstr[i].arg[2] & 0x3ff) << 10) | (finstr[i].arg[3] & 0x3ff);
-					*(iptr + 1) = ((finstr[i].op & 0x0f) << 20) | ((finstr[i].arg[0] & 0x3ff) << 10) | (finstr[i].arg[1] & 0x3ff);
-				}
-			}
-		} else {
-			if (audigy) {
-				*iptr = ((0xcf & 0x7ff) << 12) | (0xc0 & 0x7ff);
-				*(iptr + 1) = ((0x0f & 0x0f) << 24) | ((0xc0 & 0x7ff) << 12) | (0xc0 & 0x7ff);
-			} else {
-				if (i < 0x200) {
-					*iptr = ((0x40 & 0x3ff) << 10) | (0x40 & 0x3ff);
-					*(iptr + 1) = ((0x06 & 0x0f) << 20) | ((0x40 & 0x3ff) << 10) | (0x40 & 0x3ff);
-				}
+				*iptr = ((finstr[i].arg[2] & 0x3ff) << 10) | (finstr[i].arg[3] & 0x3ff);
+				*(iptr + 1) = ((finstr[i].op & 0x0f) << 20) | ((finstr[i].arg[0] & 0x3ff) << 10) | (finstr[i].arg[1] & 0x3ff);
 			}
-		}
+		} else
+			set_nop_instr(audigy, iptr);
 	}
 
-	if (header->dump_type != DUMP_TYPE_AUDIGY_OLD && 
-		driver_set_tram_size(header->tram_size))
+	/* same dump loaded again changes nothing */
+	res = -1;
+	if (!full)
+		res = dump_load_delta(audigy, &code, header->tram_size);
+	if (res > 0)
 		goto err1;
 
-	if (driver_init_dsp(audigy))
-		goto err1;
+	if (res < 0) {
+		if (header->dump_type != DUMP_TYPE_AUDIGY_OLD && 
+			driver_set_tram_size(header->tram_size))
+			goto err1;
 
-	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_POKE, &code) < 0) {
-		error("unable to poke code");
-		goto err1;
+		if (driver_init_dsp(audigy))
+			goto err1;
+
+		if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_POKE, &code) < 0) {
+			error("unable to poke code");
+			goto err1;
+		}
 	}
 
+	res = 0;
+	if (verify)
+		res = dump_verify(audigy, &code, ctrl, header->ctl_count);
+
+	free_code_struct(&code);
 	if (dump_data)
 		free(dump_data);
 
 	if (ctrl)
 		free(ctrl);
 
-	return 0;
+	return res;
 
 err:
 	error("wrong dump file format %s", file_name);
@@ -485,6 +801,9 @@ int main(int argc, char *argv[])
 	int audigy;
 	
 	int opt_help = 0;
+	int opt_full = 0;
+	int opt_verify = 0;
+	int res = 1;
 	char *opt_dump_file = NULL;
 
 	char card_id[32];
@@ -501,11 +820,13 @@ int main(int argc, char *argv[])
 				   {"help", 0, 0, 'h'},
 				   {"card", 1, 0, 'c'},
 				   {"dump", 1, 0, 'd'},
+				   {"full", 0, 0, 'f'},
+				   {"verify", 0, 0, 'v'},
 				   {0, 0, 0, 0}
                };
 
 	int option_index = 0;
-	while ((c = getopt_long(argc, argv, "hc:d:",
+	while ((c = getopt_long(argc, argv, "hc:d:fv",
 	        long_options, &option_index)) != EOF) {
 		switch (c) {
 /* 		case 0: */
@@ -516,6 +837,12 @@ int main(int argc, char *argv[])
 		case 'd':
 			opt_dump_file = optarg;
 			break;
+		case 'f':
+			opt_full = 1;
+			break;
+		case 'v':
+			opt_verify = 1;
+			break;
 		case 'c':
 			card = snd_card_get_index(optarg);
 			if (card < 0 || card > 31) {
@@ -601,7 +928,7 @@ int main(int argc, char *argv[])
 				exit(1);
 			}
 			
-			err = dump_load(audigy, opt_dump_file);
+			res = dump_load(audigy, opt_dump_file, opt_full, opt_verify);
 
 			snd_hwdep_close(handle);
 
@@ -611,5 +938,5 @@ int main(int argc, char *argv[])
 
 	snd_ctl_close(ctl_handle);
 
-	return 0;
+	return res;
 }
@@ -24,6 +24,8 @@
 #include <limits.h>
 #include <sys/stat.h>
 #include <alsa/asoundlib.h>
+#include <alsa/sound/emu10k1.h>
+#include <stdint.h>
 #include <getopt.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -38,9 +40,10 @@
 #include "ld10k1.h"
 #include "ld10k1_fnc.h"
 #include "ld10k1_fnc1.h"
+#include "ld10k1_emu.h"
 
-int card = 0;
-snd_hwdep_t *handle;
+int optimize = 0;
+int auto_order = 0;
 char comm_pipe[256];
 FILE *comm;
 char pidpath[256];
@@ -92,13 +95,18 @@ static void help(char *command)
 		"Usage: %s [-options]\n"
 		"\nAvailable options:\n"
 		"  -h, --help        this help\n"
-		"  -c, --card        select card number, default = 0\n"
+		"  -c, --card        select card number, default = 0, repeat to manage more cards\n"
 		"  -p, --pipe_name   connect to this, default = /tmp/.ld10k1_port\n"
 		"  -n, --network     listen on port\n"
 		"      --port        port number, default = 20480\n"
 		"  -d  --daemon      start in background\n"
 		"  -i  --pidfile     print daemon process id to file, default /var/run/ld10k1.pid\n"
 		"  -l  --logfile     \n"
+		"  -e  --emulate     run on software DSP instead of card (live or audigy)\n"
+		"  -O  --optimize    optimize patches on load\n"
+		"  -a  --auto_order  order patches by connections\n"
+		"  -S  --snapshot    keep dsp state in file and start from it,\n"
+		"                    other cards use file with .1, .2, ... suffix\n"
 		"  -t, --tram_size   initialize tram with given size\n"
 		"		0 -    0 KB\n"
 		"		1 -   16 KB\n"
@@ -126,28 +134,127 @@ static void term_handler(int i)
 
 int tram_size_table[] = {0, 8192, 16384, 32768, 65536, 131072, 262144, 524288, 1048576};
 
-int main(int argc, char *argv[])
+/* snapshot file of card - first card uses path as given */
+static char *snapshot_path(const char *path, int card)
+{
+	char *res;
+
+	if (!path[0])
+		return NULL;
+
+	res = (char *)malloc(strlen(path) + 8);
+	if (!res)
+		return NULL;
+	if (card)
+		sprintf(res, "%s.%i", path, card);
+	else
+		strcpy(res, path);
+	return res;
+}
+
+/* open control and EMU10k1 hwdep device of card */
+static int open_card(int card, ld10k1_card_t *info)
 {
 	int dev;
-	int c;
 	int err;
-	int audigy;
+	char card_id[32];
+	char name[16];
+	const char *card_proc_id;
+	snd_ctl_t *ctl_handle;
+	snd_ctl_card_info_t *card_info;
+	snd_hwdep_info_t *hwdep_info;
+
+	snd_ctl_card_info_alloca(&card_info);
+	snd_hwdep_info_alloca(&hwdep_info);
+
+	/* Get control handle for selected card */
+	sprintf(card_id, "hw:%i", card);
+	if ((err = snd_ctl_open(&ctl_handle, card_id, 0)) < 0) {
+		error("control open (%s): %s", card_id, snd_strerror(err));
+		return -1;
+	}
+
+	/* Read control hardware info from card */
+	if ((err = snd_ctl_card_info(ctl_handle, card_info)) < 0) {
+		error("control hardware info (%s): %s", card_id, snd_strerror(err));
+		goto err;
+	}
+
+	if (!(card_proc_id = snd_ctl_card_info_get_id (card_info))) {
+		error("card id (%s): %s", card_id, snd_strerror(err));
+		goto err;
+	}
+
+
+	/* EMU10k1/EMU10k2 chip is present only on SB Live, Audigy, Audigy 2, E-mu APS cards */
+	if (strcmp(snd_ctl_card_info_get_driver(card_info), "EMU10K1") != 0 &&
+	    strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy") != 0 &&
+		strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy2") != 0 &&
+		strcmp(snd_ctl_card_info_get_driver(card_info), "E-mu APS") != 0) {
+		error("not a EMU10K1/EMU10K2 based card (%s)", card_id);
+		goto err;
+	}
+
+	if (strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy") == 0 ||
+		strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy2") == 0)
+		info->audigy = 1;
+	else
+		info->audigy = 0;
+		
+	/* find EMU10k1 hardware dependant device */
+	dev = -1;
+	err = 1;
+	while (1) {
+		if (snd_ctl_hwdep_next_device(ctl_handle, &dev) < 0)
+			error("hwdep next device (%s): %s", card_id, snd_strerror(err));
+		if (dev < 0)
+			break;
+		snd_hwdep_info_set_device(hwdep_info, dev);
+		if (snd_ctl_hwdep_info(ctl_handle, hwdep_info) < 0) {
+			if (err != -ENOENT)
+				error("control hwdep info (%s): %s", card_id, snd_strerror(err));
+			continue;
+		}
+		if (snd_hwdep_info_get_iface(hwdep_info) == SND_HWDEP_IFACE_EMU10K1) {
+			sprintf(name, "hw:%i,%i", card, dev);
+
+			/* open EMU10k1 hwdep device */
+			if ((err = snd_hwdep_open(&(info->handle), name, O_WRONLY)) < 0) {
+				error("EMU10k1 open (%i-%i): %s", card, dev, snd_strerror(err));
+				goto err;
+			}
+
+			/* card info is freed on return */
+			info->card_id = strdup(card_proc_id);
+			info->emu = NULL;
+			info->ctlp = ctl_handle;
+			return 0;
+		}
+	}
+	error("EMU10k1 hwdep device not found (%s)", card_id);
+err:
+	snd_ctl_close(ctl_handle);
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int i;
+	ld10k1_emu_t *emu;
 
 	int opt_help = 0;
 	int tram_size = 0;
 	int opt_daemon = 0;
+	int opt_emulate = -1;
 	unsigned short opt_port = 20480;
 	int uses_pipe = 1;
 	char logpath[255];
+	char snappath[255];
 
-	char card_id[32];
-	const char *card_proc_id;
-
-	snd_ctl_t *ctl_handle;
-	snd_ctl_card_info_t *card_info;
-	snd_hwdep_info_t *hwdep_info;
-	
-	char name[16];
+	int card_nums[CARD_MAX];
+	int card_count = 0;
+	ld10k1_card_t cards[CARD_MAX];
 
 	comm_param params;
 	
@@ -163,18 +270,20 @@ int main(int argc, char *argv[])
 				   {"tram_size", 1, 0, 't'},
 				   {"pidfile", 1, 0, 'i'},
 				   {"logfile", 1, 0, 'l'},
+				   {"emulate", 1, 0, 'e'},
+				   {"optimize", 0, 0, 'O'},
+				   {"auto_order", 0, 0, 'a'},
+				   {"snapshot", 1, 0, 'S'},
                    {0, 0, 0, 0}
                };
 
-	snd_ctl_card_info_alloca(&card_info);
-	snd_hwdep_info_alloca(&hwdep_info);
-
 	strcpy(comm_pipe,"/tmp/.ld10k1_port");
 	strcpy(pidpath, "/var/run/ld10k1.pid");
 	memset(logpath, 0, sizeof(logpath));
+	memset(snappath, 0, sizeof(snappath));
 
 	option_index = 0;
-	while ((c = getopt_long(argc, argv, "hc:p:t:ndl:i:",
+	while ((c = getopt_long(argc, argv, "hc:p:t:ndl:i:e:OaS:",
 	        long_options, &option_index)) != EOF) {
 		switch (c) {
 		case 0:
@@ -186,11 +295,21 @@ int main(int argc, char *argv[])
 			opt_help = 1;
 			break;
 		case 'c':
-			card = snd_card_get_index(optarg);
-			if (card < 0 || card > 31) {
+			if (card_count >= CARD_MAX) {
+				error ("too many cards, maximum is %i\n", CARD_MAX);
+				return 1;
+			}
+			card_nums[card_count] = snd_card_get_index(optarg);
+			if (card_nums[card_count] < 0 || card_nums[card_count] > 31) {
 				error ("wrong -c argument '%s'\n", optarg);
 				return 1;
 			}
+			for (i = 0; i < card_count; i++)
+				if (card_nums[i] == card_nums[card_count]) {
+					error ("card '%s' given twice\n", optarg);
+					return 1;
+				}
+			card_count++;
 			break;
 		case 'p':
 			uses_pipe = 1;
@@ -219,6 +338,26 @@ int main(int argc, char *argv[])
 			strncpy(logpath, optarg, sizeof(logpath) - 1);
 			logpath[sizeof(logpath) - 1] = '\0';
 			break;
+		case 'e':
+			if (strcmp(optarg, "live") == 0)
+				opt_emulate = 0;
+			else if (strcmp(optarg, "audigy") == 0)
+				opt_emulate = 1;
+			else {
+				error ("wrong -e argument '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'O':
+			optimize = 1;
+			break;
+		case 'a':
+			auto_order = 1;
+			break;
+		case 'S':
+			strncpy(snappath, optarg, sizeof(snappath) - 1);
+			snappath[sizeof(snappath) - 1] = '\0';
+			break;
 		default:
 			return 1;
 		}
@@ -229,7 +368,7 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 	
-	if (getuid() != 0 ) {
+	if (opt_emulate < 0 && getuid() != 0 ) {
 		error("You are not running ld10k1 as root.");
 		return 1;
 	}
@@ -272,76 +411,53 @@ int main(int argc, char *argv[])
 	params.port = opt_port;
 	params.wfc = 0;
 
-	/* Get control handle for selected card */
-	sprintf(card_id, "hw:%i", card);
-	if ((err = snd_ctl_open(&ctl_handle, card_id, 0)) < 0) {
-		error("control open (%s): %s", card_id, snd_strerror(err));
-		return 1;
-	}
+	if (opt_emulate >= 0) {
+		if (ld10k1_emu_new(opt_emulate, EMU_ITRAM_SIZE, tram_size, &emu) < 0) {
+			error("unable to create DSP emulator");
+			return 1;
+		}
 
-	/* Read control hardware info from card */
-	if ((err = snd_ctl_card_info(ctl_handle, card_info)) < 0) {
-		error("control hardware info (%s): %s", card_id, snd_strerror(err));
-		exit(1);
-	}
+		cards[0].audigy = opt_emulate;
+		cards[0].card_id = "emulator";
+		cards[0].handle = NULL;
+		cards[0].emu = emu;
+		cards[0].ctlp = NULL;
+		cards[0].snapshot = snapshot_path(snappath, 0);
+
+		while (1)
+			if (main_loop(&params, cards, 1, tram_size)) {
+				error("error in main loop");
+				break;
+			}
 
-	if (!(card_proc_id = snd_ctl_card_info_get_id (card_info))) {
-		error("card id (%s): %s", card_id, snd_strerror(err));
-		exit(1);
+		ld10k1_emu_free(emu);
+		if (cards[0].snapshot)
+			free(cards[0].snapshot);
+		return 0;
 	}
 
+	if (!card_count)
+		card_nums[card_count++] = 0;
 
-	/* EMU10k1/EMU10k2 chip is present only on SB Live, Audigy, Audigy 2, E-mu APS cards */
-	if (strcmp(snd_ctl_card_info_get_driver(card_info), "EMU10K1") != 0 &&
-	    strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy") != 0 &&
-		strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy2") != 0 &&
-		strcmp(snd_ctl_card_info_get_driver(card_info), "E-mu APS") != 0) {
-		error("not a EMU10K1/EMU10K2 based card");
-		exit(1);
+	for (i = 0; i < card_count; i++) {
+		if (open_card(card_nums[i], &(cards[i])) < 0)
+			exit(1);
+		cards[i].snapshot = snapshot_path(snappath, i);
 	}
 
-	if (strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy") == 0 ||
-		strcmp(snd_ctl_card_info_get_driver(card_info), "Audigy2") == 0)
-		audigy = 1;
-	else
-		audigy = 0;
-		
-	/* find EMU10k1 hardware dependant device and execute command */
-	dev = -1;
-	err = 1;
-	while (1) {
-		if (snd_ctl_hwdep_next_device(ctl_handle, &dev) < 0)
-			error("hwdep next device (%s): %s", card_id, snd_strerror(err));
-		if (dev < 0)
+	while (1)
+		if (main_loop(&params, cards, card_count, tram_size)) {
+			error("error in main loop");
 			break;
-		snd_hwdep_info_set_device(hwdep_info, dev);
-		if (snd_ctl_hwdep_info(ctl_handle, hwdep_info) < 0) {
-			if (err != -ENOENT)
-				error("control hwdep info (%s): %s", card_id, snd_strerror(err));
-			continue;
 		}
-		if (snd_hwdep_info_get_iface(hwdep_info) == SND_HWDEP_IFACE_EMU10K1) {
-			sprintf(name, "hw:%i,%i", card, dev);
 
-			/* open EMU10k1 hwdep device */
-			if ((err = snd_hwdep_open(&handle, name, O_WRONLY)) < 0) {
-				error("EMU10k1 open (%i-%i): %s", card, dev, snd_strerror(err));
-				exit(1);
-			}
-
-			while (1)
-				if (main_loop(&params, audigy, card_proc_id, tram_size, ctl_handle)) {
-					error("error in main loop");
-					break;
-				}
-			
-			snd_hwdep_close(handle);
-
-			break;
-		}
+	for (i = 0; i < card_count; i++) {
+		snd_hwdep_close(cards[i].handle);
+		snd_ctl_close(cards[i].ctlp);
+		free((char *)cards[i].card_id);
+		if (cards[i].snapshot)
+			free(cards[i].snapshot);
 	}
 
-	snd_ctl_close(ctl_handle);
-
 	return 0;
 }
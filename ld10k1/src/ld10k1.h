@@ -24,6 +24,7 @@
 
 #define MAX_CONST_COUNT 0x220
 #define MAX_GPR_COUNT 0x200
+#define CONST_HASH_SIZE 0x400
 #define MAX_TRAM_COUNT 0x100
 
 /* instructions */
@@ -65,11 +66,22 @@ typedef struct {
 	unsigned int grp;
 } ld10k1_tram_acc_t;
 
+/* free tram block */
+typedef struct {
+	unsigned int offset;
+	unsigned int size;
+} ld10k1_tram_extent_t;
+
 typedef struct {
 	unsigned int size;
 	unsigned int max_hwacc;
 	ld10k1_tram_hwacc_t *hwacc;
 	unsigned int used_hwacc;
+
+	/* free blocks sorted by offset */
+	unsigned int ext_count;
+	ld10k1_tram_extent_t ext[MAX_TRAM_COUNT + 1];
+	unsigned int compactions;
 } ld10k1_tram_t;
 
 #define MAX_CONN_PER_POINT 15
@@ -105,6 +117,14 @@ typedef struct ld10k1_conn_point_tag
 typedef struct {
 	char *name;
 	ld10k1_conn_point_t *point;
+
+	/* instructions of patch using this register */
+	unsigned int instr_use_count;
+	unsigned int *instr_use;
+
+	/* physical register cached during one instruction actualization */
+	unsigned int phys_gen;
+	int phys;
 } ld10k1_p_in_out_t;
 
 typedef struct {
@@ -150,13 +170,25 @@ typedef struct {
 
 typedef struct ld10k1_ctl_list_item_tag {
 	struct ld10k1_ctl_list_item_tag *next;
+	struct ld10k1_ctl_list_item_tag *prev;
+	unsigned int hash;
 	ld10k1_ctl_t ctl;
 } ld10k1_ctl_list_item_t;
 
+typedef struct {
+	ld10k1_ctl_list_item_t *first;
+	int count;
+	/* open addressing index by name and index, size is power of 2 */
+	unsigned int hash_size;
+	ld10k1_ctl_list_item_t **hash;
+} ld10k1_ctl_list_t;
+
 typedef struct ld10k1_patch_tag {
 	char *patch_name;
 	int order;
 	int id;
+	/* feedback loop through patch is broken on its inputs */
+	int loop_break;
 
 	unsigned int in_count;
 	ld10k1_p_in_out_t *ins;
@@ -187,7 +219,13 @@ typedef struct ld10k1_patch_tag {
 
 	unsigned int instr_count;
 	unsigned int instr_offset;
+	unsigned int instr_modified;
+	/* removed by optimizer */
+	unsigned int instr_removed;
 	ld10k1_instr_t *instr;
+
+	/* storage for instr_use of ins and outs */
+	unsigned int *instr_use;
 } ld10k1_patch_t;
 
 #define EMU10K1_PATCH_MAX 128
@@ -225,9 +263,40 @@ typedef struct ld10k1_reserved_ctl_list_item_tag {
 	ld10k1_reserved_ctl_t res_ctl;
 } ld10k1_reserved_ctl_list_item_t;
 
+/* batch - changes are applied to dsp_mgr but driver is updated only on commit */
+#define BATCH_UNDO_PATCH 1
+#define BATCH_UNDO_LINK 2
+
+typedef struct {
+	int type;
+	int patch_num;
+	int patch_id;
+	/* patch io and what was it connected to before */
+	int io_type;
+	int io;
+	int linked;
+	int simple;
+	int rep_type;
+	int rep_patch;
+	int rep_patch_id;
+	int rep_io;
+} ld10k1_batch_undo_t;
+
+typedef struct {
+	int owner;
+	int failed;
+	/* commit upload is not done yet, batch is kept for rollback */
+	int committing;
+	int undo_count;
+	int undo_max;
+	ld10k1_batch_undo_t *undo;
+} ld10k1_batch_t;
+
 typedef struct {
 	int audigy;
 	const char *card_id;
+	/* hwdep device or emulator of this card */
+	struct ld10k1_driver_tag *driver;
 
 	/* registers */
 	unsigned int fx_count;
@@ -271,21 +340,51 @@ typedef struct {
 	unsigned int patch_count;
 	ld10k1_patch_t *patch_ptr[EMU10K1_PATCH_MAX];
 	unsigned int patch_order[EMU10K1_PATCH_MAX];
+	/* patch order is computed from connections */
+	int auto_order;
+	int order_dirty;
+	/* points are mixed into register of last writer */
+	int optimize;
+	/* register values written by FNC_PATCH_GPR_WRITE wait for upload */
+	int gpr_write_pending;
 
 	unsigned short patch_id_gens[EMU10K1_PATCH_MAX];
 
-	ld10k1_ctl_list_item_t *add_ctl_list;
-	int add_list_count;
-
-	ld10k1_ctl_list_item_t *del_ctl_list;
-	int del_list_count;
-
-	ld10k1_ctl_list_item_t *ctl_list;
-	int ctl_list_count;
+	ld10k1_ctl_list_t add_ctl_list;
+	ld10k1_ctl_list_t del_ctl_list;
+	ld10k1_ctl_list_t ctl_list;
 	
 	ld10k1_reserved_ctl_list_item_t *reserved_ctl_list;
 
 	ld10k1_conn_point_t *point_list;
+
+	ld10k1_batch_t *batch;
+
+	/* generation of physical register cache in patch ins and outs */
+	unsigned int phys_gen;
+
+	/* allocator state - free gprs, used dynamic gprs, free constants
+	   and what is reserved by operation in progress */
+	unsigned long regs_free[MAX_GPR_COUNT / (sizeof(unsigned long) * 8)];
+	unsigned long regs_dyn[MAX_GPR_COUNT / (sizeof(unsigned long) * 8)];
+	unsigned long regs_res[MAX_GPR_COUNT / (sizeof(unsigned long) * 8)];
+	unsigned long consts_free[(MAX_CONST_COUNT + sizeof(unsigned long) * 8 - 1) / (sizeof(unsigned long) * 8)];
+	unsigned long consts_res[(MAX_CONST_COUNT + sizeof(unsigned long) * 8 - 1) / (sizeof(unsigned long) * 8)];
+
+	/* used and reserved constants by value, chained through consts_hash_next, -1 ends chain */
+	int consts_hash[CONST_HASH_SIZE];
+	int consts_hash_next[MAX_CONST_COUNT];
+	/* constant sharing statistic */
+	unsigned int const_lookups;
+	unsigned int const_shared;
+	/* patch optimizer statistic */
+	unsigned int opt_instr;
+	unsigned int opt_removed;
+
+	/* what must be uploaded to driver on next update */
+	unsigned long regs_dirty[MAX_GPR_COUNT / (sizeof(unsigned long) * 8)];
+	unsigned long instr_dirty[1024 / (sizeof(unsigned long) * 8)];
+	unsigned long tram_dirty[0x100 / (sizeof(unsigned long) * 8)];
 } ld10k1_dsp_mgr_t;
 
 void error(const char *fmt,...);
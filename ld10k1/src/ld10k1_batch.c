@@ -0,0 +1,297 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+
+#include "ld10k1.h"
+#include "ld10k1_fnc.h"
+#include "ld10k1_fnc_int.h"
+#include "ld10k1_driver.h"
+#include "ld10k1_batch.h"
+#include "ld10k1_error.h"
+
+int ld10k1_batch_begin(ld10k1_dsp_mgr_t *dsp_mgr, int owner)
+{
+	ld10k1_batch_t *batch;
+
+	if (dsp_mgr->batch)
+		return LD10K1_ERR_BATCH_ACTIVE;
+
+	batch = (ld10k1_batch_t *)malloc(sizeof(ld10k1_batch_t));
+	if (!batch)
+		return LD10K1_ERR_NO_MEM;
+
+	batch->owner = owner;
+	batch->failed = 0;
+	batch->committing = 0;
+	batch->undo_count = 0;
+	batch->undo_max = 0;
+	batch->undo = NULL;
+
+	dsp_mgr->batch = batch;
+	return 0;
+}
+
+void ld10k1_batch_free(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	if (!dsp_mgr->batch)
+		return;
+
+	if (dsp_mgr->batch->undo)
+		free(dsp_mgr->batch->undo);
+	free(dsp_mgr->batch);
+	dsp_mgr->batch = NULL;
+}
+
+static ld10k1_batch_undo_t *ld10k1_batch_undo_new(ld10k1_batch_t *batch)
+{
+	ld10k1_batch_undo_t *new_undo;
+	int new_max;
+
+	if (batch->undo_count >= batch->undo_max) {
+		new_max = batch->undo_max ? batch->undo_max * 2 : 64;
+		new_undo = (ld10k1_batch_undo_t *)realloc(batch->undo, sizeof(ld10k1_batch_undo_t) * new_max);
+		if (!new_undo)
+			return NULL;
+		batch->undo = new_undo;
+		batch->undo_max = new_max;
+	}
+
+	new_undo = &(batch->undo[batch->undo_count++]);
+	memset(new_undo, 0, sizeof(ld10k1_batch_undo_t));
+	return new_undo;
+}
+
+int ld10k1_batch_save_patch(ld10k1_dsp_mgr_t *dsp_mgr, int patch_num)
+{
+	ld10k1_batch_undo_t *undo;
+
+	if (!dsp_mgr->batch)
+		return 0;
+
+	if (!(undo = ld10k1_batch_undo_new(dsp_mgr->batch)))
+		return LD10K1_ERR_NO_MEM;
+
+	undo->type = BATCH_UNDO_PATCH;
+	undo->patch_num = patch_num;
+	undo->patch_id = dsp_mgr->patch_ptr[patch_num]->id;
+	return 0;
+}
+
+static int ld10k1_batch_patch_num(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch)
+{
+	int i;
+
+	for (i = 0; i < EMU10K1_PATCH_MAX; i++)
+		if (dsp_mgr->patch_ptr[i] == patch)
+			return i;
+	return -1;
+}
+
+/* remember to what is patch io connected, so it can be reconnected on rollback */
+int ld10k1_batch_save_link(ld10k1_dsp_mgr_t *dsp_mgr, int io_type, int patch_num, int io)
+{
+	ld10k1_batch_undo_t *undo;
+	ld10k1_patch_t *patch;
+	ld10k1_conn_point_t *point;
+	int i;
+
+	if (!dsp_mgr->batch)
+		return 0;
+
+	if (io_type != CON_IO_PIN && io_type != CON_IO_POUT)
+		return 0;
+	if (patch_num < 0 || patch_num >= EMU10K1_PATCH_MAX || !dsp_mgr->patch_ptr[patch_num])
+		return 0;
+
+	patch = dsp_mgr->patch_ptr[patch_num];
+	if (io < 0 ||
+		(io_type == CON_IO_PIN && io >= patch->in_count) ||
+		(io_type == CON_IO_POUT && io >= patch->out_count))
+		return 0;
+
+	if (!(undo = ld10k1_batch_undo_new(dsp_mgr->batch)))
+		return LD10K1_ERR_NO_MEM;
+
+	undo->type = BATCH_UNDO_LINK;
+	undo->patch_num = patch_num;
+	undo->patch_id = patch->id;
+	undo->io_type = io_type;
+	undo->io = io;
+
+	point = io_type == CON_IO_PIN ? patch->ins[io].point : patch->outs[io].point;
+	if (!point)
+		return 0;
+
+	undo->simple = point->simple;
+
+	/* any other member of point is enough */
+	switch (EMU10K1_REG_TYPE_B(point->con_gpr_idx)) {
+		case EMU10K1_REG_TYPE_FX:
+			undo->rep_type = CON_IO_FX;
+			break;
+		case EMU10K1_REG_TYPE_INPUT:
+			undo->rep_type = CON_IO_IN;
+			break;
+		case EMU10K1_REG_TYPE_OUTPUT:
+			undo->rep_type = CON_IO_OUT;
+			break;
+		default:
+			undo->rep_type = 0;
+	}
+
+	if (undo->rep_type) {
+		undo->rep_patch = -1;
+		undo->rep_io = point->con_gpr_idx & ~EMU10K1_REG_TYPE_MASK;
+		undo->linked = 1;
+		return 0;
+	}
+
+	for (i = 0; i < MAX_CONN_PER_POINT; i++)
+		if (point->type[i] && !(point->type[i] == io_type && point->patch[i] == patch && point->io[i] == io)) {
+			undo->rep_type = point->type[i];
+			undo->rep_patch = ld10k1_batch_patch_num(dsp_mgr, point->patch[i]);
+			undo->rep_patch_id = point->patch[i]->id;
+			undo->rep_io = point->io[i];
+			undo->linked = 1;
+			break;
+		}
+	return 0;
+}
+
+static int ld10k1_batch_patch_valid(ld10k1_dsp_mgr_t *dsp_mgr, int patch_num, int patch_id)
+{
+	return patch_num >= 0 && patch_num < EMU10K1_PATCH_MAX &&
+		dsp_mgr->patch_ptr[patch_num] &&
+		dsp_mgr->patch_ptr[patch_num]->id == patch_id;
+}
+
+static void ld10k1_batch_undo_link(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_batch_undo_t *undo)
+{
+	ld10k1_fnc_connection_t connection_fnc;
+	int conn_id;
+
+	if (!ld10k1_batch_patch_valid(dsp_mgr, undo->patch_num, undo->patch_id))
+		return;
+
+	memset(&connection_fnc, 0, sizeof(connection_fnc));
+	connection_fnc.what = FNC_CONNECTION_DEL;
+	connection_fnc.from_type = undo->io_type;
+	connection_fnc.from_patch = undo->patch_num;
+	connection_fnc.from_io = undo->io;
+	connection_fnc.to_type = -1;
+	connection_fnc.to_patch = -1;
+	connection_fnc.to_io = -1;
+	ld10k1_connection_fnc(dsp_mgr, &connection_fnc, &conn_id);
+
+	if (!undo->linked)
+		return;
+
+	if (undo->rep_patch >= 0 &&
+		!ld10k1_batch_patch_valid(dsp_mgr, undo->rep_patch, undo->rep_patch_id))
+		return;
+
+	connection_fnc.what = FNC_CONNECTION_ADD;
+	connection_fnc.multi = 1;
+	connection_fnc.simple = undo->simple;
+	connection_fnc.to_type = undo->rep_type;
+	connection_fnc.to_patch = undo->rep_patch;
+	connection_fnc.to_io = undo->rep_io;
+	ld10k1_connection_fnc(dsp_mgr, &connection_fnc, &conn_id);
+}
+
+/* undo all changes made in batch, driver is not updated */
+static void ld10k1_batch_rollback(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_batch_t *batch = dsp_mgr->batch;
+	ld10k1_batch_undo_t *undo;
+
+	while (batch->undo_count > 0) {
+		undo = &(batch->undo[--batch->undo_count]);
+		if (undo->type == BATCH_UNDO_PATCH) {
+			if (ld10k1_batch_patch_valid(dsp_mgr, undo->patch_num, undo->patch_id))
+				ld10k1_dsp_mgr_patch_unload(dsp_mgr, dsp_mgr->patch_ptr[undo->patch_num], undo->patch_num);
+		} else
+			ld10k1_batch_undo_link(dsp_mgr, undo);
+	}
+}
+
+/* operation in batch failed - whole batch will be reverted on commit */
+void ld10k1_batch_fail(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	if (dsp_mgr->batch)
+		dsp_mgr->batch->failed = 1;
+}
+
+int ld10k1_batch_abort(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	if (!dsp_mgr->batch)
+		return LD10K1_ERR_BATCH_NOT_ACTIVE;
+
+	ld10k1_batch_rollback(dsp_mgr);
+	ld10k1_batch_free(dsp_mgr);
+
+	/* rollback could leave some instructions modified */
+	return ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
+}
+
+int ld10k1_batch_commit(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_batch_t *batch = dsp_mgr->batch;
+	int err;
+
+	if (!batch)
+		return LD10K1_ERR_BATCH_NOT_ACTIVE;
+
+	if (batch->failed) {
+		ld10k1_batch_rollback(dsp_mgr);
+		ld10k1_batch_free(dsp_mgr);
+		ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
+		return LD10K1_ERR_BATCH_FAILED;
+	}
+
+	/* one driver update for whole batch */
+	dsp_mgr->batch = NULL;
+	err = ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
+	dsp_mgr->batch = batch;
+	if (err < 0 || !ld10k1_driver_busy(dsp_mgr))
+		return ld10k1_batch_commit_end(dsp_mgr, err);
+
+	/* ld10k1_batch_commit_end is called when upload is done */
+	batch->committing = 1;
+	return 0;
+}
+
+/* upload of commit is done, batch is reverted if driver refused it */
+int ld10k1_batch_commit_end(ld10k1_dsp_mgr_t *dsp_mgr, int err)
+{
+	if (err < 0) {
+		ld10k1_batch_rollback(dsp_mgr);
+		ld10k1_batch_free(dsp_mgr);
+		ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
+		return err;
+	}
+
+	ld10k1_batch_free(dsp_mgr);
+	return 0;
+}
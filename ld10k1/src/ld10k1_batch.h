@@ -0,0 +1,35 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __LD10K1_BATCH_H
+#define __LD10K1_BATCH_H
+
+int ld10k1_batch_begin(ld10k1_dsp_mgr_t *dsp_mgr, int owner);
+int ld10k1_batch_commit(ld10k1_dsp_mgr_t *dsp_mgr);
+int ld10k1_batch_commit_end(ld10k1_dsp_mgr_t *dsp_mgr, int err);
+int ld10k1_batch_abort(ld10k1_dsp_mgr_t *dsp_mgr);
+void ld10k1_batch_free(ld10k1_dsp_mgr_t *dsp_mgr);
+
+int ld10k1_batch_save_patch(ld10k1_dsp_mgr_t *dsp_mgr, int patch_num);
+int ld10k1_batch_save_link(ld10k1_dsp_mgr_t *dsp_mgr, int io_type, int patch_num, int io);
+void ld10k1_batch_fail(ld10k1_dsp_mgr_t *dsp_mgr);
+
+#endif /* __LD10K1_BATCH_H */
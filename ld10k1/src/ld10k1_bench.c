@@ -0,0 +1,357 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Register allocator benchmark, not installed
+ *
+ * Dsp manager of audigy (512 GPRs) runs on emulator, so no card is
+ * needed. Reserve, alloc and free of all GPRs and constant slots are
+ * timed directly, then synthetic patches with many statics or many
+ * controls are loaded until GPRs are full and unloaded again.
+ *
+ * usage: ld10k1_bench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+#include <alsa/sound/emu10k1.h>
+
+#include "ld10k1.h"
+#include "ld10k1_fnc.h"
+#include "ld10k1_fnc_int.h"
+#include "ld10k1_driver.h"
+#include "ld10k1_emu.h"
+#include "ld10k1_error.h"
+
+typedef struct {
+	const char *name;
+	unsigned int sta_count;
+	unsigned int const_count;
+	unsigned int ctl_count;
+	unsigned int ctl_channels;
+} bench_patch_t;
+
+static const bench_patch_t bench_patches[] = {
+	{"statics", 120, 8, 0, 0},
+	{"controls", 8, 8, 24, 4},
+	{"mixed", 48, 16, 12, 4},
+};
+
+void error(const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	fprintf(stderr, "Error: ");
+	vfprintf(stderr, fmt, va);
+	fprintf(stderr, "\n");
+	va_end(va);
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_mgr_init(ld10k1_dsp_mgr_t *mgr, ld10k1_emu_t **emu)
+{
+	int err;
+
+	memset(mgr, 0, sizeof(ld10k1_dsp_mgr_t));
+	mgr->audigy = 1;
+	mgr->card_id = "bench";
+
+	if ((err = ld10k1_dsp_mgr_init(mgr)) < 0)
+		return err;
+	ld10k1_dsp_mgr_init_id_gen(mgr);
+
+	if ((err = ld10k1_emu_new(1, EMU_ITRAM_SIZE, 0, emu)) < 0)
+		goto err;
+	if ((err = ld10k1_driver_open(mgr, NULL, NULL, *emu)) < 0)
+		goto err_emu;
+	if ((err = ld10k1_init_driver(mgr, 0)) < 0)
+		goto err_driver;
+	return 0;
+err_driver:
+	ld10k1_driver_close(mgr);
+err_emu:
+	ld10k1_emu_free(*emu);
+err:
+	ld10k1_dsp_mgr_free(mgr);
+	return err;
+}
+
+static void bench_mgr_free(ld10k1_dsp_mgr_t *mgr, ld10k1_emu_t *emu)
+{
+	ld10k1_driver_close(mgr);
+	ld10k1_dsp_mgr_free(mgr);
+	ld10k1_emu_free(emu);
+}
+
+/* every register of patch is used by some instruction */
+static ld10k1_patch_t *bench_patch_new(const bench_patch_t *bp, unsigned int seq)
+{
+	ld10k1_patch_t *patch;
+	unsigned int i, j, regs, instr_count;
+	unsigned int arg[4];
+
+	patch = ld10k1_dsp_mgr_patch_new();
+	if (!patch)
+		return NULL;
+	if (!ld10k1_dsp_mgr_name_new(&(patch->patch_name), bp->name))
+		goto err;
+
+	regs = bp->sta_count + bp->const_count + bp->ctl_count * bp->ctl_channels;
+	instr_count = (regs + 2) / 3;
+
+	if (bp->sta_count && !ld10k1_dsp_mgr_patch_sta_new(patch, bp->sta_count))
+		goto err;
+	for (i = 0; i < bp->sta_count; i++)
+		patch->stas[i].const_val = i;
+
+	/* constants of patch differ from other patches, they are not shared */
+	if (bp->const_count && !ld10k1_dsp_mgr_patch_const_new(patch, bp->const_count))
+		goto err;
+	for (i = 0; i < bp->const_count; i++)
+		patch->consts[i].const_val = 0x12350000 + seq * bp->const_count + i;
+
+	if (bp->ctl_count && !ld10k1_dsp_mgr_patch_ctl_new(patch, bp->ctl_count))
+		goto err;
+	for (i = 0; i < bp->ctl_count; i++) {
+		snprintf(patch->ctl[i].name, sizeof(patch->ctl[i].name), "Bench %u", i);
+		patch->ctl[i].want_index = -1;
+		patch->ctl[i].vcount = bp->ctl_channels;
+		patch->ctl[i].count = bp->ctl_channels;
+		patch->ctl[i].min = 0;
+		patch->ctl[i].max = 100;
+		patch->ctl[i].translation = EMU10K1_GPR_TRANSLATION_NONE;
+		for (j = 0; j < bp->ctl_channels; j++)
+			patch->ctl[i].value[j] = 50;
+	}
+
+	if (!ld10k1_dsp_mgr_patch_instr_new(patch, instr_count))
+		goto err;
+	for (i = 0; i < regs; i++) {
+		if (i < bp->sta_count)
+			arg[i % 3] = EMU10K1_PREG_STA(i);
+		else if (i < bp->sta_count + bp->const_count)
+			arg[i % 3] = EMU10K1_PREG_CONST(i - bp->sta_count);
+		else {
+			j = i - bp->sta_count - bp->const_count;
+			arg[i % 3] = EMU10K1_PREG_CTL(j / bp->ctl_channels, j % bp->ctl_channels);
+		}
+		if (i % 3 == 2 || i == regs - 1) {
+			for (j = i % 3 + 1; j < 3; j++)
+				arg[j] = arg[0];
+			/* acc3 sta, sta, const, ctl - result register is first read one */
+			patch->instr[i / 3].used = 1;
+			patch->instr[i / 3].op_code = iACC3;
+			patch->instr[i / 3].arg[0] = arg[0];
+			patch->instr[i / 3].arg[1] = arg[0];
+			patch->instr[i / 3].arg[2] = arg[1];
+			patch->instr[i / 3].arg[3] = arg[2];
+		}
+	}
+	return patch;
+err:
+	ld10k1_dsp_mgr_patch_free(patch);
+	return NULL;
+}
+
+/* reserve all free GPRs and constant slots in one operation, then alloc and free them */
+static void bench_alloc(ld10k1_dsp_mgr_t *mgr, unsigned int rounds)
+{
+	int res[MAX_GPR_COUNT];
+	int res_count;
+	int const_res[MAX_CONST_COUNT];
+	int const_res_count;
+	unsigned int reg[MAX_GPR_COUNT];
+	unsigned int reg_count;
+	unsigned int round, i, count_gpr = 0, count_const = 0;
+	double t, t_res = 0, t_alloc = 0, t_free = 0;
+	double t_cres = 0, t_calloc = 0, t_cfree = 0;
+
+	for (round = 0; round < rounds; round++) {
+		res_count = 0;
+		reg_count = 0;
+		t = bench_now();
+		while (reg_count < MAX_GPR_COUNT &&
+			(reg[reg_count] = ld10k1_gpr_reserve(mgr, MAX_GPR_COUNT, &res_count, res, GPR_USAGE_NORMAL, 0)))
+			reg_count++;
+		t_res += bench_now() - t;
+
+		t = bench_now();
+		for (i = 0; i < reg_count; i++)
+			ld10k1_gpr_alloc(mgr, res[i]);
+		t_alloc += bench_now() - t;
+
+		t = bench_now();
+		for (i = 0; i < reg_count; i++)
+			ld10k1_gpr_free(mgr, reg[i]);
+		t_free += bench_now() - t;
+		count_gpr = reg_count;
+
+		res_count = 0;
+		const_res_count = 0;
+		reg_count = 0;
+		t = bench_now();
+		while (reg_count < MAX_GPR_COUNT &&
+			(reg[reg_count] = ld10k1_const_reserve(mgr, MAX_CONST_COUNT, &const_res_count, const_res,
+				MAX_GPR_COUNT, &res_count, res, 0x12340000 + reg_count)))
+			reg_count++;
+		t_cres += bench_now() - t;
+
+		t = bench_now();
+		for (i = 0; i < (unsigned int)const_res_count; i++)
+			ld10k1_const_alloc(mgr, const_res[i]);
+		for (i = 0; i < (unsigned int)res_count; i++)
+			ld10k1_gpr_alloc(mgr, res[i]);
+		t_calloc += bench_now() - t;
+
+		t = bench_now();
+		for (i = 0; i < reg_count; i++)
+			ld10k1_const_free(mgr, reg[i]);
+		t_cfree += bench_now() - t;
+		count_const = reg_count;
+	}
+
+	printf("gpr:   %u regs, reserve %.1f ns, alloc %.1f ns, free %.1f ns per reg\n",
+		count_gpr,
+		t_res * 1e9 / (rounds * count_gpr),
+		t_alloc * 1e9 / (rounds * count_gpr),
+		t_free * 1e9 / (rounds * count_gpr));
+	if (count_const)
+		printf("const: %u slots, reserve %.1f ns, alloc %.1f ns, free %.1f ns per slot\n",
+			count_const,
+			t_cres * 1e9 / (rounds * count_const),
+			t_calloc * 1e9 / (rounds * count_const),
+			t_cfree * 1e9 / (rounds * count_const));
+}
+
+/* load patches until GPRs are full, unload them */
+static int bench_load(ld10k1_dsp_mgr_t *mgr, const bench_patch_t *bp, unsigned int rounds)
+{
+	ld10k1_patch_t *patch;
+	int loaded[2];
+	unsigned int round, count = 0, used;
+	unsigned int i, idx;
+	double t, t_load = 0, t_unload = 0;
+	int err;
+
+	for (round = 0; round < rounds; round++) {
+		count = 0;
+		while (mgr->patch_count < EMU10K1_PATCH_MAX) {
+			patch = bench_patch_new(bp, count);
+			if (!patch)
+				return LD10K1_ERR_NO_MEM;
+			if ((err = ld10k1_patch_fnc_check_patch(mgr, patch)) < 0) {
+				ld10k1_dsp_mgr_patch_free(patch);
+				return err;
+			}
+
+			t = bench_now();
+			err = ld10k1_dsp_mgr_patch_load(mgr, patch, mgr->patch_count, loaded);
+			if (err < 0) {
+				ld10k1_dsp_mgr_patch_free(patch);
+				if (err == LD10K1_ERR_NOT_FREE_REG || err == LD10K1_ERR_NOT_FREE_INSTR)
+					break;
+				return err;
+			}
+			t_load += bench_now() - t;
+			count++;
+		}
+
+		for (i = 0, used = 0; i < mgr->regs_max_count; i++)
+			if (mgr->regs[i].used)
+				used++;
+
+		t = bench_now();
+		while (mgr->patch_count > 0) {
+			idx = mgr->patch_order[mgr->patch_count - 1];
+			if ((err = ld10k1_dsp_mgr_patch_unload(mgr, mgr->patch_ptr[idx], idx)) < 0)
+				return err;
+		}
+		t_unload += bench_now() - t;
+	}
+
+	if (!count) {
+		printf("%-8s patch doesn't fit\n", bp->name);
+		return 0;
+	}
+	printf("%-8s %u patches (%u sta, %u const, %u x %u ctl), %u gprs used, load %.1f us, unload %.1f us per patch\n",
+		bp->name, count, bp->sta_count, bp->const_count, bp->ctl_count, bp->ctl_channels, used,
+		t_load * 1e6 / (rounds * count),
+		t_unload * 1e6 / (rounds * count));
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	ld10k1_dsp_mgr_t *mgr;
+	ld10k1_emu_t *emu;
+	unsigned int rounds = 100;
+	unsigned int i;
+	double t, t_init = 0;
+	int err;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+	if (rounds < 1)
+		rounds = 1;
+
+	mgr = (ld10k1_dsp_mgr_t *)malloc(sizeof(ld10k1_dsp_mgr_t));
+	if (!mgr)
+		return 1;
+
+	for (i = 0; i < rounds; i++) {
+		t = bench_now();
+		err = bench_mgr_init(mgr, &emu);
+		t_init += bench_now() - t;
+		if (err < 0)
+			goto err;
+		bench_mgr_free(mgr, emu);
+	}
+	printf("audigy dsp manager init %.1f us\n", t_init * 1e6 / rounds);
+
+	if ((err = bench_mgr_init(mgr, &emu)) < 0)
+		goto err;
+	bench_alloc(mgr, rounds);
+	for (i = 0; i < sizeof(bench_patches) / sizeof(bench_patches[0]); i++)
+		if ((err = bench_load(mgr, &(bench_patches[i]), rounds)) < 0) {
+			bench_mgr_free(mgr, emu);
+			goto err;
+		}
+	bench_mgr_free(mgr, emu);
+	free(mgr);
+	return 0;
+err:
+	error("benchmark failed (%d)", err);
+	free(mgr);
+	return 1;
+}
@@ -23,9 +23,11 @@
 #include "ld10k1.h"
 #include "ld10k1_fnc.h"
 #include "ld10k1_fnc1.h"
+#include "ld10k1_fnc_int.h"
 #include "ld10k1_debug.h"
 #include "ld10k1_error.h"
 #include "ld10k1_tram.h"
+#include "ld10k1_order.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -96,9 +98,10 @@ static int ld10k1_debug_new_fx_read(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr)
 	if ((err = send_debug_line(data_conn)) < 0)
 		return err;
 	for (i = 0; i < dsp_mgr->fx_count; i++) {
-		sprintf(debug_line, "%03x : %-20s\n",
+		sprintf(debug_line, "%03x : %-20s 0x%08x\n",
 			i,
-			dsp_mgr->fxs[i].name ? dsp_mgr->fxs[i].name : "");
+			dsp_mgr->fxs[i].name ? dsp_mgr->fxs[i].name : "",
+			ld10k1_standard_to_named_reg(dsp_mgr, EMU10K1_REG_FX(i)));
 		if ((err = send_debug_line(data_conn)) < 0)
 			return err;
 	}
@@ -114,9 +117,10 @@ static int ld10k1_debug_new_in_read(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr)
 	if ((err = send_debug_line(data_conn)) < 0)
 		return err;
 	for (i = 0; i < dsp_mgr->in_count; i++) {
-		sprintf(debug_line, "%03x : %-20s\n",
+		sprintf(debug_line, "%03x : %-20s 0x%08x\n",
 			i,
-			dsp_mgr->ins[i].name ? dsp_mgr->ins[i].name : "");
+			dsp_mgr->ins[i].name ? dsp_mgr->ins[i].name : "",
+			ld10k1_standard_to_named_reg(dsp_mgr, EMU10K1_REG_IN(i)));
 		if ((err = send_debug_line(data_conn)) < 0)
 			return err;
 	}
@@ -132,9 +136,10 @@ static int ld10k1_debug_new_out_read(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr)
 	if ((err = send_debug_line(data_conn)) < 0)
 		return err;
 	for (i = 0; i < dsp_mgr->out_count; i++) {
-		sprintf(debug_line, "%03x : %-20s\n",
+		sprintf(debug_line, "%03x : %-20s 0x%08x\n",
 			i,
-			dsp_mgr->outs[i].name ? dsp_mgr->outs[i].name : "");
+			dsp_mgr->outs[i].name ? dsp_mgr->outs[i].name : "",
+			ld10k1_standard_to_named_reg(dsp_mgr, EMU10K1_REG_OUT(i)));
 		if ((err = send_debug_line(data_conn)) < 0)
 			return err;
 	}
@@ -179,6 +184,12 @@ static int ld10k1_debug_new_const_read(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr)
 		if (dsp_mgr->consts[i].used)
 			if ((err = ld10k1_debug_new_const_read_one(data_conn, dsp_mgr, i)) < 0)
 				return err;
+
+	sprintf(debug_line, "Shared constants: %u of %u requests (%u%%)\n",
+		dsp_mgr->const_shared, dsp_mgr->const_lookups,
+		dsp_mgr->const_lookups ? dsp_mgr->const_shared * 100 / dsp_mgr->const_lookups : 0);
+	if ((err = send_debug_line(data_conn)) < 0)
+		return err;
 	return 0;
 }
 
@@ -301,9 +312,27 @@ static int ld10k1_debug_new_code_read(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr)
 			if ((err = ld10k1_debug_new_code_read_one(data_conn, 0, instr, i)) < 0)
 				return err;
 	}
+
+	sprintf(debug_line, "Optimized out: %u of %u instructions (%u%%)\n",
+		dsp_mgr->opt_removed, dsp_mgr->opt_instr,
+		dsp_mgr->opt_instr ? dsp_mgr->opt_removed * 100 / dsp_mgr->opt_instr : 0);
+	if ((err = send_debug_line(data_conn)) < 0)
+		return err;
 	return 0;
 }
 
+static int ld10k1_debug_tram_space(int data_conn, ld10k1_tram_t *tram)
+{
+	unsigned int free, largest;
+
+	ld10k1_tram_space_info(tram, &free, &largest);
+	/* fragmentation - part of free space not usable for largest possible group */
+	sprintf(debug_line, "  Free: 0x%08x  Largest free block: 0x%08x  Free blocks: %u  Fragmentation: %u%%  Compactions: %u\n",
+		free, largest, tram->ext_count, free ? 100 - (unsigned int)((unsigned long long)largest * 100 / free) : 0,
+		tram->compactions);
+	return send_debug_line(data_conn);
+}
+
 static int ld10k1_debug_new_tram_info_read(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr)
 {
 	int i, j;
@@ -315,9 +344,6 @@ static int ld10k1_debug_new_tram_info_read(int data_conn, ld10k1_dsp_mgr_t *dsp_
 	ld10k1_tram_acc_t *tram_acc;
 	unsigned int data, addr;
 
-	int ifree = dsp_mgr->i_tram.size;
-	int efree = dsp_mgr->e_tram.size;
-
 	sprintf(debug_line, "TRAM\n\n");
 	if ((err = send_debug_line(data_conn)) < 0)
 		return err;
@@ -325,9 +351,13 @@ static int ld10k1_debug_new_tram_info_read(int data_conn, ld10k1_dsp_mgr_t *dsp_
 	sprintf(debug_line, "Internal tram size: 0x%08x\n", dsp_mgr->i_tram.size);
 	if ((err = send_debug_line(data_conn)) < 0)
 		return err;
+	if ((err = ld10k1_debug_tram_space(data_conn, &(dsp_mgr->i_tram))) < 0)
+		return err;
 	sprintf(debug_line, "External tram size: 0x%08x\n", dsp_mgr->e_tram.size);
 	if ((err = send_debug_line(data_conn)) < 0)
 		return err;
+	if ((err = ld10k1_debug_tram_space(data_conn, &(dsp_mgr->e_tram))) < 0)
+		return err;
 
 	sprintf(debug_line, "\nTram groups:\n");
 	if ((err = send_debug_line(data_conn)) < 0)
@@ -348,13 +378,10 @@ static int ld10k1_debug_new_tram_info_read(int data_conn, ld10k1_dsp_mgr_t *dsp_
 				req_pos_str = "EXTERNAL";
 
 			pos_str = "NONE";
-			if (dsp_mgr->tram_grp[i].pos == TRAM_POS_INTERNAL) {
+			if (dsp_mgr->tram_grp[i].pos == TRAM_POS_INTERNAL)
 				pos_str = "INTERNAL";
-				ifree -= dsp_mgr->tram_grp[i].size;
-			} else if (dsp_mgr->tram_grp[i].pos == TRAM_POS_EXTERNAL) {
+			else if (dsp_mgr->tram_grp[i].pos == TRAM_POS_EXTERNAL)
 				pos_str = "EXTERNAL";
-				efree -= dsp_mgr->tram_grp[i].size;
-			}
 
 			sprintf(debug_line, "%10s  %10s   %08x  %08x  %03d\n", req_pos_str, pos_str,
 				dsp_mgr->tram_grp[i].size, dsp_mgr->tram_grp[i].offset, dsp_mgr->tram_grp[i].acc_count);
@@ -536,6 +563,12 @@ int ld10k1_debug_new_patch_read1(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr, ld10k
 		if ((err = ld10k1_debug_new_code_read_one(data_conn, 1, instr, i)) < 0)
 			return err;
 	}
+
+	if (patch->instr_removed) {
+		sprintf(debug_line, "Optimized out: %u instructions\n", patch->instr_removed);
+		if ((err = send_debug_line(data_conn)) < 0)
+			return err;
+	}
 	return 0;
 }
 
@@ -571,24 +604,66 @@ static int ld10k1_debug_new_patch_list_read(int data_conn, ld10k1_dsp_mgr_t *dsp
 
 static int ld10k1_debug_new_patch_order_read(int data_conn, ld10k1_dsp_mgr_t *dsp_mgr)
 {
-	int i, idx;
+	int i, j, idx;
 	ld10k1_patch_t *patch;
+	ld10k1_order_graph_t *graph;
+	ld10k1_conn_point_t *point;
+	unsigned int lat;
 	int err;
 
-	sprintf(debug_line, "\nPatch order:\n");
-	if ((err = send_debug_line(data_conn)) < 0)
+	if ((err = ld10k1_order_graph_get(dsp_mgr, &graph)) < 0)
 		return err;
+
+	sprintf(debug_line, "\nPatch order%s:\n", dsp_mgr->auto_order ? " (auto)" : "");
+	if ((err = send_debug_line(data_conn)) < 0)
+		goto err;
 	for (i = 0; i < dsp_mgr->patch_count; i++) {
 		idx = dsp_mgr->patch_order[i];
 		patch = dsp_mgr->patch_ptr[idx];
 		if (patch) {
-			sprintf(debug_line, "%03d   %03d %s\n\n", i, idx, patch->patch_name);
+			sprintf(debug_line, "%03d   %03d %s  latency: %u%s\n\n", i, idx, patch->patch_name,
+				graph->latency[i], patch->loop_break ? "  loop break" : "");
 			if ((err = send_debug_line(data_conn)) < 0)
-				return err;
+				goto err;
 		}
 	}
 
-	return 0;
+	/* connections to patches placed before producer */
+	sprintf(debug_line, "Delayed connections:\n");
+	if ((err = send_debug_line(data_conn)) < 0)
+		goto err;
+	for (i = 0; i < graph->count; i++)
+		for (j = 0; j < i; j++)
+			if (graph->edge[i][j] != ORDER_EDGE_NONE) {
+				sprintf(debug_line, "%03d %s -> %03d %s  %s\n",
+					dsp_mgr->patch_order[i], dsp_mgr->patch_ptr[dsp_mgr->patch_order[i]]->patch_name,
+					dsp_mgr->patch_order[j], dsp_mgr->patch_ptr[dsp_mgr->patch_order[j]]->patch_name,
+					graph->edge[i][j] == ORDER_EDGE_FEEDBACK ? "feedback" : "1 sample");
+				if ((err = send_debug_line(data_conn)) < 0)
+					goto err;
+			}
+
+	/* worst path from inputs to dsp outputs */
+	sprintf(debug_line, "\nOutput latency:\n");
+	if ((err = send_debug_line(data_conn)) < 0)
+		goto err;
+	for (i = 0; i < dsp_mgr->out_count; i++) {
+		point = dsp_mgr->outs[i].point;
+		if (!point)
+			continue;
+		lat = 0;
+		for (j = 0; j < MAX_CONN_PER_POINT; j++)
+			if (point->type[j] == CON_IO_POUT && graph->latency[point->patch[j]->order] > lat)
+				lat = graph->latency[point->patch[j]->order];
+		sprintf(debug_line, "%03d %s  latency: %u\n", i, dsp_mgr->outs[i].name ? dsp_mgr->outs[i].name : "", lat);
+		if ((err = send_debug_line(data_conn)) < 0)
+			goto err;
+	}
+
+	err = 0;
+err:
+	ld10k1_order_graph_free(graph);
+	return err;
 }
 
 int ld10k1_fnc_debug(int data_conn, int op, int size)
@@ -603,59 +678,59 @@ int ld10k1_fnc_debug(int data_conn, int op, int size)
 		return err;
 
 	if (debug_info.what >= 100 && debug_info.what <= 100 + EMU10K1_PATCH_MAX) {
-		if ((err = ld10k1_debug_new_patch_read(data_conn, &dsp_mgr, debug_info.what - 100)) < 0)
+		if ((err = ld10k1_debug_new_patch_read(data_conn, dsp_mgr, debug_info.what - 100)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 1) {
 		/* registers */
-		if ((err = ld10k1_debug_new_gpr_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_gpr_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 2) {
 		/* registers */
-		if ((err = ld10k1_debug_new_const_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_const_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 3) {
 		/* instruction */
-		if ((err = ld10k1_debug_new_code_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_code_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 4) {
 		/* tram */
-		if ((err = ld10k1_debug_new_tram_info_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_tram_info_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 5) {
-		if ((err = ld10k1_debug_new_patch_list_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_patch_list_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 6) {
-		if ((err = ld10k1_debug_new_patch_order_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_patch_order_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 7) {
 		/* fx */
-		if ((err = ld10k1_debug_new_fx_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_fx_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 8) {
 		/* in */
-		if ((err = ld10k1_debug_new_in_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_in_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
 	} else if (debug_info.what == 9) {
 		/* out */
-		if ((err = ld10k1_debug_new_out_read(data_conn, &dsp_mgr)) < 0)
+		if ((err = ld10k1_debug_new_out_read(data_conn, dsp_mgr)) < 0)
 			return err;
 		if ((err = send_response_ok(data_conn)) < 0)
 			return err;
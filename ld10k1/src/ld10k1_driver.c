@@ -24,6 +24,8 @@
 #endif
 
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <alsa/asoundlib.h>
 #include <alsa/sound/emu10k1.h>
 #include <stdint.h>
@@ -35,13 +37,68 @@
 #include "bitops.h"
 #include "ld10k1.h"
 #include "ld10k1_driver.h"
+#include "ld10k1_emu.h"
 #include "ld10k1_error.h"
 #include "ld10k1_fnc.h"
 #include "ld10k1_fnc_int.h"
+#include "ld10k1_tram.h"
 
 //#define DEBUG_DRIVER 1
 
-extern snd_hwdep_t *handle;
+typedef struct ld10k1_driver_job_tag {
+	struct ld10k1_driver_job_tag *next;
+	emu10k1_fx8010_code_t code;
+	/* result is reported through notify_fd */
+	int notify;
+	/* dsp init - present controls are deleted, pcm is stopped */
+	int reset;
+} ld10k1_driver_job_t;
+
+/*
+ * Card driver
+ *
+ * Code pokes to hwdep are done by worker thread of card, nothing waits
+ * for them in main thread. Uploads with only register values are merged
+ * into upload which still waits in queue. Uploads changing code, tram or
+ * controls notify main thread through notify_fd when they are done, their
+ * result is sent to request then - driver can refuse them (control name
+ * used by other driver). Until then requests for card wait, other cards
+ * work. Dsp manager is used only by main thread. Emulator is updated
+ * directly.
+ */
+struct ld10k1_driver_tag {
+	snd_hwdep_t *handle;
+	/* mixer of card, control values are written through it */
+	snd_ctl_t *ctlp;
+	/* set when card runs without hardware */
+	ld10k1_emu_t *emu;
+	int audigy;
+
+	/* tram size read on first init */
+	int tram_known;
+	unsigned int itram_size;
+	unsigned int etram_size;
+
+	pthread_t worker;
+	int worker_running;
+	pthread_mutex_t lock;
+	/* signaled on new job and when job is done */
+	pthread_cond_t cond;
+	ld10k1_driver_job_t *first;
+	ld10k1_driver_job_t *last;
+	int queued;
+	int busy;
+	int stop;
+	/* some upload failed - next update uploads everything */
+	int failed;
+
+	/* eventfd, readable when notify job is done */
+	int notify_fd;
+	/* notify jobs submitted and done since last finish, first error */
+	int notify_sent;
+	int notify_done;
+	int notify_err;
+};
 
 void ld10k1_syntetize_instr(int audigy, int op, int arg1, int arg2, int arg3, int arg4, unsigned int *out)
 {
@@ -116,153 +173,639 @@ err:
 	return LD10K1_ERR_NO_MEM;
 }
 
+static void ld10k1_driver_job_free(ld10k1_driver_job_t *job)
+{
+	ld10k1_free_code_struct(&(job->code));
+	if (job->code.gpr_add_controls)
+		free(job->code.gpr_add_controls);
+	if (job->code.gpr_del_controls)
+		free(job->code.gpr_del_controls);
+	free(job);
+}
+
+static void ld10k1_driver_notify(ld10k1_driver_t *driver)
+{
+	uint64_t one = 1;
+
+	while (write(driver->notify_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+}
+
+/* controls of dsp init are deleted - which are present is known only from driver */
+static int ld10k1_driver_reset_ctls(ld10k1_driver_t *driver, emu10k1_fx8010_code_t *code)
+{
+	emu10k1_fx8010_code_t list;
+	emu10k1_fx8010_control_gpr_t *ctrl;
+	emu10k1_ctl_elem_id_t *ids;
+	unsigned int i;
+	int err;
+
+	if ((err = ld10k1_alloc_code_struct(&list)) < 0)
+		return err;
+
+	/* get count of controls */
+	list.gpr_list_control_count = 0;
+	list.gpr_list_control_total = 0;
+	list.gpr_list_controls = NULL;
+	if (snd_hwdep_ioctl(driver->handle, SNDRV_EMU10K1_IOCTL_CODE_PEEK, &list) < 0) {
+		error("unable to peek code");
+		err = LD10K1_ERR_DRIVER_CODE_PEEK;
+		goto err;
+	}
+
+	ctrl = calloc(list.gpr_list_control_total + 1, sizeof(emu10k1_fx8010_control_gpr_t));
+	ids = calloc(list.gpr_list_control_total + 1, sizeof(emu10k1_ctl_elem_id_t));
+	if (!ctrl || !ids) {
+		free(ctrl);
+		free(ids);
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+
+	list.gpr_list_control_count = list.gpr_list_control_total;
+	list.gpr_list_controls = ctrl;
+	if (snd_hwdep_ioctl(driver->handle, SNDRV_EMU10K1_IOCTL_CODE_PEEK, &list) < 0) {
+		error("unable to peek code");
+		free(ctrl);
+		free(ids);
+		err = LD10K1_ERR_DRIVER_CODE_PEEK;
+		goto err;
+	}
+
+	for (i = 0; i < list.gpr_list_control_count; i++)
+		memcpy(&(ids[i]), &(ctrl[i].id), sizeof(emu10k1_ctl_elem_id_t));
+	free(ctrl);
+
+	code->gpr_del_control_count = list.gpr_list_control_count;
+	code->gpr_del_controls = ids;
+	err = 0;
+err:
+	ld10k1_free_code_struct(&list);
+	return err;
+}
+
+/* delete tram pcm dsp part */
+static int ld10k1_driver_reset_pcm(ld10k1_driver_t *driver)
+{
+	emu10k1_fx8010_pcm_t ipcm;
+	int i;
+
+	if (driver->audigy)
+		return 0;
+
+	for (i = 0; i < EMU10K1_FX8010_PCM_COUNT; i++) {
+		memset(&ipcm, 0, sizeof(ipcm));
+		ipcm.substream = i;
+		ipcm.channels = 0;
+#ifndef DEBUG_DRIVER
+		if (snd_hwdep_ioctl(driver->handle, SNDRV_EMU10K1_IOCTL_PCM_POKE, &ipcm) < 0) {
+			error("unable to poke code");
+			return LD10K1_ERR_DRIVER_PCM_POKE;
+		}
+#endif
+	}
+	return 0;
+}
+
+static void *ld10k1_driver_worker(void *arg)
+{
+	ld10k1_driver_t *driver = (ld10k1_driver_t *)arg;
+	ld10k1_driver_job_t *job;
+	int err;
+
+	pthread_mutex_lock(&driver->lock);
+	while (1) {
+		while (!driver->first && !driver->stop)
+			pthread_cond_wait(&driver->cond, &driver->lock);
+		/* queue is emptied before stop */
+		if (!driver->first)
+			break;
+
+		job = driver->first;
+		driver->first = job->next;
+		if (!driver->first)
+			driver->last = NULL;
+		driver->queued--;
+		driver->busy = 1;
+		pthread_mutex_unlock(&driver->lock);
+
+		err = 0;
+		if (job->reset)
+			err = ld10k1_driver_reset_ctls(driver, &(job->code));
+#ifndef DEBUG_DRIVER
+		if (!err && snd_hwdep_ioctl(driver->handle, SNDRV_EMU10K1_IOCTL_CODE_POKE, &(job->code)) < 0) {
+			error("unable to poke code");
+			err = LD10K1_ERR_DRIVER_CODE_POKE;
+		}
+#endif
+		if (!err && job->reset)
+			err = ld10k1_driver_reset_pcm(driver);
+
+		pthread_mutex_lock(&driver->lock);
+		if (err)
+			driver->failed = 1;
+		else if (job->reset)
+			driver->failed = 0;
+		if (job->notify) {
+			driver->notify_done++;
+			if (err && !driver->notify_err)
+				driver->notify_err = err;
+			ld10k1_driver_notify(driver);
+		}
+		ld10k1_driver_job_free(job);
+		driver->busy = 0;
+		pthread_cond_broadcast(&driver->cond);
+	}
+	pthread_mutex_unlock(&driver->lock);
+	return NULL;
+}
+
+int ld10k1_driver_open(ld10k1_dsp_mgr_t *dsp_mgr, snd_hwdep_t *handle, snd_ctl_t *ctlp, ld10k1_emu_t *emu)
+{
+	ld10k1_driver_t *driver;
+
+	driver = (ld10k1_driver_t *)malloc(sizeof(ld10k1_driver_t));
+	if (!driver)
+		return LD10K1_ERR_NO_MEM;
+	memset(driver, 0, sizeof(ld10k1_driver_t));
+
+	driver->handle = handle;
+	driver->ctlp = ctlp;
+	driver->emu = emu;
+	driver->audigy = dsp_mgr->audigy;
+	driver->notify_fd = -1;
+	pthread_mutex_init(&driver->lock, NULL);
+	pthread_cond_init(&driver->cond, NULL);
+
+	if (!emu) {
+		driver->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (driver->notify_fd < 0) {
+			error("unable to create driver notification");
+			goto err;
+		}
+		if (pthread_create(&driver->worker, NULL, ld10k1_driver_worker, driver)) {
+			error("unable to start driver worker");
+			close(driver->notify_fd);
+			goto err;
+		}
+		driver->worker_running = 1;
+	}
+
+	dsp_mgr->driver = driver;
+	return 0;
+err:
+	pthread_cond_destroy(&driver->cond);
+	pthread_mutex_destroy(&driver->lock);
+	free(driver);
+	return LD10K1_ERR_NO_MEM;
+}
+
+void ld10k1_driver_close(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+
+	if (!driver)
+		return;
+
+	if (driver->worker_running) {
+		pthread_mutex_lock(&driver->lock);
+		driver->stop = 1;
+		pthread_cond_broadcast(&driver->cond);
+		pthread_mutex_unlock(&driver->lock);
+		pthread_join(driver->worker, NULL);
+	}
+
+	if (driver->notify_fd >= 0)
+		close(driver->notify_fd);
+	pthread_cond_destroy(&driver->cond);
+	pthread_mutex_destroy(&driver->lock);
+	free(driver);
+	dsp_mgr->driver = NULL;
+}
+
+/*
+ * wait until worker uploads all queued code and finish waited uploads,
+ * only for card initialization before requests are processed
+ */
+int ld10k1_driver_sync(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+	int err = 0;
+
+	pthread_mutex_lock(&driver->lock);
+	while (driver->first || driver->busy)
+		pthread_cond_wait(&driver->cond, &driver->lock);
+	pthread_mutex_unlock(&driver->lock);
+
+	ld10k1_driver_finish(dsp_mgr, &err);
+	return err;
+}
+
+/* count of uploads not finished yet */
+int ld10k1_driver_pending(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+	int pending;
+
+	pthread_mutex_lock(&driver->lock);
+	pending = driver->queued + driver->busy;
+	pthread_mutex_unlock(&driver->lock);
+	return pending;
+}
+
+ld10k1_emu_t *ld10k1_driver_emu(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	return dsp_mgr->driver->emu;
+}
+
+/* eventfd for poll, readable when waited upload is done, -1 - uploads are done directly */
+int ld10k1_driver_fd(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	return dsp_mgr->driver->notify_fd;
+}
+
+/* some upload waited for by request is not done yet */
+int ld10k1_driver_busy(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+	int busy;
+
+	if (driver->emu)
+		return 0;
+
+	pthread_mutex_lock(&driver->lock);
+	busy = driver->notify_sent != driver->notify_done;
+	pthread_mutex_unlock(&driver->lock);
+	return busy;
+}
+
+/* register values, tram and code of later upload replace values of earlier one */
+static void ld10k1_driver_merge(emu10k1_fx8010_code_t *to, emu10k1_fx8010_code_t *from)
+{
+	unsigned int i;
+
+	for (i = find_next_bit(from->gpr_valid, sizeof(from->gpr_valid) * 8, 0);
+		i < sizeof(from->gpr_valid) * 8;
+		i = find_next_bit(from->gpr_valid, sizeof(from->gpr_valid) * 8, i + 1)) {
+		set_bit(i, to->gpr_valid);
+		to->gpr_map[i] = from->gpr_map[i];
+	}
+
+	for (i = find_next_bit(from->tram_valid, sizeof(from->tram_valid) * 8, 0);
+		i < sizeof(from->tram_valid) * 8;
+		i = find_next_bit(from->tram_valid, sizeof(from->tram_valid) * 8, i + 1)) {
+		set_bit(i, to->tram_valid);
+		to->tram_addr_map[i] = from->tram_addr_map[i];
+		to->tram_data_map[i] = from->tram_data_map[i];
+	}
+
+	for (i = find_next_bit(from->code_valid, sizeof(from->code_valid) * 8, 0);
+		i < sizeof(from->code_valid) * 8;
+		i = find_next_bit(from->code_valid, sizeof(from->code_valid) * 8, i + 1)) {
+		set_bit(i, to->code_valid);
+		to->code[i * 2] = from->code[i * 2];
+		to->code[i * 2 + 1] = from->code[i * 2 + 1];
+	}
+}
+
+/*
+ * driver takes job, main thread never waits for worker. Job without notify
+ * is merged into last queued job - worker didn't start it yet, so nobody
+ * sees state between them. Result of notify job is taken by finish.
+ */
+static void ld10k1_driver_submit(ld10k1_driver_t *driver, ld10k1_driver_job_t *job, int notify)
+{
+	if (driver->emu) {
+		ld10k1_emu_poke(driver->emu, &(job->code));
+		ld10k1_driver_job_free(job);
+		return;
+	}
+
+	job->next = NULL;
+	job->notify = notify;
+	pthread_mutex_lock(&driver->lock);
+	if (!notify && !job->reset && driver->last) {
+		ld10k1_driver_merge(&(driver->last->code), &(job->code));
+		pthread_mutex_unlock(&driver->lock);
+		ld10k1_driver_job_free(job);
+		return;
+	}
+	if (driver->last)
+		driver->last->next = job;
+	else
+		driver->first = job;
+	driver->last = job;
+	driver->queued++;
+	if (notify)
+		driver->notify_sent++;
+	pthread_cond_broadcast(&driver->cond);
+	pthread_mutex_unlock(&driver->lock);
+}
+
+/* controls sent to driver are present now */
+static void ld10k1_driver_ctl_done(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_ctl_list_item_t *item;
+
+	for (item = dsp_mgr->del_ctl_list.first; item != NULL; item = item->next)
+		ld10k1_del_control_from_list(&(dsp_mgr->ctl_list), &(item->ctl));
+
+	ld10k1_del_all_controls_from_list(&(dsp_mgr->del_ctl_list));
+
+	for (item = dsp_mgr->add_ctl_list.first; item != NULL; item = item->next)
+		ld10k1_add_control_to_list(&(dsp_mgr->ctl_list), &(item->ctl));
+
+	ld10k1_del_all_controls_from_list(&(dsp_mgr->add_ctl_list));
+}
+
+/*
+ * take result of waited uploads, returns 1 when all of them are done and
+ * err is set, 0 - nothing to finish or worker didn't finish them yet.
+ * After error controls stay in add and del list and next update uploads
+ * everything again.
+ */
+int ld10k1_driver_finish(ld10k1_dsp_mgr_t *dsp_mgr, int *err)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+	uint64_t count;
+
+	if (driver->emu)
+		return 0;
+
+	while (read(driver->notify_fd, &count, sizeof(count)) < 0 && errno == EINTR)
+		;
+
+	pthread_mutex_lock(&driver->lock);
+	if (!driver->notify_sent || driver->notify_sent != driver->notify_done) {
+		pthread_mutex_unlock(&driver->lock);
+		return 0;
+	}
+	*err = driver->notify_err;
+	driver->notify_sent = 0;
+	driver->notify_done = 0;
+	driver->notify_err = 0;
+	pthread_mutex_unlock(&driver->lock);
+
+	if (!*err)
+		ld10k1_driver_ctl_done(dsp_mgr);
+	return 1;
+}
+
+/* previous upload failed, hardware state is unknown - everything is uploaded again */
+static int ld10k1_driver_check_failed(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+	unsigned int i, tram_count;
+	int failed;
+
+	pthread_mutex_lock(&driver->lock);
+	failed = driver->failed;
+	driver->failed = 0;
+	pthread_mutex_unlock(&driver->lock);
+
+	if (!failed)
+		return 0;
+
+	for (i = 0; i < dsp_mgr->regs_max_count; i++)
+		set_bit(i, dsp_mgr->regs_dirty);
+	for (i = 0; i < dsp_mgr->instr_count; i++)
+		set_bit(i, dsp_mgr->instr_dirty);
+	tram_count = dsp_mgr->max_itram_hwacc + dsp_mgr->max_etram_hwacc;
+	for (i = 0; i < tram_count; i++)
+		set_bit(i, dsp_mgr->tram_dirty);
+	return 1;
+}
+
+static void ld10k1_driver_fill_ctl(emu10k1_fx8010_control_gpr_t *add_ctrl, ld10k1_ctl_t *ctl)
+{
+	unsigned int j;
+
+	strcpy(add_ctrl->id.name, ctl->name);
+	add_ctrl->id.iface = EMU10K1_CTL_ELEM_IFACE_MIXER;
+	add_ctrl->id.index = ctl->index;
+	add_ctrl->vcount = ctl->vcount;
+	add_ctrl->count = ctl->count;
+	for (j = 0; j < 32; j++) {
+		add_ctrl->gpr[j] = ctl->gpr_idx[j];
+		add_ctrl->value[j] = ctl->value[j];
+	}
+	add_ctrl->min = ctl->min;
+	add_ctrl->max = ctl->max;
+	add_ctrl->translation = ctl->translation;
+}
+
+/*
+ * set one value of control like mixer does - driver translates it and
+ * mixer shows it, code is not poked. Other values are read from driver
+ * first, mixer could change them, manager keeps values read back.
+ */
+int ld10k1_driver_ctl_write(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *ctl, unsigned int idx, unsigned int val)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+	ld10k1_ctl_list_item_t *item;
+	emu10k1_fx8010_control_gpr_t emu_ctl;
+	snd_ctl_elem_value_t *value;
+	unsigned int values[32];
+	unsigned int i;
+
+	/* control is in driver after its upload is done */
+	item = ld10k1_look_control_from_list(&(dsp_mgr->ctl_list), ctl);
+	if (!item || ld10k1_look_control_from_list(&(dsp_mgr->del_ctl_list), ctl))
+		return LD10K1_ERR_DRIVER_CTL_WRITE;
+
+	memcpy(values, item->ctl.value, sizeof(values));
+	if (driver->emu) {
+		values[idx] = val;
+		ld10k1_driver_fill_ctl(&emu_ctl, &(item->ctl));
+		memcpy(emu_ctl.value, values, sizeof(values));
+		ld10k1_emu_ctl_put(driver->emu, &emu_ctl);
+	} else {
+		snd_ctl_elem_value_alloca(&value);
+		snd_ctl_elem_value_set_interface(value, SND_CTL_ELEM_IFACE_MIXER);
+		snd_ctl_elem_value_set_name(value, ctl->name);
+		snd_ctl_elem_value_set_index(value, ctl->index);
+		if (!driver->ctlp || snd_ctl_elem_read(driver->ctlp, value) < 0) {
+			error("unable to read control %s", ctl->name);
+			return LD10K1_ERR_DRIVER_CTL_WRITE;
+		}
+		for (i = 0; i < item->ctl.vcount; i++)
+			values[i] = snd_ctl_elem_value_get_integer(value, i);
+		values[idx] = val;
+		snd_ctl_elem_value_set_integer(value, idx, val);
+		if (snd_ctl_elem_write(driver->ctlp, value) < 0) {
+			error("unable to write control %s", ctl->name);
+			return LD10K1_ERR_DRIVER_CTL_WRITE;
+		}
+	}
+
+	/* next full upload adds control with these values */
+	for (i = 0; i < item->ctl.vcount; i++) {
+		item->ctl.value[i] = values[i];
+		ctl->value[i] = values[i];
+	}
+	return 0;
+}
+
 int ld10k1_update_driver(ld10k1_dsp_mgr_t *dsp_mgr)
 {
-	emu10k1_fx8010_code_t code;
+	ld10k1_driver_job_t *job;
+	emu10k1_fx8010_code_t *code;
 	emu10k1_fx8010_control_gpr_t *add_ctrl;
 	emu10k1_ctl_elem_id_t *del_ids;
 
 	ld10k1_ctl_list_item_t *item;
-	unsigned int i, j;
-	int max;
-	int modified;
-	unsigned int addr;
+	ld10k1_tram_hwacc_t *hwacc;
+	unsigned int i;
+	unsigned int tram_count;
+	unsigned int add_count;
 	unsigned int vaddr;
-	unsigned int op;
-	unsigned int idx_offset;
 	unsigned int *iptr;
-	ld10k1_ctl_t gctl;
+	int resend, notify = 0;
 	
 	int err;
 	
-	if ((err = ld10k1_alloc_code_struct(&code)) < 0)
-    		return err;
+	resend = ld10k1_driver_check_failed(dsp_mgr);
+
+	job = (ld10k1_driver_job_t *)malloc(sizeof(ld10k1_driver_job_t));
+	if (!job)
+		return LD10K1_ERR_NO_MEM;
+	code = &(job->code);
+	if ((err = ld10k1_alloc_code_struct(code)) < 0) {
+		free(job);
+		return err;
+	}
+	code->gpr_add_controls = NULL;
+	code->gpr_del_controls = NULL;
+	job->reset = 0;
 	
 	/* new name */
-	strcpy(code.name, LD10K1_SIGNATURE);
+	strcpy(code->name, LD10K1_SIGNATURE);
 
-	for (i = 0; i < sizeof(code.gpr_valid) / sizeof(unsigned long); i++)
-		code.gpr_valid[i] = 0;
-	for (i = 0; i < sizeof(code.tram_valid) / sizeof(unsigned long); i++)
-		code.tram_valid[i] = 0;
-	for (i = 0; i < sizeof(code.code_valid) / sizeof(unsigned long); i++)
-		code.code_valid[i] = 0;
+	for (i = 0; i < sizeof(code->gpr_valid) / sizeof(unsigned long); i++)
+		code->gpr_valid[i] = 0;
+	for (i = 0; i < sizeof(code->tram_valid) / sizeof(unsigned long); i++)
+		code->tram_valid[i] = 0;
+	for (i = 0; i < sizeof(code->code_valid) / sizeof(unsigned long); i++)
+		code->code_valid[i] = 0;
 
-	/* registers */
-	for (i = 0; i < dsp_mgr->regs_max_count; i++)
-		if (dsp_mgr->regs[i].modified) {
-			set_bit(i, code.gpr_valid);
-			code.gpr_map[i] = dsp_mgr->regs[i].val;
-		}
+	/* registers - only these marked as dirty */
+	for (i = find_next_bit(dsp_mgr->regs_dirty, dsp_mgr->regs_max_count, 0);
+		i < dsp_mgr->regs_max_count;
+		i = find_next_bit(dsp_mgr->regs_dirty, dsp_mgr->regs_max_count, i + 1)) {
+		set_bit(i, code->gpr_valid);
+		code->gpr_map[i] = dsp_mgr->regs[i].val;
+	}
 
-	/* tram addr + data */
-	for (j = 0; j < 2; j++) {
-		max = (j == 0 ? dsp_mgr->max_itram_hwacc : dsp_mgr->max_etram_hwacc);
-		for (i = 0; i < max; i++) {
-			modified = (j == 0 ? dsp_mgr->itram_hwacc[i].modified : dsp_mgr->etram_hwacc[i].modified);
-			if (modified) {
-				addr = (j == 0 ? dsp_mgr->itram_hwacc[i].addr_val : dsp_mgr->etram_hwacc[i].addr_val);
-				vaddr = addr & 0xFFFFF;
-				idx_offset = (j == 0 ? 0 : dsp_mgr->max_itram_hwacc);
-				op = (j == 0 ? dsp_mgr->itram_hwacc[i].op : dsp_mgr->etram_hwacc[i].op);
-
-				set_bit(i + idx_offset, code.tram_valid);
-				switch(op) {
-					case TRAM_OP_READ:
-						if (dsp_mgr->audigy)
-							vaddr = vaddr | 0x2 << 20;
-						else
-							vaddr = vaddr | TANKMEMADDRREG_READ | TANKMEMADDRREG_ALIGN;
-						break;
-					case TRAM_OP_WRITE:
-						if (dsp_mgr->audigy)
-							vaddr = vaddr | 0x6 << 20;
-						else
-							vaddr = vaddr | TANKMEMADDRREG_WRITE | TANKMEMADDRREG_ALIGN;
-						break;
-					case TRAM_OP_NULL:
-					default:
-						vaddr = 0;
-						break;
-				}
+	/* tram addr + data - itram hwacc followed by etram hwacc */
+	tram_count = dsp_mgr->max_itram_hwacc + dsp_mgr->max_etram_hwacc;
+	for (i = find_next_bit(dsp_mgr->tram_dirty, tram_count, 0);
+		i < tram_count;
+		i = find_next_bit(dsp_mgr->tram_dirty, tram_count, i + 1)) {
+		if (i < dsp_mgr->max_itram_hwacc)
+			hwacc = &(dsp_mgr->itram_hwacc[i]);
+		else
+			hwacc = &(dsp_mgr->etram_hwacc[i - dsp_mgr->max_itram_hwacc]);
 
-				code.tram_addr_map[i + idx_offset] = vaddr;
-				code.tram_data_map[i + idx_offset] = (j == 0 ? dsp_mgr->itram_hwacc[i].data_val : dsp_mgr->etram_hwacc[i].data_val);
-			}
+		vaddr = hwacc->addr_val & 0xFFFFF;
+
+		set_bit(i, code->tram_valid);
+		notify = 1;
+		switch(hwacc->op) {
+			case TRAM_OP_READ:
+				if (dsp_mgr->audigy)
+					vaddr = vaddr | 0x2 << 20;
+				else
+					vaddr = vaddr | TANKMEMADDRREG_READ | TANKMEMADDRREG_ALIGN;
+				break;
+			case TRAM_OP_WRITE:
+				if (dsp_mgr->audigy)
+					vaddr = vaddr | 0x6 << 20;
+				else
+					vaddr = vaddr | TANKMEMADDRREG_WRITE | TANKMEMADDRREG_ALIGN;
+				break;
+			case TRAM_OP_NULL:
+			default:
+				vaddr = 0;
+				break;
 		}
+
+		code->tram_addr_map[i] = vaddr;
+		code->tram_data_map[i] = hwacc->data_val;
 	}
 
-	/* controls to add */
-	if (dsp_mgr->add_list_count > 0) {
-		add_ctrl = calloc(dsp_mgr->add_list_count,
+	/* controls to add, after failed upload present controls are added again
+	   - driver sets their registers to translated values */
+	add_count = dsp_mgr->add_ctl_list.count;
+	if (resend)
+		add_count += dsp_mgr->ctl_list.count;
+	if (add_count > 0) {
+		add_ctrl = calloc(add_count,
 				  sizeof(emu10k1_fx8010_control_gpr_t));
 		if (!add_ctrl)
-			return LD10K1_ERR_NO_MEM;
-		for (i = 0, item = dsp_mgr->add_ctl_list; item != NULL; item = item->next, i++) {
-			strcpy(add_ctrl[i].id.name, item->ctl.name);
-			add_ctrl[i].id.iface = EMU10K1_CTL_ELEM_IFACE_MIXER;
-			add_ctrl[i].id.index = item->ctl.index;
-			add_ctrl[i].vcount = item->ctl.vcount;
-			add_ctrl[i].count = item->ctl.count;
-			for (j = 0; j < 32; j++) {
-				add_ctrl[i].gpr[j] = item->ctl.gpr_idx[j];
-				add_ctrl[i].value[j] = item->ctl.value[j];
-			}
-			add_ctrl[i].min = item->ctl.min;
-			add_ctrl[i].max = item->ctl.max;
-			add_ctrl[i].translation = item->ctl.translation;
-		}
+			goto err_mem;
+		i = 0;
+		for (item = dsp_mgr->add_ctl_list.first; item != NULL; item = item->next)
+			ld10k1_driver_fill_ctl(&(add_ctrl[i++]), &(item->ctl));
+		if (resend)
+			for (item = dsp_mgr->ctl_list.first; item != NULL; item = item->next)
+				if (!ld10k1_look_control_from_list(&(dsp_mgr->del_ctl_list), &(item->ctl)))
+					ld10k1_driver_fill_ctl(&(add_ctrl[i++]), &(item->ctl));
+		add_count = i;
+		notify = 1;
 	} else
 		add_ctrl = NULL;
 
-	code.gpr_add_control_count = dsp_mgr->add_list_count;
-	code.gpr_add_controls = add_ctrl;
+	code->gpr_add_control_count = add_count;
+	code->gpr_add_controls = add_ctrl;
 
 	/* controls to del */
-	if (dsp_mgr->del_list_count > 0) {
-		del_ids = calloc(dsp_mgr->del_list_count,
+	if (dsp_mgr->del_ctl_list.count > 0) {
+		del_ids = calloc(dsp_mgr->del_ctl_list.count,
 				 sizeof(emu10k1_ctl_elem_id_t));
 		if (!del_ids)
-			return LD10K1_ERR_NO_MEM;
-		for (i = 0, item = dsp_mgr->del_ctl_list; item != NULL; item = item->next, i++) {
+			goto err_mem;
+		for (i = 0, item = dsp_mgr->del_ctl_list.first; item != NULL; item = item->next, i++) {
 			strcpy(del_ids[i].name, item->ctl.name);
 			del_ids[i].iface = EMU10K1_CTL_ELEM_IFACE_MIXER;
 			del_ids[i].index = item->ctl.index;
 		}
+		notify = 1;
 	} else
 		del_ids = NULL;
 		
-	code.gpr_del_control_count = dsp_mgr->del_list_count;
-	code.gpr_del_controls = del_ids;
+	code->gpr_del_control_count = dsp_mgr->del_ctl_list.count;
+	code->gpr_del_controls = del_ids;
 
-	code.gpr_list_control_count = 0;
+	code->gpr_list_control_count = 0;
 
-	for (iptr = code.code, i = 0; i < dsp_mgr->instr_count; i++, iptr += 2) {
-		if (dsp_mgr->instr[i].modified) {
-			set_bit(i, code.code_valid);
-			if (dsp_mgr->instr[i].used) {
-				if (dsp_mgr->audigy) {
+	for (i = find_next_bit(dsp_mgr->instr_dirty, dsp_mgr->instr_count, 0);
+		i < dsp_mgr->instr_count;
+		i = find_next_bit(dsp_mgr->instr_dirty, dsp_mgr->instr_count, i + 1)) {
+		iptr = code->code + i * 2;
+		set_bit(i, code->code_valid);
+		notify = 1;
+		if (dsp_mgr->instr[i].used) {
+			if (dsp_mgr->audigy) {
+				ld10k1_syntetize_instr(dsp_mgr->audigy,
+					dsp_mgr->instr[i].op_code,
+					dsp_mgr->instr[i].arg[0], dsp_mgr->instr[i].arg[1], dsp_mgr->instr[i].arg[2], dsp_mgr->instr[i].arg[3], iptr);
+			} else {
+				if (i < 0x200) {
 					ld10k1_syntetize_instr(dsp_mgr->audigy,
 						dsp_mgr->instr[i].op_code,
 						dsp_mgr->instr[i].arg[0], dsp_mgr->instr[i].arg[1], dsp_mgr->instr[i].arg[2], dsp_mgr->instr[i].arg[3], iptr);
-				} else {
-					if (i < 0x200) {
-						ld10k1_syntetize_instr(dsp_mgr->audigy,
-							dsp_mgr->instr[i].op_code,
-							dsp_mgr->instr[i].arg[0], dsp_mgr->instr[i].arg[1], dsp_mgr->instr[i].arg[2], dsp_mgr->instr[i].arg[3], iptr);
-					}
 				}
+			}
+		} else {
+			if (dsp_mgr->audigy) {
+				ld10k1_syntetize_instr(dsp_mgr->audigy,
+					0x0f,
+					0xc0, 0xc0, 0xcf, 0xc0, iptr);
 			} else {
-				if (dsp_mgr->audigy) {
+				if (i < 0x200) {
 					ld10k1_syntetize_instr(dsp_mgr->audigy,
-						0x0f,
-						0xc0, 0xc0, 0xcf, 0xc0, iptr);
-				} else {
-					if (i < 0x200) {
-						ld10k1_syntetize_instr(dsp_mgr->audigy,
-							0x06,
-							0x40, 0x40, 0x40, 0x40, iptr);
-					}
+						0x06,
+						0x40, 0x40, 0x40, 0x40, iptr);
 				}
 			}
 		}
@@ -270,176 +813,177 @@ int ld10k1_update_driver(ld10k1_dsp_mgr_t *dsp_mgr)
 	
 	/* check initialization of i2s outputs on audigy */
 	if (dsp_mgr->audigy)
-		ld10k1_check_must_init_output(dsp_mgr, &code);
+		ld10k1_check_must_init_output(dsp_mgr, code);
 
+	/* after failed upload worker marks driver and everything is uploaded again,
+	   control lists are updated when upload is done */
+	dsp_mgr->gpr_write_pending = 0;
+	ld10k1_driver_submit(dsp_mgr->driver, job, notify);
+	if (dsp_mgr->driver->emu)
+		ld10k1_driver_ctl_done(dsp_mgr);
 
-#ifndef DEBUG_DRIVER
-	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_POKE, &code) < 0) {
-		error("unable to poke code");
-		ld10k1_free_code_struct(&code);
-		if (add_ctrl)
-			free(add_ctrl);
-		if (del_ids)
-			free(del_ids);
-		return LD10K1_ERR_DRIVER_CODE_POKE;
-	}
-#endif
+	for (i = find_next_bit(dsp_mgr->regs_dirty, dsp_mgr->regs_max_count, 0);
+		i < dsp_mgr->regs_max_count;
+		i = find_next_bit(dsp_mgr->regs_dirty, dsp_mgr->regs_max_count, i + 1))
+		dsp_mgr->regs[i].modified = 0;
+
+	for (i = find_next_bit(dsp_mgr->instr_dirty, dsp_mgr->instr_count, 0);
+		i < dsp_mgr->instr_count;
+		i = find_next_bit(dsp_mgr->instr_dirty, dsp_mgr->instr_count, i + 1))
+		dsp_mgr->instr[i].modified = 0;
 
-	/* update state */
-	for (item = dsp_mgr->del_ctl_list; item != NULL; item = item->next) {
-		strcpy(gctl.name, item->ctl.name);
-		ld10k1_del_control_from_list(&(dsp_mgr->ctl_list), &(dsp_mgr->ctl_list_count), &gctl);
+	for (i = find_next_bit(dsp_mgr->tram_dirty, tram_count, 0);
+		i < tram_count;
+		i = find_next_bit(dsp_mgr->tram_dirty, tram_count, i + 1)) {
+		if (i < dsp_mgr->max_itram_hwacc)
+			dsp_mgr->itram_hwacc[i].modified = 0;
+		else
+			dsp_mgr->etram_hwacc[i - dsp_mgr->max_itram_hwacc].modified = 0;
 	}
 
-	ld10k1_del_all_controls_from_list(&(dsp_mgr->del_ctl_list), &dsp_mgr->del_list_count);
+	memset(dsp_mgr->regs_dirty, 0, sizeof(dsp_mgr->regs_dirty));
+	memset(dsp_mgr->instr_dirty, 0, sizeof(dsp_mgr->instr_dirty));
+	memset(dsp_mgr->tram_dirty, 0, sizeof(dsp_mgr->tram_dirty));
+	
+	return 0;
+err_mem:
+	ld10k1_driver_job_free(job);
+	return LD10K1_ERR_NO_MEM;
+}
 
-	for (item = dsp_mgr->add_ctl_list; item != NULL; item = item->next)
-		ld10k1_add_control_to_list(&(dsp_mgr->ctl_list), &(dsp_mgr->ctl_list_count), &(item->ctl));
 
-	ld10k1_del_all_controls_from_list(&(dsp_mgr->add_ctl_list), &dsp_mgr->add_list_count);
+/* read gpr and tram data values of running code, arrays are indexed like regs and hwacc */
+int ld10k1_peek_driver(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int *gpr, unsigned int *tram_data)
+{
+	snd_hwdep_t *handle = dsp_mgr->driver->handle;
+	ld10k1_emu_t *emu = dsp_mgr->driver->emu;
+	emu10k1_fx8010_code_t code;
+	unsigned int i;
+	int err;
 
-	for (i = 0; i < dsp_mgr->regs_max_count; i++)
-		dsp_mgr->regs[i].modified = 0;
+	if ((err = ld10k1_alloc_code_struct(&code)) < 0)
+		return err;
 
-	for (i = 0; i < dsp_mgr->instr_count; i++)
-		dsp_mgr->instr[i].modified = 0;
+	code.gpr_list_control_count = 0;
+	code.gpr_list_controls = NULL;
 
-	for (j = 0; j < 2; j++) {
-		max = (j == 0 ? dsp_mgr->max_itram_hwacc : dsp_mgr->max_etram_hwacc);
-		for (i = 0; i < max; i++) {
-			if (j == 0)
-				dsp_mgr->itram_hwacc[i].modified = 0;
-			else
-				dsp_mgr->etram_hwacc[i].modified = 0;
-		}
+	if (emu)
+		ld10k1_emu_peek(emu, &code);
+#ifndef DEBUG_DRIVER
+	else if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_PEEK, &code) < 0) {
+		ld10k1_free_code_struct(&code);
+		return LD10K1_ERR_DRIVER_CODE_PEEK;
 	}
-	
-	ld10k1_free_code_struct(&code);
+#endif
+
+	for (i = 0; i < dsp_mgr->regs_max_count; i++)
+		gpr[i] = code.gpr_map[i];
+	for (i = 0; i < dsp_mgr->max_itram_hwacc + dsp_mgr->max_etram_hwacc; i++)
+		tram_data[i] = code.tram_data_map[i];
 
-	if (add_ctrl)
-		free(add_ctrl);
-	if (del_ids)
-		free(del_ids);
+	ld10k1_free_code_struct(&code);
 	return 0;
 }
 
-
-int ld10k1_init_driver(ld10k1_dsp_mgr_t *dsp_mgr, int tram_size)
+/* driver version and tram size, only on first init */
+static int ld10k1_init_driver_info(ld10k1_dsp_mgr_t *dsp_mgr, int tram_size)
 {
+	ld10k1_driver_t *driver = dsp_mgr->driver;
 	emu10k1_fx8010_info_t info;
 	int i;
-	emu10k1_fx8010_code_t code;
-	emu10k1_fx8010_control_gpr_t *ctrl;
-	emu10k1_ctl_elem_id_t *ids;
-	emu10k1_fx8010_pcm_t ipcm;
-	
-	unsigned int *iptr;
-	
-	int err;
-	
-	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_PVERSION, &i) < 0) {
+
+	if (driver->emu) {
+		/* emulator tram is allocated with emulator */
+		driver->itram_size = driver->emu->itram_size;
+		driver->etram_size = driver->emu->etram_size;
+		driver->tram_known = 1;
+		return 0;
+	}
+
+	if (snd_hwdep_ioctl(driver->handle, SNDRV_EMU10K1_IOCTL_PVERSION, &i) < 0) {
 		error("Cannot get emu10k1 driver version, likely an old driver is running.");
 		return LD10K1_ERR_DRIVER_INFO;
 	}
 
-	if ((err = ld10k1_alloc_code_struct(&code)) < 0)
-    		return err;
-	
 	/* setup tram size */
-	if (tram_size >= 0 && snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_TRAM_SETUP, &tram_size) < 0) {
+	if (tram_size >= 0 && snd_hwdep_ioctl(driver->handle, SNDRV_EMU10K1_IOCTL_TRAM_SETUP, &tram_size) < 0) {
 		error("unable to setup tram");
 		if (dsp_mgr->audigy)
 			error("You are probably user of audigy, audigy 2 and you not aplyed patch to enable tram");
 		/* this is not fatal, but do not use tram */
-		dsp_mgr->i_tram.size = 0;
-		dsp_mgr->e_tram.size = 0;
+		driver->itram_size = 0;
+		driver->etram_size = 0;
 	} else {
-		if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_INFO, &info) < 0) {
+		if (snd_hwdep_ioctl(driver->handle, SNDRV_EMU10K1_IOCTL_INFO, &info) < 0) {
 			error("unable to get info ");
-			ld10k1_free_code_struct(&code);
 			return LD10K1_ERR_DRIVER_INFO;
 		}
 
-		dsp_mgr->i_tram.size = info.internal_tram_size;
-		dsp_mgr->e_tram.size = info.external_tram_size;
-	}
-	
-	/* get count of controls */
-	code.gpr_list_control_count = 0;
-	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_PEEK, &code) < 0) {
-		error("unable to peek code");
-		ld10k1_free_code_struct(&code);
-		return LD10K1_ERR_DRIVER_CODE_PEEK;
-	}
-
-	ctrl = calloc(code.gpr_list_control_total,
-		      sizeof(emu10k1_fx8010_control_gpr_t));
-	if (!ctrl) {
-		ld10k1_free_code_struct(&code);
-		return LD10K1_ERR_NO_MEM;
+		driver->itram_size = info.internal_tram_size;
+		driver->etram_size = info.external_tram_size;
 	}
+	driver->tram_known = 1;
+	return 0;
+}
 
-	code.gpr_list_control_count = code.gpr_list_control_total;
-	code.gpr_list_controls = ctrl;
-
-	for (i = 0; i < sizeof(code.gpr_valid) / sizeof(unsigned long); i++)
-		code.gpr_valid[i] = 0x0;
-	for (i = 0; i < sizeof(code.tram_valid) / sizeof(unsigned long); i++)
-		code.tram_valid[i] = 0x0;
-	for (i = 0; i < sizeof(code.code_valid) / sizeof(unsigned long); i++)
-		code.code_valid[i] = 0x0;;
-
-	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_PEEK, &code) < 0) {
-		error("unable to peek code");
-		ld10k1_free_code_struct(&code);
-		free(ctrl);
-		return LD10K1_ERR_DRIVER_CODE_PEEK;
-	}
-	
-	
+/*
+ * Whole dsp is cleared. Card is asked for version and tram only on first
+ * init, clearing is queued after older uploads and its result is reported
+ * like result of other waited upload.
+ */
+int ld10k1_init_driver(ld10k1_dsp_mgr_t *dsp_mgr, int tram_size)
+{
+	ld10k1_driver_t *driver = dsp_mgr->driver;
+	ld10k1_driver_job_t *job;
+	emu10k1_fx8010_code_t *code;
+	unsigned int *iptr;
+	unsigned int i;
+	int err;
 
-	/* new name */
-	strcpy(code.name, LD10K1_SIGNATURE);
-	for (i = 0; i < sizeof(code.gpr_valid) / sizeof(unsigned long); i++)
-		code.gpr_valid[i] = ~0;
+	if (!driver->tram_known && (err = ld10k1_init_driver_info(dsp_mgr, tram_size)) < 0)
+		return err;
 
-	for (i = 0; i < sizeof(code.gpr_valid) * 8; i++) {
-		code.gpr_map[i] = 0;
-	}
+	dsp_mgr->i_tram.size = driver->itram_size;
+	dsp_mgr->e_tram.size = driver->etram_size;
+	ld10k1_tram_init_space(dsp_mgr);
 
-	ids = calloc(code.gpr_list_control_total,
-		     sizeof(emu10k1_ctl_elem_id_t));
-	if (!ids) {
-		ld10k1_free_code_struct(&code);
-		free(ctrl);
+	job = (ld10k1_driver_job_t *)malloc(sizeof(ld10k1_driver_job_t));
+	if (!job)
 		return LD10K1_ERR_NO_MEM;
+	code = &(job->code);
+	if ((err = ld10k1_alloc_code_struct(code)) < 0) {
+		free(job);
+		return err;
 	}
+	job->reset = 1;
 
-	code.gpr_del_control_count = code.gpr_list_control_total;
-	if (code.gpr_del_control_count) {
-		for (i = 0; i < code.gpr_del_control_count; i++) {
-			memcpy(&(ids[i]), &(ctrl[i].id), sizeof(emu10k1_ctl_elem_id_t));
-		}
-	}
+	/* new name */
+	strcpy(code->name, LD10K1_SIGNATURE);
 
-	free(ctrl);
+	/* controls to delete are filled by worker */
+	code->gpr_del_control_count = 0;
+	code->gpr_del_controls = NULL;
+	code->gpr_add_control_count = 0;
+	code->gpr_add_controls = NULL;
+	code->gpr_list_control_count = 0;
+	code->gpr_list_controls = NULL;
 
-	code.gpr_del_controls = ids;
-	code.gpr_list_control_count = 0;
-	code.gpr_add_control_count = 0;
-	code.gpr_list_control_count = 0;
+	for (i = 0; i < sizeof(code->gpr_valid) / sizeof(unsigned long); i++)
+		code->gpr_valid[i] = ~0;
+	for (i = 0; i < sizeof(code->gpr_valid) * 8; i++)
+		code->gpr_map[i] = 0;
 
-	for (i = 0; i < sizeof(code.tram_valid) / sizeof(unsigned long); i++)
-		code.tram_valid[i] = ~0;
-	for (i = 0; i < sizeof(code.code_valid) / sizeof(unsigned long); i++)
-		code.code_valid[i] = ~0;
+	for (i = 0; i < sizeof(code->tram_valid) / sizeof(unsigned long); i++)
+		code->tram_valid[i] = ~0;
+	for (i = 0; i < sizeof(code->code_valid) / sizeof(unsigned long); i++)
+		code->code_valid[i] = ~0;
 
-	for (i = 0; i < sizeof(code.tram_valid) * 8; i++) {
-		code.tram_addr_map[i] = 0;
-		code.tram_data_map[i] = 0;
+	for (i = 0; i < sizeof(code->tram_valid) * 8; i++) {
+		code->tram_addr_map[i] = 0;
+		code->tram_data_map[i] = 0;
 	}
 
-	for (iptr = code.code, i = 0; i < sizeof(code.code_valid) * 8; i++, iptr += 2)
+	for (iptr = code->code, i = 0; i < sizeof(code->code_valid) * 8; i++, iptr += 2)
 		if (dsp_mgr->audigy) {
 			ld10k1_syntetize_instr(dsp_mgr->audigy,
 				0x0f,
@@ -449,41 +993,15 @@ int ld10k1_init_driver(ld10k1_dsp_mgr_t *dsp_mgr, int tram_size)
 				0x06,
 				0x40, 0x40, 0x40, 0x40, iptr);
 		}
-		
+
 	/* initialize i2s outputs on audigy */
 	if (dsp_mgr->audigy) {
-		for (iptr = code.code, i = 0; audigy_must_init_output[i] > 0; i += 2, iptr += 2)
+		for (iptr = code->code, i = 0; audigy_must_init_output[i] > 0; i += 2, iptr += 2)
 			ld10k1_syntetize_instr(dsp_mgr->audigy,	0x00,
 				audigy_must_init_output[i], 0xc0, 0xc0, 0xc0, iptr);
 	}
-	
-#ifndef DEBUG_DRIVER
-	if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_CODE_POKE, &code) < 0) {
-		error("unable to poke code");
-		ld10k1_free_code_struct(&code);
-		free(ids);
-		return LD10K1_ERR_DRIVER_CODE_POKE;
-	}
-#endif
-
-	free(ids);
 
-	/* delete tram pcm dsp part */
-	if (!dsp_mgr->audigy) {
-		for (i = 0; i < EMU10K1_FX8010_PCM_COUNT; i++) {
-			ipcm.substream = i;
-			ipcm.channels = 0;
-#ifndef DEBUG_DRIVER
-			if (snd_hwdep_ioctl(handle, SNDRV_EMU10K1_IOCTL_PCM_POKE, &ipcm) < 0) {
-				error("unable to poke code");
-				ld10k1_free_code_struct(&code);
-				return LD10K1_ERR_DRIVER_PCM_POKE;
-			}
-#endif
-		}
-	}
-	
-	ld10k1_free_code_struct(&code);
+	ld10k1_driver_submit(driver, job, 1);
 	return 0;
 }
 
@@ -22,7 +22,21 @@
 #ifndef __LD10K1_DRIVER_H
 #define __LD10K1_DRIVER_H
 
+typedef struct ld10k1_driver_tag ld10k1_driver_t;
+struct ld10k1_emu_s;
+
+int ld10k1_driver_open(ld10k1_dsp_mgr_t *dsp_mgr, snd_hwdep_t *handle, snd_ctl_t *ctlp, struct ld10k1_emu_s *emu);
+void ld10k1_driver_close(ld10k1_dsp_mgr_t *dsp_mgr);
+int ld10k1_driver_sync(ld10k1_dsp_mgr_t *dsp_mgr);
+int ld10k1_driver_pending(ld10k1_dsp_mgr_t *dsp_mgr);
+int ld10k1_driver_fd(ld10k1_dsp_mgr_t *dsp_mgr);
+int ld10k1_driver_busy(ld10k1_dsp_mgr_t *dsp_mgr);
+int ld10k1_driver_finish(ld10k1_dsp_mgr_t *dsp_mgr, int *err);
+struct ld10k1_emu_s *ld10k1_driver_emu(ld10k1_dsp_mgr_t *dsp_mgr);
+
 int ld10k1_update_driver(ld10k1_dsp_mgr_t *dsp_mgr);
+int ld10k1_driver_ctl_write(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *ctl, unsigned int idx, unsigned int val);
 int ld10k1_init_driver(ld10k1_dsp_mgr_t *dsp_mgr, int tram_size);
+int ld10k1_peek_driver(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int *gpr, unsigned int *tram_data);
 
 #endif /* __LD10K1_DRIVER_H */
@@ -44,7 +44,7 @@ int ld10k1_make_dump(ld10k1_dsp_mgr_t *dsp_mgr, void **dump, int *size)
 	ld10k1_instr_dump_t *instr = NULL;
 
 	dump_size += sizeof(ld10k1_dump_t);
-	dump_size += sizeof(ld10k1_ctl_dump_t) * dsp_mgr->ctl_list_count;
+	dump_size += sizeof(ld10k1_ctl_dump_t) * dsp_mgr->ctl_list.count;
 	dump_size += sizeof(unsigned int) * dsp_mgr->regs_max_count;
 	dump_size += sizeof(ld10k1_tram_dump_t) * (dsp_mgr->max_itram_hwacc + dsp_mgr->max_etram_hwacc);
 	dump_size += sizeof(ld10k1_instr_dump_t) * dsp_mgr->instr_count;
@@ -62,7 +62,7 @@ int ld10k1_make_dump(ld10k1_dsp_mgr_t *dsp_mgr, void **dump, int *size)
 		header->dump_type = DUMP_TYPE_AUDIGY;
 	
 	header->tram_size = dsp_mgr->e_tram.size;
-	header->ctl_count = dsp_mgr->ctl_list_count;
+	header->ctl_count = dsp_mgr->ctl_list.count;
 	header->gpr_count = dsp_mgr->regs_max_count;
 	header->tram_count = dsp_mgr->max_itram_hwacc + dsp_mgr->max_etram_hwacc;
 	header->instr_count = dsp_mgr->instr_count;
@@ -76,7 +76,7 @@ int ld10k1_make_dump(ld10k1_dsp_mgr_t *dsp_mgr, void **dump, int *size)
 
 	ptr += sizeof(ld10k1_dump_t);
 	/* ctls */
-	for (item = dsp_mgr->ctl_list; item != NULL; item = item->next) {
+	for (item = dsp_mgr->ctl_list.first; item != NULL; item = item->next) {
 		ctl = (ld10k1_ctl_dump_t *)ptr;
 		strcpy(ctl->name, item->ctl.name);
 		ctl->index = item->ctl.index;
@@ -0,0 +1,1729 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <alsa/asoundlib.h>
+#include <alsa/sound/emu10k1.h>
+#include <stdint.h>
+
+#include "bitops.h"
+#include "ld10k1.h"
+#include "ld10k1_emu.h"
+#include "ld10k1_error.h"
+#include "ld10k1_fnc.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EMU_AVX2
+#include <immintrin.h>
+#endif
+
+/*
+ * Register space (operand addresses):
+ *
+ *           SB Live        Audigy
+ * io        0x000-0x03f    0x000-0x0bf
+ * const     0x040-0x055    0x0c0-0x0d5
+ * hw        0x056-0x05b    0x0d6-0x0db   accum, ccr, noise1, noise2, irq, dbac
+ * tram data 0x200-0x29f    0x200-0x2ff   internal followed by external
+ * tram addr 0x300-0x39f    0x300-0x3ff
+ * gpr       0x100-0x1ff    0x400-0x5ff
+ *
+ * One call of ld10k1_emu_step is one sample period: tram engine moves
+ * data between tram memory and data registers, whole program runs
+ * once and delay base address counter is decremented.
+ */
+
+static uint32_t emu_const_table[] = {
+	0x00000000, 0x00000001, 0x00000002, 0x00000003,
+	0x00000004, 0x00000008, 0x00000010, 0x00000020,
+	0x00000100, 0x00010000, 0x00080000, 0x10000000,
+	0x20000000, 0x40000000, 0x80000000, 0x7fffffff,
+	0xffffffff, 0xfffffffe, 0xc0000000, 0x4f1bbcdc,
+	0x5a7ef9db, 0x00100000
+};
+
+int ld10k1_emu_new(int audigy, unsigned int itram_size, unsigned int etram_size, ld10k1_emu_t **emu)
+{
+	ld10k1_emu_t *e;
+	unsigned int i;
+
+	e = (ld10k1_emu_t *)malloc(sizeof(ld10k1_emu_t));
+	if (!e)
+		return LD10K1_ERR_NO_MEM;
+	memset(e, 0, sizeof(ld10k1_emu_t));
+
+	e->audigy = audigy;
+	if (audigy) {
+		e->instr_count = 0x400;
+		e->const_base = 0xc0;
+		e->gpr_base = 0x400;
+		e->gpr_count = 0x200;
+		e->itram_count = 0xc0;
+		e->etram_count = 0x40;
+	} else {
+		e->instr_count = 0x200;
+		e->const_base = 0x40;
+		e->gpr_base = 0x100;
+		e->gpr_count = 0x100;
+		e->itram_count = 0x80;
+		e->etram_count = 0x20;
+	}
+
+	for (i = 0; i < sizeof(emu_const_table) / sizeof(uint32_t); i++)
+		e->regs[e->const_base + i] = emu_const_table[i];
+
+	e->noise = 0x12345678;
+	e->jit_enable = 1;
+#ifdef EMU_AVX2
+	__builtin_cpu_init();
+	e->avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	e->itram_size = itram_size;
+	if (itram_size) {
+		e->itram = (int16_t *)calloc(itram_size, sizeof(int16_t));
+		if (!e->itram)
+			goto err;
+	}
+	e->etram_size = etram_size;
+	if (etram_size) {
+		e->etram = (int16_t *)calloc(etram_size, sizeof(int16_t));
+		if (!e->etram)
+			goto err;
+	}
+
+	*emu = e;
+	return 0;
+err:
+	ld10k1_emu_free(e);
+	return LD10K1_ERR_NO_MEM;
+}
+
+static void ld10k1_emu_plan_free(ld10k1_emu_t *emu);
+
+void ld10k1_emu_free(ld10k1_emu_t *emu)
+{
+	ld10k1_emu_plan_free(emu);
+	if (emu->itram)
+		free(emu->itram);
+	if (emu->etram)
+		free(emu->etram);
+	free(emu);
+}
+
+/* value of TABLE100 translation, 0.4 dB steps down from full scale */
+static uint32_t ld10k1_emu_db_value(unsigned int val)
+{
+	double gain = 2147483647.0;
+
+	if (val == 0)
+		return 0;
+	if (val > 100)
+		val = 100;
+	for (; val < 100; val++)
+		gain /= 1.0471285480508996;
+	return (uint32_t)gain;
+}
+
+void ld10k1_emu_ctl_put(ld10k1_emu_t *emu, emu10k1_fx8010_control_gpr_t *ctl)
+{
+	unsigned int i, val, gpr;
+
+	for (i = 0; i < ctl->count && i < 32; i++) {
+		gpr = ctl->gpr[i];
+		if (gpr >= emu->gpr_count)
+			continue;
+		val = ctl->value[i];
+		if (val < ctl->min)
+			val = ctl->min;
+		if (val > ctl->max)
+			val = ctl->max;
+		switch (ctl->translation) {
+			case EMU10K1_GPR_TRANSLATION_NONE:
+				emu->regs[emu->gpr_base + gpr] = val;
+				break;
+			case EMU10K1_GPR_TRANSLATION_TABLE100:
+				emu->regs[emu->gpr_base + gpr] = ld10k1_emu_db_value(val);
+				break;
+			case EMU10K1_GPR_TRANSLATION_ONOFF:
+				emu->regs[emu->gpr_base + gpr] = val ? 0x7fffffff : 0;
+				break;
+			default:
+				/* bass and treble use driver coefficient tables - keep gpr value,
+				   emu_run refuses such program */
+				break;
+		}
+	}
+}
+
+void ld10k1_emu_poke(ld10k1_emu_t *emu, emu10k1_fx8010_code_t *code)
+{
+	unsigned int i;
+
+	for (i = 0; i < emu->gpr_count; i++)
+		if (test_bit(i, (unsigned long *)code->gpr_valid))
+			emu->regs[emu->gpr_base + i] = code->gpr_map[i];
+
+	for (i = 0; i < emu->itram_count + emu->etram_count; i++)
+		if (test_bit(i, (unsigned long *)code->tram_valid)) {
+			emu->regs[EMU_TRAM_DATA + i] = code->tram_data_map[i];
+			emu->regs[EMU_TRAM_ADDR + i] = code->tram_addr_map[i];
+		}
+
+	for (i = 0; i < code->gpr_add_control_count; i++)
+		ld10k1_emu_ctl_put(emu, &(code->gpr_add_controls[i]));
+
+	for (i = 0; i < emu->instr_count; i++)
+		if (test_bit(i, (unsigned long *)code->code_valid)) {
+			emu->code[i * 2] = code->code[i * 2];
+			emu->code[i * 2 + 1] = code->code[i * 2 + 1];
+		}
+
+	emu->plan_valid = 0;
+}
+
+void ld10k1_emu_peek(ld10k1_emu_t *emu, emu10k1_fx8010_code_t *code)
+{
+	unsigned int i;
+
+	for (i = 0; i < emu->gpr_count; i++) {
+		set_bit(i, (unsigned long *)code->gpr_valid);
+		code->gpr_map[i] = emu->regs[emu->gpr_base + i];
+	}
+
+	for (i = 0; i < emu->itram_count + emu->etram_count; i++) {
+		set_bit(i, (unsigned long *)code->tram_valid);
+		code->tram_data_map[i] = emu->regs[EMU_TRAM_DATA + i];
+		code->tram_addr_map[i] = emu->regs[EMU_TRAM_ADDR + i];
+	}
+
+	for (i = 0; i < emu->instr_count; i++) {
+		set_bit(i, (unsigned long *)code->code_valid);
+		code->code[i * 2] = emu->code[i * 2];
+		code->code[i * 2 + 1] = emu->code[i * 2 + 1];
+	}
+}
+
+static int32_t ld10k1_emu_sat(int64_t val, int *sat)
+{
+	if (val > INT32_MAX) {
+		*sat = 1;
+		return INT32_MAX;
+	}
+	if (val < INT32_MIN) {
+		*sat = 1;
+		return INT32_MIN;
+	}
+	return (int32_t)val;
+}
+
+static uint32_t ld10k1_emu_read(ld10k1_emu_t *emu, unsigned int reg, int intop)
+{
+	int sat;
+
+	if (reg < emu->const_base || reg >= emu->const_base + 0x20)
+		return emu->regs[reg];
+
+	switch (reg - emu->const_base) {
+		case EMU_HW_ACCUM:
+			/* macint* see low 32 bits, others high 32 bits */
+			if (intop)
+				return (uint32_t)((uint64_t)emu->acc_hi << 31) | emu->acc_lo;
+			return (uint32_t)ld10k1_emu_sat(emu->acc_hi, &sat);
+		case EMU_HW_CCR:
+			return emu->ccr;
+		case EMU_HW_NOISE1:
+		case EMU_HW_NOISE2:
+			emu->noise ^= emu->noise << 13;
+			emu->noise ^= emu->noise >> 17;
+			emu->noise ^= emu->noise << 5;
+			return emu->noise;
+		case EMU_HW_DBAC:
+			return emu->dbac;
+		default:
+			return emu->regs[reg];
+	}
+}
+
+static void ld10k1_emu_write(ld10k1_emu_t *emu, unsigned int reg, uint32_t val)
+{
+	if (reg < emu->const_base || reg >= emu->const_base + 0x20) {
+		emu->regs[reg] = val;
+		return;
+	}
+
+	/* constants, accumulator and noise are read only */
+	switch (reg - emu->const_base) {
+		case EMU_HW_CCR:
+			emu->ccr = val;
+			break;
+		case EMU_HW_IRQ:
+			emu->regs[reg] = val;
+			break;
+		case EMU_HW_DBAC:
+			emu->dbac = val & 0xFFFFF;
+			break;
+	}
+}
+
+/* add product in 2^-31 units to accumulator */
+static void ld10k1_emu_acc_add(ld10k1_emu_t *emu, int64_t hi, uint32_t lo, int64_t p)
+{
+	lo += (uint32_t)(p & 0x7fffffff);
+	emu->acc_hi = hi + (p >> 31) + (lo >> 31);
+	emu->acc_lo = lo & 0x7fffffff;
+}
+
+static void ld10k1_emu_acc_set(ld10k1_emu_t *emu, int64_t val)
+{
+	emu->acc_hi = val;
+	emu->acc_lo = 0;
+}
+
+/*
+ * LOG/EXP - X is maximal exponent (1 - 31), Y is sign format:
+ * 0 - keep sign, 1 - absolute value, 2 - negative absolute value, 3 - negate.
+ * Result is exponent in top bits followed by mantissa without leading one.
+ */
+static int ld10k1_emu_exp_bits(unsigned int max_exp)
+{
+	int bits = 0;
+
+	while (max_exp) {
+		bits++;
+		max_exp >>= 1;
+	}
+	return bits;
+}
+
+static int32_t ld10k1_emu_sign(int32_t in, uint32_t mag, unsigned int format)
+{
+	switch (format & 0x3) {
+		case 1:
+			return mag;
+		case 2:
+			return -(int32_t)mag;
+		case 3:
+			return in < 0 ? (int32_t)mag : -(int32_t)mag;
+		default:
+			return in < 0 ? -(int32_t)mag : (int32_t)mag;
+	}
+}
+
+static int32_t ld10k1_emu_log(int32_t a, unsigned int max_exp, unsigned int format)
+{
+	uint32_t mag, m;
+	int lz, e, ebits;
+
+	max_exp &= 0x1f;
+	if (!max_exp)
+		max_exp = 1;
+	ebits = ld10k1_emu_exp_bits(max_exp);
+
+	mag = a < 0 ? (a == INT32_MIN ? 0x7fffffff : -a) : a;
+	if (!mag)
+		return 0;
+
+	for (lz = 0; !(mag & (0x40000000 >> lz)); lz++)
+		;
+	e = max_exp - lz;
+	if (e > 0)
+		m = (mag << lz) & 0x3fffffff;
+	else {
+		e = 0;
+		m = mag << (max_exp - 1);
+	}
+	return ld10k1_emu_sign(a, ((uint32_t)e << (31 - ebits)) | (m >> ebits), format);
+}
+
+static int32_t ld10k1_emu_exp(int32_t a, unsigned int max_exp, unsigned int format)
+{
+	uint32_t mag, m;
+	int e, ebits;
+
+	max_exp &= 0x1f;
+	if (!max_exp)
+		max_exp = 1;
+	ebits = ld10k1_emu_exp_bits(max_exp);
+
+	mag = a < 0 ? (a == INT32_MIN ? 0x7fffffff : -a) : a;
+	e = mag >> (31 - ebits);
+	m = (mag << ebits) & 0x3fffffff;
+	if (e > max_exp)
+		e = max_exp;
+	if (e > 0)
+		mag = (m | 0x40000000) >> (max_exp - e);
+	else
+		mag = m >> (max_exp - 1);
+	return ld10k1_emu_sign(a, mag, format);
+}
+
+/*
+ * Skip test word - three terms of 10 bits, combined by bits 31-30.
+ * Low 5 bits of term are flags which must be set, high 5 bits flags
+ * which must be clear, flag in both halves is ignored.
+ */
+int ld10k1_emu_skip_test(uint32_t ccr, uint32_t test)
+{
+	int t[3];
+	uint32_t set, clr;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		set = (test >> (i * 10)) & 0x1f;
+		clr = (test >> (i * 10 + 5)) & 0x1f;
+		t[i] = (ccr & (set & ~clr)) == (set & ~clr) && !(ccr & (clr & ~set));
+	}
+
+	switch (test >> 30) {
+		case 0:
+			return t[0] && t[1] && t[2];
+		case 1:
+			return t[0] || t[1] || t[2];
+		case 2:
+			return (t[0] && t[1]) || t[2];
+		default:
+			return t[0] && (t[1] || t[2]);
+	}
+}
+
+/* tram access i - memory and operation, 0 for unused access */
+static int ld10k1_emu_tram_op(ld10k1_emu_t *emu, unsigned int i, int16_t **mem, unsigned int *size)
+{
+	unsigned int flags;
+
+	if (i < emu->itram_count) {
+		*mem = emu->itram;
+		*size = emu->itram_size;
+	} else {
+		*mem = emu->etram;
+		*size = emu->etram_size;
+	}
+	if (!*size)
+		return 0;
+
+	flags = (emu->regs[EMU_TRAM_ADDR + i] >> 20) & 0xf;
+	if (emu->audigy) {
+		if (flags & 0x4)
+			return TRAM_OP_WRITE;
+		if (flags & 0x2)
+			return TRAM_OP_READ;
+	} else {
+		if (flags & 0x2)
+			return TRAM_OP_WRITE;
+		if (flags & 0x1)
+			return TRAM_OP_READ;
+	}
+	return 0;
+}
+
+static unsigned int ld10k1_emu_tram_pos(ld10k1_emu_t *emu, unsigned int i, uint32_t dbac, unsigned int size)
+{
+	return ((emu->regs[EMU_TRAM_ADDR + i] & 0xFFFFF) + dbac) % size;
+}
+
+/* writes of previous sample go first, then reads for this one */
+static void ld10k1_emu_tram(ld10k1_emu_t *emu, int write)
+{
+	unsigned int i, size;
+	int16_t *mem;
+	int op;
+
+	for (i = 0; i < emu->itram_count + emu->etram_count; i++) {
+		op = ld10k1_emu_tram_op(emu, i, &mem, &size);
+		if (write && op == TRAM_OP_WRITE)
+			mem[ld10k1_emu_tram_pos(emu, i, emu->dbac, size)] =
+				(int16_t)(emu->regs[EMU_TRAM_DATA + i] >> 16);
+		else if (!write && op == TRAM_OP_READ)
+			emu->regs[EMU_TRAM_DATA + i] =
+				(uint32_t)(uint16_t)mem[ld10k1_emu_tram_pos(emu, i, emu->dbac, size)] << 16;
+	}
+}
+
+/* opcode of instruction pc, operands r, a, x, y to o */
+static unsigned int ld10k1_emu_decode(ld10k1_emu_t *emu, unsigned int pc, unsigned int *o)
+{
+	uint32_t w0, w1;
+
+	w0 = emu->code[pc * 2];
+	w1 = emu->code[pc * 2 + 1];
+	if (emu->audigy) {
+		o[0] = (w1 >> 12) & 0x7ff;
+		o[1] = w1 & 0x7ff;
+		o[2] = (w0 >> 12) & 0x7ff;
+		o[3] = w0 & 0x7ff;
+		return (w1 >> 24) & 0xf;
+	}
+	o[0] = (w1 >> 10) & 0x3ff;
+	o[1] = w1 & 0x3ff;
+	o[2] = (w0 >> 10) & 0x3ff;
+	o[3] = w0 & 0x3ff;
+	return (w1 >> 20) & 0xf;
+}
+
+static uint32_t ld10k1_emu_flags(int32_t res, int sat)
+{
+	return (sat ? EMU_CCR_S : 0) |
+		(res == 0 ? EMU_CCR_Z : 0) |
+		(res < 0 ? EMU_CCR_M : 0) |
+		((((uint32_t)res ^ ((uint32_t)res << 1)) & 0x80000000) ? EMU_CCR_N : 0);
+}
+
+/* run instructions start - end-1 once, skip past end ends the run */
+void ld10k1_emu_exec(ld10k1_emu_t *emu, unsigned int start, unsigned int end)
+{
+	unsigned int pc, op, o[4];
+	int32_t va, vx, vy, res;
+	int64_t p, hi;
+	uint32_t lo;
+	int intop, sat;
+
+	for (pc = start; pc < end; pc++) {
+		op = ld10k1_emu_decode(emu, pc, o);
+
+		intop = op == EMU_OP_MACINTS || op == EMU_OP_MACINTW;
+		va = ld10k1_emu_read(emu, o[1], intop);
+		vx = ld10k1_emu_read(emu, o[2], intop);
+		vy = ld10k1_emu_read(emu, o[3], intop);
+		sat = 0;
+
+		switch (op) {
+			case EMU_OP_MACS:
+			case EMU_OP_MACS1:
+			case EMU_OP_MACW:
+			case EMU_OP_MACW1:
+				p = (int64_t)vx * vy;
+				if (op & 1)
+					p = -p;
+				/* accumulator as A keeps its full precision */
+				if (o[1] == emu->const_base + EMU_HW_ACCUM) {
+					hi = emu->acc_hi;
+					lo = emu->acc_lo;
+				} else {
+					hi = va;
+					lo = 0;
+				}
+				ld10k1_emu_acc_add(emu, hi, lo, p);
+				if (op == EMU_OP_MACS || op == EMU_OP_MACS1)
+					res = ld10k1_emu_sat(emu->acc_hi, &sat);
+				else
+					res = (int32_t)emu->acc_hi;
+				break;
+			case EMU_OP_MACINTS:
+			case EMU_OP_MACINTW:
+				p = (int64_t)va + (int64_t)vx * vy;
+				ld10k1_emu_acc_add(emu, 0, 0, p);
+				if (op == EMU_OP_MACINTS)
+					res = ld10k1_emu_sat(p, &sat);
+				else
+					res = (int32_t)(p & 0x7fffffff);
+				break;
+			case EMU_OP_ACC3:
+				p = (int64_t)va + vx + vy;
+				ld10k1_emu_acc_set(emu, p);
+				res = ld10k1_emu_sat(p, &sat);
+				break;
+			case EMU_OP_MACMV:
+				res = va;
+				ld10k1_emu_acc_add(emu, emu->acc_hi, emu->acc_lo, (int64_t)vx * vy);
+				break;
+			case EMU_OP_ANDXOR:
+				res = (va & vx) ^ vy;
+				break;
+			case EMU_OP_TSTNEG:
+				res = va >= vy ? vx : ~vx;
+				break;
+			case EMU_OP_LIMIT:
+				res = va >= vy ? vx : vy;
+				break;
+			case EMU_OP_LIMIT1:
+				res = va < vy ? vx : vy;
+				break;
+			case EMU_OP_LOG:
+				res = ld10k1_emu_log(va, vx, vy);
+				break;
+			case EMU_OP_EXP:
+				res = ld10k1_emu_exp(va, vx, vy);
+				break;
+			case EMU_OP_INTERP:
+				p = (int64_t)va + (((int64_t)vx * ((int64_t)vy - va)) >> 31);
+				ld10k1_emu_acc_set(emu, p);
+				res = ld10k1_emu_sat(p, &sat);
+				break;
+			case EMU_OP_SKIP:
+			default:
+				ld10k1_emu_write(emu, o[0], va);
+				if (ld10k1_emu_skip_test(va, vx)) {
+					if ((uint32_t)vy >= end - pc)
+						return;
+					pc += (uint32_t)vy;
+				}
+				continue;
+		}
+
+		ld10k1_emu_write(emu, o[0], res);
+		emu->ccr = ld10k1_emu_flags(res, sat);
+	}
+}
+
+void ld10k1_emu_step(ld10k1_emu_t *emu)
+{
+	ld10k1_emu_tram(emu, 1);
+	ld10k1_emu_tram(emu, 0);
+	ld10k1_emu_exec(emu, 0, emu->instr_count);
+	emu->dbac = (emu->dbac - 1) & 0xFFFFF;
+}
+
+/*
+ * Block evaluation
+ *
+ * ld10k1_emu_run evaluates program over blocks of up to EMU_BLOCK_MAX
+ * samples. Each register used by program has row of block values,
+ * row[0] is value before block, row[s] value in sample s. Instruction
+ * which reads only values computed earlier in the same sample is run
+ * for whole block at once (vector item). Values carried from previous
+ * sample (filter state, accumulator chains), skips and noise need
+ * sample order - such instructions are grouped to segments, which are
+ * run sample by sample by scalar interpreter over rows. Tram reads of
+ * block are done before program and writes after it, so block size is
+ * limited by shortest distance between read and write in one tram.
+ * Result is same as from ld10k1_emu_step for every sample.
+ */
+
+#define EMU_BLOCK_MIN	8
+
+#define EMU_SLOT_CONST	1	/* not written - row filled when plan is built */
+#define EMU_SLOT_INPUT	2	/* set before program in every sample */
+#define EMU_SLOT_NORMAL	3
+
+#define EMU_PLAN_REG	0x0fff
+#define EMU_PLAN_CARRY	0x1000	/* load value of previous sample */
+#define EMU_PLAN_STORE	0x2000	/* written by segment */
+
+static int32_t *ld10k1_emu_row(ld10k1_emu_t *emu, unsigned int reg)
+{
+	return emu->slot_buf + emu->slot[reg] * (EMU_BLOCK_MAX + 1);
+}
+
+static int ld10k1_emu_is_const(ld10k1_emu_t *emu, unsigned int reg)
+{
+	return reg >= emu->const_base && reg < emu->const_base + EMU_HW_ACCUM;
+}
+
+int ld10k1_emu_writable(ld10k1_emu_t *emu, unsigned int reg)
+{
+	return !ld10k1_emu_is_const(emu, reg) &&
+		reg != emu->const_base + EMU_HW_ACCUM &&
+		reg != emu->const_base + EMU_HW_NOISE1 &&
+		reg != emu->const_base + EMU_HW_NOISE2;
+}
+
+static int ld10k1_emu_ins_reads(ld10k1_emu_ins_t *ins, unsigned int reg)
+{
+	unsigned int i;
+
+	for (i = 0; i < ins->rd_count; i++)
+		if (ins->rd[i] == reg)
+			return 1;
+	return 0;
+}
+
+static int ld10k1_emu_ins_writes(ld10k1_emu_ins_t *ins, unsigned int reg)
+{
+	unsigned int i;
+
+	for (i = 0; i < ins->wr_count; i++)
+		if (ins->wr[i] == reg)
+			return 1;
+	return 0;
+}
+
+/* is value written to reg by instruction pc read later (in this or next sample) */
+static int ld10k1_emu_live(ld10k1_emu_ins_t *ins, unsigned int count, unsigned int pc, unsigned int reg)
+{
+	unsigned int i, q;
+
+	for (i = 1; i <= count; i++) {
+		q = (pc + i) % count;
+		if (ld10k1_emu_ins_reads(&(ins[q]), reg))
+			return 1;
+		/* skipped write does not hide value */
+		if (!ins[q].cond && ld10k1_emu_ins_writes(&(ins[q]), reg))
+			return 0;
+	}
+	return 0;
+}
+
+static void ld10k1_emu_plan_items_free(ld10k1_emu_t *emu)
+{
+	unsigned int i;
+
+	if (emu->plan) {
+		for (i = 0; i < emu->plan_count; i++) {
+			if (emu->plan[i].regs)
+				free(emu->plan[i].regs);
+			if (emu->plan[i].rows)
+				free(emu->plan[i].rows);
+			if (emu->plan[i].jit)
+				ld10k1_emu_jit_free(emu->plan[i].jit);
+		}
+		free(emu->plan);
+	}
+	if (emu->slot_buf)
+		free(emu->slot_buf);
+	emu->plan = NULL;
+	emu->plan_count = 0;
+	emu->slot_buf = NULL;
+	emu->slot_count = 0;
+}
+
+static void ld10k1_emu_plan_free(ld10k1_emu_t *emu)
+{
+	ld10k1_emu_plan_items_free(emu);
+	if (emu->jit)
+		ld10k1_emu_jit_free(emu->jit);
+	if (emu->plan_in_regs)
+		free(emu->plan_in_regs);
+	emu->jit = NULL;
+	emu->plan_in_regs = NULL;
+	emu->plan_in_count = 0;
+	emu->plan_valid = 0;
+	emu->block = 1;
+}
+
+static void ld10k1_emu_span(int *span, unsigned int start, int end)
+{
+	if (span[start] < end)
+		span[start] = end;
+}
+
+/* value of reg needs to be loaded from previous sample at instruction pc */
+static int ld10k1_emu_carried(ld10k1_emu_ins_t *ins, unsigned int pc, unsigned int reg,
+	unsigned char *input, int *first_w, int *last_w, int *first_uw)
+{
+	if (input[reg] || first_w[reg] < 0)
+		return 0;
+	/*
+	 * read before first write, or write which can be skipped - skipped
+	 * writes before pc are handled by their own segment
+	 */
+	if (ld10k1_emu_ins_reads(&(ins[pc]), reg) && first_uw[reg] >= (int)pc && last_w[reg] >= (int)pc)
+		return 1;
+	if (ins[pc].cond && ld10k1_emu_ins_writes(&(ins[pc]), reg) && first_uw[reg] > (int)pc)
+		return 1;
+	return 0;
+}
+
+static int ld10k1_emu_plan_add(ld10k1_emu_t *emu, unsigned int start, unsigned int end, int segment)
+{
+	ld10k1_emu_plan_t *item;
+
+	item = emu->plan + emu->plan_count++;
+	memset(item, 0, sizeof(ld10k1_emu_plan_t));
+	item->start = start;
+	item->end = end;
+	item->segment = segment;
+	return emu->plan_count - 1;
+}
+
+static int ld10k1_emu_plan_segment(ld10k1_emu_t *emu, ld10k1_emu_plan_t *item, ld10k1_emu_ins_t *ins,
+	unsigned char *input, int *first_w, int *last_w, int *first_uw, unsigned int *mark)
+{
+	unsigned int pc, i, j, reg, acc, ccr, dbac, count;
+	unsigned int regs[EMU_REG_COUNT];
+	unsigned int *list;
+
+	acc = emu->const_base + EMU_HW_ACCUM;
+	ccr = emu->const_base + EMU_HW_CCR;
+	dbac = emu->const_base + EMU_HW_DBAC;
+
+	count = 0;
+	for (pc = item->start; pc < item->end; pc++) {
+		/* dropped instructions see stale values, they have no effect */
+		if (ins[pc].nop)
+			continue;
+		for (i = 0; i < ins[pc].rd_count + ins[pc].wr_count; i++) {
+			reg = i < ins[pc].rd_count ? ins[pc].rd[i] : ins[pc].wr[i - ins[pc].rd_count];
+			if (ld10k1_emu_carried(ins, pc, reg, input, first_w, last_w, first_uw)) {
+				if (reg == acc)
+					item->acc_carry = 1;
+				else if (reg == ccr)
+					item->ccr_carry = 1;
+				else
+					mark[reg] |= EMU_PLAN_CARRY;
+			}
+			if (reg == acc || reg == ccr || reg == dbac)
+				continue;
+			/* constants stay in regs */
+			if (!input[reg] && first_w[reg] < 0)
+				continue;
+			if (i >= ins[pc].rd_count)
+				mark[reg] |= EMU_PLAN_STORE;
+			if (!(mark[reg] & 0x8000)) {
+				mark[reg] |= 0x8000;
+				regs[count++] = reg;
+			}
+		}
+	}
+
+	list = (unsigned int *)malloc(sizeof(unsigned int) * (count ? count : 1));
+	item->rows = (int32_t **)malloc(sizeof(int32_t *) * (count ? count * 2 : 1));
+	if (!list || !item->rows) {
+		if (list)
+			free(list);
+		return LD10K1_ERR_NO_MEM;
+	}
+	/*
+	 * carried register stored by segment has value of previous sample
+	 * in regs already, it is loaded only in first sample of block
+	 */
+	item->load_count = 0;
+	for (j = 0; j < count; j++) {
+		reg = regs[j];
+		if ((mark[reg] & (EMU_PLAN_CARRY | EMU_PLAN_STORE)) != (EMU_PLAN_CARRY | EMU_PLAN_STORE))
+			list[item->load_count++] = reg | (mark[reg] & (EMU_PLAN_CARRY | EMU_PLAN_STORE));
+	}
+	for (i = item->load_count, j = 0; j < count; j++) {
+		reg = regs[j];
+		if ((mark[reg] & (EMU_PLAN_CARRY | EMU_PLAN_STORE)) == (EMU_PLAN_CARRY | EMU_PLAN_STORE))
+			list[i++] = reg | EMU_PLAN_CARRY | EMU_PLAN_STORE;
+		mark[reg] = 0;
+	}
+	item->regs = list;
+	item->reg_count = count;
+	return 0;
+}
+
+/* row pointers of segment registers, sample s is at index s - 1 */
+static void ld10k1_emu_plan_rows(ld10k1_emu_t *emu, ld10k1_emu_plan_t *item)
+{
+	unsigned int i, e;
+
+	for (i = 0; i < item->reg_count; i++) {
+		e = item->regs[i];
+		item->rows[i] = ld10k1_emu_row(emu, e & EMU_PLAN_REG) + (e & EMU_PLAN_CARRY ? 0 : 1);
+		item->rows[item->reg_count + i] = ld10k1_emu_row(emu, e & EMU_PLAN_REG) + 1;
+	}
+}
+
+static int ld10k1_emu_plan(ld10k1_emu_t *emu, unsigned int in_count, int *in_regs)
+{
+	ld10k1_emu_ins_t *ins = NULL;
+	int *first_w = NULL, *last_w, *first_uw, *span = NULL;
+	unsigned int *mark = NULL;
+	unsigned char input[EMU_REG_COUNT], konst[EMU_REG_COUNT];
+	unsigned int count, pc, i, j, k, reg, acc, ccr, dbac, size, d;
+	unsigned int tram_count, tram_size[0x100];
+	int tram_op[0x100];
+	int16_t *mem;
+	uint32_t c;
+	int err, seg_start, seg_end, vector, idx, block_ok;
+	int32_t *row;
+
+	ld10k1_emu_plan_free(emu);
+	emu->plan_valid = 1;
+	emu->tram_rd_count = 0;
+	emu->tram_wr_count = 0;
+
+	emu->plan_in_regs = (int *)malloc(sizeof(int) * (in_count ? in_count : 1));
+	if (!emu->plan_in_regs) {
+		emu->plan_valid = 0;
+		return LD10K1_ERR_NO_MEM;
+	}
+	memcpy(emu->plan_in_regs, in_regs, sizeof(int) * in_count);
+	emu->plan_in_count = in_count;
+
+	count = emu->instr_count;
+	acc = emu->const_base + EMU_HW_ACCUM;
+	ccr = emu->const_base + EMU_HW_CCR;
+	dbac = emu->const_base + EMU_HW_DBAC;
+	tram_count = emu->itram_count + emu->etram_count;
+
+	err = LD10K1_ERR_NO_MEM;
+	ins = (ld10k1_emu_ins_t *)malloc(sizeof(ld10k1_emu_ins_t) * count);
+	first_w = (int *)malloc(sizeof(int) * EMU_REG_COUNT * 3);
+	span = (int *)malloc(sizeof(int) * count);
+	mark = (unsigned int *)calloc(EMU_REG_COUNT, sizeof(unsigned int));
+	emu->plan = (ld10k1_emu_plan_t *)malloc(sizeof(ld10k1_emu_plan_t) * count);
+	if (!ins || !first_w || !span || !mark || !emu->plan)
+		goto err;
+	last_w = first_w + EMU_REG_COUNT;
+	first_uw = last_w + EMU_REG_COUNT;
+	memset(ins, 0, sizeof(ld10k1_emu_ins_t) * count);
+
+	/* registers read and written by each instruction */
+	err = 0;
+	block_ok = 1;
+	for (pc = 0; pc < count; pc++) {
+		ins[pc].op = ld10k1_emu_decode(emu, pc, ins[pc].o);
+		for (i = 1; i < 4; i++) {
+			reg = ins[pc].o[i];
+			if (reg == emu->const_base + EMU_HW_NOISE1 || reg == emu->const_base + EMU_HW_NOISE2)
+				ins[pc].noise = 1;
+			else
+				ins[pc].rd[ins[pc].rd_count++] = reg;
+		}
+		if (ins[pc].op == EMU_OP_MACMV)
+			ins[pc].rd[ins[pc].rd_count++] = acc;
+
+		reg = ins[pc].o[0];
+		/* moving delay lines - per sample only */
+		if (reg == dbac || (reg >= EMU_TRAM_ADDR && reg < EMU_TRAM_ADDR + tram_count))
+			block_ok = 0;
+		if (ld10k1_emu_writable(emu, reg))
+			ins[pc].wr[ins[pc].wr_count++] = reg;
+		if (ins[pc].op <= EMU_OP_MACMV || ins[pc].op == EMU_OP_INTERP)
+			ins[pc].wr[ins[pc].wr_count++] = acc;
+		if (ins[pc].op != EMU_OP_SKIP)
+			ins[pc].wr[ins[pc].wr_count++] = ccr;
+		ins[pc].skip_end = -1;
+		span[pc] = -1;
+	}
+
+	/* registers set before program - inputs, tram reads, dbac */
+	memset(input, 0, sizeof(input));
+	for (i = 0; i < in_count; i++)
+		input[in_regs[i]] = 1;
+	input[dbac] = 1;
+
+	emu->block = EMU_BLOCK_MAX;
+	for (i = 0; i < tram_count; i++) {
+		tram_op[i] = ld10k1_emu_tram_op(emu, i, &mem, &size);
+		tram_size[i] = size;
+		if (!tram_op[i])
+			continue;
+		/* wrap of dbac must not move positions */
+		if ((size & (size - 1)) || size > 0x100000)
+			block_ok = 0;
+		if (tram_op[i] == TRAM_OP_READ) {
+			input[EMU_TRAM_DATA + i] = 1;
+			emu->tram_rd[emu->tram_rd_count++] = i;
+		} else
+			emu->tram_wr[emu->tram_wr_count++] = i;
+	}
+	/* read must not see value written in the same block */
+	for (i = 0; i < tram_count; i++) {
+		if (tram_op[i] != TRAM_OP_READ)
+			continue;
+		for (j = 0; j < tram_count; j++) {
+			if (tram_op[j] != TRAM_OP_WRITE || (i < emu->itram_count) != (j < emu->itram_count))
+				continue;
+			d = ((emu->regs[EMU_TRAM_ADDR + i] & 0xFFFFF) -
+				(emu->regs[EMU_TRAM_ADDR + j] & 0xFFFFF)) & (tram_size[i] - 1);
+			if (d + 1 < emu->block)
+				emu->block = d + 1;
+		}
+	}
+	if (emu->block < EMU_BLOCK_MIN)
+		block_ok = 0;
+	emu->tram_wr_seq = 0;
+	for (i = 0; i < tram_count; i++) {
+		if (tram_op[i] != TRAM_OP_WRITE)
+			continue;
+		for (j = 0; j < tram_count; j++) {
+			if (j == i || tram_op[j] != TRAM_OP_WRITE || (i < emu->itram_count) != (j < emu->itram_count))
+				continue;
+			d = ((emu->regs[EMU_TRAM_ADDR + i] & 0xFFFFF) -
+				(emu->regs[EMU_TRAM_ADDR + j] & 0xFFFFF)) & (tram_size[i] - 1);
+			if (d && d + 2 <= emu->block)
+				emu->tram_wr_seq = 1;
+		}
+	}
+
+	for (reg = 0; reg < EMU_REG_COUNT; reg++) {
+		first_w[reg] = -1;
+		last_w[reg] = -1;
+		first_uw[reg] = count;
+	}
+	for (pc = 0; pc < count; pc++)
+		for (i = 0; i < ins[pc].wr_count; i++) {
+			reg = ins[pc].wr[i];
+			if (first_w[reg] < 0)
+				first_w[reg] = pc;
+			last_w[reg] = pc;
+		}
+
+	/* registers with same value in every sample */
+	for (reg = 0; reg < EMU_REG_COUNT; reg++)
+		konst[reg] = ld10k1_emu_is_const(emu, reg) ||
+			(!input[reg] && first_w[reg] < 0 && ld10k1_emu_writable(emu, reg) && reg != ccr);
+
+	/* skips - count known only for constant register */
+	for (pc = 0; pc < count; pc++) {
+		if (ins[pc].op != EMU_OP_SKIP)
+			continue;
+		reg = ins[pc].o[3];
+		if (konst[reg])
+			c = emu->regs[reg];
+		else
+			c = count;
+		if (!c)
+			continue;
+		ins[pc].skip_end = c >= count - pc ? count - 1 : pc + c;
+		for (k = pc + 1; k <= (unsigned int)ins[pc].skip_end; k++)
+			ins[k].cond = 1;
+		ld10k1_emu_span(span, pc, ins[pc].skip_end);
+	}
+
+	for (pc = 0; pc < count; pc++)
+		for (i = 0; i < ins[pc].wr_count; i++) {
+			reg = ins[pc].wr[i];
+			if (!ins[pc].cond && first_uw[reg] == (int)count)
+				first_uw[reg] = pc;
+		}
+
+	/* unused accumulator and flags are not computed, instructions without effect dropped */
+	for (pc = 0; pc < count; pc++) {
+		ins[pc].acc_live = ld10k1_emu_ins_writes(&(ins[pc]), acc) &&
+			ld10k1_emu_live(ins, count, pc, acc);
+		ins[pc].ccr_live = ld10k1_emu_ins_writes(&(ins[pc]), ccr) &&
+			ld10k1_emu_live(ins, count, pc, ccr);
+		ins[pc].nop = !ins[pc].noise && !ld10k1_emu_writable(emu, ins[pc].o[0]) &&
+			!ins[pc].acc_live && !ins[pc].ccr_live && ins[pc].skip_end < 0;
+	}
+
+	if (!block_ok)
+		goto sample;
+
+	/* instructions which need sample order */
+	seg_start = -1;
+	seg_end = -1;
+	for (pc = 0; pc < count; pc++) {
+		if (ins[pc].noise) {
+			if (seg_start < 0)
+				seg_start = pc;
+			seg_end = pc;
+		}
+		if (ins[pc].nop)
+			continue;
+		for (i = 0; i < ins[pc].rd_count + ins[pc].wr_count; i++) {
+			reg = i < ins[pc].rd_count ? ins[pc].rd[i] : ins[pc].wr[i - ins[pc].rd_count];
+			if (ld10k1_emu_carried(ins, pc, reg, input, first_w, last_w, first_uw))
+				ld10k1_emu_span(span, pc, last_w[reg]);
+		}
+	}
+	if (seg_start >= 0)
+		ld10k1_emu_span(span, seg_start, seg_end);
+
+	/* merge spans to segments, rest are vector items */
+	seg_end = -1;
+	idx = -1;
+	vector = 0;
+	for (pc = 0; pc < count; pc++) {
+		if (idx >= 0 && (int)pc > seg_end) {
+			emu->plan[idx].end = seg_end + 1;
+			idx = -1;
+		}
+		if (span[pc] >= 0) {
+			if (idx < 0) {
+				idx = ld10k1_emu_plan_add(emu, pc, pc + 1, 1);
+				seg_end = span[pc];
+			} else if (span[pc] > seg_end)
+				seg_end = span[pc];
+		}
+		if (idx < 0 && !ins[pc].nop) {
+			ld10k1_emu_plan_add(emu, pc, pc + 1, 0);
+			emu->plan[emu->plan_count - 1].acc_live = ins[pc].acc_live;
+			emu->plan[emu->plan_count - 1].ccr_live = ins[pc].ccr_live;
+			vector++;
+		}
+	}
+	if (idx >= 0)
+		emu->plan[idx].end = seg_end + 1;
+	/* nothing to gain */
+	if (!vector)
+		goto sample;
+
+	err = LD10K1_ERR_NO_MEM;
+	for (i = 0; i < emu->plan_count; i++) {
+		if (!emu->plan[i].segment)
+			continue;
+		if (ld10k1_emu_plan_segment(emu, &(emu->plan[i]), ins, input, first_w, last_w, first_uw, mark) < 0)
+			goto err;
+		/* interpreter is used when native code is not available */
+		if (emu->jit_enable)
+			ld10k1_emu_jit_compile(emu, ins, konst, emu->plan[i].start, emu->plan[i].end,
+				&(emu->plan[i].jit));
+	}
+
+	/* rows for registers used by program, inputs and tram reads */
+	for (reg = 0; reg < EMU_REG_COUNT; reg++)
+		emu->slot[reg] = -1;
+	for (pc = 0; pc < count; pc++) {
+		if (ins[pc].nop)
+			continue;
+		for (i = 0; i < ins[pc].rd_count + ins[pc].wr_count; i++) {
+			reg = i < ins[pc].rd_count ? ins[pc].rd[i] : ins[pc].wr[i - ins[pc].rd_count];
+			if (reg != acc && emu->slot[reg] < 0)
+				emu->slot[reg] = emu->slot_count++;
+		}
+	}
+	for (i = 0; i < in_count; i++)
+		if (emu->slot[in_regs[i]] < 0)
+			emu->slot[in_regs[i]] = emu->slot_count++;
+	for (i = 0; i < tram_count; i++)
+		if (tram_op[i] == TRAM_OP_READ && emu->slot[EMU_TRAM_DATA + i] < 0)
+			emu->slot[EMU_TRAM_DATA + i] = emu->slot_count++;
+
+	emu->slot_buf = (int32_t *)malloc(sizeof(int32_t) * (EMU_BLOCK_MAX + 1) * (emu->slot_count ? emu->slot_count : 1));
+	if (!emu->slot_buf)
+		goto err;
+	for (reg = 0; reg < EMU_REG_COUNT; reg++) {
+		if (emu->slot[reg] < 0)
+			continue;
+		emu->slot_reg[emu->slot[reg]] = reg;
+		if (input[reg])
+			emu->slot_type[reg] = EMU_SLOT_INPUT;
+		else if (first_w[reg] >= 0)
+			emu->slot_type[reg] = EMU_SLOT_NORMAL;
+		else {
+			emu->slot_type[reg] = EMU_SLOT_CONST;
+			row = ld10k1_emu_row(emu, reg);
+			for (i = 0; i <= EMU_BLOCK_MAX; i++)
+				row[i] = reg == ccr ? emu->ccr : emu->regs[reg];
+		}
+	}
+	for (i = 0; i < emu->plan_count; i++)
+		if (emu->plan[i].segment)
+			ld10k1_emu_plan_rows(emu, &(emu->plan[i]));
+
+	free(ins);
+	free(first_w);
+	free(span);
+	free(mark);
+	return 0;
+sample:
+	if (emu->jit_enable)
+		ld10k1_emu_jit_compile(emu, ins, konst, 0, count, &(emu->jit));
+err:
+	/* per sample run */
+	if (ins)
+		free(ins);
+	if (first_w)
+		free(first_w);
+	if (span)
+		free(span);
+	if (mark)
+		free(mark);
+	ld10k1_emu_plan_items_free(emu);
+	emu->block = 1;
+	return err;
+}
+
+/* operand row of vector item, accumulator is converted to tmp */
+static int32_t *ld10k1_emu_vec_src(ld10k1_emu_t *emu, unsigned int reg, int intop, int32_t *tmp, unsigned int n)
+{
+	unsigned int s;
+	int64_t *hi = emu->acc_hi_buf;
+	uint32_t *lo = emu->acc_lo_buf;
+
+	if (reg != emu->const_base + EMU_HW_ACCUM)
+		return ld10k1_emu_row(emu, reg) + 1;
+
+	for (s = 1; s <= n; s++)
+		if (intop)
+			tmp[s] = (int32_t)((uint32_t)((uint64_t)hi[s] << 31) | lo[s]);
+		else
+			tmp[s] = hi[s] > INT32_MAX ? INT32_MAX : (hi[s] < INT32_MIN ? INT32_MIN : (int32_t)hi[s]);
+	return tmp + 1;
+}
+
+static int32_t ld10k1_emu_clamp(int64_t v)
+{
+	return v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : (int32_t)v);
+}
+
+#ifdef EMU_AVX2
+/*
+ * AVX2 kernels - four samples of 64 bit intermediates or eight samples
+ * of 32 bit values per step. They return number of samples done, rest
+ * is finished by scalar loop of caller. Saturation is stored only when
+ * sat is not NULL (flags are used).
+ */
+#define EMU_AVX2_FN __attribute__((target("avx2")))
+
+static EMU_AVX2_FN __m256i ld10k1_emu_avx2_load64(int32_t *p)
+{
+	return _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i *)p));
+}
+
+/* low halves of 64 bit lanes */
+static EMU_AVX2_FN __m128i ld10k1_emu_avx2_pack(__m256i v)
+{
+	return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7)));
+}
+
+/* arithmetic shift by 31, there is no 64 bit one in AVX2 */
+static EMU_AVX2_FN __m256i ld10k1_emu_avx2_sra31(__m256i v)
+{
+	__m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), v);
+
+	return _mm256_or_si256(_mm256_srli_epi64(v, 31), _mm256_slli_epi64(sign, 33));
+}
+
+static EMU_AVX2_FN void ld10k1_emu_avx2_store_sat(int32_t *r, int32_t *sat, __m256i v)
+{
+	const __m256i max = _mm256_set1_epi64x(INT32_MAX);
+	const __m256i min = _mm256_set1_epi64x(INT32_MIN);
+	__m256i over = _mm256_cmpgt_epi64(v, max);
+	__m256i under = _mm256_cmpgt_epi64(min, v);
+
+	v = _mm256_blendv_epi8(v, max, over);
+	v = _mm256_blendv_epi8(v, min, under);
+	_mm_storeu_si128((__m128i *)r, ld10k1_emu_avx2_pack(v));
+	if (sat)
+		_mm_storeu_si128((__m128i *)sat, ld10k1_emu_avx2_pack(_mm256_or_si256(over, under)));
+}
+
+/*
+ * MACS, MACS1, MACW, MACW1 with A not accumulator - eight samples.
+ * Products of even and odd lanes are shifted so that their bits 31 - 62
+ * (product >> 31) end in 32 bit lanes. That fits in 32 bits except of
+ * MACS of 0x80000000 * 0x80000000, which is left to scalar loop.
+ */
+static EMU_AVX2_FN unsigned int ld10k1_emu_avx2_mac(unsigned int op, int32_t *r, int32_t *sat,
+	int32_t *a, int32_t *x, int32_t *y, unsigned int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i min = _mm256_set1_epi32(INT32_MIN);
+	const __m256i max = _mm256_set1_epi32(INT32_MAX);
+	__m256i va, vx, vy, pe, po, p, t, over;
+	unsigned int s;
+
+	for (s = 0; s + 8 <= n; s += 8) {
+		vx = _mm256_loadu_si256((__m256i *)(x + s));
+		vy = _mm256_loadu_si256((__m256i *)(y + s));
+		va = _mm256_loadu_si256((__m256i *)(a + s));
+		if (op == EMU_OP_MACS &&
+			!_mm256_testz_si256(_mm256_cmpeq_epi32(vx, min), _mm256_cmpeq_epi32(vy, min)))
+			break;
+
+		pe = _mm256_mul_epi32(vx, vy);
+		po = _mm256_mul_epi32(_mm256_srli_epi64(vx, 32), _mm256_srli_epi64(vy, 32));
+		if (op & 1) {
+			pe = _mm256_sub_epi64(zero, pe);
+			po = _mm256_sub_epi64(zero, po);
+		}
+		p = _mm256_blend_epi32(_mm256_srli_epi64(pe, 31), _mm256_slli_epi64(po, 1), 0xaa);
+
+		t = _mm256_add_epi32(va, p);
+		if (op == EMU_OP_MACS || op == EMU_OP_MACS1) {
+			over = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(va, t), _mm256_xor_si256(p, t)), 31);
+			t = _mm256_blendv_epi8(t, _mm256_xor_si256(_mm256_srai_epi32(va, 31), max), over);
+			if (sat)
+				_mm256_storeu_si256((__m256i *)(sat + s), over);
+		}
+		_mm256_storeu_si256((__m256i *)(r + s), t);
+	}
+	return s;
+}
+
+/* MACINTS, MACINTW and ACC3 */
+static EMU_AVX2_FN unsigned int ld10k1_emu_avx2_int(unsigned int op, int32_t *r, int32_t *sat,
+	int32_t *a, int32_t *x, int32_t *y, unsigned int n)
+{
+	__m256i t;
+	unsigned int s;
+
+	for (s = 0; s + 4 <= n; s += 4) {
+		if (op == EMU_OP_ACC3)
+			t = _mm256_add_epi64(_mm256_add_epi64(ld10k1_emu_avx2_load64(a + s),
+				ld10k1_emu_avx2_load64(x + s)), ld10k1_emu_avx2_load64(y + s));
+		else
+			t = _mm256_add_epi64(ld10k1_emu_avx2_load64(a + s),
+				_mm256_mul_epi32(ld10k1_emu_avx2_load64(x + s), ld10k1_emu_avx2_load64(y + s)));
+		if (op == EMU_OP_MACINTW)
+			_mm_storeu_si128((__m128i *)(r + s), _mm_and_si128(ld10k1_emu_avx2_pack(t),
+				_mm_set1_epi32(0x7fffffff)));
+		else
+			ld10k1_emu_avx2_store_sat(r + s, sat ? sat + s : NULL, t);
+	}
+	return s;
+}
+
+/* ANDXOR, TSTNEG, LIMIT, LIMIT1 and move of SKIP */
+static EMU_AVX2_FN unsigned int ld10k1_emu_avx2_logic(unsigned int op, int32_t *r,
+	int32_t *a, int32_t *x, int32_t *y, unsigned int n)
+{
+	__m256i va, vx, vy, lt, res;
+	unsigned int s;
+
+	for (s = 0; s + 8 <= n; s += 8) {
+		va = _mm256_loadu_si256((__m256i *)(a + s));
+		vx = _mm256_loadu_si256((__m256i *)(x + s));
+		vy = _mm256_loadu_si256((__m256i *)(y + s));
+		lt = _mm256_cmpgt_epi32(vy, va);
+		switch (op) {
+			case EMU_OP_ANDXOR:
+				res = _mm256_xor_si256(_mm256_and_si256(va, vx), vy);
+				break;
+			case EMU_OP_TSTNEG:
+				res = _mm256_xor_si256(vx, lt);
+				break;
+			case EMU_OP_LIMIT:
+				res = _mm256_blendv_epi8(vx, vy, lt);
+				break;
+			case EMU_OP_LIMIT1:
+				res = _mm256_blendv_epi8(vy, vx, lt);
+				break;
+			default:
+				res = va;
+				break;
+		}
+		_mm256_storeu_si256((__m256i *)(r + s), res);
+	}
+	return s;
+}
+
+static EMU_AVX2_FN unsigned int ld10k1_emu_avx2_flags(int32_t *ccr, int32_t *r, int32_t *sat, unsigned int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v, f;
+	unsigned int s;
+
+	for (s = 0; s + 8 <= n; s += 8) {
+		v = _mm256_loadu_si256((__m256i *)(r + s));
+		f = _mm256_and_si256(_mm256_cmpeq_epi32(v, zero), _mm256_set1_epi32(EMU_CCR_Z));
+		f = _mm256_or_si256(f, _mm256_and_si256(_mm256_srai_epi32(v, 31), _mm256_set1_epi32(EMU_CCR_M)));
+		f = _mm256_or_si256(f, _mm256_srli_epi32(_mm256_xor_si256(v, _mm256_slli_epi32(v, 1)), 31));
+		if (sat)
+			f = _mm256_or_si256(f, _mm256_andnot_si256(_mm256_cmpeq_epi32(
+				_mm256_loadu_si256((__m256i *)(sat + s)), zero), _mm256_set1_epi32(EMU_CCR_S)));
+		_mm256_storeu_si256((__m256i *)(ccr + s), f);
+	}
+	return s;
+}
+
+/*
+ * INTERP - Y - A has 33 bits, its product with X is built from unsigned
+ * 32 x 32 product of low halves and corrections for negative X and Y - A.
+ */
+static EMU_AVX2_FN unsigned int ld10k1_emu_avx2_interp(int32_t *r, int32_t *sat,
+	int32_t *a, int32_t *x, int32_t *y, unsigned int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i va, vx, d, p;
+	unsigned int s;
+
+	for (s = 0; s + 4 <= n; s += 4) {
+		va = ld10k1_emu_avx2_load64(a + s);
+		vx = ld10k1_emu_avx2_load64(x + s);
+		d = _mm256_sub_epi64(ld10k1_emu_avx2_load64(y + s), va);
+		p = _mm256_mul_epu32(vx, d);
+		p = _mm256_sub_epi64(p, _mm256_and_si256(_mm256_cmpgt_epi64(zero, vx), _mm256_slli_epi64(d, 32)));
+		p = _mm256_sub_epi64(p, _mm256_and_si256(_mm256_cmpgt_epi64(zero, d), _mm256_slli_epi64(vx, 32)));
+		ld10k1_emu_avx2_store_sat(r + s, sat ? sat + s : NULL, _mm256_add_epi64(va, ld10k1_emu_avx2_sra31(p)));
+	}
+	return s;
+}
+
+/* tram block - samples go to lower addresses, row[i] is at mem[n - 1 - i] */
+static EMU_AVX2_FN unsigned int ld10k1_emu_avx2_tram_get(int32_t *row, int16_t *mem, unsigned int n)
+{
+	const __m128i rev = _mm_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+	__m128i v;
+	unsigned int s;
+
+	for (s = 0; s + 8 <= n; s += 8) {
+		v = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(mem + n - 8 - s)), rev);
+		_mm256_storeu_si256((__m256i *)(row + s), _mm256_slli_epi32(_mm256_cvtepu16_epi32(v), 16));
+	}
+	return s;
+}
+
+static EMU_AVX2_FN unsigned int ld10k1_emu_avx2_tram_put(int16_t *mem, int32_t *row, unsigned int n)
+{
+	const __m128i rev = _mm_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+	__m128i lo, hi;
+	unsigned int s;
+
+	for (s = 0; s + 8 <= n; s += 8) {
+		lo = _mm_srai_epi32(_mm_loadu_si128((__m128i *)(row + s)), 16);
+		hi = _mm_srai_epi32(_mm_loadu_si128((__m128i *)(row + s + 4)), 16);
+		_mm_storeu_si128((__m128i *)(mem + n - 8 - s), _mm_shuffle_epi8(_mm_packs_epi32(lo, hi), rev));
+	}
+	return s;
+}
+#endif
+
+static void ld10k1_emu_tram_get(ld10k1_emu_t *emu, int32_t *row, int16_t *mem, unsigned int n)
+{
+	unsigned int s = 0;
+
+#ifdef EMU_AVX2
+	if (emu->avx2)
+		s = ld10k1_emu_avx2_tram_get(row, mem, n);
+#endif
+	for (; s < n; s++)
+		row[s] = (uint32_t)(uint16_t)mem[n - 1 - s] << 16;
+}
+
+static void ld10k1_emu_tram_put(ld10k1_emu_t *emu, int16_t *mem, int32_t *row, unsigned int n)
+{
+	unsigned int s = 0;
+
+#ifdef EMU_AVX2
+	if (emu->avx2)
+		s = ld10k1_emu_avx2_tram_put(mem, row, n);
+#endif
+	for (; s < n; s++)
+		mem[n - 1 - s] = (int16_t)((uint32_t)row[s] >> 16);
+}
+
+/* one instruction for whole block */
+static void ld10k1_emu_vec(ld10k1_emu_t *emu, ld10k1_emu_plan_t *item, unsigned int n)
+{
+	unsigned int op, o[4], s;
+	int32_t *r, *a, *x, *y, *sat, *ccr;
+	int64_t *hi, t, p, m;
+	uint32_t *lo, l;
+	int intop;
+
+	op = ld10k1_emu_decode(emu, item->start, o);
+	intop = op == EMU_OP_MACINTS || op == EMU_OP_MACINTW;
+
+	a = ld10k1_emu_vec_src(emu, o[1], intop, emu->tmp_buf[0], n);
+	x = ld10k1_emu_vec_src(emu, o[2], intop, emu->tmp_buf[1], n);
+	y = ld10k1_emu_vec_src(emu, o[3], intop, emu->tmp_buf[2], n);
+	if (ld10k1_emu_writable(emu, o[0]))
+		r = ld10k1_emu_row(emu, o[0]) + 1;
+	else
+		r = emu->tmp_buf[3] + 1;
+	sat = emu->tmp_buf[4] + 1;
+	hi = emu->acc_hi_buf + 1;
+	lo = emu->acc_lo_buf + 1;
+	s = 0;
+
+	switch (op) {
+		case EMU_OP_MACS:
+		case EMU_OP_MACS1:
+		case EMU_OP_MACW:
+		case EMU_OP_MACW1:
+			m = op & 1 ? -1 : 0;
+			if (o[1] == emu->const_base + EMU_HW_ACCUM || item->acc_live) {
+				for (; s < n; s++) {
+					p = (((int64_t)x[s] * y[s]) ^ m) - m;
+					/* accumulator as A keeps its full precision */
+					if (o[1] == emu->const_base + EMU_HW_ACCUM)
+						l = lo[s] + (uint32_t)(p & 0x7fffffff);
+					else {
+						hi[s] = a[s];
+						l = (uint32_t)(p & 0x7fffffff);
+					}
+					hi[s] = hi[s] + (p >> 31) + (l >> 31);
+					lo[s] = l & 0x7fffffff;
+					r[s] = op < EMU_OP_MACW ? ld10k1_emu_clamp(hi[s]) : (int32_t)hi[s];
+					sat[s] = r[s] != hi[s];
+				}
+				if (op >= EMU_OP_MACW)
+					sat = NULL;
+				break;
+			}
+#ifdef EMU_AVX2
+			if (emu->avx2)
+				s = ld10k1_emu_avx2_mac(op, r, item->ccr_live ? sat : NULL, a, x, y, n);
+#endif
+			for (; s < n; s++) {
+				t = (int64_t)a[s] + (((((int64_t)x[s] * y[s]) ^ m) - m) >> 31);
+				r[s] = op < EMU_OP_MACW ? ld10k1_emu_clamp(t) : (int32_t)t;
+				sat[s] = r[s] != t;
+			}
+			if (op >= EMU_OP_MACW)
+				sat = NULL;
+			break;
+		case EMU_OP_MACINTS:
+		case EMU_OP_MACINTW:
+		case EMU_OP_ACC3:
+#ifdef EMU_AVX2
+			if (emu->avx2 && !item->acc_live)
+				s = ld10k1_emu_avx2_int(op, r, item->ccr_live ? sat : NULL, a, x, y, n);
+#endif
+			for (; s < n; s++) {
+				if (op == EMU_OP_ACC3)
+					t = (int64_t)a[s] + x[s] + y[s];
+				else
+					t = (int64_t)a[s] + (int64_t)x[s] * y[s];
+				if (item->acc_live) {
+					hi[s] = op == EMU_OP_ACC3 ? t : t >> 31;
+					lo[s] = op == EMU_OP_ACC3 ? 0 : (uint32_t)(t & 0x7fffffff);
+				}
+				r[s] = op == EMU_OP_MACINTW ? (int32_t)(t & 0x7fffffff) : ld10k1_emu_clamp(t);
+				sat[s] = r[s] != t;
+			}
+			if (op == EMU_OP_MACINTW)
+				sat = NULL;
+			break;
+		case EMU_OP_INTERP:
+#ifdef EMU_AVX2
+			if (emu->avx2 && !item->acc_live)
+				s = ld10k1_emu_avx2_interp(r, item->ccr_live ? sat : NULL, a, x, y, n);
+#endif
+			for (; s < n; s++) {
+				t = (int64_t)a[s] + (((int64_t)x[s] * ((int64_t)y[s] - a[s])) >> 31);
+				if (item->acc_live) {
+					hi[s] = t;
+					lo[s] = 0;
+				}
+				r[s] = ld10k1_emu_clamp(t);
+				sat[s] = r[s] != t;
+			}
+			break;
+		case EMU_OP_MACMV:
+			if (item->acc_live)
+				for (s = 0; s < n; s++) {
+					p = (int64_t)x[s] * y[s];
+					l = lo[s] + (uint32_t)(p & 0x7fffffff);
+					hi[s] = hi[s] + (p >> 31) + (l >> 31);
+					lo[s] = l & 0x7fffffff;
+				}
+			memmove(r, a, sizeof(int32_t) * n);
+			sat = NULL;
+			break;
+		case EMU_OP_LOG:
+			for (; s < n; s++)
+				r[s] = ld10k1_emu_log(a[s], x[s], y[s]);
+			sat = NULL;
+			break;
+		case EMU_OP_EXP:
+			for (; s < n; s++)
+				r[s] = ld10k1_emu_exp(a[s], x[s], y[s]);
+			sat = NULL;
+			break;
+		default:
+#ifdef EMU_AVX2
+			if (emu->avx2)
+				s = ld10k1_emu_avx2_logic(op, r, a, x, y, n);
+#endif
+			for (; s < n; s++)
+				switch (op) {
+					case EMU_OP_ANDXOR:
+						r[s] = (a[s] & x[s]) ^ y[s];
+						break;
+					case EMU_OP_TSTNEG:
+						r[s] = a[s] >= y[s] ? x[s] : ~x[s];
+						break;
+					case EMU_OP_LIMIT:
+						r[s] = a[s] >= y[s] ? x[s] : y[s];
+						break;
+					case EMU_OP_LIMIT1:
+						r[s] = a[s] < y[s] ? x[s] : y[s];
+						break;
+					default:
+						r[s] = a[s];
+						break;
+				}
+			sat = NULL;
+			break;
+	}
+
+	/* only skips which never skip are vector items, they keep flags */
+	if (!item->ccr_live || op == EMU_OP_SKIP)
+		return;
+	/* written after result - ccr as R keeps flags */
+	ccr = ld10k1_emu_row(emu, emu->const_base + EMU_HW_CCR) + 1;
+	s = 0;
+#ifdef EMU_AVX2
+	if (emu->avx2)
+		s = ld10k1_emu_avx2_flags(ccr, r, sat, n);
+#endif
+	for (; s < n; s++)
+		ccr[s] = ld10k1_emu_flags(r[s], sat ? sat[s] : 0);
+}
+
+/* segment sample by sample, registers are loaded from rows to regs */
+static void ld10k1_emu_segment(ld10k1_emu_t *emu, ld10k1_emu_plan_t *item, unsigned int n, uint32_t dbac)
+{
+	unsigned int s, i, e, count;
+	int32_t *ccr = NULL;
+
+	if (emu->slot[emu->const_base + EMU_HW_CCR] >= 0)
+		ccr = ld10k1_emu_row(emu, emu->const_base + EMU_HW_CCR);
+
+	for (s = 1; s <= n; s++) {
+		count = s == 1 ? item->reg_count : item->load_count;
+		for (i = 0; i < count; i++)
+			emu->regs[item->regs[i] & EMU_PLAN_REG] = item->rows[i][s - 1];
+		/* carried accumulator and flags are from previous run of segment */
+		if (s == 1 || !item->acc_carry) {
+			emu->acc_hi = emu->acc_hi_buf[item->acc_carry ? s - 1 : s];
+			emu->acc_lo = emu->acc_lo_buf[item->acc_carry ? s - 1 : s];
+		}
+		if (ccr && (s == 1 || !item->ccr_carry))
+			emu->ccr = ccr[item->ccr_carry ? s - 1 : s];
+		emu->dbac = (dbac - (s - 1)) & 0xFFFFF;
+
+		if (item->jit)
+			item->jit->run(emu);
+		else
+			ld10k1_emu_exec(emu, item->start, item->end);
+
+		for (i = 0; i < item->reg_count; i++) {
+			e = item->regs[i];
+			if (e & EMU_PLAN_STORE)
+				item->rows[item->reg_count + i][s - 1] = emu->regs[e & EMU_PLAN_REG];
+		}
+		emu->acc_hi_buf[s] = emu->acc_hi;
+		emu->acc_lo_buf[s] = emu->acc_lo;
+		if (ccr)
+			ccr[s] = emu->ccr;
+	}
+}
+
+static void ld10k1_emu_block(ld10k1_emu_t *emu, unsigned int n,
+	unsigned int in_count, int *in_regs, int32_t *in,
+	unsigned int out_count, int *out_regs, int32_t *out)
+{
+	unsigned int i, j, k, s, reg, size, pos, ccr, dbac_reg;
+	uint32_t dbac;
+	int16_t *mem;
+	int32_t *row;
+
+	ccr = emu->const_base + EMU_HW_CCR;
+	dbac_reg = emu->const_base + EMU_HW_DBAC;
+	dbac = emu->dbac;
+
+	/* writes of last sample of previous block */
+	ld10k1_emu_tram(emu, 1);
+
+	for (i = 0; i < emu->slot_count; i++) {
+		reg = emu->slot_reg[i];
+		if (emu->slot_type[reg] == EMU_SLOT_CONST)
+			continue;
+		row = ld10k1_emu_row(emu, reg);
+		row[0] = reg == ccr ? emu->ccr : emu->regs[reg];
+		if (reg == dbac_reg)
+			for (s = 1; s <= n; s++)
+				row[s] = (dbac - (s - 1)) & 0xFFFFF;
+	}
+	emu->acc_hi_buf[0] = emu->acc_hi;
+	emu->acc_lo_buf[0] = emu->acc_lo;
+
+	for (j = 0; j < in_count; j++) {
+		row = ld10k1_emu_row(emu, in_regs[j]);
+		for (s = 1; s <= n; s++)
+			row[s] = in[(s - 1) * in_count + j];
+	}
+
+	/* sizes are power of 2 in block mode, copied in runs between wraps of tram */
+	for (j = 0; j < emu->tram_rd_count; j++) {
+		i = emu->tram_rd[j];
+		ld10k1_emu_tram_op(emu, i, &mem, &size);
+		pos = (emu->regs[EMU_TRAM_ADDR + i] + dbac) & (size - 1);
+		row = ld10k1_emu_row(emu, EMU_TRAM_DATA + i) + 1;
+		for (s = 0; s < n; s += k, pos = (pos - k) & (size - 1)) {
+			k = n - s < pos + 1 ? n - s : pos + 1;
+			ld10k1_emu_tram_get(emu, row + s, mem + pos + 1 - k, k);
+		}
+	}
+
+	for (i = 0; i < emu->plan_count; i++)
+		if (emu->plan[i].segment)
+			ld10k1_emu_segment(emu, &(emu->plan[i]), n, dbac);
+		else
+			ld10k1_emu_vec(emu, &(emu->plan[i]), n);
+
+	for (s = 1; s <= n; s++)
+		for (j = 0; j < out_count; j++) {
+			reg = out_regs[j];
+			*out++ = emu->slot[reg] >= 0 ? (uint32_t)ld10k1_emu_row(emu, reg)[s] : emu->regs[reg];
+		}
+
+	/* tram writes done at start of samples 2 - n */
+	if (emu->tram_wr_seq) {
+		for (s = 1; s < n; s++)
+			for (j = 0; j < emu->tram_wr_count; j++) {
+				i = emu->tram_wr[j];
+				ld10k1_emu_tram_op(emu, i, &mem, &size);
+				reg = EMU_TRAM_DATA + i;
+				mem[(emu->regs[EMU_TRAM_ADDR + i] + dbac - s) & (size - 1)] =
+					(int16_t)((emu->slot[reg] >= 0 ? (uint32_t)ld10k1_emu_row(emu, reg)[s] : emu->regs[reg]) >> 16);
+			}
+	} else
+		for (j = 0; j < emu->tram_wr_count; j++) {
+			i = emu->tram_wr[j];
+			ld10k1_emu_tram_op(emu, i, &mem, &size);
+			reg = EMU_TRAM_DATA + i;
+			pos = (emu->regs[EMU_TRAM_ADDR + i] + dbac - 1) & (size - 1);
+			if (emu->slot[reg] < 0) {
+				for (s = 1; s < n; s++, pos = (pos - 1) & (size - 1))
+					mem[pos] = (int16_t)(emu->regs[reg] >> 16);
+				continue;
+			}
+			row = ld10k1_emu_row(emu, reg) + 1;
+			for (s = 0; s < n - 1; s += k, pos = (pos - k) & (size - 1)) {
+				k = n - 1 - s < pos + 1 ? n - 1 - s : pos + 1;
+				ld10k1_emu_tram_put(emu, mem + pos + 1 - k, row + s, k);
+			}
+		}
+
+	/* state after last sample */
+	for (i = 0; i < emu->slot_count; i++) {
+		reg = emu->slot_reg[i];
+		if (emu->slot_type[reg] == EMU_SLOT_CONST || reg == dbac_reg)
+			continue;
+		if (reg == ccr)
+			emu->ccr = ld10k1_emu_row(emu, reg)[n];
+		else
+			emu->regs[reg] = ld10k1_emu_row(emu, reg)[n];
+	}
+	emu->acc_hi = emu->acc_hi_buf[n];
+	emu->acc_lo = emu->acc_lo_buf[n];
+	emu->dbac = (dbac - n) & 0xFFFFF;
+}
+
+void ld10k1_emu_run(ld10k1_emu_t *emu, unsigned int frames,
+	unsigned int in_count, int *in_regs, int32_t *in,
+	unsigned int out_count, int *out_regs, int32_t *out)
+{
+	unsigned int i, j, n;
+
+	if (!emu->plan_valid || emu->plan_in_count != in_count ||
+		memcmp(emu->plan_in_regs, in_regs, sizeof(int) * in_count))
+		ld10k1_emu_plan(emu, in_count, in_regs);
+
+	if (emu->block > 1) {
+		while (frames) {
+			n = frames < emu->block ? frames : emu->block;
+			ld10k1_emu_block(emu, n, in_count, in_regs, in, out_count, out_regs, out);
+			in += n * in_count;
+			out += n * out_count;
+			frames -= n;
+		}
+		return;
+	}
+
+	for (i = 0; i < frames; i++) {
+		for (j = 0; j < in_count; j++)
+			emu->regs[in_regs[j]] = *in++;
+		ld10k1_emu_tram(emu, 1);
+		ld10k1_emu_tram(emu, 0);
+		if (emu->jit)
+			emu->jit->run(emu);
+		else
+			ld10k1_emu_exec(emu, 0, emu->instr_count);
+		emu->dbac = (emu->dbac - 1) & 0xFFFFF;
+		for (j = 0; j < out_count; j++)
+			*out++ = emu->regs[out_regs[j]];
+	}
+}
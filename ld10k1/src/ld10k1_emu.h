@@ -0,0 +1,183 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __LD10K1_EMU_H
+#define __LD10K1_EMU_H
+
+/* software FX8010, used instead of hwdep device when ld10k1 runs with -e */
+
+#define EMU_REG_COUNT 0x800
+/* internal tram size in samples */
+#define EMU_ITRAM_SIZE 0x2000
+/* samples evaluated at once by ld10k1_emu_run */
+#define EMU_BLOCK_MAX 128
+
+#define EMU_OP_MACS	0x00
+#define EMU_OP_MACS1	0x01
+#define EMU_OP_MACW	0x02
+#define EMU_OP_MACW1	0x03
+#define EMU_OP_MACINTS	0x04
+#define EMU_OP_MACINTW	0x05
+#define EMU_OP_ACC3	0x06
+#define EMU_OP_MACMV	0x07
+#define EMU_OP_ANDXOR	0x08
+#define EMU_OP_TSTNEG	0x09
+#define EMU_OP_LIMIT	0x0a
+#define EMU_OP_LIMIT1	0x0b
+#define EMU_OP_LOG	0x0c
+#define EMU_OP_EXP	0x0d
+#define EMU_OP_INTERP	0x0e
+#define EMU_OP_SKIP	0x0f
+
+/* offsets from const_base */
+#define EMU_HW_ACCUM	0x16
+#define EMU_HW_CCR	0x17
+#define EMU_HW_NOISE1	0x18
+#define EMU_HW_NOISE2	0x19
+#define EMU_HW_IRQ	0x1a
+#define EMU_HW_DBAC	0x1b
+
+#define EMU_CCR_S	0x10
+#define EMU_CCR_Z	0x08
+#define EMU_CCR_M	0x04
+#define EMU_CCR_B	0x02
+#define EMU_CCR_N	0x01
+
+#define EMU_TRAM_DATA	0x200
+#define EMU_TRAM_ADDR	0x300
+
+/* program analysis, shared by block plan and jit */
+typedef struct {
+	unsigned int op;
+	unsigned int o[4];
+	unsigned int rd[4];
+	unsigned int rd_count;
+	unsigned int wr[3];
+	unsigned int wr_count;
+	int noise;
+	int cond;
+	int skip_end;
+	int nop;
+	int acc_live;
+	int ccr_live;
+} ld10k1_emu_ins_t;
+
+typedef struct ld10k1_emu_s ld10k1_emu_t;
+
+/* native code of instruction range, same effect as interpreter run over it */
+typedef struct {
+	void *mem;
+	size_t size;
+	void (*run)(ld10k1_emu_t *emu);
+} ld10k1_emu_jit_t;
+
+/* block plan item - one instruction for whole block or segment run sample by sample */
+typedef struct {
+	unsigned int start;
+	unsigned int end;
+	int segment;
+	int acc_live;
+	int ccr_live;
+	int acc_carry;
+	int ccr_carry;
+	unsigned int reg_count;
+	unsigned int *regs;
+	/* regs before load_count are loaded in every sample, rest only in first */
+	unsigned int load_count;
+	/* rows of regs indexed by sample - to load, then to store */
+	int32_t **rows;
+	ld10k1_emu_jit_t *jit;
+} ld10k1_emu_plan_t;
+
+struct ld10k1_emu_s {
+	int audigy;
+
+	unsigned int instr_count;
+	unsigned int const_base;
+	unsigned int gpr_base;
+	unsigned int gpr_count;
+	unsigned int itram_count;
+	unsigned int etram_count;
+
+	uint32_t regs[EMU_REG_COUNT];
+	uint32_t code[0x400 * 2];
+
+	/* accumulator - value in 2^-31 units as hi * 2^31 + lo */
+	int64_t acc_hi;
+	uint32_t acc_lo;
+	uint32_t ccr;
+	uint32_t dbac;
+	uint32_t noise;
+
+	/* tram memory - 16 bit samples */
+	unsigned int itram_size;
+	int16_t *itram;
+	unsigned int etram_size;
+	int16_t *etram;
+
+	/* block evaluation, plan is rebuilt after poke */
+	int avx2;
+	int plan_valid;
+	unsigned int block;
+	unsigned int plan_count;
+	ld10k1_emu_plan_t *plan;
+	unsigned int plan_in_count;
+	int *plan_in_regs;
+	short slot[EMU_REG_COUNT];
+	unsigned char slot_type[EMU_REG_COUNT];
+	unsigned short slot_reg[EMU_REG_COUNT];
+	unsigned int slot_count;
+	int32_t *slot_buf;
+	int64_t acc_hi_buf[EMU_BLOCK_MAX + 1];
+	uint32_t acc_lo_buf[EMU_BLOCK_MAX + 1];
+	unsigned int tram_rd_count;
+	unsigned short tram_rd[0x100];
+	unsigned int tram_wr_count;
+	unsigned short tram_wr[0x100];
+	/* writes can hit same address in one block - done sample by sample */
+	int tram_wr_seq;
+	int32_t tmp_buf[5][EMU_BLOCK_MAX + 1];
+
+	/* native code of whole program for per sample run */
+	int jit_enable;
+	ld10k1_emu_jit_t *jit;
+};
+
+int ld10k1_emu_new(int audigy, unsigned int itram_size, unsigned int etram_size, ld10k1_emu_t **emu);
+void ld10k1_emu_free(ld10k1_emu_t *emu);
+void ld10k1_emu_poke(ld10k1_emu_t *emu, emu10k1_fx8010_code_t *code);
+void ld10k1_emu_peek(ld10k1_emu_t *emu, emu10k1_fx8010_code_t *code);
+void ld10k1_emu_ctl_put(ld10k1_emu_t *emu, emu10k1_fx8010_control_gpr_t *ctl);
+void ld10k1_emu_step(ld10k1_emu_t *emu);
+void ld10k1_emu_run(ld10k1_emu_t *emu, unsigned int frames,
+	unsigned int in_count, int *in_regs, int32_t *in,
+	unsigned int out_count, int *out_regs, int32_t *out);
+
+/* used by jit */
+void ld10k1_emu_exec(ld10k1_emu_t *emu, unsigned int start, unsigned int end);
+int ld10k1_emu_skip_test(uint32_t ccr, uint32_t test);
+int ld10k1_emu_writable(ld10k1_emu_t *emu, unsigned int reg);
+
+int ld10k1_emu_jit_compile(ld10k1_emu_t *emu, ld10k1_emu_ins_t *ins, unsigned char *konst,
+	unsigned int start, unsigned int end, ld10k1_emu_jit_t **jit);
+void ld10k1_emu_jit_free(ld10k1_emu_jit_t *jit);
+
+#endif /* __LD10K1_EMU_H */
@@ -0,0 +1,632 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <alsa/asoundlib.h>
+#include <alsa/sound/emu10k1.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ld10k1.h"
+#include "ld10k1_emu.h"
+#include "ld10k1_error.h"
+
+/*
+ * Translation of FX8010 program to x86-64 code
+ *
+ * Every instruction is translated to code which loads operands from
+ * emulator registers, computes result and stores it back, so state
+ * in memory is same as after interpreter after every instruction.
+ * Registers which have same value in every sample are compiled in as
+ * immediates, results which are overwritten before read are not
+ * stored and accumulator and flags are computed only when used.
+ * LOG, EXP, noise and accumulator as operand call interpreter for
+ * single instruction. Only base x86-64 instructions are used; on
+ * other machines, or when executable memory can not be mapped,
+ * interpreter is used.
+ *
+ * Generated function (emu in rdi):
+ *   rbx - emu, r8, r9, r10 - A, X, Y sign extended to 64 bits,
+ *   rax - result, rcx, rdx - temporary, r12 - skip count
+ */
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+#define JIT_AX	0
+#define JIT_CX	1
+#define JIT_DX	2
+#define JIT_BX	3
+#define JIT_SI	6
+#define JIT_DI	7
+#define JIT_R8	8
+#define JIT_R9	9
+#define JIT_R10	10
+#define JIT_R12	12
+
+/* condition codes */
+#define JIT_CC_E	0x4
+#define JIT_CC_NE	0x5
+#define JIT_CC_AE	0x3
+#define JIT_CC_L	0xc
+#define JIT_CC_GE	0xd
+#define JIT_CC_G	0xf
+
+/* code size limit for one instruction */
+#define JIT_INSTR_MAX	256
+
+#define JIT_OFF(field) ((int32_t)offsetof(ld10k1_emu_t, field))
+#define JIT_REG(reg) (JIT_OFF(regs) + (int32_t)(reg) * 4)
+
+typedef struct {
+	unsigned char *buf;
+	unsigned int pos;
+	/* rel32 positions and their target instruction */
+	unsigned int fix_count;
+	unsigned int *fix_pos;
+	unsigned int *fix_target;
+	/* lea of jump table */
+	unsigned int tab_count;
+	unsigned int *tab_pos;
+} ld10k1_emu_jit_buf_t;
+
+static void jit_8(ld10k1_emu_jit_buf_t *b, unsigned int v)
+{
+	b->buf[b->pos++] = v & 0xff;
+}
+
+static void jit_32(ld10k1_emu_jit_buf_t *b, uint32_t v)
+{
+	jit_8(b, v);
+	jit_8(b, v >> 8);
+	jit_8(b, v >> 16);
+	jit_8(b, v >> 24);
+}
+
+static void jit_64(ld10k1_emu_jit_buf_t *b, uint64_t v)
+{
+	jit_32(b, (uint32_t)v);
+	jit_32(b, (uint32_t)(v >> 32));
+}
+
+static void jit_rex(ld10k1_emu_jit_buf_t *b, int w, int reg, int rm)
+{
+	unsigned int rex = 0x40 | (w ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+
+	if (rex != 0x40)
+		jit_8(b, rex);
+}
+
+/* opcode over 0xff has 0x0f prefix */
+static void jit_op(ld10k1_emu_jit_buf_t *b, unsigned int op)
+{
+	if (op > 0xff)
+		jit_8(b, op >> 8);
+	jit_8(b, op);
+}
+
+/* op reg, rm - both registers */
+static void jit_rr(ld10k1_emu_jit_buf_t *b, int w, unsigned int op, int reg, int rm)
+{
+	jit_rex(b, w, reg, rm);
+	jit_op(b, op);
+	jit_8(b, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* op reg, [rbx + disp] */
+static void jit_rm(ld10k1_emu_jit_buf_t *b, int w, unsigned int op, int reg, int32_t disp)
+{
+	jit_rex(b, w, reg, JIT_BX);
+	jit_op(b, op);
+	jit_8(b, 0x80 | (reg & 7) << 3 | JIT_BX);
+	jit_32(b, disp);
+}
+
+/* group op with immediate - ext is opcode extension in reg field */
+static void jit_ri(ld10k1_emu_jit_buf_t *b, int w, unsigned int op, int ext, int rm)
+{
+	jit_rex(b, w, 0, rm);
+	jit_op(b, op);
+	jit_8(b, 0xc0 | ext << 3 | (rm & 7));
+}
+
+/* mov r64, sign extended imm32 */
+static void jit_mov_imm(ld10k1_emu_jit_buf_t *b, int reg, int32_t v)
+{
+	jit_ri(b, 1, 0xc7, 0, reg);
+	jit_32(b, v);
+}
+
+#define jit_mov(b, dst, src)	jit_rr(b, 1, 0x89, src, dst)
+#define jit_add(b, dst, src)	jit_rr(b, 1, 0x01, src, dst)
+#define jit_sub(b, dst, src)	jit_rr(b, 1, 0x29, src, dst)
+#define jit_and(b, dst, src)	jit_rr(b, 1, 0x21, src, dst)
+#define jit_xor(b, dst, src)	jit_rr(b, 1, 0x31, src, dst)
+#define jit_cmp(b, dst, src)	jit_rr(b, 1, 0x39, src, dst)
+#define jit_imul(b, dst, src)	jit_rr(b, 1, 0x0faf, dst, src)
+#define jit_cmov(b, cc, dst, src)	jit_rr(b, 1, 0x0f40 | (cc), dst, src)
+#define jit_load32s(b, reg, disp)	jit_rm(b, 1, 0x63, reg, disp)
+#define jit_load32(b, reg, disp)	jit_rm(b, 0, 0x8b, reg, disp)
+#define jit_load64(b, reg, disp)	jit_rm(b, 1, 0x8b, reg, disp)
+#define jit_add64(b, reg, disp)	jit_rm(b, 1, 0x03, reg, disp)
+#define jit_store32(b, reg, disp)	jit_rm(b, 0, 0x89, reg, disp)
+#define jit_store64(b, reg, disp)	jit_rm(b, 1, 0x89, reg, disp)
+
+static void jit_shift(ld10k1_emu_jit_buf_t *b, int ext, int reg, unsigned int n)
+{
+	jit_ri(b, 1, 0xc1, ext, reg);
+	jit_8(b, n);
+}
+
+#define jit_shl(b, reg, n)	jit_shift(b, 4, reg, n)
+#define jit_shr(b, reg, n)	jit_shift(b, 5, reg, n)
+#define jit_sar(b, reg, n)	jit_shift(b, 7, reg, n)
+
+/* and r64, 0x7fffffff */
+static void jit_mask31(ld10k1_emu_jit_buf_t *b, int reg)
+{
+	jit_ri(b, 1, 0x81, 4, reg);
+	jit_32(b, 0x7fffffff);
+}
+
+/* call C function, arguments are already in rdi, rsi, rdx */
+static void jit_call(ld10k1_emu_jit_buf_t *b, uint64_t fn)
+{
+	jit_8(b, 0x48);
+	jit_8(b, 0xb8);
+	jit_64(b, fn);
+	jit_8(b, 0xff);
+	jit_8(b, 0xd0);
+}
+
+/* jump to start of instruction target, JIT_TARGET_END is end of code */
+#define JIT_TARGET_END	0xffffffff
+
+static void jit_jump(ld10k1_emu_jit_buf_t *b, int cc, unsigned int target)
+{
+	if (cc < 0)
+		jit_8(b, 0xe9);
+	else {
+		jit_8(b, 0x0f);
+		jit_8(b, 0x80 | cc);
+	}
+	b->fix_pos[b->fix_count] = b->pos;
+	b->fix_target[b->fix_count++] = target;
+	jit_32(b, 0);
+}
+
+static void jit_load(ld10k1_emu_jit_buf_t *b, ld10k1_emu_t *emu, unsigned char *konst,
+	unsigned int reg, int dst)
+{
+	if (konst[reg])
+		jit_mov_imm(b, dst, (int32_t)emu->regs[reg]);
+	else if (reg == emu->const_base + EMU_HW_CCR)
+		jit_load32s(b, dst, JIT_OFF(ccr));
+	else if (reg == emu->const_base + EMU_HW_DBAC)
+		jit_load32s(b, dst, JIT_OFF(dbac));
+	else
+		jit_load32s(b, dst, JIT_REG(reg));
+}
+
+/* rax to int32 range, original value left in rdx */
+static void jit_sat(ld10k1_emu_jit_buf_t *b)
+{
+	jit_mov(b, JIT_DX, JIT_AX);
+	jit_mov_imm(b, JIT_CX, INT32_MAX);
+	jit_cmp(b, JIT_AX, JIT_CX);
+	jit_cmov(b, JIT_CC_G, JIT_AX, JIT_CX);
+	jit_mov_imm(b, JIT_CX, INT32_MIN);
+	jit_cmp(b, JIT_AX, JIT_CX);
+	jit_cmov(b, JIT_CC_L, JIT_AX, JIT_CX);
+}
+
+/* flags of result in eax to ccr, sat - compare rdx with rax */
+static void jit_flags(ld10k1_emu_jit_buf_t *b, int sat)
+{
+	if (sat) {
+		/* S - cmp rdx, rax; setne dl; movzx edx, dl; shl edx, 4 */
+		jit_cmp(b, JIT_DX, JIT_AX);
+		jit_rr(b, 0, 0x0f90 | JIT_CC_NE, 0, JIT_DX);
+		jit_rr(b, 0, 0x0fb6, JIT_DX, JIT_DX);
+		jit_ri(b, 0, 0xc1, 4, JIT_DX);
+		jit_8(b, 4);
+	} else
+		jit_rr(b, 0, 0x31, JIT_DX, JIT_DX);
+	/* Z - test eax, eax; sete cl; movzx ecx, cl; shl ecx, 3 */
+	jit_rr(b, 0, 0x85, JIT_AX, JIT_AX);
+	jit_rr(b, 0, 0x0f90 | JIT_CC_E, 0, JIT_CX);
+	jit_rr(b, 0, 0x0fb6, JIT_CX, JIT_CX);
+	jit_ri(b, 0, 0xc1, 4, JIT_CX);
+	jit_8(b, 3);
+	jit_rr(b, 0, 0x09, JIT_CX, JIT_DX);
+	/* M - sign moved to bit 2 */
+	jit_rr(b, 0, 0x89, JIT_AX, JIT_CX);
+	jit_ri(b, 0, 0xc1, 5, JIT_CX);
+	jit_8(b, 31);
+	jit_ri(b, 0, 0xc1, 4, JIT_CX);
+	jit_8(b, 2);
+	jit_rr(b, 0, 0x09, JIT_CX, JIT_DX);
+	/* N - bit 31 differs from bit 30 */
+	jit_rr(b, 0, 0x89, JIT_AX, JIT_CX);
+	jit_rr(b, 0, 0x01, JIT_CX, JIT_CX);
+	jit_rr(b, 0, 0x31, JIT_AX, JIT_CX);
+	jit_ri(b, 0, 0xc1, 5, JIT_CX);
+	jit_8(b, 31);
+	jit_rr(b, 0, 0x09, JIT_CX, JIT_DX);
+	jit_store32(b, JIT_DX, JIT_OFF(ccr));
+}
+
+/* product in rax added to accumulator */
+static void jit_acc_add(ld10k1_emu_jit_buf_t *b)
+{
+	jit_mov(b, JIT_CX, JIT_AX);
+	jit_mask31(b, JIT_CX);
+	jit_load32(b, JIT_DX, JIT_OFF(acc_lo));
+	jit_add(b, JIT_CX, JIT_DX);
+	jit_sar(b, JIT_AX, 31);
+	jit_add64(b, JIT_AX, JIT_OFF(acc_hi));
+	jit_mov(b, JIT_DX, JIT_CX);
+	jit_shr(b, JIT_DX, 31);
+	jit_add(b, JIT_AX, JIT_DX);
+	jit_mask31(b, JIT_CX);
+	jit_store32(b, JIT_CX, JIT_OFF(acc_lo));
+	jit_store64(b, JIT_AX, JIT_OFF(acc_hi));
+}
+
+/* accumulator set to rax */
+static void jit_acc_set(ld10k1_emu_jit_buf_t *b)
+{
+	jit_store64(b, JIT_AX, JIT_OFF(acc_hi));
+	/* mov dword [rbx + acc_lo], 0 */
+	jit_rm(b, 0, 0xc7, 0, JIT_OFF(acc_lo));
+	jit_32(b, 0);
+}
+
+/* is value written to reg by instruction pc overwritten before read in start - end */
+static int jit_dead(ld10k1_emu_ins_t *ins, unsigned int pc, unsigned int end, unsigned int reg)
+{
+	unsigned int q, i;
+
+	for (q = pc + 1; q < end; q++) {
+		for (i = 0; i < ins[q].rd_count; i++)
+			if (ins[q].rd[i] == reg)
+				return 0;
+		if (ins[q].cond)
+			continue;
+		for (i = 0; i < ins[q].wr_count; i++)
+			if (ins[q].wr[i] == reg)
+				return 1;
+	}
+	return 0;
+}
+
+static int jit_instr(ld10k1_emu_jit_buf_t *b, ld10k1_emu_t *emu, ld10k1_emu_ins_t *ins,
+	unsigned char *konst, unsigned int pc, unsigned int start, unsigned int end)
+{
+	ld10k1_emu_ins_t *in = &(ins[pc]);
+	unsigned int op, r, acc, ccr, dbac, i, c;
+	int store, full, sat;
+
+	op = in->op;
+	r = in->o[0];
+	acc = emu->const_base + EMU_HW_ACCUM;
+	ccr = emu->const_base + EMU_HW_CCR;
+	dbac = emu->const_base + EMU_HW_DBAC;
+	full = op <= EMU_OP_MACW1 && in->o[1] == acc;
+
+	if (r == ccr)
+		store = op == EMU_OP_SKIP && in->ccr_live;
+	else
+		store = ld10k1_emu_writable(emu, r) && !jit_dead(ins, pc, end, r);
+
+	if (op == EMU_OP_SKIP) {
+		/* skip can not be run by interpreter alone */
+		if (in->noise || r == dbac)
+			return LD10K1_ERR_INSTR_OPCODE;
+		for (i = 1; i < 4; i++)
+			if (in->o[i] == acc)
+				return LD10K1_ERR_INSTR_OPCODE;
+	} else {
+		if (!store && !in->acc_live && !in->ccr_live && !in->noise)
+			return 0;
+		if (op == EMU_OP_LOG || op == EMU_OP_EXP || in->noise || r == dbac ||
+			(!full && in->o[1] == acc) || in->o[2] == acc || in->o[3] == acc) {
+			/* interpreter for this instruction */
+			jit_mov(b, JIT_DI, JIT_BX);
+			jit_8(b, 0xb8 + JIT_SI);
+			jit_32(b, pc);
+			jit_8(b, 0xb8 + JIT_DX);
+			jit_32(b, pc + 1);
+			jit_call(b, (uint64_t)(uintptr_t)ld10k1_emu_exec);
+			return 0;
+		}
+	}
+
+	if (!full)
+		jit_load(b, emu, konst, in->o[1], JIT_R8);
+	jit_load(b, emu, konst, in->o[2], JIT_R9);
+	jit_load(b, emu, konst, in->o[3], JIT_R10);
+
+	sat = 0;
+	switch (op) {
+		case EMU_OP_MACS:
+		case EMU_OP_MACS1:
+		case EMU_OP_MACW:
+		case EMU_OP_MACW1:
+			jit_mov(b, JIT_AX, JIT_R9);
+			jit_imul(b, JIT_AX, JIT_R10);
+			if (op & 1)
+				jit_ri(b, 1, 0xf7, 3, JIT_AX);
+			if (full)
+				jit_acc_add(b);
+			else {
+				if (in->acc_live) {
+					jit_mov(b, JIT_CX, JIT_AX);
+					jit_mask31(b, JIT_CX);
+					jit_store32(b, JIT_CX, JIT_OFF(acc_lo));
+				}
+				jit_sar(b, JIT_AX, 31);
+				jit_add(b, JIT_AX, JIT_R8);
+				if (in->acc_live)
+					jit_store64(b, JIT_AX, JIT_OFF(acc_hi));
+			}
+			if (op == EMU_OP_MACS || op == EMU_OP_MACS1) {
+				jit_sat(b);
+				sat = 1;
+			}
+			break;
+		case EMU_OP_MACINTS:
+		case EMU_OP_MACINTW:
+			jit_mov(b, JIT_AX, JIT_R9);
+			jit_imul(b, JIT_AX, JIT_R10);
+			jit_add(b, JIT_AX, JIT_R8);
+			if (in->acc_live) {
+				jit_mov(b, JIT_CX, JIT_AX);
+				jit_mask31(b, JIT_CX);
+				jit_store32(b, JIT_CX, JIT_OFF(acc_lo));
+				jit_mov(b, JIT_DX, JIT_AX);
+				jit_sar(b, JIT_DX, 31);
+				jit_store64(b, JIT_DX, JIT_OFF(acc_hi));
+			}
+			if (op == EMU_OP_MACINTS) {
+				jit_sat(b);
+				sat = 1;
+			} else
+				jit_mask31(b, JIT_AX);
+			break;
+		case EMU_OP_ACC3:
+			jit_mov(b, JIT_AX, JIT_R8);
+			jit_add(b, JIT_AX, JIT_R9);
+			jit_add(b, JIT_AX, JIT_R10);
+			if (in->acc_live)
+				jit_acc_set(b);
+			jit_sat(b);
+			sat = 1;
+			break;
+		case EMU_OP_MACMV:
+			if (in->acc_live) {
+				jit_mov(b, JIT_AX, JIT_R9);
+				jit_imul(b, JIT_AX, JIT_R10);
+				jit_acc_add(b);
+			}
+			jit_mov(b, JIT_AX, JIT_R8);
+			break;
+		case EMU_OP_ANDXOR:
+			jit_mov(b, JIT_AX, JIT_R8);
+			jit_and(b, JIT_AX, JIT_R9);
+			jit_xor(b, JIT_AX, JIT_R10);
+			break;
+		case EMU_OP_TSTNEG:
+			jit_mov(b, JIT_AX, JIT_R9);
+			jit_ri(b, 1, 0xf7, 2, JIT_AX);
+			jit_cmp(b, JIT_R8, JIT_R10);
+			jit_cmov(b, JIT_CC_GE, JIT_AX, JIT_R9);
+			break;
+		case EMU_OP_LIMIT:
+		case EMU_OP_LIMIT1:
+			jit_mov(b, JIT_AX, JIT_R10);
+			jit_cmp(b, JIT_R8, JIT_R10);
+			jit_cmov(b, op == EMU_OP_LIMIT ? JIT_CC_GE : JIT_CC_L, JIT_AX, JIT_R9);
+			break;
+		case EMU_OP_INTERP:
+			jit_mov(b, JIT_AX, JIT_R10);
+			jit_sub(b, JIT_AX, JIT_R8);
+			jit_imul(b, JIT_AX, JIT_R9);
+			jit_sar(b, JIT_AX, 31);
+			jit_add(b, JIT_AX, JIT_R8);
+			if (in->acc_live)
+				jit_acc_set(b);
+			jit_sat(b);
+			sat = 1;
+			break;
+		case EMU_OP_SKIP:
+		default:
+			if (store)
+				jit_store32(b, JIT_R8, r == ccr ? JIT_OFF(ccr) : JIT_REG(r));
+			if (konst[in->o[3]]) {
+				c = emu->regs[in->o[3]];
+				if (!c)
+					return 0;
+			} else {
+				c = 0;
+				jit_mov(b, JIT_R12, JIT_R10);
+			}
+			/* esi - test, edi - ccr */
+			jit_rr(b, 0, 0x89, JIT_R9, JIT_SI);
+			jit_rr(b, 0, 0x89, JIT_R8, JIT_DI);
+			jit_call(b, (uint64_t)(uintptr_t)ld10k1_emu_skip_test);
+			jit_rr(b, 0, 0x85, JIT_AX, JIT_AX);
+			if (c) {
+				jit_jump(b, JIT_CC_NE, c >= end - pc ? JIT_TARGET_END : pc + 1 + c);
+				return 0;
+			}
+			jit_jump(b, JIT_CC_E, pc + 1);
+			/* count past end ends run, else jmp [table + (pc + 1 + count - start) * 8] */
+			jit_rr(b, 0, 0x89, JIT_R12, JIT_AX);
+			jit_8(b, 0x3d);
+			jit_32(b, end - pc);
+			jit_jump(b, JIT_CC_AE, JIT_TARGET_END);
+			jit_8(b, 0x05);
+			jit_32(b, pc + 1 - start);
+			jit_8(b, 0x48);
+			jit_8(b, 0x8d);
+			jit_8(b, 0x0d);
+			b->tab_pos[b->tab_count++] = b->pos;
+			jit_32(b, 0);
+			jit_8(b, 0xff);
+			jit_8(b, 0x24);
+			jit_8(b, 0xc1);
+			return 0;
+	}
+
+	if (store)
+		jit_store32(b, JIT_AX, JIT_REG(r));
+	if (in->ccr_live)
+		jit_flags(b, sat);
+	return 0;
+}
+
+int ld10k1_emu_jit_compile(ld10k1_emu_t *emu, ld10k1_emu_ins_t *ins, unsigned char *konst,
+	unsigned int start, unsigned int end, ld10k1_emu_jit_t **jit)
+{
+	ld10k1_emu_jit_buf_t b;
+	ld10k1_emu_jit_t *j = NULL;
+	unsigned int *label = NULL;
+	unsigned int count, pc, i, tab, target;
+	unsigned char *mem;
+	size_t size;
+	int err;
+
+	*jit = NULL;
+	count = end - start;
+	memset(&b, 0, sizeof(b));
+
+	err = LD10K1_ERR_NO_MEM;
+	b.buf = (unsigned char *)malloc((count + 2) * JIT_INSTR_MAX);
+	label = (unsigned int *)malloc(sizeof(unsigned int) * (count + 1));
+	b.fix_pos = (unsigned int *)malloc(sizeof(unsigned int) * (count * 2 + 1));
+	b.fix_target = (unsigned int *)malloc(sizeof(unsigned int) * (count * 2 + 1));
+	b.tab_pos = (unsigned int *)malloc(sizeof(unsigned int) * (count + 1));
+	j = (ld10k1_emu_jit_t *)malloc(sizeof(ld10k1_emu_jit_t));
+	if (!b.buf || !label || !b.fix_pos || !b.fix_target || !b.tab_pos || !j)
+		goto err;
+
+	/* push rbx; push r12; sub rsp, 8; mov rbx, rdi */
+	jit_8(&b, 0x53);
+	jit_8(&b, 0x41);
+	jit_8(&b, 0x54);
+	jit_ri(&b, 1, 0x83, 5, 4);
+	jit_8(&b, 8);
+	jit_mov(&b, JIT_BX, JIT_DI);
+
+	for (pc = start; pc < end; pc++) {
+		label[pc - start] = b.pos;
+		if (ins[pc].nop)
+			continue;
+		if ((err = jit_instr(&b, emu, ins, konst, pc, start, end)) < 0)
+			goto err;
+	}
+
+	/* add rsp, 8; pop r12; pop rbx; ret */
+	label[count] = b.pos;
+	jit_ri(&b, 1, 0x83, 0, 4);
+	jit_8(&b, 8);
+	jit_8(&b, 0x41);
+	jit_8(&b, 0x5c);
+	jit_8(&b, 0x5b);
+	jit_8(&b, 0xc3);
+
+	for (i = 0; i < b.fix_count; i++) {
+		target = b.fix_target[i] == JIT_TARGET_END ? label[count] : label[b.fix_target[i] - start];
+		*(int32_t *)(b.buf + b.fix_pos[i]) = (int32_t)(target - (b.fix_pos[i] + 4));
+	}
+
+	/* jump table of instruction addresses */
+	tab = (b.pos + 7) & ~7;
+	size = tab;
+	if (b.tab_count) {
+		size += (count + 1) * 8;
+		for (i = 0; i < b.tab_count; i++)
+			*(int32_t *)(b.buf + b.tab_pos[i]) = (int32_t)(tab - (b.tab_pos[i] + 4));
+	}
+
+	mem = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+	memcpy(mem, b.buf, b.pos);
+	if (b.tab_count)
+		for (i = 0; i <= count; i++)
+			*(uint64_t *)(mem + tab + i * 8) = (uint64_t)(uintptr_t)(mem + label[i]);
+	if (mprotect(mem, size, PROT_READ | PROT_EXEC) < 0) {
+		munmap(mem, size);
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+
+	j->mem = mem;
+	j->size = size;
+	j->run = (void (*)(ld10k1_emu_t *))(uintptr_t)mem;
+	*jit = j;
+	j = NULL;
+	err = 0;
+err:
+	if (b.buf)
+		free(b.buf);
+	if (label)
+		free(label);
+	if (b.fix_pos)
+		free(b.fix_pos);
+	if (b.fix_target)
+		free(b.fix_target);
+	if (b.tab_pos)
+		free(b.tab_pos);
+	if (j)
+		free(j);
+	return err;
+}
+
+void ld10k1_emu_jit_free(ld10k1_emu_jit_t *jit)
+{
+	munmap(jit->mem, jit->size);
+	free(jit);
+}
+
+#else
+
+int ld10k1_emu_jit_compile(ld10k1_emu_t *emu, ld10k1_emu_ins_t *ins, unsigned char *konst,
+	unsigned int start, unsigned int end, ld10k1_emu_jit_t **jit)
+{
+	*jit = NULL;
+	return LD10K1_ERR_INSTR_OPCODE;
+}
+
+void ld10k1_emu_jit_free(ld10k1_emu_jit_t *jit)
+{
+	free(jit);
+}
+
+#endif
@@ -29,12 +29,15 @@
 #include <alsa/asoundlib.h>
 #include <alsa/sound/emu10k1.h>
 
+#include "bitops.h"
 #include "ld10k1.h"
 #include "ld10k1_fnc.h"
 #include "ld10k1_fnc_int.h"
 #include "ld10k1_driver.h"
 #include "ld10k1_tram.h"
+#include "ld10k1_batch.h"
 #include "ld10k1_error.h"
+#include "ld10k1_order.h"
 
 char *ld10k1_dsp_mgr_name_new(char **where, const char *from);
 int ld10k1_add_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *gctl);
@@ -42,17 +45,7 @@ void ld10k1_del_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *gctl);
 int ld10k1_dsp_mgr_patch_unload(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int idx);
 int ld10k1_get_used_index_for_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *gctl, int **idxs, int *cnt);
 
-unsigned int ld10k1_resolve_named_reg(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int reg);
-unsigned int ld10k1_gpr_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_count, int *res_count, int *res,
-	unsigned int usage, unsigned int val);
-unsigned int ld10k1_gpr_dyn_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_count, int *res_count, int *res);
-unsigned int ld10k1_const_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_const_count, int *res_const_count, int *res_const,
-	int max_res_count, int *res_count, int *res, int const_val);
-
-void ld10k1_const_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
-void ld10k1_const_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
-void ld10k1_gpr_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
-void ld10k1_gpr_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
+void ld10k1_dsp_mgr_alloc_init(ld10k1_dsp_mgr_t *dsp_mgr);
 
 ld10k1_conn_point_t *ld10k1_conn_point_alloc(int simple);
 void ld10k1_conn_point_free(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point);
@@ -105,17 +98,14 @@ int ld10k1_dsp_mgr_init(ld10k1_dsp_mgr_t *dsp_mgr)
 	int tmp_op_count = 0;
 	int i, j;
 
-	dsp_mgr->add_ctl_list = NULL;
-	dsp_mgr->add_list_count = 0;
-
-	dsp_mgr->del_ctl_list = NULL;
-	dsp_mgr->del_list_count = 0;
-
-	dsp_mgr->ctl_list = NULL;
-	dsp_mgr->ctl_list_count = 0;
+	ld10k1_init_control_list(&(dsp_mgr->add_ctl_list));
+	ld10k1_init_control_list(&(dsp_mgr->del_ctl_list));
+	ld10k1_init_control_list(&(dsp_mgr->ctl_list));
 	
 	dsp_mgr->point_list = 0;
 
+	dsp_mgr->batch = NULL;
+
 	if (dsp_mgr->audigy) {
 		tmp_itram_count = 0xC0;
 		tmp_etram_count = 0x100 - 0xC0;
@@ -131,9 +121,14 @@ int ld10k1_dsp_mgr_init(ld10k1_dsp_mgr_t *dsp_mgr)
 	dsp_mgr->instr_count = tmp_op_count;
 	dsp_mgr->instr_free = tmp_op_count;
 
+	memset(dsp_mgr->regs_dirty, 0, sizeof(dsp_mgr->regs_dirty));
+	memset(dsp_mgr->instr_dirty, 0, sizeof(dsp_mgr->instr_dirty));
+	memset(dsp_mgr->tram_dirty, 0, sizeof(dsp_mgr->tram_dirty));
+	dsp_mgr->phys_gen = 0;
+
 	for (i = 0; i < tmp_op_count; i++) {
 		dsp_mgr->instr[i].used = 0;
-		dsp_mgr->instr[i].modified = 1;
+		ld10k1_dsp_mgr_instr_modified(dsp_mgr, i);
 		dsp_mgr->instr[i].op_code = 0;
 		for (j = 0; j < 4; j++)
 		    dsp_mgr->instr[i].arg[j] = 0;
@@ -271,10 +266,16 @@ int ld10k1_dsp_mgr_init(ld10k1_dsp_mgr_t *dsp_mgr)
 		dsp_mgr->regs[i].gpr_usage = GPR_USAGE_NONE;
 		dsp_mgr->regs[i].val = 0;
 		dsp_mgr->regs[i].ref = 0;
-		dsp_mgr->regs[i].modified = 1;
+		ld10k1_dsp_mgr_reg_modified(dsp_mgr, i);
 	}
 
+	ld10k1_dsp_mgr_alloc_init(dsp_mgr);
+
 	dsp_mgr->patch_count = 0;
+	dsp_mgr->auto_order = 0;
+	dsp_mgr->order_dirty = 0;
+	dsp_mgr->optimize = 0;
+	dsp_mgr->gpr_write_pending = 0;
 
 	for (i = 0; i < 0x100; i++) {
 		dsp_mgr->tram_acc[i].used = 0;
@@ -310,6 +311,9 @@ int ld10k1_dsp_mgr_init(ld10k1_dsp_mgr_t *dsp_mgr)
 	dsp_mgr->max_itram_hwacc = tmp_itram_count;
 	dsp_mgr->max_etram_hwacc = tmp_etram_count;
 
+	for (i = 0; i < tmp_itram_count + tmp_etram_count; i++)
+		set_bit(i, dsp_mgr->tram_dirty);
+
 	dsp_mgr->i_tram.size = 0;
 	dsp_mgr->i_tram.max_hwacc = tmp_itram_count;
 	dsp_mgr->i_tram.hwacc = dsp_mgr->itram_hwacc;
@@ -320,6 +324,8 @@ int ld10k1_dsp_mgr_init(ld10k1_dsp_mgr_t *dsp_mgr)
 	dsp_mgr->e_tram.hwacc = dsp_mgr->etram_hwacc;
 	dsp_mgr->e_tram.used_hwacc = 0;
 
+	ld10k1_tram_init_space(dsp_mgr);
+
 	dsp_mgr->patch_count = 0;
 	for (i = 0; i < EMU10K1_PATCH_MAX; i++) {
 		dsp_mgr->patch_ptr[i] = NULL;
@@ -346,9 +352,11 @@ void ld10k1_dsp_mgr_free(ld10k1_dsp_mgr_t *dsp_mgr)
 		    ld10k1_dsp_mgr_patch_unload(dsp_mgr, dsp_mgr->patch_ptr[i], i);
 	}
 
-	ld10k1_del_all_controls_from_list(&(dsp_mgr->del_ctl_list), &dsp_mgr->del_list_count);
-	ld10k1_del_all_controls_from_list(&(dsp_mgr->add_ctl_list), &dsp_mgr->add_list_count);
-	ld10k1_del_all_controls_from_list(&(dsp_mgr->ctl_list), &dsp_mgr->ctl_list_count);
+	ld10k1_del_all_controls_from_list(&(dsp_mgr->del_ctl_list));
+	ld10k1_del_all_controls_from_list(&(dsp_mgr->add_ctl_list));
+	ld10k1_del_all_controls_from_list(&(dsp_mgr->ctl_list));
+
+	ld10k1_batch_free(dsp_mgr);
 
 	/* FIXME - uvolnovanie point - asi netreba - su uvolnovane pri patch */
 	for (i = 0; i < dsp_mgr->fx_count; i++)
@@ -374,6 +382,7 @@ ld10k1_patch_t *ld10k1_dsp_mgr_patch_new(void)
 
 	np->patch_name = NULL;
 	np->id = 0;
+	np->loop_break = 0;
 
 	np->in_count = 0;
 	np->ins = NULL;
@@ -404,8 +413,12 @@ ld10k1_patch_t *ld10k1_dsp_mgr_patch_new(void)
 
 	np->instr_count = 0;
 	np->instr_offset = 0;
+	np->instr_modified = 1;
+	np->instr_removed = 0;
 	np->instr = NULL;
 
+	np->instr_use = NULL;
+
 	return np;
 }
 
@@ -454,6 +467,9 @@ void ld10k1_dsp_mgr_patch_free(ld10k1_patch_t *patch)
 	if (patch->instr)
 		free(patch->instr);
 
+	if (patch->instr_use)
+		free(patch->instr_use);
+
 	free(patch);
 }
 
@@ -653,6 +669,28 @@ char *ld10k1_dsp_mgr_name_new(char **where, const char *from)
 	return ns;
 }
 
+void ld10k1_dsp_mgr_reg_modified(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int idx)
+{
+	dsp_mgr->regs[idx].modified = 1;
+	set_bit(idx, dsp_mgr->regs_dirty);
+}
+
+void ld10k1_dsp_mgr_instr_modified(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int idx)
+{
+	dsp_mgr->instr[idx].modified = 1;
+	set_bit(idx, dsp_mgr->instr_dirty);
+}
+
+/* acc is index to itram hwacc followed by etram hwacc */
+void ld10k1_dsp_mgr_tram_modified(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int acc)
+{
+	if (acc < dsp_mgr->max_itram_hwacc)
+		dsp_mgr->itram_hwacc[acc].modified = 1;
+	else
+		dsp_mgr->etram_hwacc[acc - dsp_mgr->max_itram_hwacc].modified = 1;
+	set_bit(acc, dsp_mgr->tram_dirty);
+}
+
 void ld10k1_dsp_mgr_op(ld10k1_instr_t *instr, unsigned int op, unsigned int arg1, unsigned int arg2, unsigned int arg3, unsigned int arg4)
 {
 	instr->used = 1;
@@ -778,8 +816,10 @@ int ld10k1_dsp_mgr_get_phys_reg_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patc
 {
 	unsigned int ind_reg = 0;
 	unsigned int acc_idx = 0;
+	int phys;
 
 	ld10k1_conn_point_t *point;
+	ld10k1_p_in_out_t *io = NULL;
 
 	switch (EMU10K1_PREG_TYPE_B(reg)) {
 		case EMU10K1_PREG_TYPE_IN:
@@ -788,15 +828,21 @@ int ld10k1_dsp_mgr_get_phys_reg_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patc
 			else
 				ind_reg = EMU10K1_REG_HW(0);
 			break;*/
-			if (patch->ins[reg & 0xFFFFFFF].point) {
-				point = patch->ins[reg & 0xFFFFFFF].point;
+			io = &(patch->ins[reg & 0xFFFFFFF]);
+			if (io->phys_gen == dsp_mgr->phys_gen)
+				return io->phys;
+			if (io->point) {
+				point = io->point;
 				ind_reg = ld10k1_conn_point_get_reg(dsp_mgr, point, CON_IO_PIN, patch, reg & 0xFFFFFFF);
 			} else
 				ind_reg = EMU10K1_REG_HW(0);
 			break;
 		case EMU10K1_PREG_TYPE_OUT:
-			if (patch->outs[reg & 0xFFFFFFF].point) {
-				point = patch->outs[reg & 0xFFFFFFF].point;
+			io = &(patch->outs[reg & 0xFFFFFFF]);
+			if (io->phys_gen == dsp_mgr->phys_gen)
+				return io->phys;
+			if (io->point) {
+				point = io->point;
 
 				ind_reg = ld10k1_conn_point_get_reg(dsp_mgr, point, CON_IO_POUT, patch, reg & 0xFFFFFFF);
 			} else
@@ -829,9 +875,12 @@ int ld10k1_dsp_mgr_get_phys_reg_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patc
 			return -1;
 	}
 
-	if (ind_reg)
-		return ld10k1_dsp_mgr_get_phys_reg(dsp_mgr, ind_reg);
-	return -1;
+	phys = ind_reg ? ld10k1_dsp_mgr_get_phys_reg(dsp_mgr, ind_reg) : -1;
+	if (io) {
+		io->phys = phys;
+		io->phys_gen = dsp_mgr->phys_gen;
+	}
+	return phys;
 }
 
 int ld10k1_dsp_mgr_actualize_instr(ld10k1_dsp_mgr_t *dsp_mgr)
@@ -843,9 +892,23 @@ int ld10k1_dsp_mgr_actualize_instr(ld10k1_dsp_mgr_t *dsp_mgr)
 	ld10k1_conn_point_t *tmp_point;
 	int allmodified = 0;
 	int found;
+	int err;
+
+	/* everything will be done at once on batch commit */
+	if (dsp_mgr->batch)
+		return 0;
+
+	/* connections changed - producers are moved before consumers */
+	if (dsp_mgr->auto_order && dsp_mgr->order_dirty)
+		if ((err = ld10k1_dsp_mgr_auto_order(dsp_mgr)) < 0)
+			return err;
 	
 	instr_offset = 0;
 
+	/* forget physical registers cached by previous actualization, 0 is never valid */
+	if (!++dsp_mgr->phys_gen)
+		dsp_mgr->phys_gen++;
+
 	/* intruction actualization */
 	for (i = 0; i < dsp_mgr->patch_count; i++) {
   		tmpp = dsp_mgr->patch_ptr[dsp_mgr->patch_order[i]];
@@ -886,7 +949,7 @@ int ld10k1_dsp_mgr_actualize_instr(ld10k1_dsp_mgr_t *dsp_mgr)
 								instr = &(dsp_mgr->instr[k + tmp_point->out_instr_offset]);
 
 								instr->used = 1;
-								instr->modified = 1;
+								ld10k1_dsp_mgr_instr_modified(dsp_mgr, k + tmp_point->out_instr_offset);
 								instr->op_code = tmp_point->out_instr[k].op_code;
 								for (l = 0; l < 4; l++)
 									instr->arg[l] = ld10k1_dsp_mgr_get_phys_reg(dsp_mgr, tmp_point->out_instr[k].arg[l]);
@@ -903,17 +966,21 @@ int ld10k1_dsp_mgr_actualize_instr(ld10k1_dsp_mgr_t *dsp_mgr)
 
 				tmpp->instr_offset = instr_offset;
 
-				for (j = 0; j < tmpp->instr_count; j++)
-					if (allmodified || tmpp->instr[j].modified) {
-						instr = &(dsp_mgr->instr[j + tmpp->instr_offset]);
-
-						instr->used = 1;
-						instr->modified = 1;
-						instr->op_code = tmpp->instr[j].op_code;
-						for (k = 0; k < 4; k++)
-							instr->arg[k] = ld10k1_dsp_mgr_get_phys_reg_for_patch(dsp_mgr, tmpp, tmpp->instr[j].arg[k]);
-						tmpp->instr[j].modified = 0;
-					}
+				/* patch didn't move and nothing in it changed - skip it */
+				if (allmodified || tmpp->instr_modified) {
+					for (j = 0; j < tmpp->instr_count; j++)
+						if (allmodified || tmpp->instr[j].modified) {
+							instr = &(dsp_mgr->instr[j + tmpp->instr_offset]);
+
+							instr->used = 1;
+							ld10k1_dsp_mgr_instr_modified(dsp_mgr, j + tmpp->instr_offset);
+							instr->op_code = tmpp->instr[j].op_code;
+							for (k = 0; k < 4; k++)
+								instr->arg[k] = ld10k1_dsp_mgr_get_phys_reg_for_patch(dsp_mgr, tmpp, tmpp->instr[j].arg[k]);
+							tmpp->instr[j].modified = 0;
+						}
+					tmpp->instr_modified = 0;
+				}
 				instr_offset += tmpp->instr_count;
 			}
 		}
@@ -921,7 +988,7 @@ int ld10k1_dsp_mgr_actualize_instr(ld10k1_dsp_mgr_t *dsp_mgr)
 
 	for (j = instr_offset; j < dsp_mgr->instr_count; j++) {
 		if (dsp_mgr->instr[j].used) {
-			dsp_mgr->instr[j].modified = 1;
+			ld10k1_dsp_mgr_instr_modified(dsp_mgr, j);
 			dsp_mgr->instr[j].used = 0;
 		}
 	}
@@ -930,16 +997,100 @@ int ld10k1_dsp_mgr_actualize_instr(ld10k1_dsp_mgr_t *dsp_mgr)
 
 int ld10k1_dsp_mgr_actualize_instr_for_reg(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int reg)
 {
+	ld10k1_p_in_out_t *io;
 	int j, k;
 
+	switch (EMU10K1_PREG_TYPE_B(reg)) {
+		case EMU10K1_PREG_TYPE_IN:
+			io = &(patch->ins[reg & 0xFFFFFFF]);
+			break;
+		case EMU10K1_PREG_TYPE_OUT:
+			io = &(patch->outs[reg & 0xFFFFFFF]);
+			break;
+		default:
+			io = NULL;
+	}
+
+	if (io && patch->instr_use) {
+		for (j = 0; j < io->instr_use_count; j++)
+			patch->instr[io->instr_use[j]].modified = 1;
+		if (io->instr_use_count)
+			patch->instr_modified = 1;
+		return 0;
+	}
+
 	for (j = 0; j < patch->instr_count; j++)
 		for (k = 0; k < 4; k++)
 			if (patch->instr[j].arg[k] == reg) {
 				patch->instr[j].modified = 1;
+				patch->instr_modified = 1;
 			}
 	return 0;
 }
 
+/* build index of instructions using patch ins and outs */
+int ld10k1_dsp_mgr_patch_index_io(ld10k1_patch_t *patch)
+{
+	ld10k1_p_in_out_t *io;
+	unsigned int total, arg;
+	int i, j, k, l, pass;
+
+	if (patch->instr_use) {
+		free(patch->instr_use);
+		patch->instr_use = NULL;
+	}
+
+	/* first pass counts, second fills */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < patch->in_count; i++)
+			patch->ins[i].instr_use_count = 0;
+		for (i = 0; i < patch->out_count; i++)
+			patch->outs[i].instr_use_count = 0;
+
+		for (j = 0; j < patch->instr_count; j++)
+			for (k = 0; k < 4; k++) {
+				arg = patch->instr[j].arg[k];
+				if (EMU10K1_PREG_TYPE_B(arg) == EMU10K1_PREG_TYPE_IN)
+					io = &(patch->ins[arg & 0xFFFFFFF]);
+				else if (EMU10K1_PREG_TYPE_B(arg) == EMU10K1_PREG_TYPE_OUT)
+					io = &(patch->outs[arg & 0xFFFFFFF]);
+				else
+					continue;
+				/* instruction is listed only once */
+				for (l = 0; l < k; l++)
+					if (patch->instr[j].arg[l] == arg)
+						break;
+				if (l < k)
+					continue;
+				if (pass)
+					io->instr_use[io->instr_use_count] = j;
+				io->instr_use_count++;
+			}
+
+		if (pass)
+			break;
+
+		for (i = 0, total = 0; i < patch->in_count; i++)
+			total += patch->ins[i].instr_use_count;
+		for (i = 0; i < patch->out_count; i++)
+			total += patch->outs[i].instr_use_count;
+
+		patch->instr_use = (unsigned int *)malloc(sizeof(unsigned int) * (total ? total : 1));
+		if (!patch->instr_use)
+			return LD10K1_ERR_NO_MEM;
+
+		for (i = 0, total = 0; i < patch->in_count; i++) {
+			patch->ins[i].instr_use = patch->instr_use + total;
+			total += patch->ins[i].instr_use_count;
+		}
+		for (i = 0; i < patch->out_count; i++) {
+			patch->outs[i].instr_use = patch->instr_use + total;
+			total += patch->outs[i].instr_use_count;
+		}
+	}
+	return 0;
+}
+
 void ld10k1_dsp_mgr_actualize_order(ld10k1_dsp_mgr_t *dsp_mgr)
 {
 	int i;
@@ -972,6 +1123,9 @@ int ld10k1_dsp_mgr_patch_load(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch,
 	if (dsp_mgr->patch_count >= EMU10K1_PATCH_MAX)
 		return LD10K1_ERR_MAX_PATCH_COUNT;
 
+	if ((err = ld10k1_dsp_mgr_patch_index_io(patch)) < 0)
+		return err;
+
 	/* get patch number */
 	for (i = 0, pp = -1; i < dsp_mgr->patch_count; i++)
 		if (dsp_mgr->patch_ptr[i] == NULL)
@@ -1071,17 +1225,22 @@ int ld10k1_dsp_mgr_patch_load(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch,
 	for (i = 0; i < res_count; i++)
 		ld10k1_gpr_alloc(dsp_mgr, res[i]);
 
-	/* actualize tram */
-	if (patch->tram_count > 0)
-		for (i = 0; i < dsp_mgr->patch_count; i++) {
-			tpatch = dsp_mgr->patch_ptr[dsp_mgr->patch_order[i]];
-			if (tpatch->tram_count)
-				ld10k1_tram_actualize_tram_for_patch(dsp_mgr, tpatch);
-		}
+	/* actualize tram - other patches only if their groups were moved */
+	if (patch->tram_count > 0) {
+		if (tram_res.icompact || tram_res.ecompact) {
+			for (i = 0; i < dsp_mgr->patch_count; i++) {
+				tpatch = dsp_mgr->patch_ptr[dsp_mgr->patch_order[i]];
+				if (tpatch->tram_count)
+					ld10k1_tram_actualize_tram_for_patch(dsp_mgr, tpatch);
+			}
+		} else
+			ld10k1_tram_actualize_tram_for_patch(dsp_mgr, patch);
+	}
 
 	dsp_mgr->instr_free -= patch->instr_count;
 
 	ld10k1_dsp_mgr_actualize_order(dsp_mgr);
+	dsp_mgr->order_dirty = 1;
 	return ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
 }
 
@@ -1141,6 +1300,7 @@ int ld10k1_dsp_mgr_patch_unload(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch
 	dsp_mgr->instr_free += patch->instr_count;
 
 	ld10k1_dsp_mgr_actualize_order(dsp_mgr);
+	dsp_mgr->order_dirty = 1;
 	/* actualize instructons */
 	return ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
 }
@@ -1276,6 +1436,128 @@ int ld10k1_patch_fnc_del(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_fnc_patch_del_t *patc
 		return LD10K1_ERR_UNKNOWN_PATCH_NUM;
 }
 
+ld10k1_patch_t *ld10k1_dsp_mgr_patch_find_id(ld10k1_dsp_mgr_t *dsp_mgr, int patch_id)
+{
+	int i;
+
+	for (i = 0; i < EMU10K1_PATCH_MAX; i++)
+		if (dsp_mgr->patch_ptr[i] && dsp_mgr->patch_ptr[i]->id == patch_id)
+			return dsp_mgr->patch_ptr[i];
+	return NULL;
+}
+
+/* register and value can be written */
+int ld10k1_dsp_mgr_patch_gpr_check(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int reg, unsigned int val)
+{
+	ld10k1_ctl_t *ctl;
+	unsigned int idx;
+
+	switch (EMU10K1_PREG_TYPE_B(reg)) {
+		case EMU10K1_PREG_TYPE_STA:
+			idx = reg & ~EMU10K1_PREG_TYPE_MASK;
+			if (idx >= patch->sta_count)
+				return LD10K1_ERR_UNKNOWN_PATCH_REG_NUM;
+			return 0;
+		case EMU10K1_PREG_TYPE_CTL:
+			idx = (reg & 0xFF00) >> 8;
+			if ((reg & ~(EMU10K1_PREG_TYPE_MASK | 0xFFFF)) || idx >= patch->ctl_count)
+				return LD10K1_ERR_UNKNOWN_PATCH_REG_NUM;
+			ctl = &(patch->ctl[idx]);
+			/* only values visible in mixer */
+			idx = reg & 0xFF;
+			if (idx >= ctl->vcount)
+				return LD10K1_ERR_UNKNOWN_PATCH_REG_NUM;
+			if (val < ctl->min || val > ctl->max)
+				return LD10K1_ERR_CTL_REG_VALUE;
+			return 0;
+		default:
+			return LD10K1_ERR_UNKNOWN_PATCH_REG_NUM;
+	}
+}
+
+/*
+ * Static register is uploaded on next driver update. Control value is
+ * written through mixer - driver translates it (table100, bass, treble,
+ * onoff) and mixer shows new value.
+ */
+int ld10k1_dsp_mgr_patch_gpr_write(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int reg, unsigned int val)
+{
+	ld10k1_ctl_t *ctl;
+	unsigned int gpr;
+	unsigned int idx;
+	int err;
+
+	if ((err = ld10k1_dsp_mgr_patch_gpr_check(dsp_mgr, patch, reg, val)) < 0)
+		return err;
+
+	if (EMU10K1_PREG_TYPE_B(reg) == EMU10K1_PREG_TYPE_STA) {
+		idx = reg & ~EMU10K1_PREG_TYPE_MASK;
+		patch->stas[idx].const_val = val;
+		gpr = patch->stas[idx].gpr_idx & ~EMU10K1_REG_TYPE_MASK;
+		if (dsp_mgr->regs[gpr].val != val) {
+			dsp_mgr->regs[gpr].val = val;
+			ld10k1_dsp_mgr_reg_modified(dsp_mgr, gpr);
+			dsp_mgr->gpr_write_pending = 1;
+		}
+		return 0;
+	}
+
+	ctl = &(patch->ctl[(reg & 0xFF00) >> 8]);
+	return ld10k1_driver_ctl_write(dsp_mgr, ctl, reg & 0xFF, val);
+}
+
+/* index of patch register in gpr_map or tram_data_map of code peek, -1 - not readable */
+int ld10k1_dsp_mgr_patch_peek_idx(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int reg, int *tram)
+{
+	unsigned int idx = reg & ~EMU10K1_PREG_TYPE_MASK;
+	unsigned int count;
+	unsigned int gpr_base;
+	int phys;
+
+	switch (EMU10K1_PREG_TYPE_B(reg)) {
+		case EMU10K1_PREG_TYPE_IN:
+			count = patch->in_count;
+			break;
+		case EMU10K1_PREG_TYPE_OUT:
+			count = patch->out_count;
+			break;
+		case EMU10K1_PREG_TYPE_CONST:
+			count = patch->const_count;
+			break;
+		case EMU10K1_PREG_TYPE_STA:
+			count = patch->sta_count;
+			break;
+		case EMU10K1_PREG_TYPE_DYN:
+			count = patch->dyn_count;
+			break;
+		case EMU10K1_PREG_TYPE_CTL:
+			if (idx > 0xFFFF || (idx >> 8) >= patch->ctl_count)
+				return -1;
+			count = patch->ctl[idx >> 8].count;
+			idx &= 0xFF;
+			break;
+		case EMU10K1_PREG_TYPE_TRAM_DATA:
+			count = patch->tram_acc_count;
+			break;
+		default:
+			return -1;
+	}
+	if (idx >= count)
+		return -1;
+
+	phys = ld10k1_dsp_mgr_get_phys_reg_for_patch(dsp_mgr, patch, reg);
+	gpr_base = dsp_mgr->audigy ? 0x400 : 0x100;
+	if (phys >= gpr_base && phys < gpr_base + dsp_mgr->regs_max_count) {
+		*tram = 0;
+		return phys - gpr_base;
+	}
+	if (phys >= 0x200 && phys < 0x200 + dsp_mgr->max_itram_hwacc + dsp_mgr->max_etram_hwacc) {
+		*tram = 1;
+		return phys - 0x200;
+	}
+	return -1;
+}
+
 int ld10k1_connection_fnc(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_fnc_connection_t *connection_fnc, int *conn_id)
 {
 	ld10k1_patch_t *from_patch = NULL;
@@ -1426,6 +1708,7 @@ int ld10k1_connection_fnc(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_fnc_connection_t *co
 			
 		*conn_id = tmp_point->id;
 		
+		dsp_mgr->order_dirty = 1;
 		ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
 		return 0;
 	} if (connection_fnc->what == FNC_CONNECTION_DEL) {
@@ -1463,44 +1746,129 @@ int ld10k1_connection_fnc(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_fnc_connection_t *co
 			
 		ld10k1_conn_point_del(dsp_mgr, from_point, connection_fnc->from_type, from_patch, connection_fnc->from_io);
 
+		dsp_mgr->order_dirty = 1;
 		ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
 		return 0;
 	} else
 		return LD10K1_ERR_CONNECTION_FNC;
 }
 
-ld10k1_ctl_list_item_t *ld10k1_look_control_from_list(ld10k1_ctl_list_item_t *list, ld10k1_ctl_t *gctl)
+/* controls are kept in list (order of list is order for driver) indexed by open addressing hash */
+static unsigned int ld10k1_ctl_hash_fnc(const char *name, int index)
+{
+	unsigned int h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	h ^= (unsigned int)index;
+	h *= 16777619U;
+	return h;
+}
+
+static void ld10k1_ctl_hash_insert(ld10k1_ctl_list_t *list, ld10k1_ctl_list_item_t *item)
+{
+	unsigned int mask = list->hash_size - 1;
+	unsigned int i;
+
+	for (i = item->hash & mask; list->hash[i]; i = (i + 1) & mask)
+		;
+	list->hash[i] = item;
+}
+
+static int ld10k1_ctl_hash_grow(ld10k1_ctl_list_t *list)
+{
+	ld10k1_ctl_list_item_t **old_hash = list->hash;
+	ld10k1_ctl_list_item_t *item;
+	unsigned int new_size = list->hash_size ? list->hash_size * 2 : 32;
+
+	list->hash = (ld10k1_ctl_list_item_t **)calloc(new_size, sizeof(ld10k1_ctl_list_item_t *));
+	if (!list->hash) {
+		list->hash = old_hash;
+		return LD10K1_ERR_NO_MEM;
+	}
+	list->hash_size = new_size;
+
+	for (item = list->first; item != NULL; item = item->next)
+		ld10k1_ctl_hash_insert(list, item);
+
+	if (old_hash)
+		free(old_hash);
+	return 0;
+}
+
+/* remove from hash - following items in cluster are moved back */
+static void ld10k1_ctl_hash_remove(ld10k1_ctl_list_t *list, ld10k1_ctl_list_item_t *item)
+{
+	unsigned int mask = list->hash_size - 1;
+	unsigned int i, j, k;
+
+	for (i = item->hash & mask; list->hash[i] != item; i = (i + 1) & mask)
+		;
+
+	list->hash[i] = NULL;
+	for (j = (i + 1) & mask; list->hash[j]; j = (j + 1) & mask) {
+		k = list->hash[j]->hash & mask;
+		/* can item at j be moved to i */
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			list->hash[i] = list->hash[j];
+			list->hash[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+void ld10k1_init_control_list(ld10k1_ctl_list_t *list)
+{
+	list->first = NULL;
+	list->count = 0;
+	list->hash = NULL;
+	list->hash_size = 0;
+}
+
+ld10k1_ctl_list_item_t *ld10k1_look_control_from_list(ld10k1_ctl_list_t *list, ld10k1_ctl_t *gctl)
 {
 	ld10k1_ctl_list_item_t *item;
+	unsigned int h, mask, i;
 
-	for (item = list; item != NULL; item = item->next)
-		if (strcmp(item->ctl.name, gctl->name) == 0 && item->ctl.index == gctl->index)
+	if (!list->count)
+		return NULL;
+
+	h = ld10k1_ctl_hash_fnc(gctl->name, gctl->index);
+	mask = list->hash_size - 1;
+	for (i = h & mask; (item = list->hash[i]) != NULL; i = (i + 1) & mask)
+		if (item->hash == h && item->ctl.index == gctl->index && strcmp(item->ctl.name, gctl->name) == 0)
 			return item;
 
 	return NULL;
 }
 
-int ld10k1_add_control_to_list(ld10k1_ctl_list_item_t **list, int *count, ld10k1_ctl_t *gctl)
+int ld10k1_add_control_to_list(ld10k1_ctl_list_t *list, ld10k1_ctl_t *gctl)
 {
 	ld10k1_ctl_list_item_t *item;
 	
-	item = ld10k1_look_control_from_list(*list, gctl);
+	item = ld10k1_look_control_from_list(list, gctl);
 	if (!item) {
+		/* keep hash at most half full */
+		if ((list->count + 1) * 2 > list->hash_size)
+			if (ld10k1_ctl_hash_grow(list) < 0)
+				return LD10K1_ERR_NO_MEM;
+
 		item = (ld10k1_ctl_list_item_t *)malloc(sizeof(ld10k1_ctl_list_item_t));
 		if (!item)
 			return LD10K1_ERR_NO_MEM;
 
-		item->next = NULL;
+		/* add to begining */
+		item->prev = NULL;
+		item->next = list->first;
+		if (list->first)
+			list->first->prev = item;
+		list->first = item;
+		list->count++;
 
-		if (!*list)
-			/* empty */
-			*list = item;
-		else {
-			/* add to begining */
-			item->next = *list;
-			*list = item;
-		}
-		(*count)++;
+		item->hash = ld10k1_ctl_hash_fnc(gctl->name, gctl->index);
+		ld10k1_ctl_hash_insert(list, item);
 	}
 
 	memcpy(&(item->ctl), gctl, sizeof(*gctl));
@@ -1508,45 +1876,41 @@ int ld10k1_add_control_to_list(ld10k1_ctl_list_item_t **list, int *count, ld10k1
 	return 0;
 }
 
-void ld10k1_del_control_from_list(ld10k1_ctl_list_item_t **list, int *count, ld10k1_ctl_t *gctl)
+void ld10k1_del_control_from_list(ld10k1_ctl_list_t *list, ld10k1_ctl_t *gctl)
 {
 	ld10k1_ctl_list_item_t *item;
-	ld10k1_ctl_list_item_t *item1;
 
-	if (!*list)
-		return;
-
-	item = ld10k1_look_control_from_list(*list, gctl);
+	item = ld10k1_look_control_from_list(list, gctl);
 	if (!item)
 		return;
-		
-	if (*list == item) {
-		*list = item->next;
-	} else {
-		for (item1 = *list; item1->next != NULL; item1 = item1->next)
-			if (item1->next == item) {
-				item1->next = item->next;
-				break;
-			}
-	}
+
+	ld10k1_ctl_hash_remove(list, item);
+
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		list->first = item->next;
+	if (item->next)
+		item->next->prev = item->prev;
 
 	free(item);
-	(*count)--;
+	list->count--;
 }
 
-void ld10k1_del_all_controls_from_list(ld10k1_ctl_list_item_t **list, int *count)
+void ld10k1_del_all_controls_from_list(ld10k1_ctl_list_t *list)
 {
 	ld10k1_ctl_list_item_t *item;
 	ld10k1_ctl_list_item_t *item1;
 	
-	for (item = *list; item != NULL;) {
+	for (item = list->first; item != NULL;) {
 		item1 = item->next;
 		free(item);
 		item = item1;
 	}
-	
-	*count = 0;
-	*list = NULL;
+
+	if (list->hash)
+		free(list->hash);
+	ld10k1_init_control_list(list);
 }
 
 int ld10k1_get_used_index_for_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *gctl, int **idxs, int *cnt)
@@ -1561,11 +1925,11 @@ int ld10k1_get_used_index_for_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *g
 	i = 0;
 	
 	/* first get count */
-	for (item = dsp_mgr->ctl_list; item != NULL; item = item->next)
+	for (item = dsp_mgr->ctl_list.first; item != NULL; item = item->next)
 		if (strcmp(item->ctl.name, gctl->name) == 0)
 			count++;
 			
-	for (item = dsp_mgr->add_ctl_list; item != NULL; item = item->next)
+	for (item = dsp_mgr->add_ctl_list.first; item != NULL; item = item->next)
 		if (strcmp(item->ctl.name, gctl->name) == 0)
 			count++;
 			
@@ -1584,11 +1948,11 @@ int ld10k1_get_used_index_for_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *g
 	if (!index_list)
 		return LD10K1_ERR_NO_MEM;
 		
-	for (item = dsp_mgr->ctl_list; item != NULL; item = item->next)
+	for (item = dsp_mgr->ctl_list.first; item != NULL; item = item->next)
 		if (strcmp(item->ctl.name, gctl->name) == 0)
 			index_list[i++] = item->ctl.index;
 	
-	for (item = dsp_mgr->add_ctl_list; item != NULL; item = item->next)
+	for (item = dsp_mgr->add_ctl_list.first; item != NULL; item = item->next)
 		if (strcmp(item->ctl.name, gctl->name) == 0)
 			index_list[i++] = item->ctl.index;
 	
@@ -1645,209 +2009,320 @@ int ld10k1_add_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *gctl)
 		gctl->index = gctl->want_index;
 	
 	/* is there control ??? */
-	if (ld10k1_look_control_from_list(dsp_mgr->ctl_list, gctl))
+	if (ld10k1_look_control_from_list(&(dsp_mgr->ctl_list), gctl))
 		return LD10K1_ERR_CTL_EXISTS;
 	/* is for add ??? */
-	if (ld10k1_look_control_from_list(dsp_mgr->add_ctl_list, gctl))
+	if (ld10k1_look_control_from_list(&(dsp_mgr->add_ctl_list), gctl))
 		return 0;
 
 	/* add */
-	return ld10k1_add_control_to_list(&(dsp_mgr->add_ctl_list), &(dsp_mgr->add_list_count), gctl);
+	return ld10k1_add_control_to_list(&(dsp_mgr->add_ctl_list), gctl);
 }
 
 void ld10k1_del_control(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_ctl_t *gctl)
 {
 	/* is for add ??? */
-	if (ld10k1_look_control_from_list(dsp_mgr->add_ctl_list, gctl)) {
-		ld10k1_del_control_from_list(&(dsp_mgr->add_ctl_list), &(dsp_mgr->add_list_count), gctl);
+	if (ld10k1_look_control_from_list(&(dsp_mgr->add_ctl_list), gctl)) {
+		ld10k1_del_control_from_list(&(dsp_mgr->add_ctl_list), gctl);
 		return;
 	}
 	
 	/* is for del ??? */
-	if (ld10k1_look_control_from_list(dsp_mgr->del_ctl_list, gctl))
+	if (ld10k1_look_control_from_list(&(dsp_mgr->del_ctl_list), gctl))
 		return;
 
 	/* delete ??? */
-	if (ld10k1_look_control_from_list(dsp_mgr->ctl_list, gctl)) {
-		ld10k1_add_control_to_list(&(dsp_mgr->del_ctl_list), &(dsp_mgr->del_list_count), gctl);
+	if (ld10k1_look_control_from_list(&(dsp_mgr->ctl_list), gctl)) {
+		ld10k1_add_control_to_list(&(dsp_mgr->del_ctl_list), gctl);
 		return;
 	}
 	return;
 }
 
-/* this will by usefull with modified as10k1 */
-unsigned int named_to_standard[] =
+/* named register -> physical register on live and audigy (0 - not present on chip),
+   indexed directly by group (fx, in, out, hw) and number of named register */
+#define NAMED_REG_GROUPS 4
+#define NAMED_REG_GROUP_SIZE 0x20
+#define NAMED_REG_IDX(reg) ((((reg) >> 8) & 0xFF) * NAMED_REG_GROUP_SIZE + ((reg) & 0xFF))
+#define NAMED_REG(reg, live, audigy) [NAMED_REG_IDX(reg)] = { live, audigy }
+
+static const unsigned int named_to_standard[NAMED_REG_GROUPS * NAMED_REG_GROUP_SIZE][2] =
 {
 	/* FX buses */
-	EMU10K1_NREG_FXBUS_PCM_LEFT,		EMU10K1_REG_FX(0x00),	EMU10K1_REG_FX(0x00),
-	EMU10K1_NREG_FXBUS_PCM_RIGHT,		EMU10K1_REG_FX(0x01),	EMU10K1_REG_FX(0x01),
-	EMU10K1_NREG_FXBUS_PCM_FRONT_LEFT,	EMU10K1_REG_FX(0x08),	EMU10K1_REG_FX(0x08),
-	EMU10K1_NREG_FXBUS_PCM_FRONT_RIGHT,	EMU10K1_REG_FX(0x09),	EMU10K1_REG_FX(0x09),
-	EMU10K1_NREG_FXBUS_PCM_REAR_LEFT,	EMU10K1_REG_FX(0x02),	EMU10K1_REG_FX(0x02),
-	EMU10K1_NREG_FXBUS_PCM_REAR_RIGHT,	EMU10K1_REG_FX(0x03),	EMU10K1_REG_FX(0x03),
-	EMU10K1_NREG_FXBUS_PCM_CENTER,		EMU10K1_REG_FX(0x06),	EMU10K1_REG_FX(0x06),
-	EMU10K1_NREG_FXBUS_PCM_LFE,			EMU10K1_REG_FX(0x07),	EMU10K1_REG_FX(0x07),
-	EMU10K1_NREG_FXBUS_MIDI_LEFT,		EMU10K1_REG_FX(0x04),	EMU10K1_REG_FX(0x04),
-	EMU10K1_NREG_FXBUS_MIDI_RIGHT,		EMU10K1_REG_FX(0x05),	EMU10K1_REG_FX(0x05),
-	EMU10K1_NREG_FXBUS_MIDI_REVERB,		EMU10K1_REG_FX(0x0C),	EMU10K1_REG_FX(0x0C),
-	EMU10K1_NREG_FXBUS_MIDI_CHORUS,		EMU10K1_REG_FX(0x0D),	EMU10K1_REG_FX(0x0D),
-
-	EMU10K1_A_NREG_FXBUS_PT_LEFT,		0,						EMU10K1_REG_FX(0x14),
-	EMU10K1_A_NREG_FXBUS_PT_RIGHT,		0,						EMU10K1_REG_FX(0x15),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_LEFT,	EMU10K1_REG_FX(0x00),	EMU10K1_REG_FX(0x00)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_RIGHT,	EMU10K1_REG_FX(0x01),	EMU10K1_REG_FX(0x01)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_FRONT_LEFT,	EMU10K1_REG_FX(0x08),	EMU10K1_REG_FX(0x08)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_FRONT_RIGHT,	EMU10K1_REG_FX(0x09),	EMU10K1_REG_FX(0x09)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_REAR_LEFT,	EMU10K1_REG_FX(0x02),	EMU10K1_REG_FX(0x02)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_REAR_RIGHT,	EMU10K1_REG_FX(0x03),	EMU10K1_REG_FX(0x03)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_CENTER,	EMU10K1_REG_FX(0x06),	EMU10K1_REG_FX(0x06)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_PCM_LFE,	EMU10K1_REG_FX(0x07),	EMU10K1_REG_FX(0x07)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_MIDI_LEFT,	EMU10K1_REG_FX(0x04),	EMU10K1_REG_FX(0x04)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_MIDI_RIGHT,	EMU10K1_REG_FX(0x05),	EMU10K1_REG_FX(0x05)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_MIDI_REVERB,	EMU10K1_REG_FX(0x0C),	EMU10K1_REG_FX(0x0C)),
+	NAMED_REG(EMU10K1_NREG_FXBUS_MIDI_CHORUS,	EMU10K1_REG_FX(0x0D),	EMU10K1_REG_FX(0x0D)),
+
+	NAMED_REG(EMU10K1_A_NREG_FXBUS_PT_LEFT,	0,	EMU10K1_REG_FX(0x14)),
+	NAMED_REG(EMU10K1_A_NREG_FXBUS_PT_RIGHT,	0,	EMU10K1_REG_FX(0x15)),
 
 	/* inputs */
-	EMU10K1_NREG_IN_AC97_LEFT,			EMU10K1_REG_IN(0x00),	EMU10K1_REG_IN(0x00),
-	EMU10K1_NREG_IN_AC97_RIGHT,			EMU10K1_REG_IN(0x01),	EMU10K1_REG_IN(0x01),
-	EMU10K1_NREG_IN_SPDIF_CD_LEFT,		EMU10K1_REG_IN(0x02),	EMU10K1_REG_IN(0x02),
-	EMU10K1_NREG_IN_SPDIF_CD_RIGHT,		EMU10K1_REG_IN(0x03),	EMU10K1_REG_IN(0x03),
-	EMU10K1_NREG_IN_SPDIF_OPT_LEFT,		EMU10K1_REG_IN(0x06),	EMU10K1_REG_IN(0x04),
-	EMU10K1_NREG_IN_SPDIF_OPT_RIGHT,	EMU10K1_REG_IN(0x07),	EMU10K1_REG_IN(0x05),
-	EMU10K1_NREG_IN_I2S_1_LEFT,			EMU10K1_REG_IN(0x08),	EMU10K1_REG_IN(0x08),
-	EMU10K1_NREG_IN_I2S_1_RIGHT,		EMU10K1_REG_IN(0x09),	EMU10K1_REG_IN(0x09),
-	EMU10K1_NREG_IN_I2S_2_LEFT,			EMU10K1_REG_IN(0x0C),	EMU10K1_REG_IN(0x0C),
-	EMU10K1_NREG_IN_I2S_2_RIGHT,		EMU10K1_REG_IN(0x0D),	EMU10K1_REG_IN(0x0D),
-
-	EMU10K1_L_NREG_IN_SPDIF_COAX_LEFT,	EMU10K1_REG_IN(0x0A),	0,
-	EMU10K1_L_NREG_IN_SPDIF_COAX_RIGHT,	EMU10K1_REG_IN(0x0B),	0,
-	EMU10K1_L_NREG_IN_ZOOM_LEFT,		EMU10K1_REG_IN(0x04),	0,
-	EMU10K1_L_NREG_IN_ZOOM_RIGHT,		EMU10K1_REG_IN(0x05),	0,
-	EMU10K1_L_NREG_IN_LINE_1_LEFT,		EMU10K1_REG_IN(0x08),	0,
-	EMU10K1_L_NREG_IN_LINE_1_RIGHT,		EMU10K1_REG_IN(0x09),	0,
-	EMU10K1_L_NREG_IN_LINE_2_LEFT,		EMU10K1_REG_IN(0x0C),	0,
-	EMU10K1_L_NREG_IN_LINE_2_RIGHT,		EMU10K1_REG_IN(0x0D),	0,
-
-	EMU10K1_A_NREG_IN_LINE_1_LEFT,		0,						EMU10K1_REG_IN(0x0A),
-	EMU10K1_A_NREG_IN_LINE_1_RIGHT,		0,						EMU10K1_REG_IN(0x0B),
-	EMU10K1_A_NREG_IN_LINE_2_LEFT,		0,						EMU10K1_REG_IN(0x08),
-	EMU10K1_A_NREG_IN_LINE_2_RIGHT,		0,						EMU10K1_REG_IN(0x09),
-	EMU10K1_A_NREG_IN_LINE_3_LEFT,		0,						EMU10K1_REG_IN(0x0C),
-	EMU10K1_A_NREG_IN_LINE_3_RIGHT,		0,						EMU10K1_REG_IN(0x0D),
+	NAMED_REG(EMU10K1_NREG_IN_AC97_LEFT,	EMU10K1_REG_IN(0x00),	EMU10K1_REG_IN(0x00)),
+	NAMED_REG(EMU10K1_NREG_IN_AC97_RIGHT,	EMU10K1_REG_IN(0x01),	EMU10K1_REG_IN(0x01)),
+	NAMED_REG(EMU10K1_NREG_IN_SPDIF_CD_LEFT,	EMU10K1_REG_IN(0x02),	EMU10K1_REG_IN(0x02)),
+	NAMED_REG(EMU10K1_NREG_IN_SPDIF_CD_RIGHT,	EMU10K1_REG_IN(0x03),	EMU10K1_REG_IN(0x03)),
+	NAMED_REG(EMU10K1_NREG_IN_SPDIF_OPT_LEFT,	EMU10K1_REG_IN(0x06),	EMU10K1_REG_IN(0x04)),
+	NAMED_REG(EMU10K1_NREG_IN_SPDIF_OPT_RIGHT,	EMU10K1_REG_IN(0x07),	EMU10K1_REG_IN(0x05)),
+	NAMED_REG(EMU10K1_NREG_IN_I2S_1_LEFT,	EMU10K1_REG_IN(0x08),	EMU10K1_REG_IN(0x08)),
+	NAMED_REG(EMU10K1_NREG_IN_I2S_1_RIGHT,	EMU10K1_REG_IN(0x09),	EMU10K1_REG_IN(0x09)),
+	NAMED_REG(EMU10K1_NREG_IN_I2S_2_LEFT,	EMU10K1_REG_IN(0x0C),	EMU10K1_REG_IN(0x0C)),
+	NAMED_REG(EMU10K1_NREG_IN_I2S_2_RIGHT,	EMU10K1_REG_IN(0x0D),	EMU10K1_REG_IN(0x0D)),
+
+	NAMED_REG(EMU10K1_L_NREG_IN_SPDIF_COAX_LEFT,	EMU10K1_REG_IN(0x0A),	0),
+	NAMED_REG(EMU10K1_L_NREG_IN_SPDIF_COAX_RIGHT,	EMU10K1_REG_IN(0x0B),	0),
+	NAMED_REG(EMU10K1_L_NREG_IN_ZOOM_LEFT,	EMU10K1_REG_IN(0x04),	0),
+	NAMED_REG(EMU10K1_L_NREG_IN_ZOOM_RIGHT,	EMU10K1_REG_IN(0x05),	0),
+	NAMED_REG(EMU10K1_L_NREG_IN_LINE_1_LEFT,	EMU10K1_REG_IN(0x08),	0),
+	NAMED_REG(EMU10K1_L_NREG_IN_LINE_1_RIGHT,	EMU10K1_REG_IN(0x09),	0),
+	NAMED_REG(EMU10K1_L_NREG_IN_LINE_2_LEFT,	EMU10K1_REG_IN(0x0C),	0),
+	NAMED_REG(EMU10K1_L_NREG_IN_LINE_2_RIGHT,	EMU10K1_REG_IN(0x0D),	0),
+
+	NAMED_REG(EMU10K1_A_NREG_IN_LINE_1_LEFT,	0,	EMU10K1_REG_IN(0x0A)),
+	NAMED_REG(EMU10K1_A_NREG_IN_LINE_1_RIGHT,	0,	EMU10K1_REG_IN(0x0B)),
+	NAMED_REG(EMU10K1_A_NREG_IN_LINE_2_LEFT,	0,	EMU10K1_REG_IN(0x08)),
+	NAMED_REG(EMU10K1_A_NREG_IN_LINE_2_RIGHT,	0,	EMU10K1_REG_IN(0x09)),
+	NAMED_REG(EMU10K1_A_NREG_IN_LINE_3_LEFT,	0,	EMU10K1_REG_IN(0x0C)),
+	NAMED_REG(EMU10K1_A_NREG_IN_LINE_3_RIGHT,	0,	EMU10K1_REG_IN(0x0D)),
 
 	/* outputs */
-	EMU10K1_NREG_OUT_FRONT_LEFT,		EMU10K1_REG_OUT(0x00),	EMU10K1_REG_OUT(0x08),
-	EMU10K1_NREG_OUT_FRONT_RIGHT,		EMU10K1_REG_OUT(0x01),	EMU10K1_REG_OUT(0x09),
-	EMU10K1_NREG_OUT_REAR_LEFT,			EMU10K1_REG_OUT(0x08),	EMU10K1_REG_OUT(0x0E),
-	EMU10K1_NREG_OUT_REAR_RIGHT,		EMU10K1_REG_OUT(0x09),	EMU10K1_REG_OUT(0x0F),
-	EMU10K1_NREG_OUT_CENTER,			EMU10K1_REG_OUT(0x04),	EMU10K1_REG_OUT(0x0A),
-	EMU10K1_NREG_OUT_LFE,				EMU10K1_REG_OUT(0x05),	EMU10K1_REG_OUT(0x0B),
-	EMU10K1_NREG_OUT_AC97_LEFT,			EMU10K1_REG_OUT(0x00),	EMU10K1_REG_OUT(0x10),
-	EMU10K1_NREG_OUT_AC97_RIGHT,		EMU10K1_REG_OUT(0x01),	EMU10K1_REG_OUT(0x11),
-	EMU10K1_NREG_OUT_ADC_LEFT,			EMU10K1_REG_OUT(0x0A),	EMU10K1_REG_OUT(0x16),
-	EMU10K1_NREG_OUT_ADC_RIGHT,			EMU10K1_REG_OUT(0x0B),	EMU10K1_REG_OUT(0x17),
-	EMU10K1_NREG_OUT_MIC,				EMU10K1_REG_OUT(0x0C),	EMU10K1_REG_OUT(0x18),
-	EMU10K1_NREG_OUT_HEADPHONE_LEFT,	EMU10K1_REG_OUT(0x06),	EMU10K1_REG_OUT(0x04),
-	EMU10K1_NREG_OUT_HEADPHONE_RIGHT,	EMU10K1_REG_OUT(0x07),	EMU10K1_REG_OUT(0x05),
-
-	EMU10K1_L_NREG_OUT_OPT_LEFT,		EMU10K1_REG_OUT(0x02),	0,
-	EMU10K1_L_NREG_OUT_OPT_RIGHT,		EMU10K1_REG_OUT(0x03),	0,
-
-	EMU10K1_A_NREG_OUT_D_FRONT_LEFT,	0,						EMU10K1_REG_OUT(0x00),
-	EMU10K1_A_NREG_OUT_D_FRONT_RIGHT,	0,						EMU10K1_REG_OUT(0x01),
-	EMU10K1_A_NREG_OUT_D_REAR_LEFT,		0,						EMU10K1_REG_OUT(0x06),
-	EMU10K1_A_NREG_OUT_D_REAR_RIGHT,	0,						EMU10K1_REG_OUT(0x07),
-	EMU10K1_A_NREG_OUT_D_CENTER,		0,						EMU10K1_REG_OUT(0x02),
-	EMU10K1_A_NREG_OUT_D_LFE,			0,						EMU10K1_REG_OUT(0x03),
+	NAMED_REG(EMU10K1_NREG_OUT_FRONT_LEFT,	EMU10K1_REG_OUT(0x00),	EMU10K1_REG_OUT(0x08)),
+	NAMED_REG(EMU10K1_NREG_OUT_FRONT_RIGHT,	EMU10K1_REG_OUT(0x01),	EMU10K1_REG_OUT(0x09)),
+	NAMED_REG(EMU10K1_NREG_OUT_REAR_LEFT,	EMU10K1_REG_OUT(0x08),	EMU10K1_REG_OUT(0x0E)),
+	NAMED_REG(EMU10K1_NREG_OUT_REAR_RIGHT,	EMU10K1_REG_OUT(0x09),	EMU10K1_REG_OUT(0x0F)),
+	NAMED_REG(EMU10K1_NREG_OUT_CENTER,	EMU10K1_REG_OUT(0x04),	EMU10K1_REG_OUT(0x0A)),
+	NAMED_REG(EMU10K1_NREG_OUT_LFE,	EMU10K1_REG_OUT(0x05),	EMU10K1_REG_OUT(0x0B)),
+	NAMED_REG(EMU10K1_NREG_OUT_AC97_LEFT,	EMU10K1_REG_OUT(0x00),	EMU10K1_REG_OUT(0x10)),
+	NAMED_REG(EMU10K1_NREG_OUT_AC97_RIGHT,	EMU10K1_REG_OUT(0x01),	EMU10K1_REG_OUT(0x11)),
+	NAMED_REG(EMU10K1_NREG_OUT_ADC_LEFT,	EMU10K1_REG_OUT(0x0A),	EMU10K1_REG_OUT(0x16)),
+	NAMED_REG(EMU10K1_NREG_OUT_ADC_RIGHT,	EMU10K1_REG_OUT(0x0B),	EMU10K1_REG_OUT(0x17)),
+	NAMED_REG(EMU10K1_NREG_OUT_MIC,	EMU10K1_REG_OUT(0x0C),	EMU10K1_REG_OUT(0x18)),
+	NAMED_REG(EMU10K1_NREG_OUT_HEADPHONE_LEFT,	EMU10K1_REG_OUT(0x06),	EMU10K1_REG_OUT(0x04)),
+	NAMED_REG(EMU10K1_NREG_OUT_HEADPHONE_RIGHT,	EMU10K1_REG_OUT(0x07),	EMU10K1_REG_OUT(0x05)),
+
+	NAMED_REG(EMU10K1_L_NREG_OUT_OPT_LEFT,	EMU10K1_REG_OUT(0x02),	0),
+	NAMED_REG(EMU10K1_L_NREG_OUT_OPT_RIGHT,	EMU10K1_REG_OUT(0x03),	0),
+
+	NAMED_REG(EMU10K1_A_NREG_OUT_D_FRONT_LEFT,	0,	EMU10K1_REG_OUT(0x00)),
+	NAMED_REG(EMU10K1_A_NREG_OUT_D_FRONT_RIGHT,	0,	EMU10K1_REG_OUT(0x01)),
+	NAMED_REG(EMU10K1_A_NREG_OUT_D_REAR_LEFT,	0,	EMU10K1_REG_OUT(0x06)),
+	NAMED_REG(EMU10K1_A_NREG_OUT_D_REAR_RIGHT,	0,	EMU10K1_REG_OUT(0x07)),
+	NAMED_REG(EMU10K1_A_NREG_OUT_D_CENTER,	0,	EMU10K1_REG_OUT(0x02)),
+	NAMED_REG(EMU10K1_A_NREG_OUT_D_LFE,	0,	EMU10K1_REG_OUT(0x03)),
 
 	/* hardware */
-	EMU10K1_NREG_CONST_00000000,		EMU10K1_REG_HW(0x00),	EMU10K1_REG_HW(0x00),
-	EMU10K1_NREG_CONST_00000001,		EMU10K1_REG_HW(0x01),	EMU10K1_REG_HW(0x01),
-	EMU10K1_NREG_CONST_00000002,		EMU10K1_REG_HW(0x02),	EMU10K1_REG_HW(0x02),
-	EMU10K1_NREG_CONST_00000003,		EMU10K1_REG_HW(0x03),	EMU10K1_REG_HW(0x03),
-	EMU10K1_NREG_CONST_00000004,		EMU10K1_REG_HW(0x04),	EMU10K1_REG_HW(0x04),
-	EMU10K1_NREG_CONST_00000008,		EMU10K1_REG_HW(0x05),	EMU10K1_REG_HW(0x05),
-	EMU10K1_NREG_CONST_00000010,		EMU10K1_REG_HW(0x06),	EMU10K1_REG_HW(0x06),
-	EMU10K1_NREG_CONST_00000020,		EMU10K1_REG_HW(0x07),	EMU10K1_REG_HW(0x07),
-	EMU10K1_NREG_CONST_00000100,		EMU10K1_REG_HW(0x08),	EMU10K1_REG_HW(0x08),
-	EMU10K1_NREG_CONST_00010000,		EMU10K1_REG_HW(0x09),	EMU10K1_REG_HW(0x09),
-	EMU10K1_L_NREG_CONST_00080000,		EMU10K1_REG_HW(0x0A),	0,
-	EMU10K1_A_NREG_CONST_00000800,		0,						EMU10K1_REG_HW(0x0A),
-	EMU10K1_NREG_CONST_10000000,		EMU10K1_REG_HW(0x0B),	EMU10K1_REG_HW(0x0B),
-	EMU10K1_NREG_CONST_20000000,		EMU10K1_REG_HW(0x0C),	EMU10K1_REG_HW(0x0C),
-	EMU10K1_NREG_CONST_40000000,		EMU10K1_REG_HW(0x0D),	EMU10K1_REG_HW(0x0D),
-	EMU10K1_NREG_CONST_80000000,		EMU10K1_REG_HW(0x0E),	EMU10K1_REG_HW(0x0E),
-	EMU10K1_NREG_CONST_7FFFFFFF,		EMU10K1_REG_HW(0x0F),	EMU10K1_REG_HW(0x0F),
-	EMU10K1_NREG_CONST_FFFFFFFF,		EMU10K1_REG_HW(0x10),	EMU10K1_REG_HW(0x10),
-	EMU10K1_NREG_CONST_FFFFFFFE,		EMU10K1_REG_HW(0x11),	EMU10K1_REG_HW(0x11),
-	EMU10K1_NREG_CONST_C0000000,		EMU10K1_REG_HW(0x12),	EMU10K1_REG_HW(0x12),
-	EMU10K1_NREG_CONST_4F1BBCDC,		EMU10K1_REG_HW(0x13),	EMU10K1_REG_HW(0x13),
-	EMU10K1_NREG_CONST_5A7EF9DB,		EMU10K1_REG_HW(0x14),	EMU10K1_REG_HW(0x14),
-	EMU10K1_NREG_CONST_00100000,		EMU10K1_REG_HW(0x15),	EMU10K1_REG_HW(0x15),
-
-	EMU10K1_NREG_HW_ACCUM,				EMU10K1_REG_HW(0x16),	EMU10K1_REG_HW(0x16),
-	EMU10K1_NREG_HW_CCR,				EMU10K1_REG_HW(0x17),	EMU10K1_REG_HW(0x17),
-	EMU10K1_NREG_HW_NOISE1,				EMU10K1_REG_HW(0x18),	EMU10K1_REG_HW(0x18),
-	EMU10K1_NREG_HW_NOISE2,				EMU10K1_REG_HW(0x19),	EMU10K1_REG_HW(0x19),
-	EMU10K1_NREG_HW_IRQ,				EMU10K1_REG_HW(0x1A),	EMU10K1_REG_HW(0x1A),
-	EMU10K1_NREG_HW_DBAC,				EMU10K1_REG_HW(0x1B),	EMU10K1_REG_HW(0x1B),
-	EMU10K1_A_NREG_HW_DBACE,			0,						EMU10K1_REG_HW(0x1D),
-	0
+	NAMED_REG(EMU10K1_NREG_CONST_00000000,	EMU10K1_REG_HW(0x00),	EMU10K1_REG_HW(0x00)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000001,	EMU10K1_REG_HW(0x01),	EMU10K1_REG_HW(0x01)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000002,	EMU10K1_REG_HW(0x02),	EMU10K1_REG_HW(0x02)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000003,	EMU10K1_REG_HW(0x03),	EMU10K1_REG_HW(0x03)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000004,	EMU10K1_REG_HW(0x04),	EMU10K1_REG_HW(0x04)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000008,	EMU10K1_REG_HW(0x05),	EMU10K1_REG_HW(0x05)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000010,	EMU10K1_REG_HW(0x06),	EMU10K1_REG_HW(0x06)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000020,	EMU10K1_REG_HW(0x07),	EMU10K1_REG_HW(0x07)),
+	NAMED_REG(EMU10K1_NREG_CONST_00000100,	EMU10K1_REG_HW(0x08),	EMU10K1_REG_HW(0x08)),
+	NAMED_REG(EMU10K1_NREG_CONST_00010000,	EMU10K1_REG_HW(0x09),	EMU10K1_REG_HW(0x09)),
+	NAMED_REG(EMU10K1_L_NREG_CONST_00080000,	EMU10K1_REG_HW(0x0A),	0),
+	NAMED_REG(EMU10K1_A_NREG_CONST_00000800,	0,	EMU10K1_REG_HW(0x0A)),
+	NAMED_REG(EMU10K1_NREG_CONST_10000000,	EMU10K1_REG_HW(0x0B),	EMU10K1_REG_HW(0x0B)),
+	NAMED_REG(EMU10K1_NREG_CONST_20000000,	EMU10K1_REG_HW(0x0C),	EMU10K1_REG_HW(0x0C)),
+	NAMED_REG(EMU10K1_NREG_CONST_40000000,	EMU10K1_REG_HW(0x0D),	EMU10K1_REG_HW(0x0D)),
+	NAMED_REG(EMU10K1_NREG_CONST_80000000,	EMU10K1_REG_HW(0x0E),	EMU10K1_REG_HW(0x0E)),
+	NAMED_REG(EMU10K1_NREG_CONST_7FFFFFFF,	EMU10K1_REG_HW(0x0F),	EMU10K1_REG_HW(0x0F)),
+	NAMED_REG(EMU10K1_NREG_CONST_FFFFFFFF,	EMU10K1_REG_HW(0x10),	EMU10K1_REG_HW(0x10)),
+	NAMED_REG(EMU10K1_NREG_CONST_FFFFFFFE,	EMU10K1_REG_HW(0x11),	EMU10K1_REG_HW(0x11)),
+	NAMED_REG(EMU10K1_NREG_CONST_C0000000,	EMU10K1_REG_HW(0x12),	EMU10K1_REG_HW(0x12)),
+	NAMED_REG(EMU10K1_NREG_CONST_4F1BBCDC,	EMU10K1_REG_HW(0x13),	EMU10K1_REG_HW(0x13)),
+	NAMED_REG(EMU10K1_NREG_CONST_5A7EF9DB,	EMU10K1_REG_HW(0x14),	EMU10K1_REG_HW(0x14)),
+	NAMED_REG(EMU10K1_NREG_CONST_00100000,	EMU10K1_REG_HW(0x15),	EMU10K1_REG_HW(0x15)),
+
+	NAMED_REG(EMU10K1_NREG_HW_ACCUM,	EMU10K1_REG_HW(0x16),	EMU10K1_REG_HW(0x16)),
+	NAMED_REG(EMU10K1_NREG_HW_CCR,	EMU10K1_REG_HW(0x17),	EMU10K1_REG_HW(0x17)),
+	NAMED_REG(EMU10K1_NREG_HW_NOISE1,	EMU10K1_REG_HW(0x18),	EMU10K1_REG_HW(0x18)),
+	NAMED_REG(EMU10K1_NREG_HW_NOISE2,	EMU10K1_REG_HW(0x19),	EMU10K1_REG_HW(0x19)),
+	NAMED_REG(EMU10K1_NREG_HW_IRQ,	EMU10K1_REG_HW(0x1A),	EMU10K1_REG_HW(0x1A)),
+	NAMED_REG(EMU10K1_NREG_HW_DBAC,	EMU10K1_REG_HW(0x1B),	EMU10K1_REG_HW(0x1B)),
+	NAMED_REG(EMU10K1_A_NREG_HW_DBACE,	0,	EMU10K1_REG_HW(0x1D)),
 };
 
+/* physical register -> named register, filled from named_to_standard on first use */
+#define STANDARD_REG_TYPES 4
+#define STANDARD_REG_SIZE 0x40
+
+static unsigned int standard_to_named[2][STANDARD_REG_TYPES][STANDARD_REG_SIZE];
+static int standard_to_named_ready = 0;
+
 unsigned int ld10k1_resolve_named_reg(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int reg)
 {
-	/* find named - better will be use of binary search */
+	unsigned int group = (reg >> 8) & 0xFF;
+	unsigned int num = reg & 0xFF;
+
+	if (EMU10K1_REG_TYPE_B(reg) != EMU10K1_REG_TYPE_ALL || (reg & 0x0FFF0000))
+		return 0;
+	if (group >= NAMED_REG_GROUPS || num >= NAMED_REG_GROUP_SIZE)
+		return 0;
+
+	return named_to_standard[NAMED_REG_IDX(reg)][dsp_mgr->audigy ? 1 : 0];
+}
+
+static void ld10k1_standard_to_named_init(void)
+{
+	unsigned int i, chip, phys, type;
+
+	memset(standard_to_named, 0, sizeof(standard_to_named));
+	for (i = 0; i < NAMED_REG_GROUPS * NAMED_REG_GROUP_SIZE; i++)
+		for (chip = 0; chip < 2; chip++) {
+			phys = named_to_standard[i][chip];
+			if (!phys)
+				continue;
+			type = EMU10K1_REG_TYPE_B(phys) - EMU10K1_REG_TYPE_FX;
+			/* first name wins */
+			if (!standard_to_named[chip][type][phys & (STANDARD_REG_SIZE - 1)])
+				standard_to_named[chip][type][phys & (STANDARD_REG_SIZE - 1)] =
+					EMU10K1_REG_NAMED((i / NAMED_REG_GROUP_SIZE) << 8 | (i % NAMED_REG_GROUP_SIZE));
+		}
+	standard_to_named_ready = 1;
+}
+
+/* reverse to ld10k1_resolve_named_reg - returns 0 if register has no name */
+unsigned int ld10k1_standard_to_named_reg(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int reg)
+{
+	unsigned int type = EMU10K1_REG_TYPE_B(reg);
+
+	if (type < EMU10K1_REG_TYPE_FX || type > EMU10K1_REG_TYPE_HW)
+		return 0;
+	if ((reg & ~EMU10K1_REG_TYPE_MASK) >= STANDARD_REG_SIZE)
+		return 0;
+
+	if (!standard_to_named_ready)
+		ld10k1_standard_to_named_init();
+
+	return standard_to_named[dsp_mgr->audigy ? 1 : 0][type - EMU10K1_REG_TYPE_FX][reg & (STANDARD_REG_SIZE - 1)];
+}
+
+static unsigned int ld10k1_const_hash_fnc(unsigned int const_val)
+{
+	return (const_val * 2654435761U) >> 22;
+}
+
+static void ld10k1_const_hash_add(ld10k1_dsp_mgr_t *dsp_mgr, int idx)
+{
+	unsigned int h = ld10k1_const_hash_fnc(dsp_mgr->consts[idx].const_val);
+
+	dsp_mgr->consts_hash_next[idx] = dsp_mgr->consts_hash[h];
+	dsp_mgr->consts_hash[h] = idx;
+}
+
+static void ld10k1_const_hash_del(ld10k1_dsp_mgr_t *dsp_mgr, int idx)
+{
+	int *tmp = &(dsp_mgr->consts_hash[ld10k1_const_hash_fnc(dsp_mgr->consts[idx].const_val)]);
+
+	while (*tmp >= 0) {
+		if (*tmp == idx) {
+			*tmp = dsp_mgr->consts_hash_next[idx];
+			return;
+		}
+		tmp = &(dsp_mgr->consts_hash_next[*tmp]);
+	}
+}
+
+static int ld10k1_const_hash_find(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int const_val)
+{
 	int i;
 
-	i = 0;
-	while (named_to_standard[i]) {
-		if (named_to_standard[i] == reg)
-			return dsp_mgr->audigy ? named_to_standard[i + 2] : named_to_standard[i + 1];
-		i += 3;
+	for (i = dsp_mgr->consts_hash[ld10k1_const_hash_fnc(const_val)]; i >= 0; i = dsp_mgr->consts_hash_next[i])
+		if (dsp_mgr->consts[i].const_val == const_val)
+			return i;
+	return -1;
+}
+
+/* rebuild allocator bitmaps from regs and consts */
+void ld10k1_dsp_mgr_alloc_init(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	int i;
+
+	memset(dsp_mgr->regs_free, 0, sizeof(dsp_mgr->regs_free));
+	memset(dsp_mgr->regs_dyn, 0, sizeof(dsp_mgr->regs_dyn));
+	memset(dsp_mgr->regs_res, 0, sizeof(dsp_mgr->regs_res));
+	memset(dsp_mgr->consts_free, 0, sizeof(dsp_mgr->consts_free));
+	memset(dsp_mgr->consts_res, 0, sizeof(dsp_mgr->consts_res));
+
+	for (i = 0; i < dsp_mgr->regs_max_count; i++) {
+		if (!dsp_mgr->regs[i].used)
+			set_bit(i, dsp_mgr->regs_free);
+		else if (dsp_mgr->regs[i].gpr_usage == GPR_USAGE_DYNAMIC)
+			set_bit(i, dsp_mgr->regs_dyn);
 	}
 
-	return 0;
+	for (i = 0; i < CONST_HASH_SIZE; i++)
+		dsp_mgr->consts_hash[i] = -1;
+
+	for (i = 0; i < dsp_mgr->consts_max_count; i++)
+		if (!dsp_mgr->consts[i].used)
+			set_bit(i, dsp_mgr->consts_free);
+		else
+			ld10k1_const_hash_add(dsp_mgr, i);
+
+	dsp_mgr->const_lookups = 0;
+	dsp_mgr->const_shared = 0;
+	dsp_mgr->opt_instr = 0;
+	dsp_mgr->opt_removed = 0;
+}
+
+/* first reservation of operation forgets reservations from previous one */
+static void ld10k1_gpr_reserve_start(ld10k1_dsp_mgr_t *dsp_mgr, int *res_count)
+{
+	if (!*res_count)
+		memset(dsp_mgr->regs_res, 0, sizeof(dsp_mgr->regs_res));
 }
 
 unsigned int ld10k1_gpr_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_count, int *res_count, int *res,
 	unsigned int usage, unsigned int val)
 {
-	int i, j;
+	unsigned int i;
+
 	if (*res_count >= max_res_count)
 		return 0;
 
-	for (i = 0; i < dsp_mgr->regs_max_count; i++) {
-		if (!dsp_mgr->regs[i].used) {
-			/* check in reserved */
-			for (j = 0; j < *res_count; j++) {
-				if (res[j] == i)
-					break;
-			}
+	ld10k1_gpr_reserve_start(dsp_mgr, res_count);
 
-			if (j >= *res_count) {
-				res[*res_count] = i;
-				(*res_count)++;
-				dsp_mgr->regs[i].gpr_usage = usage;
-				dsp_mgr->regs[i].val = val;
-				return EMU10K1_REG_NORMAL(i);
-			}
-		}
-	}
-	return 0;
+	i = find_next_bit_andnot(dsp_mgr->regs_free, dsp_mgr->regs_res, dsp_mgr->regs_max_count, 0);
+	if (i >= dsp_mgr->regs_max_count)
+		return 0;
+
+	set_bit(i, dsp_mgr->regs_res);
+	res[*res_count] = i;
+	(*res_count)++;
+	dsp_mgr->regs[i].gpr_usage = usage;
+	dsp_mgr->regs[i].val = val;
+	return EMU10K1_REG_NORMAL(i);
 }
 
 unsigned int ld10k1_gpr_dyn_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_count, int *res_count, int *res)
 {
-	int i, j;
+	unsigned int i;
+
 	if (*res_count >= max_res_count)
 		return 0;
 
-	/* try find other dyn not reserved */
-	for (i = 0; i < dsp_mgr->regs_max_count; i++) {
-		if (dsp_mgr->regs[i].used && dsp_mgr->regs[i].gpr_usage == GPR_USAGE_DYNAMIC) {
-			/* check in reserved */
-			for (j = 0; j < *res_count; j++) {
-				if (res[j] == i)
-					break;
-			}
+	ld10k1_gpr_reserve_start(dsp_mgr, res_count);
 
-			if (j >= *res_count) {
-				res[*res_count] = i;
-				(*res_count)++;
-				dsp_mgr->regs[i].gpr_usage = GPR_USAGE_DYNAMIC;
-				dsp_mgr->regs[i].val = 0;
-				return EMU10K1_REG_NORMAL(i);
-			}
-		}
+	/* try find other dyn not reserved */
+	i = find_next_bit_andnot(dsp_mgr->regs_dyn, dsp_mgr->regs_res, dsp_mgr->regs_max_count, 0);
+	if (i < dsp_mgr->regs_max_count) {
+		set_bit(i, dsp_mgr->regs_res);
+		res[*res_count] = i;
+		(*res_count)++;
+		dsp_mgr->regs[i].gpr_usage = GPR_USAGE_DYNAMIC;
+		dsp_mgr->regs[i].val = 0;
+		return EMU10K1_REG_NORMAL(i);
 	}
 
 	/* not found - try normal */
@@ -1858,8 +2333,12 @@ void ld10k1_gpr_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int reg)
 {
 	int i = reg & 0x0FFFFFFF;
 	dsp_mgr->regs[i].ref++;
-	dsp_mgr->regs[i].modified = 1;
+	ld10k1_dsp_mgr_reg_modified(dsp_mgr, i);
 	dsp_mgr->regs[i].used = 1;
+	clear_bit(i, dsp_mgr->regs_free);
+	clear_bit(i, dsp_mgr->regs_res);
+	if (dsp_mgr->regs[i].gpr_usage == GPR_USAGE_DYNAMIC)
+		set_bit(i, dsp_mgr->regs_dyn);
 }
 
 void ld10k1_gpr_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg)
@@ -1868,60 +2347,62 @@ void ld10k1_gpr_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg)
 	dsp_mgr->regs[i].gpr_usage = GPR_USAGE_NONE;
 	dsp_mgr->regs[i].val = 0;
 	dsp_mgr->regs[i].ref--;
-	dsp_mgr->regs[i].modified = 1;
+	ld10k1_dsp_mgr_reg_modified(dsp_mgr, i);
 	dsp_mgr->regs[i].used = 0;
+	set_bit(i, dsp_mgr->regs_free);
+	clear_bit(i, dsp_mgr->regs_dyn);
 }
 
 unsigned int ld10k1_const_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_const_count, int *res_const_count, int *res_const,
 	int max_res_count, int *res_count, int *res, int const_val)
 {
-	int i, j;
+	int i;
+	unsigned int free_const;
 	int free_gpr;
 
 	if (*res_const_count >= max_res_const_count)
 		return 0;
 
-	/* check in reserved */
-	for (i = 0; i < *res_const_count; i++) {
-		if (dsp_mgr->consts[res_const[i]].const_val == const_val)
-			return EMU10K1_REG_CONST(res_const[i]);
+	if (!*res_const_count) {
+		/* forget constants reserved by previous operation and never allocated */
+		for (free_const = find_next_bit(dsp_mgr->consts_res, dsp_mgr->consts_max_count, 0);
+			free_const < dsp_mgr->consts_max_count;
+			free_const = find_next_bit(dsp_mgr->consts_res, dsp_mgr->consts_max_count, free_const + 1))
+			if (!dsp_mgr->consts[free_const].used)
+				ld10k1_const_hash_del(dsp_mgr, free_const);
+		memset(dsp_mgr->consts_res, 0, sizeof(dsp_mgr->consts_res));
 	}
 
-	/* check in all constants */
-	for (i = 0; i < dsp_mgr->consts_max_count; i++)
-		if (dsp_mgr->consts[i].used && dsp_mgr->consts[i].const_val == const_val) {
-			/* add to reserved */
-			res_const[*res_const_count] = i;
-			(*res_const_count)++;
-			return EMU10K1_REG_CONST(i);
-		}
-
+	dsp_mgr->const_lookups++;
 
-	/* try find other dyn not reserved */
-	for (i = 0; i < dsp_mgr->consts_max_count; i++) {
-		if (!dsp_mgr->consts[i].used) {
-			/* there is free room */
-			/* if in reserved continue */
-			for (j = 0; j < *res_const_count; j++) {
-				if (res_const[j] == i)
-					break;
-			}
-			if (j < *res_const_count)
-				continue;
-
-			free_gpr = ld10k1_gpr_reserve(dsp_mgr, max_res_count, res_count, res, GPR_USAGE_CONST, const_val);
-			if (!free_gpr)
-				return 0;
+	/* check in used and reserved constants */
+	if ((i = ld10k1_const_hash_find(dsp_mgr, const_val)) >= 0) {
+		dsp_mgr->const_shared++;
+		if (!test_bit(i, dsp_mgr->consts_res)) {
+			/* add to reserved */
+			set_bit(i, dsp_mgr->consts_res);
 			res_const[*res_const_count] = i;
 			(*res_const_count)++;
-			dsp_mgr->consts[i].gpr_idx = free_gpr;
-			dsp_mgr->consts[i].const_val = const_val;
-			dsp_mgr->consts[i].hw = 0;
-			return EMU10K1_REG_CONST(i);
 		}
+		return EMU10K1_REG_CONST(i);
 	}
 
-	return 0;
+	/* find free room not reserved */
+	free_const = find_next_bit_andnot(dsp_mgr->consts_free, dsp_mgr->consts_res, dsp_mgr->consts_max_count, 0);
+	if (free_const >= dsp_mgr->consts_max_count)
+		return 0;
+
+	free_gpr = ld10k1_gpr_reserve(dsp_mgr, max_res_count, res_count, res, GPR_USAGE_CONST, const_val);
+	if (!free_gpr)
+		return 0;
+	set_bit(free_const, dsp_mgr->consts_res);
+	res_const[*res_const_count] = free_const;
+	(*res_const_count)++;
+	dsp_mgr->consts[free_const].gpr_idx = free_gpr;
+	dsp_mgr->consts[free_const].const_val = const_val;
+	dsp_mgr->consts[free_const].hw = 0;
+	ld10k1_const_hash_add(dsp_mgr, free_const);
+	return EMU10K1_REG_CONST(free_const);
 }
 
 void ld10k1_const_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int reg)
@@ -1931,7 +2412,9 @@ void ld10k1_const_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int reg)
 	if (!dsp_mgr->consts[i].used) {
 		/*ld10k1_gpr_free(dsp_mgr, dsp_mgr->consts[i].gpr_idx);*/
 		dsp_mgr->consts[i].used = 1;
+		clear_bit(i, dsp_mgr->consts_free);
 	}
+	clear_bit(i, dsp_mgr->consts_res);
 }
 
 void ld10k1_const_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg)
@@ -1939,8 +2422,13 @@ void ld10k1_const_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg)
 	int i = reg & 0x0FFFFFFF;
 	dsp_mgr->consts[i].ref--;
 	if (dsp_mgr->consts[i].ref == 0) {
-		if (!dsp_mgr->consts[i].hw)
+		if (!dsp_mgr->consts[i].hw) {
+			/* register of constant is released with it */
+			ld10k1_gpr_free(dsp_mgr, dsp_mgr->consts[i].gpr_idx);
 			dsp_mgr->consts[i].used = 0;
+			set_bit(i, dsp_mgr->consts_free);
+			ld10k1_const_hash_del(dsp_mgr, i);
+		}
 	}
 }
 
@@ -2010,11 +2498,44 @@ void ld10k1_conn_point_free(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *poin
 	ld10k1_conn_point_unset(dsp_mgr, point);
 }
 
+static int ld10k1_point_reads(ld10k1_conn_point_t *point, ld10k1_patch_t *patch)
+{
+	int i;
+
+	for (i = 0; i < MAX_CONN_PER_POINT; i++)
+		if (point->type[i] == CON_IO_PIN && point->patch[i] == patch)
+			return 1;
+	return 0;
+}
+
+/*
+ * With optimization last patch writing to point, which doesn't read it,
+ * writes directly to point register and rest is added after it.
+ * Everybody reading point sees whole sum - from this or previous run.
+ */
+static int ld10k1_point_direct(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point)
+{
+	int i, direct = -1;
+
+	if (!dsp_mgr->optimize)
+		return -1;
+
+	for (i = 0; i < MAX_CONN_PER_POINT; i++)
+		if (point->type[i] == CON_IO_POUT && !ld10k1_point_reads(point, point->patch[i]) &&
+			(direct < 0 || point->patch[direct]->order < point->patch[i]->order))
+			direct = i;
+	return direct;
+}
+
 void ld10k1_point_actualize_owner(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point)
 {
 	/* instructions should be alocated */
 	int i;
 	int icount, iarg, iout;
+	int direct, cur;
+	int res_count = 0;
+	int res[1];
+	unsigned int reserved;
 
 	ld10k1_patch_t *tmp_owner = NULL;
 
@@ -2022,7 +2543,41 @@ void ld10k1_point_actualize_owner(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t
 		return;
 
 	if (point->reserved_gpr > 0) {
-		if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_NORMAL) {
+		/* producer without own register writes directly to point */
+		direct = ld10k1_point_direct(dsp_mgr, point);
+		cur = -1;
+		for (i = 0; i < MAX_CONN_PER_POINT; i++)
+			if (point->type[i] == CON_IO_POUT && !point->out_gpr_idx[i])
+				cur = i;
+
+		if (cur >= 0 && direct < 0) {
+			reserved = ld10k1_gpr_reserve(dsp_mgr, 1, &res_count, res, GPR_USAGE_NORMAL, 0);
+			if (reserved) {
+				ld10k1_gpr_alloc(dsp_mgr, reserved);
+				point->out_gpr_idx[cur] = reserved;
+				point->reserved_gpr++;
+				ld10k1_dsp_mgr_actualize_instr_for_reg(dsp_mgr, point->patch[cur], EMU10K1_PREG_OUT(point->io[cur]));
+			} else
+				/* no free register - still correct, as it doesn't read point */
+				direct = cur;
+		}
+
+		if (direct >= 0 && direct != cur) {
+			if (cur >= 0) {
+				point->out_gpr_idx[cur] = point->out_gpr_idx[direct];
+				ld10k1_dsp_mgr_actualize_instr_for_reg(dsp_mgr, point->patch[cur], EMU10K1_PREG_OUT(point->io[cur]));
+			} else {
+				ld10k1_gpr_free(dsp_mgr, point->out_gpr_idx[direct]);
+				point->reserved_gpr--;
+			}
+			point->out_gpr_idx[direct] = 0;
+			ld10k1_dsp_mgr_actualize_instr_for_reg(dsp_mgr, point->patch[direct], EMU10K1_PREG_OUT(point->io[direct]));
+		}
+
+		if (direct >= 0) {
+			point->owner = point->patch[direct];
+			point->position = INSERT_AFTER_OWNER;
+		} else if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_NORMAL) {
 			/* patch reg */
 			for (i = 0; i < MAX_CONN_PER_POINT; i++)
 				if (point->type[i] == CON_IO_PIN) {
@@ -2060,7 +2615,7 @@ void ld10k1_point_actualize_owner(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t
 					point->out_instr[icount].op_code = iACC3;
 					point->out_instr[icount].arg[0] = point->con_gpr_idx;
 					iarg++;
-					if (iout >= 3) {
+					if (iout >= 3 || direct >= 0) {
 						point->out_instr[icount].arg[1] = point->con_gpr_idx;
 						iarg++;
 					}
@@ -2155,10 +2710,25 @@ int ld10k1_conn_point_add(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point,
 	unsigned int res[2];
 	int reservedcount = 0;
 	int usedreserved = 0;
+	int direct = -1;
+	int res_direct[1];
 
 	if (point->con_count >= MAX_CONN_PER_POINT)
 		return LD10K1_ERR_MAX_CON_PER_POINT;
 
+	/* patch writing directly to point will read it - needs own register */
+	if (!point->simple && type == CON_IO_PIN && point->reserved_instr > 0) {
+		for (i = 0; i < MAX_CONN_PER_POINT; i++)
+			if (point->type[i] == CON_IO_POUT && point->patch[i] == patch && !point->out_gpr_idx[i])
+				direct = i;
+		if (direct >= 0) {
+			reserved[0] = ld10k1_gpr_reserve(dsp_mgr, 1, &reservedcount, res_direct, GPR_USAGE_NORMAL, 0);
+			if (!reserved[0])
+				return LD10K1_ERR_NOT_FREE_REG;
+			ld10k1_gpr_alloc(dsp_mgr, reserved[0]);
+		}
+	}
+
 	/* check pout count */
 	if (!point->simple && type == CON_IO_POUT) {
 		poutcount = 0;
@@ -2205,6 +2775,15 @@ int ld10k1_conn_point_add(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point,
 					ld10k1_conn_point_del(dsp_mgr, patch->ins[io].point, CON_IO_PIN, patch, io);
 				patch->ins[io].point = point;
 				ld10k1_dsp_mgr_actualize_instr_for_reg(dsp_mgr, patch, EMU10K1_PREG_IN(io));
+
+				if (direct >= 0) {
+					point->out_gpr_idx[direct] = reserved[0];
+					point->reserved_gpr++;
+					ld10k1_dsp_mgr_actualize_instr_for_reg(dsp_mgr, patch, EMU10K1_PREG_OUT(point->io[direct]));
+				}
+				/* first reader or register written directly can change */
+				if (!point->simple && point->reserved_instr > 0)
+					ld10k1_point_actualize_owner(dsp_mgr, point);
 			} else {
 				if (patch->outs[io].point)
 					ld10k1_conn_point_del(dsp_mgr, patch->outs[io].point, CON_IO_POUT, patch, io);
@@ -2258,6 +2837,8 @@ int ld10k1_conn_point_del(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point,
 			if (type == CON_IO_PIN) {
 				patch->ins[io].point = NULL;
 				ld10k1_dsp_mgr_actualize_instr_for_reg(dsp_mgr, patch, EMU10K1_PREG_IN(io));
+				if (!point->simple && point->reserved_instr > 0)
+					ld10k1_point_actualize_owner(dsp_mgr, point);
 			} else {
 				patch->outs[io].point = NULL;
 				if (!point->simple && point->out_gpr_idx[i]) {
@@ -24,22 +24,38 @@
 #endif
 
 #include <alsa/asoundlib.h>
+#include <alsa/sound/emu10k1.h>
+#include <stdint.h>
 
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include "ld10k1.h"
 #include "ld10k1_fnc.h"
 #include "ld10k1_fnc_int.h"
+#include "ld10k1_fnc1.h"
 #include "ld10k1_debug.h"
 #include "ld10k1_error.h"
 #include "ld10k1_dump.h"
 #include "ld10k1_driver.h"
 #include "ld10k1_mixer.h"
+#include "ld10k1_batch.h"
+#include "ld10k1_emu.h"
+#include "ld10k1_opt.h"
+#include "ld10k1_snapshot.h"
 #include "comm.h"
 
 
 void ld10k1_fnc_prepare_free();
 int ld10k1_fnc_patch_add(int data_conn, int op, int size);
+int ld10k1_fnc_patch_add_part(int data_conn);
+int ld10k1_fnc_patch_rcv_need(int data_conn);
+void ld10k1_fnc_patch_rcv_free(int data_conn);
+int ld10k1_fnc_patch_add_v2(int data_conn, int op, int size);
 int ld10k1_fnc_patch_del(int data_conn, int op, int size);
+int ld10k1_fnc_patch_loop_break(int data_conn, int op, int size);
+int ld10k1_fnc_patch_gpr_write(int data_conn, int op, int size);
 int ld10k1_fnc_patch_conn(int data_conn, int op, int size);
 int ld10k1_fnc_name_find(int data_conn, int op, int size);
 int ld10k1_fnc_name_rename(int data_conn, int op, int size);
@@ -55,8 +71,26 @@ int ld10k1_fnc_version(int data_conn, int op, int size);
 int ld10k1_fnc_get_points_info(int data_conn, int op, int size);
 int ld10k1_fnc_get_point_info(int data_conn, int op, int size);
 int ld10k1_fnc_get_dsp_info(int data_conn, int op, int size);
+int ld10k1_fnc_batch(int data_conn, int op, int size);
+int ld10k1_fnc_get_state(int data_conn, int op, int size);
+int ld10k1_fnc_subscribe(int data_conn, int op, int size);
+int ld10k1_fnc_peek_subscribe(int data_conn, int op, int size);
+int ld10k1_fnc_emu_run(int data_conn, int op, int size);
+int ld10k1_fnc_card_select(int data_conn, int op, int size);
 
-ld10k1_dsp_mgr_t dsp_mgr;
+extern int optimize;
+extern int auto_order;
+
+/* dsp managers of all cards, card is index */
+static ld10k1_dsp_mgr_t *dsp_mgrs = NULL;
+static int dsp_mgr_count = 0;
+/* card of client which request is processed */
+ld10k1_dsp_mgr_t *dsp_mgr = NULL;
+
+#define CARD_OF(mgr) ((int)((mgr) - dsp_mgrs))
+
+/* handler waits for next part from client, response is sent later */
+#define FNC_RES_WAIT 2
 
 struct fnc_table_t
 {
@@ -69,7 +103,10 @@ struct fnc_table_t
 struct fnc_table_t fnc_table[] =
 {
 	{FNC_PATCH_ADD, sizeof(ld10k1_fnc_patch_add_t), sizeof(ld10k1_fnc_patch_add_t), ld10k1_fnc_patch_add},
+	{FNC_PATCH_ADD, sizeof(ld10k1_fnc_patch_add_t) + sizeof(struct msg_v2), COMM_BUF_MAX_OUT, ld10k1_fnc_patch_add_v2},
 	{FNC_PATCH_DEL, sizeof(ld10k1_fnc_patch_del_t), sizeof(ld10k1_fnc_patch_del_t), ld10k1_fnc_patch_del},
+	{FNC_PATCH_LOOP_BREAK, sizeof(ld10k1_fnc_patch_loop_break_t), sizeof(ld10k1_fnc_patch_loop_break_t), ld10k1_fnc_patch_loop_break},
+	{FNC_PATCH_GPR_WRITE, sizeof(ld10k1_fnc_gpr_write_t), sizeof(ld10k1_fnc_gpr_write_t) + GPR_WRITE_MAX * sizeof(ld10k1_fnc_gpr_value_t), ld10k1_fnc_patch_gpr_write},
 	{FNC_CONNECTION_ADD, sizeof(ld10k1_fnc_connection_t), sizeof(ld10k1_fnc_connection_t), ld10k1_fnc_patch_conn},
 	{FNC_CONNECTION_DEL, sizeof(ld10k1_fnc_connection_t), sizeof(ld10k1_fnc_connection_t), ld10k1_fnc_patch_conn},
 	{FNC_DEBUG, sizeof(ld10k1_fnc_debug_t), sizeof(ld10k1_fnc_debug_t), ld10k1_fnc_debug},
@@ -97,17 +134,23 @@ struct fnc_table_t fnc_table[] =
 	{FNC_GET_POUT, sizeof(int) * 2, sizeof(int) * 2, ld10k1_fnc_get_pio},
 	{FNC_GET_PATCHES_INFO, 0, 0, ld10k1_fnc_get_patches_info},
 	{FNC_GET_PATCH, sizeof(int), sizeof(int), ld10k1_fnc_get_patch},
+	{FNC_GET_STATE, 0, 0, ld10k1_fnc_get_state},
+	{FNC_SUBSCRIBE, sizeof(int), sizeof(int), ld10k1_fnc_subscribe},
+	{FNC_PEEK_SUBSCRIBE, sizeof(ld10k1_fnc_peek_t), sizeof(ld10k1_fnc_peek_t) + PEEK_REG_MAX * sizeof(ld10k1_fnc_peek_reg_t), ld10k1_fnc_peek_subscribe},
+	{FNC_EMU_RUN, sizeof(ld10k1_fnc_emu_run_t), COMM_BUF_MAX_OUT, ld10k1_fnc_emu_run},
+	{FNC_CARD_SELECT, sizeof(int), sizeof(int), ld10k1_fnc_card_select},
 	{FNC_DSP_INIT, 0, 0, ld10k1_fnc_dsp_init},
 	{FNC_DUMP, 0, 0, ld10k1_fnc_dump},
 	{FNC_VERSION, 0, 0, ld10k1_fnc_version},
 	{FNC_GET_POINTS_INFO, 0, 0, ld10k1_fnc_get_points_info},
 	{FNC_GET_POINT_INFO, sizeof(int), sizeof(int), ld10k1_fnc_get_point_info},
 	{FNC_GET_DSP_INFO, 0, 0, ld10k1_fnc_get_dsp_info},
+	{FNC_BATCH_BEGIN, 0, 0, ld10k1_fnc_batch},
+	{FNC_BATCH_COMMIT, 0, 0, ld10k1_fnc_batch},
+	{FNC_BATCH_ABORT, 0, 0, ld10k1_fnc_batch},
 	{-1, 0, 0, NULL}
 };
 
-ld10k1_dsp_mgr_t dsp_mgr;
-
 int send_response_ok(int conn_num)
 {
 	return send_response(conn_num, FNC_OK, 0, NULL, 0);
@@ -123,94 +166,745 @@ int send_response_wd(int conn_num, void *data, int data_size)
 	return send_response(conn_num, FNC_OK, 0, data, data_size);
 }
 
+/* v1 patch upload in progress, part is processed when it is whole in buffer */
+typedef struct {
+	ld10k1_patch_t *patch;
+	ld10k1_dsp_patch_t info;
+	int where;
+	int part;
+} ld10k1_patch_rcv_t;
+
 struct ClientDefTag
 {
 	int used;
 	int socket;
+	int want_out;
+	/* selected card */
+	int card;
+	/* subscribed events */
+	int events;
+	/* register peek feed */
+	unsigned int peek_interval;
+	unsigned int peek_count;
+	ld10k1_fnc_peek_reg_t *peek_regs;
+	unsigned int peek_seq;
+	long long peek_next;
+	ld10k1_patch_rcv_t *patch_rcv;
 };
 
 typedef struct ClientDefTag ClientDef;
 
-#define MAX_CLIENTS 10
-ClientDef clients[MAX_CLIENTS];
+/* client table is indexed by socket and grows as needed */
+ClientDef *clients = NULL;
+int clients_size = 0;
 int clients_count = 0;
 
-static void client_init()
+#define MAX_EVENTS 64
+
+/* batch owner is disconnected after this many seconds without request */
+#define BATCH_TIMEOUT 10
+
+/* ms between two snapshot saves of one card */
+#define SNAPSHOT_INTERVAL 1000
+
+/* some client waits for end of batch or upload */
+static int client_waiting = 0;
+static time_t batch_last_op[CARD_MAX];
+
+/* request which waits for end of upload to card, response is sent then */
+static struct {
+	/* -1 - no client waits */
+	int socket;
+	int op;
+} upload_reply[CARD_MAX];
+
+/* change events are sent to subscribers after requests are processed */
+#define EVENT_QUEUE_SIZE 256
+
+static struct {
+	int origin;
+	int card;
+	/* event from batch waits for its end, it is dropped if batch fails */
+	int batch;
+	ld10k1_fnc_event_t event;
+} event_queue[EVENT_QUEUE_SIZE];
+static int event_count = 0;
+static int event_lost[CARD_MAX];
+/* card state changed since last snapshot */
+static int snapshot_dirty[CARD_MAX];
+/* time of last snapshot save, saves are at most once per SNAPSHOT_INTERVAL */
+static long long snapshot_last[CARD_MAX];
+
+static void ld10k1_fnc_event(int data_conn, int type, int what, int patch_num, int id, int index)
 {
-	int i;
-	for (i = 0; i < MAX_CLIENTS; i++)
-		clients[i].used = 0;
+	ld10k1_fnc_event_t *event;
+
+	if (event_count >= EVENT_QUEUE_SIZE) {
+		event_lost[CARD_OF(dsp_mgr)] = 1;
+		return;
+	}
 
+	event_queue[event_count].origin = data_conn;
+	event_queue[event_count].card = CARD_OF(dsp_mgr);
+	event_queue[event_count].batch = dsp_mgr->batch != NULL;
+	event = &(event_queue[event_count].event);
+	event->type = type;
+	event->what = what;
+	event->patch_num = patch_num;
+	event->id = id;
+	event->index = index;
+	event_count++;
+}
+
+/* remove queued events of card, only events from batch if batch_only */
+static void ld10k1_fnc_event_remove(int card, int batch_only)
+{
+	int i, j;
+
+	for (i = j = 0; i < event_count; i++) {
+		if (event_queue[i].card == card && (event_queue[i].batch || !batch_only))
+			continue;
+		if (i != j)
+			event_queue[j] = event_queue[i];
+		j++;
+	}
+	event_count = j;
+}
+
+static void ld10k1_fnc_event_batch_end(int committed)
+{
+	int i, card = CARD_OF(dsp_mgr);
+
+	if (!committed) {
+		ld10k1_fnc_event_remove(card, 1);
+		return;
+	}
+
+	for (i = 0; i < event_count; i++)
+		if (event_queue[i].card == card)
+			event_queue[i].batch = 0;
+}
+
+static void client_init()
+{
+	clients = NULL;
+	clients_size = 0;
 	clients_count = 0;
 }
 
-static int client_add()
+static int client_add(int socket)
 {
-	int i;
+	ClientDef *new_clients;
+	int new_size;
 
-	for (i = 0; i < MAX_CLIENTS; i++)
-		if (clients[i].used == 0) {
-			clients[i].used = 1;
-			clients_count++;
-			return i;
-		}
-	return -1;
+	if (socket < 0)
+		return -1;
+
+	if (socket >= clients_size) {
+		new_size = clients_size ? clients_size : 16;
+		while (new_size <= socket)
+			new_size *= 2;
+		new_clients = (ClientDef *)realloc(clients, sizeof(ClientDef) * new_size);
+		if (!new_clients)
+			return -1;
+		memset(new_clients + clients_size, 0, sizeof(ClientDef) * (new_size - clients_size));
+		clients = new_clients;
+		clients_size = new_size;
+	}
+
+	clients[socket].used = 1;
+	clients[socket].socket = socket;
+	clients[socket].want_out = 0;
+	clients[socket].card = 0;
+	clients[socket].events = 0;
+	clients[socket].peek_interval = 0;
+	clients[socket].peek_count = 0;
+	clients[socket].peek_regs = NULL;
+	clients[socket].patch_rcv = NULL;
+	clients_count++;
+	return socket;
 }
 
 static void client_del(int client)
 {
-    if (client >= 0 && client < MAX_CLIENTS && clients[client].used == 1) {
-	clients[client].used = 0;
-	clients_count--;
-    }
+	if (client >= 0 && client < clients_size && clients[client].used == 1) {
+		clients[client].used = 0;
+		if (clients[client].peek_regs) {
+			free(clients[client].peek_regs);
+			clients[client].peek_regs = NULL;
+		}
+		ld10k1_fnc_patch_rcv_free(client);
+		clients_count--;
+	}
 }
 
 static int client_find_by_socket(int socket)
 {
+	if (socket >= 0 && socket < clients_size && clients[socket].used)
+		return socket;
+	return -1;
+}
+
+static void client_free_all()
+{
+	free(clients);
+	client_init();
+}
+
+static void client_close(int epoll_fd, int client)
+{
+	int socket = clients[client].socket;
 	int i;
 
-	for (i = 0; i < MAX_CLIENTS; i++)
-		if (clients[i].socket == socket)
-			return i;
-	return -1;
+	/* unfinished batch is discarded, committed batch ends with its upload */
+	for (i = 0; i < dsp_mgr_count; i++) {
+		if (dsp_mgrs[i].batch && dsp_mgrs[i].batch->owner == socket &&
+			!dsp_mgrs[i].batch->committing) {
+			dsp_mgr = &(dsp_mgrs[i]);
+			ld10k1_batch_abort(dsp_mgr);
+			ld10k1_fnc_event_batch_end(0);
+		}
+		if (upload_reply[i].socket == socket)
+			upload_reply[i].socket = -1;
+	}
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+	client_del(client);
+	free_comm(socket);
 }
 
-int main_loop(comm_param *param, int audigy, const char *card_id, int tram_size, snd_ctl_t *ctlp)
+/* watch for writability only when there are queued responses */
+static int client_update_events(int epoll_fd, int client)
 {
-	fd_set active_fd_set/*, read_fd_set*/;
-	int i, j, res = 0;
-	sighandler_t old_sig_pipe;
+	struct epoll_event ev;
+	int want_out = pending_out_comm(clients[client].socket) > 0;
+
+	if (want_out == clients[client].want_out)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+	ev.data.fd = clients[client].socket;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, clients[client].socket, &ev) < 0)
+		return -1;
+	clients[client].want_out = want_out;
+	return 0;
+}
+
+static void client_accept(int epoll_fd, int main_sock)
+{
+	struct epoll_event ev;
+	int data_sock;
+
+	/* accept all pending connections */
+	while ((data_sock = accept_comm(main_sock)) >= 0) {
+		if (nonblock_comm(data_sock) < 0 ||
+			attach_buf_comm(data_sock) < 0 ||
+			client_add(data_sock) < 0) {
+			free_comm(data_sock);
+			continue;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = data_sock;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data_sock, &ev) < 0) {
+			client_del(data_sock);
+			free_comm(data_sock);
+		}
+	}
+}
+
+/* operations which can be used inside batch, 2 - operation modifies dsp */
+static int client_batch_op(int op)
+{
+	switch (op) {
+		case FNC_PATCH_ADD:
+		case FNC_CONNECTION_ADD:
+		case FNC_CONNECTION_DEL:
+			return 2;
+		case FNC_PATCH_DEL:
+		case FNC_PATCH_LOOP_BREAK:
+		case FNC_PATCH_GPR_WRITE:
+		case FNC_PATCH_RENAME:
+		case FNC_FX_RENAME:
+		case FNC_IN_RENAME:
+		case FNC_OUT_RENAME:
+		case FNC_PATCH_IN_RENAME:
+		case FNC_PATCH_OUT_RENAME:
+		case FNC_DSP_INIT:
+		case FNC_DEBUG:
+		case FNC_BATCH_BEGIN:
+		case FNC_EMU_RUN:
+		case FNC_CARD_SELECT:
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+/* operations which don't use dsp manager, they don't wait for upload */
+static int client_card_op(int op)
+{
+	switch (op) {
+		case FNC_VERSION:
+		case FNC_CARD_SELECT:
+		case FNC_CLOSE_CONN:
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+/* operations after which card state is saved to snapshot */
+static int client_snapshot_op(int op)
+{
+	switch (op) {
+		case FNC_PATCH_ADD:
+		case FNC_PATCH_DEL:
+		case FNC_PATCH_LOOP_BREAK:
+		case FNC_PATCH_GPR_WRITE:
+		case FNC_CONNECTION_ADD:
+		case FNC_CONNECTION_DEL:
+		case FNC_PATCH_RENAME:
+		case FNC_FX_RENAME:
+		case FNC_IN_RENAME:
+		case FNC_OUT_RENAME:
+		case FNC_PATCH_IN_RENAME:
+		case FNC_PATCH_OUT_RENAME:
+		case FNC_DSP_INIT:
+		case FNC_BATCH_COMMIT:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* skip data of refused request */
+static int client_skip_data(int socket, int data_size)
+{
+	char tmp[256];
+	int len;
+
+	while (data_size > 0) {
+		len = data_size > sizeof(tmp) ? sizeof(tmp) : data_size;
+		if (receive_msg_data(socket, tmp, len) < 0)
+			return -1;
+		data_size -= len;
+	}
+	return 0;
+}
 
-	int main_sock = 0;
-	int data_sock = 0;
-	int new_client = 0;
+/* whole request or whole next part of v1 patch upload is buffered */
+static int client_request_ready(int client)
+{
+	int socket = clients[client].socket;
+
+	if (clients[client].patch_rcv)
+		return in_buf_comm(socket) >= ld10k1_fnc_patch_rcv_need(socket);
+	return request_ready_comm(socket);
+}
+
+/* process all complete requests buffered for client, return -1 if client should be closed */
+static int client_process(int client)
+{
+	int socket = clients[client].socket;
+	int j, res = 0;
 	int op = 0;
 	int data_size = 0;
+	int in_batch;
+	int busy;
 
-	int retval = 0;
+	/* all responses are written at once */
+	cork_comm(socket, 1);
 
-	dsp_mgr.audigy = audigy;
-	dsp_mgr.card_id = card_id;
+	while (client_request_ready(client)) {
+		dsp_mgr = &(dsp_mgrs[clients[client].card]);
 
-	if (ld10k1_dsp_mgr_init(&dsp_mgr))
-		return -1;
+		/* requests from other clients wait until batch ends, requests
+		   using card wait until its upload ends */
+		if ((dsp_mgr->batch && dsp_mgr->batch->owner != socket) ||
+			(ld10k1_driver_busy(dsp_mgr) &&
+			 (clients[client].patch_rcv || client_card_op(request_op_comm(socket))))) {
+			client_waiting = 1;
+			break;
+		}
+		/* only requests not using card run during upload */
+		busy = ld10k1_driver_busy(dsp_mgr);
+
+		if (clients[client].patch_rcv) {
+			op = FNC_PATCH_ADD;
+			in_batch = dsp_mgr->batch ? client_batch_op(op) : -1;
+			res = ld10k1_fnc_patch_add_part(socket);
+			goto result;
+		}
 
-	/* initialize id generators */
-	ld10k1_dsp_mgr_init_id_gen(&dsp_mgr);
+		if (receive_request(socket, &op, &data_size))
+			op = -1;
+
+		if (op == FNC_CLOSE_CONN)
+			return -1;
+
+		if (op < 0)
+			goto e_protocol;
+
+		in_batch = dsp_mgr->batch ? client_batch_op(op) : -1;
+
+		/* search in function table */
+		res = 1;
+		if (!in_batch) {
+			if (client_skip_data(socket, data_size) < 0)
+				goto e_protocol;
+			res = LD10K1_ERR_BATCH_OP;
+		} else {
+			for (j = 0; fnc_table[j].fnc >= 0; j++)	{
+				if ((fnc_table[j].fnc == op) &&
+					(data_size >= fnc_table[j].min_size) &&
+					(data_size <= fnc_table[j].max_size)) {
+					res = (*fnc_table[j].fnc_code)(socket, op, data_size);
+					break;
+				}
+			}
+		}
+
+result:
+		if (res == FNC_RES_WAIT) {
+			if (dsp_mgr->batch)
+				batch_last_op[CARD_OF(dsp_mgr)] = time(NULL);
+			continue;
+		}
+		if (res && in_batch == 2)
+			ld10k1_batch_fail(dsp_mgr);
+		/* result of request is known when its upload ends */
+		if (!res && !busy && ld10k1_driver_busy(dsp_mgr)) {
+			upload_reply[CARD_OF(dsp_mgr)].socket = socket;
+			upload_reply[CARD_OF(dsp_mgr)].op = op;
+			if (dsp_mgr->batch)
+				batch_last_op[CARD_OF(dsp_mgr)] = time(NULL);
+			break;
+		}
+		if (!res && client_snapshot_op(op))
+			snapshot_dirty[CARD_OF(dsp_mgr)] = 1;
+		if (dsp_mgr->batch)
+			batch_last_op[CARD_OF(dsp_mgr)] = time(NULL);
+
+		if (!res) {
+			if (send_response(socket, FNC_OK, 0, NULL, 0) < 0)
+				goto e_protocol;
+		} else {
+			if (send_response(socket, FNC_ERR, res, NULL, 0) < 0)
+				goto e_protocol;
+		}
+	}
+
+	if (cork_comm(socket, 0) < 0)
+		goto e_protocol;
+	return 0;
+e_protocol:
+	printf("error protocol fnc:%d - %d\n", op, res);
+	return -1;
+}
+
+/* send queued events to subscribers of card, except to client which caused them */
+static void client_send_events(int epoll_fd)
+{
+	ld10k1_fnc_event_t resync;
+	int lost_now[CARD_MAX];
+	int i, j, card, lost;
+
+	/* resync of card in batch waits for its end */
+	lost = 0;
+	for (card = 0; card < dsp_mgr_count; card++)
+		if (dsp_mgrs[card].batch)
+			lost_now[card] = 0;
+		else {
+			lost_now[card] = event_lost[card];
+			lost |= lost_now[card];
+		}
+	if (!event_count && !lost)
+		return;
+
+	memset(&resync, 0, sizeof(resync));
+	resync.type = EVENT_RESYNC;
+	resync.patch_num = -1;
+
+	for (i = 0; i < clients_size; i++) {
+		if (!clients[i].used || !clients[i].events)
+			continue;
+
+		card = clients[i].card;
+		for (j = 0; j < event_count; j++) {
+			if (event_queue[j].batch ||
+				event_queue[j].card != card ||
+				event_queue[j].origin == clients[i].socket ||
+				!(clients[i].events & event_queue[j].event.type))
+				continue;
+			if (send_response(clients[i].socket, FNC_EVENT, 0, &(event_queue[j].event), sizeof(ld10k1_fnc_event_t)) < 0)
+				break;
+		}
+
+		if (j < event_count ||
+			(lost_now[card] && send_response(clients[i].socket, FNC_EVENT, 0, &resync, sizeof(resync)) < 0) ||
+			client_update_events(epoll_fd, i) < 0)
+			client_close(epoll_fd, i);
+	}
+
+	/* events from unfinished batch stay */
+	for (i = j = 0; i < event_count; i++)
+		if (event_queue[i].batch)
+			event_queue[j++] = event_queue[i];
+	event_count = j;
+	for (card = 0; card < dsp_mgr_count; card++)
+		if (lost_now[card])
+			event_lost[card] = 0;
+}
+
+static long long client_time_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* ms to next peek feed frame, -1 - no feed */
+static int client_peek_timeout()
+{
+	long long now, next = -1;
+	int i;
 
+	for (i = 0; i < clients_size; i++)
+		if (clients[i].used && clients[i].peek_count &&
+			(next < 0 || clients[i].peek_next < next))
+			next = clients[i].peek_next;
 
-	if (ld10k1_init_driver(&dsp_mgr, tram_size) < 0) {
-		ld10k1_dsp_mgr_free(&dsp_mgr);
+	if (next < 0)
 		return -1;
+	now = client_time_ms();
+	return next > now ? next - now : 0;
+}
+
+/* saves snapshots of changed cards, returns ms to next save, -1 - nothing to save */
+static int client_snapshot_save(ld10k1_card_t *cards, int force)
+{
+	long long now, wait = -1;
+	int i;
+
+	now = client_time_ms();
+	for (i = 0; i < dsp_mgr_count; i++) {
+		/* batch is saved after commit, change after its upload */
+		if (!snapshot_dirty[i] || dsp_mgrs[i].batch || ld10k1_driver_busy(&(dsp_mgrs[i])))
+			continue;
+		if (!force && now - snapshot_last[i] < SNAPSHOT_INTERVAL) {
+			if (wait < 0 || snapshot_last[i] + SNAPSHOT_INTERVAL - now < wait)
+				wait = snapshot_last[i] + SNAPSHOT_INTERVAL - now;
+			continue;
+		}
+		snapshot_dirty[i] = 0;
+		snapshot_last[i] = now;
+		if (cards[i].snapshot &&
+			ld10k1_snapshot_save(&(dsp_mgrs[i]), cards[i].snapshot) < 0)
+			error("unable to save snapshot %s", cards[i].snapshot);
 	}
-	
-	if (ld10k1_init_reserved_ctls(&dsp_mgr, ctlp) < 0) {
-		ld10k1_dsp_mgr_free(&dsp_mgr);
+	return wait;
+}
+
+/* one code peek per card for all clients which want frame now */
+static void client_send_peek(int epoll_fd)
+{
+	static unsigned int gpr[CARD_MAX][MAX_GPR_COUNT];
+	static unsigned int tram_data[CARD_MAX][0x100];
+	char buf[sizeof(ld10k1_fnc_peek_data_t) + PEEK_REG_MAX * sizeof(unsigned int)];
+	ld10k1_fnc_peek_data_t *data;
+	unsigned int *values;
+	ld10k1_patch_t *patch;
+	long long now;
+	int peeked[CARD_MAX];
+	int i, idx, tram, card;
+	unsigned int j;
+
+	now = client_time_ms();
+	memset(peeked, 0, sizeof(peeked));
+	data = (ld10k1_fnc_peek_data_t *)buf;
+	values = (unsigned int *)(data + 1);
+
+	for (i = 0; i < clients_size; i++) {
+		if (!clients[i].used || !clients[i].peek_count || clients[i].peek_next > now)
+			continue;
+
+		clients[i].peek_next += clients[i].peek_interval;
+		if (clients[i].peek_next <= now)
+			clients[i].peek_next = now + clients[i].peek_interval;
+
+		/* client doesn't read - frame is skipped */
+		data->seq = clients[i].peek_seq++;
+		if (pending_out_comm(clients[i].socket) > COMM_BUF_MAX_OUT)
+			continue;
+
+		card = clients[i].card;
+		dsp_mgr = &(dsp_mgrs[card]);
+		if (!peeked[card]) {
+			peeked[card] = 1;
+			/* registers can be moved by code which is not uploaded yet or by open batch
+			   which changes layout only in manager - frame is skipped */
+			if (dsp_mgr->batch || ld10k1_driver_pending(dsp_mgr))
+				peeked[card] = -1;
+			else if (ld10k1_peek_driver(dsp_mgr, gpr[card], tram_data[card]) < 0) {
+				error("unable to peek code");
+				peeked[card] = -1;
+			}
+		}
+		if (peeked[card] < 0)
+			continue;
+
+		data->count = clients[i].peek_count;
+		for (j = 0; j < clients[i].peek_count; j++) {
+			patch = ld10k1_dsp_mgr_patch_find_id(dsp_mgr, clients[i].peek_regs[j].patch_id);
+			idx = patch ? ld10k1_dsp_mgr_patch_peek_idx(dsp_mgr, patch, clients[i].peek_regs[j].reg, &tram) : -1;
+			if (idx < 0)
+				values[j] = 0;
+			else
+				values[j] = tram ? tram_data[card][idx] : gpr[card][idx];
+		}
+
+		if (send_response(clients[i].socket, FNC_PEEK_DATA, 0, buf,
+				sizeof(ld10k1_fnc_peek_data_t) + clients[i].peek_count * sizeof(unsigned int)) < 0 ||
+			client_update_events(epoll_fd, i) < 0)
+			client_close(epoll_fd, i);
+	}
+}
+
+/* waited uploads of card are done, their result is sent to request */
+static void client_upload_done(int epoll_fd)
+{
+	int card, client, err;
+
+	for (card = 0; card < dsp_mgr_count; card++) {
+		dsp_mgr = &(dsp_mgrs[card]);
+		if (!ld10k1_driver_finish(dsp_mgr, &err))
+			continue;
+
+		if (dsp_mgr->batch && dsp_mgr->batch->committing) {
+			err = ld10k1_batch_commit_end(dsp_mgr, err);
+			ld10k1_fnc_event_batch_end(!err);
+		}
+		client_waiting = 1;
+
+		client = client_find_by_socket(upload_reply[card].socket);
+		upload_reply[card].socket = -1;
+		if (err < 0)
+			error("unable to upload code to card %s", dsp_mgr->card_id);
+		if (!err && client_snapshot_op(upload_reply[card].op))
+			snapshot_dirty[card] = 1;
+		if (client < 0)
+			continue;
+
+		if (send_response(clients[client].socket, err ? FNC_ERR : FNC_OK, err, NULL, 0) < 0 ||
+			client_update_events(epoll_fd, client) < 0)
+			client_close(epoll_fd, client);
+	}
+}
+
+/* after batch or upload ends process requests postponed because of it */
+static void client_process_waiting(int epoll_fd)
+{
+	int i;
+
+	if (!client_waiting)
+		return;
+
+	client_waiting = 0;
+	for (i = 0; i < clients_size; i++) {
+		if (!clients[i].used || !client_request_ready(i))
+			continue;
+		if (client_process(i) < 0 ||
+			client_update_events(epoll_fd, i) < 0)
+			client_close(epoll_fd, i);
+	}
+}
+
+static int card_init(ld10k1_dsp_mgr_t *mgr, ld10k1_card_t *card, int tram_size)
+{
+	mgr->audigy = card->audigy;
+	mgr->card_id = card->card_id;
+
+	if (ld10k1_dsp_mgr_init(mgr))
 		return -1;
+	mgr->auto_order = auto_order;
+	mgr->optimize = optimize;
+
+	/* initialize id generators */
+	ld10k1_dsp_mgr_init_id_gen(mgr);
+
+	if (ld10k1_driver_open(mgr, card->handle, card->ctlp, card->emu) < 0)
+		goto err;
+
+	/* requests are not processed yet, init is waited for */
+	if (ld10k1_init_driver(mgr, tram_size) < 0 ||
+		ld10k1_driver_sync(mgr) < 0 ||
+		ld10k1_init_reserved_ctls(mgr, card->ctlp) < 0) {
+		ld10k1_driver_close(mgr);
+		goto err;
 	}
 
+	/* state from last run in one upload, without snapshot card starts empty */
+	if (card->snapshot && access(card->snapshot, F_OK) == 0 &&
+		ld10k1_snapshot_load(mgr, card->snapshot) < 0)
+		error("unable to load snapshot %s of card %s", card->snapshot, card->card_id);
+	return 0;
+err:
+	ld10k1_dsp_mgr_free(mgr);
+	return -1;
+}
+
+static void card_free(ld10k1_dsp_mgr_t *mgr)
+{
+	/* queued uploads are finished first */
+	ld10k1_driver_close(mgr);
+	ld10k1_free_reserved_ctls(mgr);
+	ld10k1_dsp_mgr_free(mgr);
+}
+
+int main_loop(comm_param *param, ld10k1_card_t *cards, int card_count, int tram_size)
+{
+	struct epoll_event ev;
+	struct epoll_event events[MAX_EVENTS];
+	int i, nfds, fd, client, timeout;
+	int snapshot_wait = -1;
+	int max_in = 0;
+	sighandler_t old_sig_pipe;
+
+	int main_sock = -1;
+	int epoll_fd = -1;
+
+	int retval = 0;
+
+	dsp_mgrs = (ld10k1_dsp_mgr_t *)calloc(card_count, sizeof(ld10k1_dsp_mgr_t));
+	if (!dsp_mgrs)
+		return -1;
+
+	for (dsp_mgr_count = 0; dsp_mgr_count < card_count; dsp_mgr_count++)
+		if (card_init(&(dsp_mgrs[dsp_mgr_count]), &(cards[dsp_mgr_count]), tram_size) < 0) {
+			error("unable to initialize card %s", cards[dsp_mgr_count].card_id);
+			while (dsp_mgr_count > 0)
+				card_free(&(dsp_mgrs[--dsp_mgr_count]));
+			free(dsp_mgrs);
+			dsp_mgrs = NULL;
+			return -1;
+		}
+	dsp_mgr = dsp_mgrs;
+
+	/* client can't have more than longest request unprocessed */
+	for (i = 0; fnc_table[i].fnc >= 0; i++)
+		if (fnc_table[i].max_size > max_in)
+			max_in = fnc_table[i].max_size;
+	max_in += sizeof(struct msg_req);
+
 	old_sig_pipe = signal(SIGPIPE, SIG_IGN);
 
+	/* Initialize the set of active sockets. */
+	client_init();
+
 	param->server = 1;
 	if ((main_sock = setup_comm(param)) < 0)
 		goto error;
@@ -218,91 +912,134 @@ int main_loop(comm_param *param, int audigy, const char *card_id, int tram_size,
 	if (listen_comm(main_sock))
 		goto error;
 
-	/* Initialize the set of active sockets. */
-	client_init();
+	if (nonblock_comm(main_sock))
+		goto error;
+
+	if ((epoll_fd = epoll_create(MAX_EVENTS)) < 0)
+		goto error;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = main_sock;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, main_sock, &ev) < 0)
+		goto error;
+
+	/* end of upload wakes up loop */
+	for (i = 0; i < dsp_mgr_count; i++) {
+		upload_reply[i].socket = -1;
+		if (ld10k1_driver_fd(&(dsp_mgrs[i])) < 0)
+			continue;
+		ev.data.fd = ld10k1_driver_fd(&(dsp_mgrs[i]));
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0)
+			goto error;
+	}
 
 	while (1) {
 		/* Block until input arrives on one or more active sockets. */
-		FD_ZERO (&active_fd_set);
-		FD_SET (main_sock, &active_fd_set);
+		timeout = client_peek_timeout();
+		for (i = 0; i < dsp_mgr_count; i++)
+			if (dsp_mgrs[i].batch && (timeout < 0 || timeout > 1000))
+				timeout = 1000;
+		if (snapshot_wait >= 0 && (timeout < 0 || timeout > snapshot_wait))
+			timeout = snapshot_wait;
+		nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
+			goto error;
+		}
 
-		for (i = 0; i < MAX_CLIENTS; i++)
-			if (clients[i].used)
-				FD_SET(clients[i].socket, &active_fd_set);
+		/* batch owner doesn't respond */
+		for (i = 0; i < dsp_mgr_count; i++) {
+			dsp_mgr = &(dsp_mgrs[i]);
+			if (!dsp_mgr->batch || dsp_mgr->batch->committing ||
+				time(NULL) - batch_last_op[i] <= BATCH_TIMEOUT)
+				continue;
+			client = client_find_by_socket(dsp_mgr->batch->owner);
+			if (client >= 0)
+				client_close(epoll_fd, client);
+			else {
+				ld10k1_batch_abort(dsp_mgr);
+				ld10k1_fnc_event_batch_end(0);
+			}
+		}
 
+		for (i = 0; i < nfds; i++) {
+			fd = events[i].data.fd;
+			if (fd == main_sock) {
+				/* Connection request on original socket. */
+				client_accept(epoll_fd, main_sock);
+				continue;
+			}
 
-		if (select(FD_SETSIZE, &active_fd_set, NULL, NULL, NULL) < 0)
-			goto error;
+			/* driver notification, it is read by client_upload_done */
+			client = client_find_by_socket(fd);
+			if (client < 0)
+				continue;
 
+			if (events[i].events & EPOLLOUT) {
+				if (flush_buf_comm(fd) < 0)
+					goto e_close;
+			}
 
-		for (i = 0; i < FD_SETSIZE; i++)
-			if (FD_ISSET (i, &active_fd_set))	{
-				if (i == main_sock)	{
-					/* Connection request on original socket. */
-					if ((data_sock = accept_comm(main_sock)) < 0)
-						goto error;
-
-					new_client = client_add();
-					if (new_client < 0)
-						free_comm(data_sock);
-					else
-						clients[new_client].socket = data_sock;
-						/*FD_SET(data_sock, &active_fd_set);*/
-				} else {
-					/* Data arriving on an already-connected socket. */
-					if (receive_request(i, &op, &data_size))
-						/*goto error;*/
-						op = -1; /* probably client closes */
-
-					if (op == FNC_CLOSE_CONN) {
-						/* wait some time */
-						usleep(10000);
-						goto e_close;
-					}
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				/* Data arriving on an already-connected socket. */
+				if (fill_buf_comm(fd, max_in) <= 0)
+					/* probably client closes */
+					goto e_close;
+				if (client_process(client) < 0)
+					goto e_close;
+			}
 
-					if (op >= 0) {
-						/* search in function table */
-						res = 1;
-						for (j = 0; fnc_table[j].fnc >= 0; j++)	{
-							if ((fnc_table[j].fnc == op) &&
-								(data_size >= fnc_table[j].min_size) &&
-								(data_size <= fnc_table[j].max_size)) {
-								res = (*fnc_table[j].fnc_code)(i, op, data_size);
-								break;
-							}
-						}
-						if (!res) {
-							if (send_response(i, FNC_OK, 0, NULL, 0) < 0)
-								goto e_close;
-						} else {
-							if (send_response(i, FNC_ERR, res, NULL, 0) < 0)
-								goto e_close;
-						}
-					} else {
+			if (client_update_events(epoll_fd, client) < 0)
+				goto e_close;
+			continue;
 e_close:
-						if (op != FNC_CLOSE_CONN)
-							printf("error protocol fnc:%d - %d\n", op, res);
-						client_del(client_find_by_socket(i));
-						/*FD_CLR (i, &active_fd_set);*/
-
-						/* close connection */
-						if (free_comm(i))
-							data_sock = 0;
-					}
-				}
-			}
+			client_close(epoll_fd, client);
+		}
+
+		client_upload_done(epoll_fd);
+		client_process_waiting(epoll_fd);
+
+		/* register writes from all requests in this round go in one upload */
+		for (i = 0; i < dsp_mgr_count; i++)
+			if (dsp_mgrs[i].gpr_write_pending && !dsp_mgrs[i].batch &&
+				ld10k1_update_driver(&(dsp_mgrs[i])) < 0)
+				error("unable to upload register values");
+
+		/* changes are collected and saved later, not on every register write */
+		snapshot_wait = client_snapshot_save(cards, 0);
+
+		client_send_events(epoll_fd);
+		client_send_peek(epoll_fd);
 	}
 end:
 	signal(SIGPIPE, old_sig_pipe);
-	for (i = 0; i < MAX_CLIENTS; i++)
+	for (i = 0; i < clients_size; i++)
 		if (clients[i].used) {
 			client_del(i);
 			free_comm(clients[i].socket);
 		}
-	free_comm(main_sock);
-
-	ld10k1_free_reserved_ctls(&dsp_mgr);
-	ld10k1_dsp_mgr_free(&dsp_mgr);
+	client_free_all();
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	if (main_sock >= 0)
+		free_comm(main_sock);
+
+	/* changes not saved yet because of interval or upload */
+	for (i = 0; i < dsp_mgr_count; i++)
+		ld10k1_driver_sync(&(dsp_mgrs[i]));
+	client_snapshot_save(cards, 1);
+	for (i = 0; i < dsp_mgr_count; i++)
+		card_free(&(dsp_mgrs[i]));
+	free(dsp_mgrs);
+	dsp_mgrs = NULL;
+	dsp_mgr_count = 0;
+	dsp_mgr = NULL;
+	event_count = 0;
+	memset(event_lost, 0, sizeof(event_lost));
+	memset(snapshot_dirty, 0, sizeof(snapshot_dirty));
+	memset(snapshot_last, 0, sizeof(snapshot_last));
 
 	return retval;
 
@@ -311,15 +1048,10 @@ error:
 	goto end;
 }
 
-int ld10k1_fnc_receive_patch_info(int data_conn, ld10k1_dsp_patch_t *new_patch, int *where)
+static int ld10k1_fnc_check_patch_info(ld10k1_fnc_patch_add_t *tmp_info, ld10k1_dsp_patch_t *new_patch, int *where)
 {
-	ld10k1_fnc_patch_add_t tmp_info;
-
-	if (receive_msg_data(data_conn, &tmp_info, sizeof(ld10k1_fnc_patch_add_t)) < 0)
-		return LD10K1_ERR_PROTOCOL;
-
-	memcpy(new_patch, &(tmp_info.patch), sizeof(ld10k1_dsp_patch_t));
-	*where = tmp_info.where;
+	memcpy(new_patch, &(tmp_info->patch), sizeof(ld10k1_dsp_patch_t));
+	*where = tmp_info->where;
 
 	new_patch->patch_name[MAX_NAME_LEN - 1] = '\n';
 	if (new_patch->in_count < 0 || new_patch->in_count > 32)
@@ -343,169 +1075,106 @@ int ld10k1_fnc_receive_patch_info(int data_conn, ld10k1_dsp_patch_t *new_patch,
 	if (new_patch->instr_count < 0 || new_patch->instr_count > 512)
 		return LD10K1_ERR_PROTOCOL_INSTR_COUNT;
 
-	return send_response_ok(data_conn);
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_in(int data_conn, ld10k1_patch_t *new_patch)
+int ld10k1_fnc_receive_patch_info(int data_conn, ld10k1_dsp_patch_t *new_patch, int *where)
 {
-	ld10k1_dsp_p_in_out_t *new_in = NULL;
-	int i;
+	ld10k1_fnc_patch_add_t tmp_info;
 	int err;
 
- 	if (!new_patch->in_count)
-		return 0;
-
- 	if (!(new_in = (ld10k1_dsp_p_in_out_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_p_in_out_t) * new_patch->in_count)))
+	if (receive_msg_data(data_conn, &tmp_info, sizeof(ld10k1_fnc_patch_add_t)) < 0)
 		return LD10K1_ERR_PROTOCOL;
 
-	/* copy values */
-	for (i = 0; i < new_patch->in_count; i++) {
-		if (!ld10k1_dsp_mgr_name_new(&(new_patch->ins[i].name), new_in[i].name)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
-	}
+	if ((err = ld10k1_fnc_check_patch_info(&tmp_info, new_patch, where)) < 0)
+		return err;
 
 	return send_response_ok(data_conn);
-error:
-	free(new_in);
-	return err;
 }
 
-int ld10k1_fnc_receive_patch_out(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_in(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_p_in_out_t *new_out = NULL;
+	ld10k1_dsp_p_in_out_t *new_in = (ld10k1_dsp_p_in_out_t *)data;
 	int i;
-	int err;
-
- 	if (!new_patch->out_count)
-		return 0;
 
- 	if (!(new_out = (ld10k1_dsp_p_in_out_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_p_in_out_t) * new_patch->out_count)))
-		return LD10K1_ERR_PROTOCOL;
-
-	/* copy values */
-	for (i = 0; i < new_patch->out_count; i++) {
-		if (!ld10k1_dsp_mgr_name_new(&(new_patch->outs[i].name), new_out[i].name)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
-	}
-
-	return send_response_ok(data_conn);
-error:
-	free(new_out);
-	return err;
+	for (i = 0; i < new_patch->in_count; i++)
+		if (!ld10k1_dsp_mgr_name_new(&(new_patch->ins[i].name), new_in[i].name))
+			return LD10K1_ERR_NO_MEM;
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_const(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_out(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_p_const_static_t *new_const = NULL;
+	ld10k1_dsp_p_in_out_t *new_out = (ld10k1_dsp_p_in_out_t *)data;
 	int i;
 
- 	if (!new_patch->const_count)
-		return 0;
+	for (i = 0; i < new_patch->out_count; i++)
+		if (!ld10k1_dsp_mgr_name_new(&(new_patch->outs[i].name), new_out[i].name))
+			return LD10K1_ERR_NO_MEM;
+	return 0;
+}
 
- 	if (!(new_const = (ld10k1_dsp_p_const_static_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_p_const_static_t) * new_patch->const_count)))
-		return LD10K1_ERR_PROTOCOL;
+static int ld10k1_fnc_copy_patch_const(ld10k1_patch_t *new_patch, void *data)
+{
+	ld10k1_dsp_p_const_static_t *new_const = (ld10k1_dsp_p_const_static_t *)data;
+	int i;
 
-	/* copy values */
 	for (i = 0; i < new_patch->const_count; i++)
 		new_patch->consts[i].const_val = new_const[i].const_val;
-
-	return send_response_ok(data_conn);
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_sta(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_sta(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_p_const_static_t *new_sta = NULL;
+	ld10k1_dsp_p_const_static_t *new_sta = (ld10k1_dsp_p_const_static_t *)data;
 	int i;
 
- 	if (!new_patch->sta_count)
-		return 0;
-
- 	if (!(new_sta = (ld10k1_dsp_p_const_static_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_p_const_static_t) * new_patch->sta_count)))
-		return LD10K1_ERR_PROTOCOL;
-
-	/* copy values */
 	for (i = 0; i < new_patch->sta_count; i++)
 		new_patch->stas[i].const_val = new_sta[i].const_val;
-
-	return send_response_ok(data_conn);
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_hw(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_hw(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_p_hw_t *new_hw = NULL;
+	ld10k1_dsp_p_hw_t *new_hw = (ld10k1_dsp_p_hw_t *)data;
 	int i;
 
- 	if (!new_patch->hw_count)
-		return 0;
-
- 	if (!(new_hw = (ld10k1_dsp_p_hw_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_p_hw_t) * new_patch->hw_count)))
-		return LD10K1_ERR_PROTOCOL;
-
-	/* copy values */
 	for (i = 0; i < new_patch->hw_count; i++)
 		new_patch->hws[i].reg_idx = new_hw[i].hw_val;
-
-	return send_response_ok(data_conn);
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_tram_grp(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_tram_grp(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_tram_grp_t *new_tram_grp = NULL;
+	ld10k1_dsp_tram_grp_t *new_tram_grp = (ld10k1_dsp_tram_grp_t *)data;
 	int i;
 
- 	if (!new_patch->tram_count)
-		return 0;
-
- 	if (!(new_tram_grp = (ld10k1_dsp_tram_grp_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_tram_grp_t) * new_patch->tram_count)))
-		return LD10K1_ERR_PROTOCOL;
-
-	/* copy values */
 	for (i = 0; i < new_patch->tram_count; i++) {
 		new_patch->tram_grp[i].grp_type = new_tram_grp[i].grp_type;
 		new_patch->tram_grp[i].grp_size = new_tram_grp[i].grp_size;
 		new_patch->tram_grp[i].grp_pos = new_tram_grp[i].grp_pos;
 	}
-
-	return send_response_ok(data_conn);
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_tram_acc(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_tram_acc(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_tram_acc_t *new_tram_acc = NULL;
+	ld10k1_dsp_tram_acc_t *new_tram_acc = (ld10k1_dsp_tram_acc_t *)data;
 	int i;
 
- 	if (!new_patch->tram_acc_count)
-		return 0;
-
- 	if (!(new_tram_acc = (ld10k1_dsp_tram_acc_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_tram_acc_t) * new_patch->tram_acc_count)))
-		return LD10K1_ERR_PROTOCOL;
-
-	/* copy values */
 	for (i = 0; i < new_patch->tram_acc_count; i++) {
 		new_patch->tram_acc[i].acc_type = new_tram_acc[i].acc_type;
 		new_patch->tram_acc[i].acc_offset = new_tram_acc[i].acc_offset;
 		new_patch->tram_acc[i].grp = new_tram_acc[i].grp;
 	}
-
-	return send_response_ok(data_conn);
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_ctl(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_ctl(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_ctl_t *new_ctl = NULL;
+	ld10k1_dsp_ctl_t *new_ctl = (ld10k1_dsp_ctl_t *)data;
 	int i, j;
 
- 	if (!new_patch->ctl_count)
-		return 0;
-
- 	if (!(new_ctl = (ld10k1_dsp_ctl_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_ctl_t) * new_patch->ctl_count)))
-		return LD10K1_ERR_PROTOCOL;
-
-	/* copy values */
 	for (i = 0; i < new_patch->ctl_count; i++) {
 		strncpy(new_patch->ctl[i].name, new_ctl[i].name, 43);
 		new_patch->ctl[i].name[43] = '\0';
@@ -520,22 +1189,14 @@ int ld10k1_fnc_receive_patch_ctl(int data_conn, ld10k1_patch_t *new_patch)
 		for (j = 0; j < new_patch->ctl[i].count; j++)
 			new_patch->ctl[i].value[j] = new_ctl[i].value[j];
 	}
-
-	return send_response_ok(data_conn);
+	return 0;
 }
 
-int ld10k1_fnc_receive_patch_instr(int data_conn, ld10k1_patch_t *new_patch)
+static int ld10k1_fnc_copy_patch_instr(ld10k1_patch_t *new_patch, void *data)
 {
-	ld10k1_dsp_instr_t *new_instr = NULL;
+	ld10k1_dsp_instr_t *new_instr = (ld10k1_dsp_instr_t *)data;
 	int i, j;
 
- 	if (!new_patch->instr_count)
-		return 0;
-
- 	if (!(new_instr = (ld10k1_dsp_instr_t *)receive_msg_data_malloc(data_conn, sizeof(ld10k1_dsp_instr_t) * new_patch->instr_count)))
-		return LD10K1_ERR_PROTOCOL;
-
-	/* copy values */
 	for (i = 0; i < new_patch->instr_count; i++) {
 		new_patch->instr[i].op_code = new_instr[i].op_code;
 		for (j = 0; j < 4; j++)
@@ -543,146 +1204,402 @@ int ld10k1_fnc_receive_patch_instr(int data_conn, ld10k1_patch_t *new_patch)
 		new_patch->instr[i].used = 1;
 		new_patch->instr[i].modified = 1;
 	}
+	return 0;
+}
 
-	return send_response_ok(data_conn);
+static void ld10k1_fnc_fill_patch_in(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_p_in_out_t *ins = (ld10k1_dsp_p_in_out_t *)data;
+	int i;
+
+	for (i = 0; i < patch->in_count; i++) {
+		if (patch->ins[i].name)
+			strcpy(ins[i].name, patch->ins[i].name);
+		else
+			ins[i].name[0] = '\0';
+	}
 }
 
-int ld10k1_fnc_patch_add(int data_conn, int op, int size)
+static void ld10k1_fnc_fill_patch_out(ld10k1_patch_t *patch, void *data)
 {
-	int err;
-	int loaded[2];
-	int where;
+	ld10k1_dsp_p_in_out_t *outs = (ld10k1_dsp_p_in_out_t *)data;
+	int i;
 
-	ld10k1_dsp_patch_t new_patch_info;
-	/* allocate new patch */
-	ld10k1_patch_t *new_patch = NULL;
+	for (i = 0; i < patch->out_count; i++) {
+		if (patch->outs[i].name)
+			strcpy(outs[i].name, patch->outs[i].name);
+		else
+			outs[i].name[0] = '\0';
+	}
+}
 
-	if ((err = ld10k1_fnc_receive_patch_info(data_conn, &new_patch_info, &where)) < 0)
-		goto error;
+static void ld10k1_fnc_fill_patch_const(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_p_const_static_t *consts = (ld10k1_dsp_p_const_static_t *)data;
+	int i;
 
-	if (!(new_patch = ld10k1_dsp_mgr_patch_new())) {
-		err = LD10K1_ERR_NO_MEM;
-		goto error;
+	for (i = 0; i < patch->const_count; i++)
+		consts[i].const_val = patch->consts[i].const_val;
+}
+
+static void ld10k1_fnc_fill_patch_sta(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_p_const_static_t *stas = (ld10k1_dsp_p_const_static_t *)data;
+	int i;
+
+	for (i = 0; i < patch->sta_count; i++)
+		stas[i].const_val = patch->stas[i].const_val;
+}
+
+static void ld10k1_fnc_fill_patch_hw(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_p_hw_t *hws = (ld10k1_dsp_p_hw_t *)data;
+	int i;
+
+	for (i = 0; i < patch->hw_count; i++)
+		hws[i].hw_val = patch->hws[i].reg_idx;
+}
+
+static void ld10k1_fnc_fill_patch_tram_grp(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_tram_grp_t *grps = (ld10k1_dsp_tram_grp_t *)data;
+	int i;
+
+	for (i = 0; i < patch->tram_count; i++) {
+		grps[i].grp_type = patch->tram_grp[i].grp_type;
+		grps[i].grp_size = patch->tram_grp[i].grp_size;
+		grps[i].grp_pos = patch->tram_grp[i].grp_pos;
 	}
+}
 
-	/* name */
-	if (!ld10k1_dsp_mgr_name_new(&(new_patch->patch_name), new_patch_info.patch_name)) {
-		err = LD10K1_ERR_NO_MEM;
-		goto error;
+static void ld10k1_fnc_fill_patch_tram_acc(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_tram_acc_t *accs = (ld10k1_dsp_tram_acc_t *)data;
+	int i;
+
+	for (i = 0; i < patch->tram_acc_count; i++) {
+		accs[i].acc_type = patch->tram_acc[i].acc_type;
+		accs[i].acc_offset = patch->tram_acc[i].acc_offset;
+		accs[i].grp = patch->tram_acc[i].grp;
 	}
+}
 
+static void ld10k1_fnc_fill_patch_ctl(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_ctl_t *ctls = (ld10k1_dsp_ctl_t *)data;
+	int i, j;
+
+	for (i = 0; i < patch->ctl_count; i++) {
+		memcpy(ctls[i].name, patch->ctl[i].name, sizeof(ctls[i].name));
+		ctls[i].index = patch->ctl[i].want_index;
+		ctls[i].count = patch->ctl[i].count;
+		ctls[i].vcount = patch->ctl[i].vcount;
+		ctls[i].min = patch->ctl[i].min;
+		ctls[i].max = patch->ctl[i].max;
+		ctls[i].translation = patch->ctl[i].translation;
+
+		for (j = 0; j < ctls[i].count; j++)
+			ctls[i].value[j] = patch->ctl[i].value[j];
+	}
+}
+
+static void ld10k1_fnc_fill_patch_instr(ld10k1_patch_t *patch, void *data)
+{
+	ld10k1_dsp_instr_t *instrs = (ld10k1_dsp_instr_t *)data;
+	int i, j;
+
+	for (i = 0; i < patch->instr_count; i++) {
+		instrs[i].op_code = patch->instr[i].op_code;
+		for (j = 0; j < 4; j++)
+			instrs[i].arg[j] = patch->instr[i].arg[j];
+	}
+}
+
+/* patch parts in order in which they are sent */
+static struct {
+	int size;
+	int (*copy)(ld10k1_patch_t *new_patch, void *data);
+	void (*fill)(ld10k1_patch_t *patch, void *data);
+} patch_part[PATCH_ADD_SECT_COUNT] = {
+	{sizeof(ld10k1_fnc_patch_add_t), NULL, NULL},
+	{sizeof(ld10k1_dsp_p_in_out_t), ld10k1_fnc_copy_patch_in, ld10k1_fnc_fill_patch_in},
+	{sizeof(ld10k1_dsp_p_in_out_t), ld10k1_fnc_copy_patch_out, ld10k1_fnc_fill_patch_out},
+	{sizeof(ld10k1_dsp_p_const_static_t), ld10k1_fnc_copy_patch_const, ld10k1_fnc_fill_patch_const},
+	{sizeof(ld10k1_dsp_p_const_static_t), ld10k1_fnc_copy_patch_sta, ld10k1_fnc_fill_patch_sta},
+	{sizeof(ld10k1_dsp_p_hw_t), ld10k1_fnc_copy_patch_hw, ld10k1_fnc_fill_patch_hw},
+	{sizeof(ld10k1_dsp_tram_grp_t), ld10k1_fnc_copy_patch_tram_grp, ld10k1_fnc_fill_patch_tram_grp},
+	{sizeof(ld10k1_dsp_tram_acc_t), ld10k1_fnc_copy_patch_tram_acc, ld10k1_fnc_fill_patch_tram_acc},
+	{sizeof(ld10k1_dsp_ctl_t), ld10k1_fnc_copy_patch_ctl, ld10k1_fnc_fill_patch_ctl},
+	{sizeof(ld10k1_dsp_instr_t), ld10k1_fnc_copy_patch_instr, ld10k1_fnc_fill_patch_instr}
+};
+
+static int ld10k1_fnc_patch_part_count(ld10k1_dsp_patch_t *info, int part)
+{
+	switch (part) {
+		case PATCH_ADD_SECT_IN:
+			return info->in_count;
+		case PATCH_ADD_SECT_OUT:
+			return info->out_count;
+		case PATCH_ADD_SECT_CONST:
+			return info->const_count;
+		case PATCH_ADD_SECT_STA:
+			return info->static_count;
+		case PATCH_ADD_SECT_HW:
+			return info->hw_count;
+		case PATCH_ADD_SECT_TRAM_GRP:
+			return info->tram_count;
+		case PATCH_ADD_SECT_TRAM_ACC:
+			return info->tram_acc_count;
+		case PATCH_ADD_SECT_CTL:
+			return info->ctl_count;
+		case PATCH_ADD_SECT_INSTR:
+			return info->instr_count;
+		default:
+			return 1;
+	}
+}
+
+/* one part of patch in separate message */
+static int ld10k1_fnc_receive_patch_part(int data_conn, ld10k1_patch_t *new_patch, ld10k1_dsp_patch_t *info, int part)
+{
+	void *data;
+	int count;
+	int err;
+
+	count = ld10k1_fnc_patch_part_count(info, part);
+	if (!count)
+		return 0;
+
+	if (!(data = receive_msg_data_malloc(data_conn, patch_part[part].size * count)))
+		return LD10K1_ERR_PROTOCOL;
+
+	err = patch_part[part].copy(new_patch, data);
+	free(data);
+	if (err < 0)
+		return err;
+
+	return send_response_ok(data_conn);
+}
+
+static int ld10k1_fnc_patch_alloc(ld10k1_patch_t *new_patch, ld10k1_dsp_patch_t *new_patch_info)
+{
+	/* name */
+	if (!ld10k1_dsp_mgr_name_new(&(new_patch->patch_name), new_patch_info->patch_name))
+		return LD10K1_ERR_NO_MEM;
 
 	/* set sizes */
-	if (new_patch_info.in_count)
-		if (!ld10k1_dsp_mgr_patch_in_new(new_patch, new_patch_info.in_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->in_count)
+		if (!ld10k1_dsp_mgr_patch_in_new(new_patch, new_patch_info->in_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.out_count)
-		if (!ld10k1_dsp_mgr_patch_out_new(new_patch, new_patch_info.out_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->out_count)
+		if (!ld10k1_dsp_mgr_patch_out_new(new_patch, new_patch_info->out_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.const_count)
-		if (!ld10k1_dsp_mgr_patch_const_new(new_patch, new_patch_info.const_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->const_count)
+		if (!ld10k1_dsp_mgr_patch_const_new(new_patch, new_patch_info->const_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.static_count)
-		if (!ld10k1_dsp_mgr_patch_sta_new(new_patch, new_patch_info.static_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->static_count)
+		if (!ld10k1_dsp_mgr_patch_sta_new(new_patch, new_patch_info->static_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.dynamic_count)
-		if (!ld10k1_dsp_mgr_patch_dyn_new(new_patch, new_patch_info.dynamic_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->dynamic_count)
+		if (!ld10k1_dsp_mgr_patch_dyn_new(new_patch, new_patch_info->dynamic_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.hw_count)
-		if (!ld10k1_dsp_mgr_patch_hw_new(new_patch, new_patch_info.hw_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->hw_count)
+		if (!ld10k1_dsp_mgr_patch_hw_new(new_patch, new_patch_info->hw_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.tram_count)
-		if (!ld10k1_dsp_mgr_patch_tram_new(new_patch, new_patch_info.tram_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->tram_count)
+		if (!ld10k1_dsp_mgr_patch_tram_new(new_patch, new_patch_info->tram_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.tram_acc_count)
-		if (!ld10k1_dsp_mgr_patch_tram_acc_new(new_patch, new_patch_info.tram_acc_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->tram_acc_count)
+		if (!ld10k1_dsp_mgr_patch_tram_acc_new(new_patch, new_patch_info->tram_acc_count))
+			return LD10K1_ERR_NO_MEM;
 
-	if (new_patch_info.ctl_count)
-		if (!ld10k1_dsp_mgr_patch_ctl_new(new_patch,new_patch_info.ctl_count)) {
-			err = LD10K1_ERR_NO_MEM;
-			goto error;
-		}
+	if (new_patch_info->ctl_count)
+		if (!ld10k1_dsp_mgr_patch_ctl_new(new_patch,new_patch_info->ctl_count))
+			return LD10K1_ERR_NO_MEM;
+
+	if (!ld10k1_dsp_mgr_patch_instr_new(new_patch, new_patch_info->instr_count))
+		return LD10K1_ERR_NO_MEM;
+
+	return 0;
+}
+
+/* after load patch is owned by dsp manager and *new_patch is cleared */
+static int ld10k1_fnc_patch_add_load(int data_conn, ld10k1_patch_t **new_patch, int where)
+{
+	int err;
+	int loaded[2];
+
+	/* check patch */
+	if ((err = ld10k1_patch_fnc_check_patch(dsp_mgr, *new_patch)) < 0)
+		return err;
+
+	if (optimize && (err = ld10k1_patch_optimize(dsp_mgr, *new_patch)) < 0)
+		return err;
+
+	/* load patch */
+	if ((err = ld10k1_dsp_mgr_patch_load(dsp_mgr, *new_patch, where, loaded)) < 0)
+		return err;
+	*new_patch = NULL;
+
+	if ((err = ld10k1_batch_save_patch(dsp_mgr, loaded[0])) < 0)
+		return err;
+
+	ld10k1_fnc_event(data_conn, EVENT_PATCH_ADD, 0, loaded[0], loaded[1], 0);
+	if (dsp_mgr->patch_ptr[loaded[0]]->ctl_count)
+		ld10k1_fnc_event(data_conn, EVENT_CTL_ADD, 0, loaded[0], loaded[1], dsp_mgr->patch_ptr[loaded[0]]->ctl_count);
+
+	if ((err = send_response_wd(data_conn, loaded, sizeof(loaded))) < 0)
+		return err;
+
+	return 0;
+}
+
+void ld10k1_fnc_patch_rcv_free(int data_conn)
+{
+	ld10k1_patch_rcv_t *rcv = clients[data_conn].patch_rcv;
+
+	if (!rcv)
+		return;
+	if (rcv->patch)
+		ld10k1_dsp_mgr_patch_free(rcv->patch);
+	free(rcv);
+	clients[data_conn].patch_rcv = NULL;
+}
+
+/* size of next part of v1 patch upload, 0 - all parts are received */
+int ld10k1_fnc_patch_rcv_need(int data_conn)
+{
+	ld10k1_patch_rcv_t *rcv = clients[data_conn].patch_rcv;
+	int count;
+
+	for (; rcv->part < PATCH_ADD_SECT_COUNT; rcv->part++) {
+		count = ld10k1_fnc_patch_part_count(&(rcv->info), rcv->part);
+		if (count)
+			return patch_part[rcv->part].size * count;
+	}
+	return 0;
+}
+
+/* patch is loaded after last part, until then other requests are processed */
+static int ld10k1_fnc_patch_add_next(int data_conn)
+{
+	ld10k1_patch_rcv_t *rcv = clients[data_conn].patch_rcv;
+	int err;
+
+	if (ld10k1_fnc_patch_rcv_need(data_conn))
+		return FNC_RES_WAIT;
+
+	err = ld10k1_fnc_patch_add_load(data_conn, &(rcv->patch), rcv->where);
+	ld10k1_fnc_patch_rcv_free(data_conn);
+	return err;
+}
+
+int ld10k1_fnc_patch_add(int data_conn, int op, int size)
+{
+	ld10k1_patch_rcv_t *rcv;
+	int err;
+
+	rcv = (ld10k1_patch_rcv_t *)malloc(sizeof(ld10k1_patch_rcv_t));
+	if (!rcv)
+		return LD10K1_ERR_NO_MEM;
+	memset(rcv, 0, sizeof(ld10k1_patch_rcv_t));
+	clients[data_conn].patch_rcv = rcv;
+
+	if ((err = ld10k1_fnc_receive_patch_info(data_conn, &(rcv->info), &(rcv->where))) < 0)
+		goto error;
 
-	if (!ld10k1_dsp_mgr_patch_instr_new(new_patch, new_patch_info.instr_count)) {
+	if (!(rcv->patch = ld10k1_dsp_mgr_patch_new())) {
 		err = LD10K1_ERR_NO_MEM;
 		goto error;
 	}
 
-	/* receive next parts */
-	if (new_patch_info.in_count)
-		if ((err = ld10k1_fnc_receive_patch_in(data_conn, new_patch)) < 0)
-			goto error;
+	if ((err = ld10k1_fnc_patch_alloc(rcv->patch, &(rcv->info))) < 0)
+		goto error;
 
-	if (new_patch_info.out_count)
-		if ((err = ld10k1_fnc_receive_patch_out(data_conn, new_patch)) < 0)
-			goto error;
+	/* next parts */
+	rcv->part = PATCH_ADD_SECT_IN;
+	return ld10k1_fnc_patch_add_next(data_conn);
+error:
+	ld10k1_fnc_patch_rcv_free(data_conn);
+	return err;
+}
 
-	if (new_patch_info.const_count)
-		if ((err = ld10k1_fnc_receive_patch_const(data_conn, new_patch)) < 0)
-			goto error;
+int ld10k1_fnc_patch_add_part(int data_conn)
+{
+	ld10k1_patch_rcv_t *rcv = clients[data_conn].patch_rcv;
+	int err;
 
-	if (new_patch_info.static_count)
-		if ((err = ld10k1_fnc_receive_patch_sta(data_conn, new_patch)) < 0)
-			goto error;
+	if ((err = ld10k1_fnc_receive_patch_part(data_conn, rcv->patch, &(rcv->info), rcv->part)) < 0) {
+		ld10k1_fnc_patch_rcv_free(data_conn);
+		return err;
+	}
 
-	if (new_patch_info.hw_count)
-		if ((err = ld10k1_fnc_receive_patch_hw(data_conn, new_patch)) < 0)
-			goto error;
+	rcv->part++;
+	return ld10k1_fnc_patch_add_next(data_conn);
+}
 
-	if (new_patch_info.tram_count)
-		if ((err = ld10k1_fnc_receive_patch_tram_grp(data_conn, new_patch)) < 0)
-			goto error;
+/* whole patch in one message, parts are used directly from received data */
+int ld10k1_fnc_patch_add_v2(int data_conn, int op, int size)
+{
+	int err;
+	int where;
+	int i;
 
-	if (new_patch_info.tram_acc_count)
-		if ((err = ld10k1_fnc_receive_patch_tram_acc(data_conn, new_patch)) < 0)
-			goto error;
+	struct iovec sect[PATCH_ADD_SECT_COUNT];
+	void *arena = NULL;
 
-	if (new_patch_info.ctl_count)
-		if ((err = ld10k1_fnc_receive_patch_ctl(data_conn, new_patch)) < 0)
-			goto error;
+	ld10k1_dsp_patch_t new_patch_info;
+	ld10k1_patch_t *new_patch = NULL;
+
+	if ((err = receive_msg_v2(data_conn, size, &arena, sect, PATCH_ADD_SECT_COUNT)) < 0)
+		return err;
 
-	if ((err = ld10k1_fnc_receive_patch_instr(data_conn, new_patch)) < 0)
+	if (err != PATCH_ADD_SECT_COUNT ||
+		sect[PATCH_ADD_SECT_INFO].iov_len != sizeof(ld10k1_fnc_patch_add_t)) {
+		err = LD10K1_ERR_PROTOCOL;
 		goto error;
+	}
 
-	/* check patch */
-	if ((err = ld10k1_patch_fnc_check_patch(&dsp_mgr, new_patch)) < 0)
+	if ((err = ld10k1_fnc_check_patch_info((ld10k1_fnc_patch_add_t *)sect[PATCH_ADD_SECT_INFO].iov_base, &new_patch_info, &where)) < 0)
 		goto error;
 
-	/* load patch */
-	if ((err = ld10k1_dsp_mgr_patch_load(&dsp_mgr, new_patch, where, loaded)) < 0)
+	for (i = PATCH_ADD_SECT_IN; i < PATCH_ADD_SECT_COUNT; i++)
+		if (sect[i].iov_len != patch_part[i].size * ld10k1_fnc_patch_part_count(&new_patch_info, i)) {
+			err = LD10K1_ERR_PROTOCOL;
+			goto error;
+		}
+
+	if (!(new_patch = ld10k1_dsp_mgr_patch_new())) {
+		err = LD10K1_ERR_NO_MEM;
 		goto error;
+	}
 
-	if ((err = send_response_wd(data_conn, loaded, sizeof(loaded))) < 0)
-		return err;
+	if ((err = ld10k1_fnc_patch_alloc(new_patch, &new_patch_info)) < 0)
+		goto error;
+
+	for (i = PATCH_ADD_SECT_IN; i < PATCH_ADD_SECT_COUNT; i++)
+		if (sect[i].iov_len)
+			if ((err = patch_part[i].copy(new_patch, sect[i].iov_base)) < 0)
+				goto error;
+
+	free(arena);
+	arena = NULL;
+
+	if ((err = ld10k1_fnc_patch_add_load(data_conn, &new_patch, where)) < 0)
+		goto error;
 
 	return 0;
 error:
 	if (new_patch)
 		ld10k1_dsp_mgr_patch_free(new_patch);
+	free(arena);
 	return err;
 }
 
@@ -690,11 +1607,74 @@ int ld10k1_fnc_patch_del(int data_conn, int op, int size)
 {
 	ld10k1_fnc_patch_del_t patch_info;
 	int err;
+	int id;
+
+	if ((err = receive_msg_data(data_conn, &patch_info, sizeof(ld10k1_fnc_patch_del_t))) < 0)
+		return err;
+
+	id = -1;
+	if (patch_info.where >= 0 && patch_info.where < EMU10K1_PATCH_MAX && dsp_mgr->patch_ptr[patch_info.where])
+		id = dsp_mgr->patch_ptr[patch_info.where]->id;
+
+	if ((err = ld10k1_patch_fnc_del(dsp_mgr, &patch_info)) < 0)
+		return err;
+
+	ld10k1_fnc_event(data_conn, EVENT_PATCH_DEL, 0, patch_info.where, id, 0);
+	return 0;
+}
+
+int ld10k1_fnc_patch_loop_break(int data_conn, int op, int size)
+{
+	ld10k1_fnc_patch_loop_break_t loop_info;
+	ld10k1_patch_t *patch;
+	int err;
+
+	if ((err = receive_msg_data(data_conn, &loop_info, sizeof(ld10k1_fnc_patch_loop_break_t))) < 0)
+		return err;
+
+	if (loop_info.patch_num < 0 || loop_info.patch_num >= EMU10K1_PATCH_MAX)
+		return LD10K1_ERR_UNKNOWN_PATCH_NUM;
+	patch = dsp_mgr->patch_ptr[loop_info.patch_num];
+	if (!patch)
+		return LD10K1_ERR_UNKNOWN_PATCH_NUM;
+
+	patch->loop_break = loop_info.loop_break ? 1 : 0;
+	dsp_mgr->order_dirty = 1;
+	return ld10k1_dsp_mgr_actualize_instr(dsp_mgr);
+}
+
+int ld10k1_fnc_patch_gpr_write(int data_conn, int op, int size)
+{
+	ld10k1_fnc_gpr_write_t *gpr_write;
+	ld10k1_fnc_gpr_value_t *values;
+	ld10k1_patch_t *patch;
+	char req[sizeof(ld10k1_fnc_gpr_write_t) + GPR_WRITE_MAX * sizeof(ld10k1_fnc_gpr_value_t)];
+	unsigned int i;
+	int err;
+
+	if ((err = receive_msg_data(data_conn, req, size)) < 0)
+		return err;
+
+	gpr_write = (ld10k1_fnc_gpr_write_t *)req;
+	values = (ld10k1_fnc_gpr_value_t *)(gpr_write + 1);
+	if (gpr_write->count > GPR_WRITE_MAX ||
+		sizeof(ld10k1_fnc_gpr_write_t) + gpr_write->count * sizeof(ld10k1_fnc_gpr_value_t) != size)
+		return LD10K1_ERR_PROTOCOL;
+
+	patch = ld10k1_dsp_mgr_patch_find_id(dsp_mgr, gpr_write->patch_id);
+	if (!patch)
+		return LD10K1_ERR_UNKNOWN_PATCH_NUM;
 
-	if ((err = receive_msg_data(data_conn, &patch_info, sizeof(ld10k1_fnc_patch_del_t))) < 0)
-		return err;
+	/* nothing is written if some value is wrong */
+	for (i = 0; i < gpr_write->count; i++)
+		if ((err = ld10k1_dsp_mgr_patch_gpr_check(dsp_mgr, patch, values[i].reg, values[i].val)) < 0)
+			return err;
 
-	return ld10k1_patch_fnc_del(&dsp_mgr, &patch_info);
+	/* upload is postponed to end of main loop round */
+	for (i = 0; i < gpr_write->count; i++)
+		if ((err = ld10k1_dsp_mgr_patch_gpr_write(dsp_mgr, patch, values[i].reg, values[i].val)) < 0)
+			return err;
+	return 0;
 }
 
 int ld10k1_fnc_patch_conn(int data_conn, int op, int size)
@@ -706,9 +1686,18 @@ int ld10k1_fnc_patch_conn(int data_conn, int op, int size)
 	if ((err = receive_msg_data(data_conn, &connection_info, sizeof(ld10k1_fnc_connection_t))) < 0)
 		return err;
 
-	if ((err = ld10k1_connection_fnc(&dsp_mgr, &connection_info, &conn_id)) < 0)
+	/* both ends can be reconnected */
+	if ((err = ld10k1_batch_save_link(dsp_mgr, connection_info.from_type, connection_info.from_patch, connection_info.from_io)) < 0)
 		return err;
-		
+	if (connection_info.what == FNC_CONNECTION_ADD)
+		if ((err = ld10k1_batch_save_link(dsp_mgr, connection_info.to_type, connection_info.to_patch, connection_info.to_io)) < 0)
+			return err;
+
+	if ((err = ld10k1_connection_fnc(dsp_mgr, &connection_info, &conn_id)) < 0)
+		return err;
+
+	ld10k1_fnc_event(data_conn, EVENT_CONNECTION, connection_info.what, connection_info.from_patch, conn_id, connection_info.from_io);
+
 	return send_response_wd(data_conn, &conn_id, sizeof(conn_id));
 }
 
@@ -730,39 +1719,39 @@ int ld10k1_fnc_name_find(int data_conn, int op, int size)
 	switch (op)	{
 		case FNC_PATCH_FIND:
 			for (i = 0; i < EMU10K1_PATCH_MAX ; i++)
-				if (dsp_mgr.patch_ptr[i])
-					if (strcmp(dsp_mgr.patch_ptr[i]->patch_name, name_info.name) == 0) {
+				if (dsp_mgr->patch_ptr[i])
+					if (strcmp(dsp_mgr->patch_ptr[i]->patch_name, name_info.name) == 0) {
 						ret = i;
 						break;
 					}
 			break;
 		case FNC_FX_FIND:
-			for (i = 0; i < dsp_mgr.fx_count ; i++)
-				if (dsp_mgr.fxs[i].name)
-					if (strcmp(dsp_mgr.fxs[i].name, name_info.name) == 0) {
+			for (i = 0; i < dsp_mgr->fx_count ; i++)
+				if (dsp_mgr->fxs[i].name)
+					if (strcmp(dsp_mgr->fxs[i].name, name_info.name) == 0) {
 						ret = i;
 						break;
 					}
 			break;
 		case FNC_IN_FIND:
-			for (i = 0; i < dsp_mgr.in_count ; i++)
-				if (dsp_mgr.ins[i].name)
-					if (strcmp(dsp_mgr.ins[i].name, name_info.name) == 0) {
+			for (i = 0; i < dsp_mgr->in_count ; i++)
+				if (dsp_mgr->ins[i].name)
+					if (strcmp(dsp_mgr->ins[i].name, name_info.name) == 0) {
 						ret = i;
 						break;
 					}
 			break;
 		case FNC_OUT_FIND:
-			for (i = 0; i < dsp_mgr.out_count ; i++)
-				if (dsp_mgr.outs[i].name)
-					if (strcmp(dsp_mgr.outs[i].name, name_info.name) == 0) {
+			for (i = 0; i < dsp_mgr->out_count ; i++)
+				if (dsp_mgr->outs[i].name)
+					if (strcmp(dsp_mgr->outs[i].name, name_info.name) == 0) {
 						ret = i;
 						break;
 					}
 			break;
 		case FNC_PATCH_IN_FIND :
 			if (name_info.patch_num >= 0 || name_info.patch_num < EMU10K1_PATCH_MAX) {
-				patch = dsp_mgr.patch_ptr[name_info.patch_num];
+				patch = dsp_mgr->patch_ptr[name_info.patch_num];
 				if (patch)
 					for (i = 0; i < patch->in_count ; i++)
 						if (patch->ins[i].name)
@@ -774,7 +1763,7 @@ int ld10k1_fnc_name_find(int data_conn, int op, int size)
 			break;
 		case FNC_PATCH_OUT_FIND :
 			if (name_info.patch_num >= 0 || name_info.patch_num < EMU10K1_PATCH_MAX) {
-				patch = dsp_mgr.patch_ptr[name_info.patch_num];
+				patch = dsp_mgr->patch_ptr[name_info.patch_num];
 				if (patch)
 					for (i = 0; i < patch->out_count ; i++)
 						if (patch->outs[i].name)
@@ -806,7 +1795,7 @@ int ld10k1_fnc_name_rename(int data_conn, int op, int size)
 	switch (op)	{
 		case FNC_PATCH_RENAME:
 			if (name_info.patch_num >= 0 || name_info.patch_num < EMU10K1_PATCH_MAX) {
-				patch = dsp_mgr.patch_ptr[name_info.patch_num];
+				patch = dsp_mgr->patch_ptr[name_info.patch_num];
 				if (patch) {
 					if (!ld10k1_dsp_mgr_name_new(&(patch->patch_name), name_info.name))
 						return LD10K1_ERR_PATCH_RENAME;
@@ -816,26 +1805,26 @@ int ld10k1_fnc_name_rename(int data_conn, int op, int size)
 				return LD10K1_ERR_UNKNOWN_PATCH_NUM;
 			break;
 		case FNC_FX_RENAME:
-			if (name_info.gpr < 0 || name_info.gpr >= dsp_mgr.fx_count)
+			if (name_info.gpr < 0 || name_info.gpr >= dsp_mgr->fx_count)
 				return LD10K1_ERR_UNKNOWN_REG_NUM;
-			if (!ld10k1_dsp_mgr_name_new(&(dsp_mgr.fxs[name_info.gpr].name), name_info.name))
+			if (!ld10k1_dsp_mgr_name_new(&(dsp_mgr->fxs[name_info.gpr].name), name_info.name))
 				return LD10K1_ERR_REG_RENAME;
 			break;
 		case FNC_IN_RENAME:
-			if (name_info.gpr < 0 || name_info.gpr >= dsp_mgr.in_count)
+			if (name_info.gpr < 0 || name_info.gpr >= dsp_mgr->in_count)
 				return LD10K1_ERR_UNKNOWN_REG_NUM;
-			if (!ld10k1_dsp_mgr_name_new(&(dsp_mgr.ins[name_info.gpr].name), name_info.name))
+			if (!ld10k1_dsp_mgr_name_new(&(dsp_mgr->ins[name_info.gpr].name), name_info.name))
 				return LD10K1_ERR_REG_RENAME;
 			break;
 		case FNC_OUT_RENAME:
-			if (name_info.gpr < 0 || name_info.gpr >= dsp_mgr.out_count)
+			if (name_info.gpr < 0 || name_info.gpr >= dsp_mgr->out_count)
 				return LD10K1_ERR_UNKNOWN_REG_NUM;
-			if (!ld10k1_dsp_mgr_name_new(&(dsp_mgr.outs[name_info.gpr].name), name_info.name))
+			if (!ld10k1_dsp_mgr_name_new(&(dsp_mgr->outs[name_info.gpr].name), name_info.name))
 				return LD10K1_ERR_REG_RENAME;
 			break;
 		case FNC_PATCH_IN_RENAME:
 			if (name_info.patch_num >= 0 || name_info.patch_num < EMU10K1_PATCH_MAX) {
-				patch = dsp_mgr.patch_ptr[name_info.patch_num];
+				patch = dsp_mgr->patch_ptr[name_info.patch_num];
 				if (patch) {
 					if (name_info.gpr < 0 || name_info.gpr >= patch->in_count)
 						return LD10K1_ERR_UNKNOWN_PATCH_REG_NUM;
@@ -848,7 +1837,7 @@ int ld10k1_fnc_name_rename(int data_conn, int op, int size)
 			break;
 		case FNC_PATCH_OUT_RENAME:
 			if (name_info.patch_num >= 0 || name_info.patch_num < EMU10K1_PATCH_MAX) {
-				patch = dsp_mgr.patch_ptr[name_info.patch_num];
+				patch = dsp_mgr->patch_ptr[name_info.patch_num];
 				if (patch) {
 					if (name_info.gpr < 0 || name_info.gpr >= patch->out_count)
 						return LD10K1_ERR_UNKNOWN_PATCH_REG_NUM;
@@ -860,37 +1849,57 @@ int ld10k1_fnc_name_rename(int data_conn, int op, int size)
 				return LD10K1_ERR_UNKNOWN_PATCH_NUM;
 			break;
 	}
+
+	if (op == FNC_PATCH_RENAME)
+		ld10k1_fnc_event(data_conn, EVENT_PATCH_RENAME, op, name_info.patch_num, dsp_mgr->patch_ptr[name_info.patch_num]->id, 0);
+	else if (op == FNC_PATCH_IN_RENAME || op == FNC_PATCH_OUT_RENAME)
+		ld10k1_fnc_event(data_conn, EVENT_IO_RENAME, op, name_info.patch_num, dsp_mgr->patch_ptr[name_info.patch_num]->id, name_info.gpr);
+	else
+		ld10k1_fnc_event(data_conn, EVENT_IO_RENAME, op, -1, -1, name_info.gpr);
 	return 0;
 }
 
 int ld10k1_fnc_dsp_init(int data_conn, int op, int size)
 {
 	int audigy;
+	const char *card_id;
+	ld10k1_driver_t *driver;
 	int err, i;
 	
 	ld10k1_reserved_ctl_list_item_t *rlist;
 	int save_ids[EMU10K1_PATCH_MAX];
 
-	audigy = dsp_mgr.audigy;
+	audigy = dsp_mgr->audigy;
+	card_id = dsp_mgr->card_id;
+	driver = dsp_mgr->driver;
 
-	rlist = dsp_mgr.reserved_ctl_list; /* FIXME - hack to save reserved ctls and ids */
+	rlist = dsp_mgr->reserved_ctl_list; /* FIXME - hack to save reserved ctls and ids */
 	for (i = 0; i < EMU10K1_PATCH_MAX; i++)
-		save_ids[i] = dsp_mgr.patch_id_gens[i];
+		save_ids[i] = dsp_mgr->patch_id_gens[i];
 		
-	ld10k1_dsp_mgr_free(&dsp_mgr);
-	memset(&dsp_mgr, 0, sizeof(dsp_mgr));
+	ld10k1_dsp_mgr_free(dsp_mgr);
+	memset(dsp_mgr, 0, sizeof(ld10k1_dsp_mgr_t));
 
-	dsp_mgr.audigy = audigy;
+	dsp_mgr->audigy = audigy;
+	dsp_mgr->card_id = card_id;
+	dsp_mgr->driver = driver;
 
-	if ((err = ld10k1_dsp_mgr_init(&dsp_mgr)) < 0)
+	if ((err = ld10k1_dsp_mgr_init(dsp_mgr)) < 0)
 		return err;
+	dsp_mgr->auto_order = auto_order;
+	dsp_mgr->optimize = optimize;
 		
-	dsp_mgr.reserved_ctl_list = rlist; /* hack to seve reserved ctls */
+	dsp_mgr->reserved_ctl_list = rlist; /* hack to seve reserved ctls */
 	
 	for (i = 0; i < EMU10K1_PATCH_MAX; i++)
-		dsp_mgr.patch_id_gens[i] = save_ids[i];
+		dsp_mgr->patch_id_gens[i] = save_ids[i];
 
-	return ld10k1_init_driver(&dsp_mgr, -1);
+	/* everything changed, single event is enough */
+	ld10k1_fnc_event_remove(CARD_OF(dsp_mgr), 0);
+	event_lost[CARD_OF(dsp_mgr)] = 0;
+	ld10k1_fnc_event(data_conn, EVENT_RESET, 0, -1, -1, 0);
+
+	return ld10k1_init_driver(dsp_mgr, -1);
 }
 
 int ld10k1_fnc_get_io_count(int data_conn, int op, int size)
@@ -901,13 +1910,13 @@ int ld10k1_fnc_get_io_count(int data_conn, int op, int size)
 		
 	if (op == FNC_GET_FX_COUNT)
 		/* fxs */
-		reg_count = dsp_mgr.fx_count;
+		reg_count = dsp_mgr->fx_count;
 	else if (op == FNC_GET_IN_COUNT)
 		/* ins */
-		reg_count = dsp_mgr.in_count;
+		reg_count = dsp_mgr->in_count;
 	else
 		/* outs */
-		reg_count = dsp_mgr.out_count;
+		reg_count = dsp_mgr->out_count;
 
 	return send_response_wd(data_conn, &reg_count, sizeof(int));
 }
@@ -925,13 +1934,13 @@ int ld10k1_fnc_get_io(int data_conn, int op, int size)
 
 	if (op == FNC_GET_FX)
 		/* fx */
-		reg_count = dsp_mgr.fx_count;
+		reg_count = dsp_mgr->fx_count;
 	else if (op == FNC_GET_IN)
 		/* in */
-		reg_count = dsp_mgr.in_count;
+		reg_count = dsp_mgr->in_count;
 	else
 		/* out */
-		reg_count = dsp_mgr.out_count;
+		reg_count = dsp_mgr->out_count;
 		
 	if (reg_num < 0 || reg_num >= reg_count)
 		return LD10K1_ERR_UNKNOWN_REG_NUM;
@@ -939,18 +1948,18 @@ int ld10k1_fnc_get_io(int data_conn, int op, int size)
 	if (op == FNC_GET_FX) {
 		/* fx */
 		memset(io.name, 0, sizeof(io.name));
-		if (dsp_mgr.fxs[reg_num].name)
-			strcpy(io.name, dsp_mgr.fxs[reg_num].name);
+		if (dsp_mgr->fxs[reg_num].name)
+			strcpy(io.name, dsp_mgr->fxs[reg_num].name);
 	} else if (op == FNC_GET_IN) {
 		/* in */
 		memset(io.name, 0, sizeof(io.name));
-		if (dsp_mgr.ins[reg_num].name)
-			strcpy(io.name, dsp_mgr.ins[reg_num].name);
+		if (dsp_mgr->ins[reg_num].name)
+			strcpy(io.name, dsp_mgr->ins[reg_num].name);
 	} else {
 		/* out */
 		memset(io.name, 0, sizeof(io.name));
-		if (dsp_mgr.outs[reg_num].name)
-			strcpy(io.name, dsp_mgr.outs[reg_num].name);
+		if (dsp_mgr->outs[reg_num].name)
+			strcpy(io.name, dsp_mgr->outs[reg_num].name);
 	}
 
 	return send_response_wd(data_conn, &io, sizeof(ld10k1_fnc_get_io_t));
@@ -971,7 +1980,7 @@ int ld10k1_fnc_get_pio_count(int data_conn, int op, int size)
 	/* patch */
 	if (patch_num >= 0 && patch_num < EMU10K1_PATCH_MAX) {
 		/* patch register */
-		patch = dsp_mgr.patch_ptr[patch_num];
+		patch = dsp_mgr->patch_ptr[patch_num];
 		if (!patch)
 			return LD10K1_ERR_UNKNOWN_PATCH_NUM;
 
@@ -1009,7 +2018,7 @@ int ld10k1_fnc_get_pio(int data_conn, int op, int size)
 	/* patch */
 	if (patch_num >= 0 && patch_num < EMU10K1_PATCH_MAX) {
 		/* patch register */
-		patch = dsp_mgr.patch_ptr[patch_num];
+		patch = dsp_mgr->patch_ptr[patch_num];
 		if (!patch)
 			return LD10K1_ERR_UNKNOWN_PATCH_NUM;
 
@@ -1049,17 +2058,17 @@ int ld10k1_fnc_get_patches_info(int data_conn, int op, int size)
 
 	info = NULL;
 
-	if (dsp_mgr.patch_count >= 0) {
+	if (dsp_mgr->patch_count >= 0) {
 		/* alloc space */
-		info = (ld10k1_fnc_patches_info_t *)malloc(sizeof(ld10k1_fnc_patches_info_t) * dsp_mgr.patch_count);
+		info = (ld10k1_fnc_patches_info_t *)malloc(sizeof(ld10k1_fnc_patches_info_t) * dsp_mgr->patch_count);
 		if (!info)
 			return LD10K1_ERR_NO_MEM;
-		memset(info, 0, sizeof(ld10k1_fnc_patches_info_t) * dsp_mgr.patch_count);
+		memset(info, 0, sizeof(ld10k1_fnc_patches_info_t) * dsp_mgr->patch_count);
 
 		/* copy values */
-		for (i = 0, j = 0; i < dsp_mgr.patch_count; i++) {
-			idx = dsp_mgr.patch_order[i];
-			patch = dsp_mgr.patch_ptr[idx];
+		for (i = 0, j = 0; i < dsp_mgr->patch_count; i++) {
+			idx = dsp_mgr->patch_order[i];
+			patch = dsp_mgr->patch_ptr[idx];
 			if (patch) {
 				info[j].patch_num = idx;
 				info[j].id = patch->id;
@@ -1069,7 +2078,7 @@ int ld10k1_fnc_get_patches_info(int data_conn, int op, int size)
 		}
 	}
 
-	return send_response_wd(data_conn, info, sizeof(ld10k1_fnc_patches_info_t) * dsp_mgr.patch_count);
+	return send_response_wd(data_conn, info, sizeof(ld10k1_fnc_patches_info_t) * dsp_mgr->patch_count);
 }
 
 int ld10k1_fnc_version(int data_conn, int op, int size)
@@ -1077,253 +2086,57 @@ int ld10k1_fnc_version(int data_conn, int op, int size)
 
 	ld10k1_fnc_version_t version;
 
+	memset(&version, 0, sizeof(version));
 	strcpy(version.ld10k1_version, VERSION);
+	version.proto_magic = LD10K1_PROTO_MAGIC;
+	version.proto = LD10K1_PROTO_V3;
 	return send_response_wd(data_conn, &version, sizeof(ld10k1_fnc_version_t));
 }
 
 
-int ld10k1_fnc_send_patch_in(int data_conn, ld10k1_patch_t *patch)
-{
-	int i, err;
-	ld10k1_dsp_p_in_out_t *ins = NULL;
-
-	if (patch->in_count) {
-		ins = (ld10k1_dsp_p_in_out_t *)malloc(sizeof(ld10k1_dsp_p_in_out_t) * patch->in_count);
-		if (!ins)
-			return LD10K1_ERR_NO_MEM;
-		memset(ins, 0, sizeof(ld10k1_dsp_p_in_out_t) * patch->in_count);
-
-		for (i = 0; i < patch->in_count; i++) {
-			if (patch->ins[i].name)
-				strcpy(ins[i].name, patch->ins[i].name);
-			else
-				ins[i].name[0] = '\0';
-		}
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, ins, sizeof(ld10k1_dsp_p_in_out_t) * patch->in_count)) < 0) {
-			free(ins);
-			return err;
-		}
-
-		free(ins);
-	}
-	return 0;
-}
-
-int ld10k1_fnc_send_patch_out(int data_conn, ld10k1_patch_t *patch)
-{
-	int i, err;
-	ld10k1_dsp_p_in_out_t *outs = NULL;
-
-	if (patch->out_count) {
-		outs = (ld10k1_dsp_p_in_out_t *)malloc(sizeof(ld10k1_dsp_p_in_out_t) * patch->out_count);
-		if (!outs)
-			return LD10K1_ERR_NO_MEM;
-		memset(outs, 0, sizeof(ld10k1_dsp_p_in_out_t) * patch->out_count);
-
-		for (i = 0; i < patch->out_count; i++) {
-			if (patch->outs[i].name)
-				strcpy(outs[i].name, patch->outs[i].name);
-			else
-				outs[i].name[0] = '\0';
-		}
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, outs, sizeof(ld10k1_dsp_p_in_out_t) * patch->out_count)) < 0) {
-			free(outs);
-			return err;
-		}
-
-		free(outs);
-	}
-	return 0;
-}
-
-int ld10k1_fnc_send_patch_const(int data_conn, ld10k1_patch_t *patch)
-{
-	int i, err;
-	ld10k1_dsp_p_const_static_t *consts = NULL;
-
-	if (patch->const_count) {
-		consts = (ld10k1_dsp_p_const_static_t *)malloc(sizeof(ld10k1_dsp_p_const_static_t) * patch->const_count);
-		if (!consts)
-			return LD10K1_ERR_NO_MEM;
-
-		for (i = 0; i < patch->const_count; i++)
-			consts[i].const_val = patch->consts[i].const_val;
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, consts, sizeof(ld10k1_dsp_p_const_static_t) * patch->const_count)) < 0) {
-			free(consts);
-			return err;
-		}
-
-		free(consts);
-	}
-	return 0;
-}
-
-int ld10k1_fnc_send_patch_sta(int data_conn, ld10k1_patch_t *patch)
-{
-	int i, err;
-	ld10k1_dsp_p_const_static_t *stas = NULL;
-
-	if (patch->sta_count) {
-		stas = (ld10k1_dsp_p_const_static_t *)malloc(sizeof(ld10k1_dsp_p_const_static_t) * patch->sta_count);
-		if (!stas)
-			return LD10K1_ERR_NO_MEM;
-
-		for (i = 0; i < patch->sta_count; i++)
-			stas[i].const_val = patch->stas[i].const_val;
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, stas, sizeof(ld10k1_dsp_p_const_static_t) * patch->sta_count)) < 0) {
-			free(stas);
-			return err;
-		}
-
-		free(stas);
-	}
-	return 0;
-}
-
-int ld10k1_fnc_send_patch_hw(int data_conn, ld10k1_patch_t *patch)
-{
-	int i, err;
-	ld10k1_dsp_p_hw_t *hws = NULL;
-
-	if (patch->hw_count) {
-		hws = (ld10k1_dsp_p_hw_t *)malloc(sizeof(ld10k1_dsp_p_hw_t) * patch->hw_count);
-		if (!hws)
-			return LD10K1_ERR_NO_MEM;
-
-		for (i = 0; i < patch->hw_count; i++)
-			hws[i].hw_val = patch->hws[i].reg_idx;
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, hws, sizeof(ld10k1_dsp_p_hw_t) * patch->hw_count)) < 0) {
-			free(hws);
-			return err;
-		}
-
-		free(hws);
-	}
-	return 0;
-}
-
-int ld10k1_fnc_send_patch_tram_grp(int data_conn, ld10k1_patch_t *patch)
-{
-	int i, err;
-	ld10k1_dsp_tram_grp_t *grps = NULL;
-
-	if (patch->tram_count) {
-		grps = (ld10k1_dsp_tram_grp_t *)malloc(sizeof(ld10k1_dsp_tram_grp_t) * patch->tram_count);
-		if (!grps)
-			return LD10K1_ERR_NO_MEM;
-
-		for (i = 0; i < patch->tram_count; i++) {
-			grps[i].grp_type = patch->tram_grp[i].grp_type;
-			grps[i].grp_size = patch->tram_grp[i].grp_size;
-			grps[i].grp_pos = patch->tram_grp[i].grp_pos;
-		}
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, grps, sizeof(ld10k1_dsp_tram_grp_t) * patch->tram_count)) < 0) {
-			free(grps);
-			return err;
-		}
-
-		free(grps);
-	}
-	return 0;
-}
-
-int ld10k1_fnc_send_patch_tram_acc(int data_conn, ld10k1_patch_t *patch)
-{
-	int i, err;
-	ld10k1_dsp_tram_acc_t *accs = NULL;
-
-	if (patch->tram_acc_count) {
-		accs = (ld10k1_dsp_tram_acc_t *)malloc(sizeof(ld10k1_dsp_tram_acc_t) * patch->tram_acc_count);
-		if (!accs)
-			return LD10K1_ERR_NO_MEM;
-
-		for (i = 0; i < patch->tram_acc_count; i++) {
-			accs[i].acc_type = patch->tram_acc[i].acc_type;
-			accs[i].acc_offset = patch->tram_acc[i].acc_offset;
-			accs[i].grp = patch->tram_acc[i].grp;
-		}
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, accs, sizeof(ld10k1_dsp_tram_acc_t) * patch->tram_acc_count)) < 0) {
-			free(accs);
-			return err;
-		}
-
-		free(accs);
-	}
-	return 0;
-}
-
-int ld10k1_fnc_send_patch_ctl(int data_conn, ld10k1_patch_t *patch)
+static void ld10k1_fnc_fill_patch_info(ld10k1_patch_t *patch, ld10k1_dsp_patch_t *patch_info)
 {
-	int i, j, err;
-	ld10k1_dsp_ctl_t *ctls = NULL;
-
-	if (patch->ctl_count) {
-		ctls = (ld10k1_dsp_ctl_t *)malloc(sizeof(ld10k1_dsp_ctl_t) * patch->ctl_count);
-		if (!ctls)
-			return LD10K1_ERR_NO_MEM;
-		memset(ctls, 0, sizeof(ld10k1_dsp_ctl_t) * patch->ctl_count);
-
-		for (i = 0; i < patch->ctl_count; i++) {
-			strncpy(ctls[i].name, patch->ctl[i].name, 43);
-			ctls[i].name[43] = '\0';
-			ctls[i].index = patch->ctl[i].want_index;
-			ctls[i].count = patch->ctl[i].count;
-			ctls[i].vcount = patch->ctl[i].vcount;
-			ctls[i].min = patch->ctl[i].min;
-			ctls[i].max = patch->ctl[i].max;
-			ctls[i].translation = patch->ctl[i].translation;
-
-			for (j = 0; j < ctls[i].count; j++)
-				ctls[i].value[j] = patch->ctl[i].value[j];
-		}
-
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, ctls, sizeof(ld10k1_dsp_ctl_t) * patch->ctl_count)) < 0) {
-			free(ctls);
-			return err;
-		}
-
-		free(ctls);
-	}
-	return 0;
+	strcpy(patch_info->patch_name, patch->patch_name);
+	patch_info->id = patch->id;
+	patch_info->in_count = patch->in_count;
+	patch_info->out_count = patch->out_count;
+	patch_info->const_count = patch->const_count;
+	patch_info->static_count = patch->sta_count;
+	patch_info->dynamic_count = patch->dyn_count;
+	patch_info->hw_count = patch->hw_count;
+	patch_info->tram_count = patch->tram_count;
+	patch_info->tram_acc_count = patch->tram_acc_count;
+	patch_info->ctl_count = patch->ctl_count;
+	patch_info->instr_count = patch->instr_count;
 }
 
-int ld10k1_fnc_send_patch_instr(int data_conn, ld10k1_patch_t *patch)
+/* one part of patch in separate message */
+static int ld10k1_fnc_send_patch_part(int data_conn, ld10k1_patch_t *patch, ld10k1_dsp_patch_t *patch_info, int part)
 {
-	int i, j, err;
-	ld10k1_dsp_instr_t *instrs = NULL;
+	int err;
+	int data_size;
+	void *data;
 
-	if (patch->instr_count) {
-		instrs = (ld10k1_dsp_instr_t *)malloc(sizeof(ld10k1_dsp_instr_t) * patch->instr_count);
-		if (!instrs)
-			return LD10K1_ERR_NO_MEM;
+	data_size = patch_part[part].size * ld10k1_fnc_patch_part_count(patch_info, part);
+	if (!data_size)
+		return 0;
 
-		for (i = 0; i < patch->instr_count; i++) {
-			instrs[i].op_code = patch->instr[i].op_code;
-			for (j = 0; j < 4; j++)
-				instrs[i].arg[j] = patch->instr[i].arg[j];
-		}
+	data = malloc(data_size);
+	if (!data)
+		return LD10K1_ERR_NO_MEM;
+	memset(data, 0, data_size);
 
-		if ((err = send_response(data_conn, FNC_CONTINUE, 0, instrs, sizeof(ld10k1_dsp_instr_t) * patch->instr_count)) < 0) {
-			free(instrs);
-			return err;
-		}
+	patch_part[part].fill(patch, data);
 
-		free(instrs);
-	}
-	return 0;
+	err = send_response(data_conn, FNC_CONTINUE, 0, data, data_size);
+	free(data);
+	return err;
 }
 
-
 int ld10k1_fnc_get_patch(int data_conn, int op, int size)
 {
 	int err;
+	int i;
 
 	ld10k1_dsp_patch_t patch_info;
 	int patch_num = -1;
@@ -1332,57 +2145,23 @@ int ld10k1_fnc_get_patch(int data_conn, int op, int size)
 	if ((err = receive_msg_data(data_conn, &patch_num, sizeof(patch_num))) < 0)
 		return err;
 
-	if (dsp_mgr.patch_count >= 0) {
+	if (dsp_mgr->patch_count >= 0) {
 
 		if (patch_num > EMU10K1_PATCH_MAX)
 			return LD10K1_ERR_UNKNOWN_PATCH_NUM;
-		patch = dsp_mgr.patch_ptr[patch_num];
+		patch = dsp_mgr->patch_ptr[patch_num];
 		if (!patch)
 			return LD10K1_ERR_UNKNOWN_PATCH_NUM;
 
-		strcpy(patch_info.patch_name, patch->patch_name);
-		patch_info.id = patch->id;
-		patch_info.in_count = patch->in_count;
-		patch_info.out_count = patch->out_count;
-		patch_info.const_count = patch->const_count;
-		patch_info.static_count = patch->sta_count;
-		patch_info.dynamic_count = patch->dyn_count;
-		patch_info.hw_count = patch->hw_count;
-		patch_info.tram_count = patch->tram_count;
-		patch_info.tram_acc_count = patch->tram_acc_count;
-		patch_info.ctl_count = patch->ctl_count;
-		patch_info.instr_count = patch->instr_count;
+		ld10k1_fnc_fill_patch_info(patch, &patch_info);
 
 		if ((err = send_response(data_conn, FNC_CONTINUE, 0, &patch_info, sizeof(ld10k1_dsp_patch_t))) < 0)
 			return err;
 
   		/* send next parts */
-		if ((err = ld10k1_fnc_send_patch_in(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_out(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_const(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_sta(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_hw(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_tram_grp(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_tram_acc(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_ctl(data_conn, patch)) < 0)
-			return err;
-
-		if ((err = ld10k1_fnc_send_patch_instr(data_conn, patch)) < 0)
-			return err;
+		for (i = PATCH_ADD_SECT_IN; i < PATCH_ADD_SECT_COUNT; i++)
+			if ((err = ld10k1_fnc_send_patch_part(data_conn, patch, &patch_info, i)) < 0)
+				return err;
 	}
 
 	return 0;
@@ -1395,7 +2174,7 @@ int ld10k1_fnc_dump(int data_conn, int op, int size)
 	int dump_size = 0;
 
 
-	if ((err = ld10k1_make_dump(&dsp_mgr, &dump, &dump_size)) < 0)
+	if ((err = ld10k1_make_dump(dsp_mgr, &dump, &dump_size)) < 0)
 		return err;
 
 	if ((err = send_response(data_conn, FNC_CONTINUE, 0, dump, dump_size)) < 0)
@@ -1422,7 +2201,7 @@ int ld10k1_fnc_get_points_info(int data_conn, int op, int size)
 				return LD10K1_ERR_NO_MEM;
 			j = 0;
 		}
-		point = dsp_mgr.point_list;
+		point = dsp_mgr->point_list;
 		while (point) {
 			if (!i)
 				point_count++;
@@ -1436,24 +2215,61 @@ int ld10k1_fnc_get_points_info(int data_conn, int op, int size)
 	return send_response_wd(data_conn, info, sizeof(int) * point_count);
 }
 
+/* patch_idx maps patch order to index sent to client, patch id is sent without it */
+static void ld10k1_fnc_fill_point_info(ld10k1_conn_point_t *point, ld10k1_dsp_point_t *info, int *patch_idx)
+{
+	int k, l;
+
+	memset(info, 0, sizeof(ld10k1_dsp_point_t));
+	info->id = point->id;
+
+	if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_NORMAL)
+		info->type = CON_IO_NORMAL;
+	else if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_INPUT)
+		info->type = CON_IO_IN;
+	else if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_OUTPUT)
+		info->type = CON_IO_OUT;
+	else if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_FX)
+		info->type = CON_IO_FX;
+	info->io_idx = point->con_gpr_idx & ~EMU10K1_REG_TYPE_MASK;
+	info->simple = point->simple;
+	info->conn_count = point->con_count;
+	if (info->conn_count > 2 && info->type == CON_IO_NORMAL)
+		info->multi = 1;
+	else if (info->conn_count > 1 && info->type != CON_IO_NORMAL)
+		info->multi = 1;
+	else
+		info->multi = 0;
+	for (k = 0, l = 0; k < POINT_MAX_CONN_PER_POINT; k++) {
+		if (point->type[k]) {
+			info->io_type[l] = point->type[k] == CON_IO_PIN ? 0 : 1;
+			if (!point->patch[k])
+				info->patch[l] = -1;
+			else if (patch_idx)
+				info->patch[l] = patch_idx[point->patch[k]->order];
+			else
+				info->patch[l] = point->patch[k]->id;
+			info->io[l] = point->io[k];
+			l++;
+		}
+	}
+}
+
 int ld10k1_fnc_get_point_info(int data_conn, int op, int size)
 {
 	int err;
 
-	int k, l;
 	ld10k1_dsp_point_t info;
 	ld10k1_conn_point_t *point;
 	ld10k1_conn_point_t *found_point;
 	int what_point_id;
 
-	/*info = NULL;*/
-
 	if ((err = receive_msg_data(data_conn, &what_point_id, sizeof(int))) < 0)
 		return err;
 
 	found_point = NULL;
 	
-	point = dsp_mgr.point_list;
+	point = dsp_mgr->point_list;
 	while (point) {
 		if (point->id == what_point_id) {
 			found_point = point;
@@ -1464,34 +2280,8 @@ int ld10k1_fnc_get_point_info(int data_conn, int op, int size)
 	
 	if (!found_point)
 		return LD10K1_ERR_UNKNOWN_POINT;
-	
-	info.id = point->id;
-			
-	if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_NORMAL)
-		info.type = CON_IO_NORMAL;
-	else if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_INPUT)
-		info.type = CON_IO_IN;
-	else if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_OUTPUT)
-		info.type = CON_IO_OUT;
-	else if (EMU10K1_REG_TYPE_B(point->con_gpr_idx) == EMU10K1_REG_TYPE_FX)
-		info.type = CON_IO_FX;
-	info.io_idx = point->con_gpr_idx & ~EMU10K1_REG_TYPE_MASK;
-	info.simple = point->simple;
-	info.conn_count = point->con_count;
-	if (info.conn_count > 2 && info.type == CON_IO_NORMAL)
-		info.multi = 1;
-	else if (info.conn_count > 1 && info.type != CON_IO_NORMAL)
-		info.multi = 1;
-	else
-		info.multi = 0;
-	for (k = 0, l = 0; k < POINT_MAX_CONN_PER_POINT; k++) {
-		if (point->type[k]) {
-			info.io_type[l] = point->type[k] == CON_IO_PIN ? 0 : 1;
-			info.patch[l] = point->patch[k] ? point->patch[k]->id : -1;
-			info.io[l] = point->io[k];
-			l++;
-		}
-	}
+
+	ld10k1_fnc_fill_point_info(found_point, &info, NULL);
 
 	return send_response_wd(data_conn, &info, sizeof(ld10k1_dsp_point_t));
 }
@@ -1500,7 +2290,284 @@ int ld10k1_fnc_get_dsp_info(int data_conn, int op, int size)
 {
 	ld10k1_fnc_dsp_info_t info;
 	
-	info.chip_type = dsp_mgr.audigy;
+	info.chip_type = dsp_mgr->audigy;
 	
 	return send_response_wd(data_conn, &info, sizeof(ld10k1_fnc_dsp_info_t));
 }
+
+static void ld10k1_fnc_fill_io(ld10k1_fnc_get_io_t *io, ld10k1_p_in_out_t *regs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (regs[i].name)
+			strcpy(io[i].name, regs[i].name);
+}
+
+/* whole dsp setup in one response */
+int ld10k1_fnc_get_state(int data_conn, int op, int size)
+{
+	int err;
+	int i, j, part;
+	int part_size;
+	int state_idx[EMU10K1_PATCH_MAX];
+	ld10k1_fnc_state_t state;
+	ld10k1_dsp_patch_t *patch_info;
+	ld10k1_dsp_point_t *point_info;
+	ld10k1_patch_t *patch;
+	ld10k1_conn_point_t *point;
+	struct iovec sect[STATE_SECT_COUNT];
+	char *data, *ptr;
+	int data_size;
+
+	memset(&state, 0, sizeof(state));
+	state.chip_type = dsp_mgr->audigy;
+	state.fx_count = dsp_mgr->fx_count;
+	state.in_count = dsp_mgr->in_count;
+	state.out_count = dsp_mgr->out_count;
+
+	sect[STATE_SECT_INFO].iov_len = sizeof(state);
+	sect[STATE_SECT_FX].iov_len = sizeof(ld10k1_fnc_get_io_t) * state.fx_count;
+	sect[STATE_SECT_IN].iov_len = sizeof(ld10k1_fnc_get_io_t) * state.in_count;
+	sect[STATE_SECT_OUT].iov_len = sizeof(ld10k1_fnc_get_io_t) * state.out_count;
+
+	/* patch index in state by order */
+	sect[STATE_SECT_PATCH].iov_len = 0;
+	for (i = 0; i < dsp_mgr->patch_count; i++) {
+		state_idx[i] = -1;
+		patch = dsp_mgr->patch_ptr[dsp_mgr->patch_order[i]];
+		if (!patch)
+			continue;
+		state_idx[i] = state.patch_count++;
+		sect[STATE_SECT_PATCH].iov_len += sizeof(ld10k1_dsp_patch_t) +
+			sizeof(ld10k1_dsp_p_in_out_t) * (patch->in_count + patch->out_count) +
+			sizeof(ld10k1_dsp_p_const_static_t) * (patch->const_count + patch->sta_count) +
+			sizeof(ld10k1_dsp_p_hw_t) * patch->hw_count +
+			sizeof(ld10k1_dsp_tram_grp_t) * patch->tram_count +
+			sizeof(ld10k1_dsp_tram_acc_t) * patch->tram_acc_count +
+			sizeof(ld10k1_dsp_ctl_t) * patch->ctl_count +
+			sizeof(ld10k1_dsp_instr_t) * patch->instr_count;
+	}
+
+	for (point = dsp_mgr->point_list; point; point = point->next)
+		state.point_count++;
+	sect[STATE_SECT_POINT].iov_len = sizeof(ld10k1_dsp_point_t) * state.point_count;
+
+	data_size = 0;
+	for (i = 0; i < STATE_SECT_COUNT; i++)
+		data_size += sect[i].iov_len;
+
+	data = (char *)malloc(data_size);
+	if (!data)
+		return LD10K1_ERR_NO_MEM;
+	memset(data, 0, data_size);
+
+	for (i = 0, ptr = data; i < STATE_SECT_COUNT; i++) {
+		sect[i].iov_base = ptr;
+		ptr += sect[i].iov_len;
+	}
+
+	memcpy(sect[STATE_SECT_INFO].iov_base, &state, sizeof(state));
+	ld10k1_fnc_fill_io((ld10k1_fnc_get_io_t *)sect[STATE_SECT_FX].iov_base, dsp_mgr->fxs, state.fx_count);
+	ld10k1_fnc_fill_io((ld10k1_fnc_get_io_t *)sect[STATE_SECT_IN].iov_base, dsp_mgr->ins, state.in_count);
+	ld10k1_fnc_fill_io((ld10k1_fnc_get_io_t *)sect[STATE_SECT_OUT].iov_base, dsp_mgr->outs, state.out_count);
+
+	ptr = (char *)sect[STATE_SECT_PATCH].iov_base;
+	for (i = 0; i < dsp_mgr->patch_count; i++) {
+		if (state_idx[i] < 0)
+			continue;
+		patch = dsp_mgr->patch_ptr[dsp_mgr->patch_order[i]];
+		patch_info = (ld10k1_dsp_patch_t *)ptr;
+		ld10k1_fnc_fill_patch_info(patch, patch_info);
+		ptr += sizeof(ld10k1_dsp_patch_t);
+
+		for (part = PATCH_ADD_SECT_IN; part < PATCH_ADD_SECT_COUNT; part++) {
+			part_size = patch_part[part].size * ld10k1_fnc_patch_part_count(patch_info, part);
+			if (!part_size)
+				continue;
+			patch_part[part].fill(patch, ptr);
+			ptr += part_size;
+		}
+	}
+
+	point_info = (ld10k1_dsp_point_t *)sect[STATE_SECT_POINT].iov_base;
+	for (point = dsp_mgr->point_list, j = 0; point; point = point->next, j++)
+		ld10k1_fnc_fill_point_info(point, &point_info[j], state_idx);
+
+	err = send_response_v2(data_conn, FNC_CONTINUE, 0, sect, STATE_SECT_COUNT);
+	free(data);
+	return err;
+}
+
+int ld10k1_fnc_batch(int data_conn, int op, int size)
+{
+	int err;
+
+	if (op == FNC_BATCH_BEGIN) {
+		return ld10k1_batch_begin(dsp_mgr, data_conn);
+	}
+
+	if (!dsp_mgr->batch || dsp_mgr->batch->owner != data_conn)
+		return LD10K1_ERR_BATCH_NOT_ACTIVE;
+
+	if (op == FNC_BATCH_COMMIT) {
+		err = ld10k1_batch_commit(dsp_mgr);
+		/* events are released when upload is done */
+		if (!err && dsp_mgr->batch)
+			return 0;
+	} else
+		err = ld10k1_batch_abort(dsp_mgr);
+	ld10k1_fnc_event_batch_end(op == FNC_BATCH_COMMIT && !err);
+	return err;
+}
+
+int ld10k1_fnc_subscribe(int data_conn, int op, int size)
+{
+	int err;
+	int events;
+
+	if ((err = receive_msg_data(data_conn, &events, sizeof(events))) < 0)
+		return err;
+
+	clients[data_conn].events = events & EVENT_ALL;
+	return 0;
+}
+
+int ld10k1_fnc_peek_subscribe(int data_conn, int op, int size)
+{
+	char req[sizeof(ld10k1_fnc_peek_t) + PEEK_REG_MAX * sizeof(ld10k1_fnc_peek_reg_t)];
+	ld10k1_fnc_peek_t *peek;
+	ld10k1_fnc_peek_reg_t *regs = NULL;
+	ClientDef *client = &(clients[data_conn]);
+	int err;
+
+	if ((err = receive_msg_data(data_conn, req, size)) < 0)
+		return err;
+
+	peek = (ld10k1_fnc_peek_t *)req;
+	if (peek->count > PEEK_REG_MAX ||
+		sizeof(ld10k1_fnc_peek_t) + peek->count * sizeof(ld10k1_fnc_peek_reg_t) != size)
+		return LD10K1_ERR_PROTOCOL;
+
+	if (peek->count) {
+		regs = (ld10k1_fnc_peek_reg_t *)malloc(peek->count * sizeof(ld10k1_fnc_peek_reg_t));
+		if (!regs)
+			return LD10K1_ERR_NO_MEM;
+		memcpy(regs, peek + 1, peek->count * sizeof(ld10k1_fnc_peek_reg_t));
+	}
+
+	if (client->peek_regs)
+		free(client->peek_regs);
+	client->peek_regs = regs;
+	client->peek_count = peek->count;
+	client->peek_interval = peek->interval < PEEK_INTERVAL_MIN ? PEEK_INTERVAL_MIN : peek->interval;
+	client->peek_seq = 0;
+	/* first frame follows response */
+	client->peek_next = client_time_ms();
+	return 0;
+}
+
+/*
+ * emulator doesn't have driver bass/treble tables and LOG/EXP results are
+ * not checked against chip - such program output would be wrong
+ */
+static int emu_run_exact(ld10k1_dsp_mgr_t *mgr)
+{
+	ld10k1_ctl_list_item_t *item;
+	unsigned int i;
+
+	for (i = 0; i < mgr->instr_count; i++)
+		if (mgr->instr[i].used &&
+			(mgr->instr[i].op_code == EMU_OP_LOG || mgr->instr[i].op_code == EMU_OP_EXP))
+			return LD10K1_ERR_EMU_INEXACT;
+
+	for (item = mgr->ctl_list.first; item != NULL; item = item->next)
+		if (item->ctl.translation == EMU10K1_GPR_TRANSLATION_BASS ||
+			item->ctl.translation == EMU10K1_GPR_TRANSLATION_TREBLE)
+			return LD10K1_ERR_EMU_INEXACT;
+	return 0;
+}
+
+int ld10k1_fnc_emu_run(int data_conn, int op, int size)
+{
+	int err;
+	char *req;
+	ld10k1_fnc_emu_run_t *run;
+	int *regs;
+	int32_t *out = NULL;
+	unsigned int i, type;
+	unsigned long long need;
+	ld10k1_emu_t *emu = ld10k1_driver_emu(dsp_mgr);
+
+	req = (char *)malloc(size);
+	if (!req)
+		return LD10K1_ERR_NO_MEM;
+
+	if ((err = receive_msg_data(data_conn, req, size)) < 0)
+		goto err;
+
+	if (!emu) {
+		err = LD10K1_ERR_EMU_NOT_ACTIVE;
+		goto err;
+	}
+
+	if ((err = emu_run_exact(dsp_mgr)) < 0)
+		goto err;
+
+	run = (ld10k1_fnc_emu_run_t *)req;
+	err = LD10K1_ERR_PROTOCOL;
+	if (run->in_count > EMU_RUN_IO_MAX || run->out_count > EMU_RUN_IO_MAX)
+		goto err;
+	need = sizeof(ld10k1_fnc_emu_run_t) + (run->in_count + run->out_count) * sizeof(int) +
+		(unsigned long long)run->frames * run->in_count * sizeof(int32_t);
+	if (need != size)
+		goto err;
+	if ((unsigned long long)run->frames * run->out_count * sizeof(int32_t) > COMM_BUF_MAX_OUT)
+		goto err;
+
+	/* translate to emulator registers */
+	regs = (int *)(run + 1);
+	err = LD10K1_ERR_EMU_REG;
+	for (i = 0; i < run->in_count + run->out_count; i++) {
+		type = EMU10K1_REG_TYPE_B(regs[i]);
+		if (i < run->in_count) {
+			if (type != EMU10K1_REG_TYPE_FX && type != EMU10K1_REG_TYPE_INPUT)
+				goto err;
+		} else if (type != EMU10K1_REG_TYPE_OUTPUT)
+			goto err;
+		if ((regs[i] = ld10k1_dsp_mgr_get_phys_reg(dsp_mgr, regs[i])) < 0)
+			goto err;
+	}
+
+	out = (int32_t *)malloc(run->frames * run->out_count * sizeof(int32_t) + 1);
+	if (!out) {
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+
+	ld10k1_emu_run(emu, run->frames,
+		run->in_count, regs, (int32_t *)(regs + run->in_count + run->out_count),
+		run->out_count, regs + run->in_count, out);
+
+	err = send_response(data_conn, FNC_CONTINUE, 0, out, run->frames * run->out_count * sizeof(int32_t));
+err:
+	if (out)
+		free(out);
+	free(req);
+	return err < 0 ? err : 0;
+}
+
+int ld10k1_fnc_card_select(int data_conn, int op, int size)
+{
+	int err;
+	int card;
+
+	if ((err = receive_msg_data(data_conn, &card, sizeof(card))) < 0)
+		return err;
+
+	if (card < 0 || card >= dsp_mgr_count)
+		return LD10K1_ERR_UNKNOWN_CARD;
+
+	clients[data_conn].card = card;
+	return 0;
+}
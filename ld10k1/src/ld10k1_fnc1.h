@@ -24,9 +24,20 @@
 
 #include "comm.h"
 
-extern ld10k1_dsp_mgr_t dsp_mgr;
+/* card managed by ld10k1, handle is NULL for emulator */
+typedef struct {
+	int audigy;
+	const char *card_id;
+	snd_hwdep_t *handle;
+	struct ld10k1_emu_s *emu;
+	snd_ctl_t *ctlp;
+	/* state snapshot file, NULL - not used */
+	char *snapshot;
+} ld10k1_card_t;
 
-int main_loop(comm_param *param, int audigy, const char *card_id, int tram_size, snd_ctl_t *ctlp);
+extern ld10k1_dsp_mgr_t *dsp_mgr;
+
+int main_loop(comm_param *param, ld10k1_card_t *cards, int card_count, int tram_size);
 
 int send_response_ok(int conn_num);
 int send_response_err(int conn_num, int err);
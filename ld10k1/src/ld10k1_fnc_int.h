@@ -22,6 +22,8 @@
 #ifndef __LD10K1_FNC_INT_H
 #define __LD10K1_FNC_INT_H
 
+extern unsigned int hw_const[22 * 2];
+
 int ld10k1_dsp_mgr_init(ld10k1_dsp_mgr_t *dsp_mgr);
 void ld10k1_dsp_mgr_init_id_gen(ld10k1_dsp_mgr_t *dsp_mgr);
 void ld10k1_dsp_mgr_free(ld10k1_dsp_mgr_t *dsp_mgr);
@@ -39,14 +41,43 @@ ld10k1_p_tram_acc_t *ld10k1_dsp_mgr_patch_tram_acc_new(ld10k1_patch_t *patch, un
 ld10k1_instr_t *ld10k1_dsp_mgr_patch_instr_new(ld10k1_patch_t *patch, unsigned int count);
 ld10k1_ctl_t *ld10k1_dsp_mgr_patch_ctl_new(ld10k1_patch_t *patch, unsigned int count);
 char *ld10k1_dsp_mgr_name_new(char **where, const char *from);
+int ld10k1_dsp_mgr_patch_index_io(ld10k1_patch_t *patch);
+
+void ld10k1_dsp_mgr_reg_modified(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int idx);
+void ld10k1_dsp_mgr_instr_modified(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int idx);
+void ld10k1_dsp_mgr_tram_modified(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int acc);
+
+int ld10k1_dsp_mgr_get_phys_reg(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int reg);
+unsigned int ld10k1_resolve_named_reg(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int reg);
+unsigned int ld10k1_standard_to_named_reg(ld10k1_dsp_mgr_t *dsp_mgr, unsigned int reg);
+
+unsigned int ld10k1_gpr_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_count, int *res_count, int *res,
+	unsigned int usage, unsigned int val);
+unsigned int ld10k1_gpr_dyn_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_count, int *res_count, int *res);
+unsigned int ld10k1_const_reserve(ld10k1_dsp_mgr_t *dsp_mgr, int max_res_const_count, int *res_const_count, int *res_const,
+	int max_res_count, int *res_count, int *res, int const_val);
+void ld10k1_const_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
+void ld10k1_const_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
+void ld10k1_gpr_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
+void ld10k1_gpr_free(ld10k1_dsp_mgr_t *dsp_mgr, int reg);
 
 int ld10k1_dsp_mgr_patch_load(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, int before, int *loaded);
+int ld10k1_dsp_mgr_patch_unload(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int idx);
+int ld10k1_dsp_mgr_actualize_instr(ld10k1_dsp_mgr_t *dsp_mgr);
+void ld10k1_dsp_mgr_actualize_order(ld10k1_dsp_mgr_t *dsp_mgr);
+void ld10k1_point_actualize_owner(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point);
 int ld10k1_patch_fnc_check_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *new_patch);
 int ld10k1_patch_fnc_del(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_fnc_patch_del_t *patch_fnc);
+ld10k1_patch_t *ld10k1_dsp_mgr_patch_find_id(ld10k1_dsp_mgr_t *dsp_mgr, int patch_id);
+int ld10k1_dsp_mgr_patch_gpr_check(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int reg, unsigned int val);
+int ld10k1_dsp_mgr_patch_gpr_write(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int reg, unsigned int val);
+int ld10k1_dsp_mgr_patch_peek_idx(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, unsigned int reg, int *tram);
 int ld10k1_connection_fnc(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_fnc_connection_t *connection_fnc, int *conn_id);
 
-void ld10k1_del_control_from_list(ld10k1_ctl_list_item_t **list, int *count, ld10k1_ctl_t *gctl);
-void ld10k1_del_all_controls_from_list(ld10k1_ctl_list_item_t **list, int *count);
-int ld10k1_add_control_to_list(ld10k1_ctl_list_item_t **list, int *count, ld10k1_ctl_t *gctl);
+void ld10k1_init_control_list(ld10k1_ctl_list_t *list);
+ld10k1_ctl_list_item_t *ld10k1_look_control_from_list(ld10k1_ctl_list_t *list, ld10k1_ctl_t *gctl);
+void ld10k1_del_control_from_list(ld10k1_ctl_list_t *list, ld10k1_ctl_t *gctl);
+void ld10k1_del_all_controls_from_list(ld10k1_ctl_list_t *list);
+int ld10k1_add_control_to_list(ld10k1_ctl_list_t *list, ld10k1_ctl_t *gctl);
 
 #endif /* __LD10K1_FNC_INT_H */
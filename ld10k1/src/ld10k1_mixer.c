@@ -37,6 +37,10 @@ int ld10k1_init_reserved_ctls(ld10k1_dsp_mgr_t *dsp_mgr, snd_ctl_t *ctlp)
 	
 	dsp_mgr->reserved_ctl_list = NULL;
 	
+	/* emulator - no mixer */
+	if (!ctlp)
+		return 0;
+
 	snd_ctl_elem_list_alloca(&clist);
 	
 	if (snd_ctl_elem_list(ctlp, clist) < 0)
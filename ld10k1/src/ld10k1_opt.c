@@ -0,0 +1,574 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <alsa/asoundlib.h>
+#include <alsa/sound/emu10k1.h>
+#include <stdint.h>
+
+#include "ld10k1.h"
+#include "ld10k1_fnc.h"
+#include "ld10k1_fnc_int.h"
+#include "ld10k1_emu.h"
+#include "ld10k1_error.h"
+#include "ld10k1_opt.h"
+
+/*
+ * Patch optimizer - runs on patch registers before patch is loaded.
+ *
+ * Dynamic registers are temporaries shared by all patches, so their
+ * value is dead after patch and undefined before it. Ins and outs are
+ * connected later and can end in same register, so they (and hw
+ * registers) are treated as one register. Accumulator and flags are
+ * not expected to pass from one patch to other.
+ *
+ * - constant folding - result of instruction with constant operands
+ *   written to dynamic register is replaced by constant register
+ * - copy propagation - copy to dynamic register is replaced by source
+ *   in following reads, copy of dynamic register computed just before
+ *   (glue on patch ins and outs) is removed and computing instruction
+ *   writes directly to destination
+ * - dead store elimination - writes to dynamic registers which are not
+ *   read later, to constants and copies of register to itself
+ *
+ * Patches with SKIP are left as they are.
+ *
+ * Mixing of more patch outs connected to one point is folded when points
+ * are actualized (ld10k1_point_actualize_owner).
+ */
+
+#define OPT_REG_DYN	0	/* temporary */
+#define OPT_REG_CONST	1	/* known value, writes ignored */
+#define OPT_REG_PRIVATE	2	/* static, control, tram - only in this patch */
+#define OPT_REG_SHARED	3	/* in, out, hw - can be same register */
+#define OPT_REG_ACCUM	4
+#define OPT_REG_CCR	5
+#define OPT_REG_NOISE	6	/* read only */
+
+#define OPT_ITER_MAX	8
+
+typedef struct {
+	ld10k1_dsp_mgr_t *dsp_mgr;
+	ld10k1_patch_t *patch;
+	unsigned char *removed;
+	/* constants written by patch are used as static registers */
+	unsigned char const_written[0x100];
+	/* per dynamic register - known value or register with same value */
+	unsigned char *known;
+	uint32_t *value;
+	unsigned int *copy;
+	unsigned char *live;
+} ld10k1_opt_t;
+
+static int ld10k1_opt_class(ld10k1_opt_t *opt, unsigned int reg, uint32_t *val)
+{
+	unsigned int idx = reg & 0xFFFFFFF, hw, i;
+
+	switch (EMU10K1_PREG_TYPE_B(reg)) {
+		case EMU10K1_PREG_TYPE_DYN:
+			return OPT_REG_DYN;
+		case EMU10K1_PREG_TYPE_CONST:
+			if (opt->const_written[idx])
+				return OPT_REG_PRIVATE;
+			if (val)
+				*val = opt->patch->consts[idx].const_val;
+			return OPT_REG_CONST;
+		case EMU10K1_PREG_TYPE_HW:
+			hw = ld10k1_resolve_named_reg(opt->dsp_mgr, opt->patch->hws[idx].reg_idx);
+			if (EMU10K1_REG_TYPE_B(hw) != EMU10K1_REG_TYPE_HW)
+				return OPT_REG_SHARED;
+			for (i = 0; i < sizeof(hw_const) / sizeof(unsigned int); i += 2)
+				if (hw_const[i + 1] == hw) {
+					if (val)
+						*val = hw_const[i];
+					return OPT_REG_CONST;
+				}
+			hw &= 0x3F;
+			if (hw == EMU_HW_ACCUM)
+				return OPT_REG_ACCUM;
+			if (hw == EMU_HW_CCR)
+				return OPT_REG_CCR;
+			if (hw == EMU_HW_NOISE1 || hw == EMU_HW_NOISE2)
+				return OPT_REG_NOISE;
+			return OPT_REG_SHARED;
+		case EMU10K1_PREG_TYPE_IN:
+		case EMU10K1_PREG_TYPE_OUT:
+			return OPT_REG_SHARED;
+		default:
+			return OPT_REG_PRIVATE;
+	}
+}
+
+static int ld10k1_opt_is_zero(ld10k1_opt_t *opt, unsigned int reg)
+{
+	uint32_t val;
+
+	return ld10k1_opt_class(opt, reg, &val) == OPT_REG_CONST && !val;
+}
+
+static int ld10k1_opt_writes_acc(unsigned int op)
+{
+	return op <= EMU_OP_MACMV || op == EMU_OP_INTERP;
+}
+
+static int ld10k1_opt_reads(ld10k1_opt_t *opt, ld10k1_instr_t *instr, int type)
+{
+	int k;
+
+	if (type == OPT_REG_ACCUM && instr->op_code == EMU_OP_MACMV)
+		return 1;
+	for (k = 1; k < 4; k++)
+		if (ld10k1_opt_class(opt, instr->arg[k], NULL) == type)
+			return 1;
+	return 0;
+}
+
+/* instruction only copies *src to R */
+static int ld10k1_opt_copy(ld10k1_opt_t *opt, ld10k1_instr_t *instr, unsigned int *src)
+{
+	unsigned int *arg = instr->arg;
+	uint32_t val;
+	int i, n;
+
+	switch (instr->op_code) {
+		case EMU_OP_MACS:
+		case EMU_OP_MACS1:
+		case EMU_OP_MACW:
+		case EMU_OP_MACW1:
+		case EMU_OP_MACINTS:
+			if (!ld10k1_opt_is_zero(opt, arg[2]) && !ld10k1_opt_is_zero(opt, arg[3]))
+				return 0;
+			*src = arg[1];
+			break;
+		case EMU_OP_ACC3:
+			for (i = 1, n = 0; i < 4; i++)
+				if (ld10k1_opt_is_zero(opt, arg[i]))
+					n++;
+				else
+					*src = arg[i];
+			if (n < 2)
+				return 0;
+			if (n == 3)
+				*src = arg[1];
+			break;
+		case EMU_OP_MACMV:
+			*src = arg[1];
+			break;
+		case EMU_OP_ANDXOR:
+			if (ld10k1_opt_class(opt, arg[2], &val) != OPT_REG_CONST || val != 0xFFFFFFFF ||
+				!ld10k1_opt_is_zero(opt, arg[3]))
+				return 0;
+			*src = arg[1];
+			break;
+		default:
+			return 0;
+	}
+
+	/* accumulator is saturated, flags and noise change */
+	switch (ld10k1_opt_class(opt, *src, NULL)) {
+		case OPT_REG_ACCUM:
+		case OPT_REG_CCR:
+		case OPT_REG_NOISE:
+			return 0;
+	}
+	return 1;
+}
+
+static int32_t ld10k1_opt_sat(int64_t val)
+{
+	if (val > INT32_MAX)
+		return INT32_MAX;
+	if (val < INT32_MIN)
+		return INT32_MIN;
+	return (int32_t)val;
+}
+
+/* result of instruction with constant operands, same as on DSP */
+static int ld10k1_opt_eval(ld10k1_opt_t *opt, ld10k1_instr_t *instr, uint32_t *res)
+{
+	uint32_t v[4];
+	int32_t a, x, y;
+	int64_t p;
+	int k;
+
+	for (k = 1; k < 4; k++)
+		if (ld10k1_opt_class(opt, instr->arg[k], &(v[k])) != OPT_REG_CONST)
+			return 0;
+	a = (int32_t)v[1];
+	x = (int32_t)v[2];
+	y = (int32_t)v[3];
+
+	switch (instr->op_code) {
+		case EMU_OP_MACS:
+		case EMU_OP_MACS1:
+		case EMU_OP_MACW:
+		case EMU_OP_MACW1:
+			p = (int64_t)x * y;
+			if (instr->op_code & 1)
+				p = -p;
+			p = a + (p >> 31);
+			if (instr->op_code == EMU_OP_MACS || instr->op_code == EMU_OP_MACS1)
+				*res = ld10k1_opt_sat(p);
+			else
+				*res = (int32_t)p;
+			return 1;
+		case EMU_OP_MACINTS:
+			*res = ld10k1_opt_sat((int64_t)a + (int64_t)x * y);
+			return 1;
+		case EMU_OP_MACINTW:
+			*res = (uint32_t)(((int64_t)a + (int64_t)x * y) & 0x7fffffff);
+			return 1;
+		case EMU_OP_ACC3:
+			*res = ld10k1_opt_sat((int64_t)a + x + y);
+			return 1;
+		case EMU_OP_MACMV:
+			*res = a;
+			return 1;
+		case EMU_OP_ANDXOR:
+			*res = (a & x) ^ y;
+			return 1;
+		case EMU_OP_TSTNEG:
+			*res = a >= y ? x : ~x;
+			return 1;
+		case EMU_OP_LIMIT:
+			*res = a >= y ? x : y;
+			return 1;
+		case EMU_OP_LIMIT1:
+			*res = a < y ? x : y;
+			return 1;
+		case EMU_OP_INTERP:
+			*res = ld10k1_opt_sat((int64_t)a + (((int64_t)x * ((int64_t)y - a)) >> 31));
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* constant register with value, added to patch if needed, 0 if no space */
+static unsigned int ld10k1_opt_const_reg(ld10k1_opt_t *opt, uint32_t val)
+{
+	ld10k1_patch_t *patch = opt->patch;
+	ld10k1_p_const_sta_t *consts;
+	unsigned int i;
+
+	for (i = 0; i < patch->const_count; i++)
+		if (patch->consts[i].const_val == val && !opt->const_written[i])
+			return EMU10K1_PREG_CONST(i);
+
+	if (patch->const_count >= 0x100)
+		return 0;
+	consts = (ld10k1_p_const_sta_t *)realloc(patch->consts, sizeof(ld10k1_p_const_sta_t) * (patch->const_count + 1));
+	if (!consts)
+		return 0;
+	patch->consts = consts;
+	consts[patch->const_count].const_val = val;
+	consts[patch->const_count].gpr_idx = 0;
+	return EMU10K1_PREG_CONST(patch->const_count++);
+}
+
+/* constants and copies into dynamic registers */
+static int ld10k1_opt_propagate(ld10k1_opt_t *opt)
+{
+	ld10k1_patch_t *patch = opt->patch;
+	ld10k1_instr_t *instr;
+	unsigned int i, j, k, r, d, src, reg;
+	int changed = 0, rc;
+	uint32_t val;
+
+	memset(opt->known, 0, patch->dyn_count);
+	memset(opt->copy, 0, sizeof(unsigned int) * patch->dyn_count);
+
+	for (i = 0; i < patch->instr_count; i++) {
+		if (opt->removed[i])
+			continue;
+		instr = &(patch->instr[i]);
+
+		for (k = 1; k < 4; k++) {
+			if (EMU10K1_PREG_TYPE_B(instr->arg[k]) != EMU10K1_PREG_TYPE_DYN)
+				continue;
+			d = instr->arg[k] & 0xFFFFFFF;
+			reg = 0;
+			if (opt->known[d])
+				reg = ld10k1_opt_const_reg(opt, opt->value[d]);
+			else if (opt->copy[d])
+				reg = opt->copy[d];
+			if (reg) {
+				instr->arg[k] = reg;
+				changed = 1;
+			}
+		}
+
+		r = instr->arg[0];
+		rc = ld10k1_opt_class(opt, r, NULL);
+		for (j = 0; j < patch->dyn_count; j++)
+			if (opt->copy[j] && (opt->copy[j] == r ||
+				(rc == OPT_REG_SHARED && ld10k1_opt_class(opt, opt->copy[j], NULL) == OPT_REG_SHARED)))
+				opt->copy[j] = 0;
+		if (rc != OPT_REG_DYN)
+			continue;
+
+		d = r & 0xFFFFFFF;
+		opt->known[d] = 0;
+		opt->copy[d] = 0;
+		if (ld10k1_opt_eval(opt, instr, &val)) {
+			opt->known[d] = 1;
+			opt->value[d] = val;
+		} else if (ld10k1_opt_copy(opt, instr, &src) && src != r) {
+			if (ld10k1_opt_class(opt, src, &val) == OPT_REG_CONST) {
+				opt->known[d] = 1;
+				opt->value[d] = val;
+			} else
+				opt->copy[d] = src;
+		}
+	}
+	return changed;
+}
+
+/* is value of type or reg written at instruction pc read later */
+static int ld10k1_opt_used_after(ld10k1_opt_t *opt, unsigned int pc, int type, unsigned int reg)
+{
+	ld10k1_patch_t *patch = opt->patch;
+	ld10k1_instr_t *instr;
+	unsigned int i, k;
+
+	for (i = pc + 1; i < patch->instr_count; i++) {
+		if (opt->removed[i])
+			continue;
+		instr = &(patch->instr[i]);
+		if (type == OPT_REG_ACCUM) {
+			if (ld10k1_opt_reads(opt, instr, OPT_REG_ACCUM))
+				return 1;
+			if (ld10k1_opt_writes_acc(instr->op_code))
+				return 0;
+		} else if (type == OPT_REG_CCR) {
+			if (ld10k1_opt_reads(opt, instr, OPT_REG_CCR))
+				return 1;
+			return 0;
+		} else {
+			for (k = 1; k < 4; k++)
+				if (instr->arg[k] == reg)
+					return 1;
+			if (instr->arg[0] == reg)
+				return 0;
+		}
+	}
+	return 0;
+}
+
+/* copy of dynamic register computed just before - computing instruction writes to destination */
+static int ld10k1_opt_coalesce(ld10k1_opt_t *opt)
+{
+	ld10k1_patch_t *patch = opt->patch;
+	ld10k1_instr_t *instr, *tmp;
+	unsigned int i, k, r, src;
+	int changed = 0, rc, d, ok;
+
+	for (i = 0; i < patch->instr_count; i++) {
+		if (opt->removed[i])
+			continue;
+		instr = &(patch->instr[i]);
+		if (!ld10k1_opt_copy(opt, instr, &src) || ld10k1_opt_class(opt, src, NULL) != OPT_REG_DYN)
+			continue;
+		r = instr->arg[0];
+		rc = ld10k1_opt_class(opt, r, NULL);
+		if (r == src || rc == OPT_REG_CONST || rc == OPT_REG_ACCUM || rc == OPT_REG_CCR || rc == OPT_REG_NOISE)
+			continue;
+		if (ld10k1_opt_used_after(opt, i, OPT_REG_DYN, src) ||
+			(ld10k1_opt_writes_acc(instr->op_code) && ld10k1_opt_used_after(opt, i, OPT_REG_ACCUM, 0)) ||
+			ld10k1_opt_used_after(opt, i, OPT_REG_CCR, 0))
+			continue;
+
+		/* last write of src, nothing between may see old or new value of r */
+		ok = 1;
+		for (d = i - 1; d >= 0 && ok; d--) {
+			if (opt->removed[d])
+				continue;
+			tmp = &(patch->instr[d]);
+			if (tmp->arg[0] == src)
+				break;
+			for (k = 0; k < 4; k++)
+				if (tmp->arg[k] == r || tmp->arg[k] == src ||
+					(rc == OPT_REG_SHARED && ld10k1_opt_class(opt, tmp->arg[k], NULL) == OPT_REG_SHARED))
+					ok = 0;
+		}
+		if (!ok || d < 0)
+			continue;
+
+		patch->instr[d].arg[0] = r;
+		opt->removed[i] = 1;
+		changed = 1;
+	}
+	return changed;
+}
+
+/* instructions without visible effect */
+static int ld10k1_opt_dead(ld10k1_opt_t *opt)
+{
+	ld10k1_patch_t *patch = opt->patch;
+	ld10k1_instr_t *instr;
+	unsigned int k, r, src;
+	int i, rc, acc_live, ccr_live, no_r, changed = 0;
+
+	memset(opt->live, 0, patch->dyn_count);
+	acc_live = 0;
+	ccr_live = 0;
+
+	for (i = patch->instr_count - 1; i >= 0; i--) {
+		if (opt->removed[i])
+			continue;
+		instr = &(patch->instr[i]);
+		r = instr->arg[0];
+		rc = ld10k1_opt_class(opt, r, NULL);
+
+		no_r = rc == OPT_REG_CONST || rc == OPT_REG_ACCUM || rc == OPT_REG_NOISE ||
+			(rc == OPT_REG_DYN && !opt->live[r & 0xFFFFFFF]) ||
+			(ld10k1_opt_copy(opt, instr, &src) && src == r);
+		if (no_r && !(ld10k1_opt_writes_acc(instr->op_code) && acc_live) && !ccr_live) {
+			opt->removed[i] = 1;
+			changed = 1;
+			continue;
+		}
+
+		if (rc == OPT_REG_DYN)
+			opt->live[r & 0xFFFFFFF] = 0;
+		if (ld10k1_opt_writes_acc(instr->op_code))
+			acc_live = 0;
+		ccr_live = 0;
+		for (k = 1; k < 4; k++)
+			switch (ld10k1_opt_class(opt, instr->arg[k], NULL)) {
+				case OPT_REG_DYN:
+					opt->live[instr->arg[k] & 0xFFFFFFF] = 1;
+					break;
+				case OPT_REG_ACCUM:
+					acc_live = 1;
+					break;
+				case OPT_REG_CCR:
+					ccr_live = 1;
+					break;
+			}
+		if (instr->op_code == EMU_OP_MACMV)
+			acc_live = 1;
+	}
+	return changed;
+}
+
+/* unused constant and dynamic registers are dropped */
+static void ld10k1_opt_compact_regs(ld10k1_opt_t *opt)
+{
+	ld10k1_patch_t *patch = opt->patch;
+	unsigned int i, k, type, idx, count;
+	unsigned int map[2][0x100];
+
+	memset(map, 0, sizeof(map));
+	for (i = 0; i < patch->instr_count; i++)
+		for (k = 0; k < 4; k++) {
+			type = EMU10K1_PREG_TYPE_B(patch->instr[i].arg[k]);
+			idx = patch->instr[i].arg[k] & 0xFF;
+			if (type == EMU10K1_PREG_TYPE_CONST)
+				map[0][idx] = 1;
+			else if (type == EMU10K1_PREG_TYPE_DYN)
+				map[1][idx] = 1;
+		}
+
+	for (i = 0, count = 0; i < patch->const_count; i++)
+		if (map[0][i]) {
+			patch->consts[count] = patch->consts[i];
+			map[0][i] = count++;
+		}
+	patch->const_count = count;
+	patch->dyn_count = 0;
+	for (i = 0; i < 0x100; i++)
+		if (map[1][i])
+			map[1][i] = patch->dyn_count++;
+
+	for (i = 0; i < patch->instr_count; i++)
+		for (k = 0; k < 4; k++) {
+			type = EMU10K1_PREG_TYPE_B(patch->instr[i].arg[k]);
+			idx = patch->instr[i].arg[k] & 0xFF;
+			if (type == EMU10K1_PREG_TYPE_CONST)
+				patch->instr[i].arg[k] = EMU10K1_PREG_CONST(map[0][idx]);
+			else if (type == EMU10K1_PREG_TYPE_DYN)
+				patch->instr[i].arg[k] = EMU10K1_PREG_DYN(map[1][idx]);
+		}
+}
+
+int ld10k1_patch_optimize(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch)
+{
+	ld10k1_opt_t opt;
+	unsigned int i, count, dyn;
+	int iter, changed, err;
+
+	for (i = 0; i < patch->instr_count; i++)
+		if (patch->instr[i].op_code == EMU_OP_SKIP)
+			return 0;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.dsp_mgr = dsp_mgr;
+	opt.patch = patch;
+	for (i = 0; i < patch->instr_count; i++)
+		if (EMU10K1_PREG_TYPE_B(patch->instr[i].arg[0]) == EMU10K1_PREG_TYPE_CONST)
+			opt.const_written[patch->instr[i].arg[0] & 0xFF] = 1;
+	dyn = patch->dyn_count ? patch->dyn_count : 1;
+	opt.removed = (unsigned char *)calloc(patch->instr_count + 1, 1);
+	opt.known = (unsigned char *)malloc(dyn);
+	opt.value = (uint32_t *)malloc(sizeof(uint32_t) * dyn);
+	opt.copy = (unsigned int *)malloc(sizeof(unsigned int) * dyn);
+	opt.live = (unsigned char *)malloc(dyn);
+	if (!opt.removed || !opt.known || !opt.value || !opt.copy || !opt.live) {
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+
+	for (iter = 0; iter < OPT_ITER_MAX; iter++) {
+		changed = ld10k1_opt_propagate(&opt);
+		changed |= ld10k1_opt_coalesce(&opt);
+		changed |= ld10k1_opt_dead(&opt);
+		if (!changed)
+			break;
+	}
+
+	for (i = 0, count = 0; i < patch->instr_count; i++)
+		if (!opt.removed[i])
+			patch->instr[count++] = patch->instr[i];
+	count = patch->instr_count - count;
+	patch->instr_count -= count;
+	ld10k1_opt_compact_regs(&opt);
+
+	patch->instr_removed = count;
+	dsp_mgr->opt_instr += patch->instr_count + count;
+	dsp_mgr->opt_removed += count;
+	err = count;
+err:
+	if (opt.removed)
+		free(opt.removed);
+	if (opt.known)
+		free(opt.known);
+	if (opt.value)
+		free(opt.value);
+	if (opt.copy)
+		free(opt.copy);
+	if (opt.live)
+		free(opt.live);
+	return err;
+}
@@ -0,0 +1,246 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ld10k1.h"
+#include "ld10k1_fnc.h"
+#include "ld10k1_fnc_int.h"
+#include "ld10k1_error.h"
+#include "ld10k1_order.h"
+
+/*
+ * Patch order from connections
+ *
+ * Patch which reads output of patch placed after it gets value from
+ * previous sample. With auto order patches are sorted so producers are
+ * before consumers. Feedback loop is broken at patch marked as loop
+ * break - its inputs from loop get previous sample. Without mark loop
+ * is broken where signal enters it (first such patch in current order).
+ * Otherwise current order is kept as much as possible.
+ */
+
+static void ld10k1_order_edges(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_order_graph_t *graph)
+{
+	ld10k1_conn_point_t *point;
+	int i, j, p, c;
+
+	graph->count = dsp_mgr->patch_count;
+	memset(graph->edge, ORDER_EDGE_NONE, sizeof(graph->edge));
+
+	for (point = dsp_mgr->point_list; point; point = point->next)
+		for (i = 0; i < MAX_CONN_PER_POINT; i++) {
+			if (point->type[i] != CON_IO_POUT)
+				continue;
+			p = point->patch[i]->order;
+			for (j = 0; j < MAX_CONN_PER_POINT; j++) {
+				if (point->type[j] != CON_IO_PIN)
+					continue;
+				c = point->patch[j]->order;
+				if (p != c)
+					graph->edge[p][c] = ORDER_EDGE;
+			}
+		}
+}
+
+static void ld10k1_order_scc(ld10k1_order_graph_t *graph, int v)
+{
+	int w;
+
+	graph->index[v] = graph->low[v] = graph->next_index++;
+	graph->stack[graph->sp++] = v;
+	graph->on_stack[v] = 1;
+
+	for (w = 0; w < graph->count; w++) {
+		if (graph->edge[v][w] != ORDER_EDGE)
+			continue;
+		if (graph->index[w] < 0) {
+			ld10k1_order_scc(graph, w);
+			if (graph->low[w] < graph->low[v])
+				graph->low[v] = graph->low[w];
+		} else if (graph->on_stack[w] && graph->index[w] < graph->low[v])
+			graph->low[v] = graph->index[w];
+	}
+
+	if (graph->low[v] == graph->index[v]) {
+		do {
+			w = graph->stack[--graph->sp];
+			graph->on_stack[w] = 0;
+			graph->comp[w] = graph->comp_count;
+		} while (w != v);
+		graph->comp_count++;
+	}
+}
+
+/* marked patch first, then patch with producer outside of loop */
+static int ld10k1_order_break_rank(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_order_graph_t *graph, int v)
+{
+	int p, rank = 0;
+
+	if (dsp_mgr->patch_ptr[dsp_mgr->patch_order[v]]->loop_break)
+		rank += 2;
+	for (p = 0; p < graph->count; p++)
+		if (graph->edge[p][v] == ORDER_EDGE && graph->comp[p] != graph->comp[v]) {
+			rank++;
+			break;
+		}
+	return rank;
+}
+
+/* mark edges into loop break patch from its loop until graph has no loops */
+static void ld10k1_order_break_loops(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_order_graph_t *graph)
+{
+	int v, w, c, size, rank, brk, brk_rank, changed;
+
+	do {
+		for (v = 0; v < graph->count; v++) {
+			graph->index[v] = -1;
+			graph->on_stack[v] = 0;
+		}
+		graph->sp = 0;
+		graph->next_index = 0;
+		graph->comp_count = 0;
+		for (v = 0; v < graph->count; v++)
+			if (graph->index[v] < 0)
+				ld10k1_order_scc(graph, v);
+
+		changed = 0;
+		for (c = 0; c < graph->comp_count; c++) {
+			size = 0;
+			brk = -1;
+			brk_rank = -1;
+			for (v = 0; v < graph->count; v++)
+				if (graph->comp[v] == c) {
+					size++;
+					rank = ld10k1_order_break_rank(dsp_mgr, graph, v);
+					if (rank > brk_rank) {
+						brk = v;
+						brk_rank = rank;
+					}
+				}
+			if (size < 2)
+				continue;
+
+			for (w = 0; w < graph->count; w++)
+				if (graph->comp[w] == c && graph->edge[w][brk] == ORDER_EDGE) {
+					graph->edge[w][brk] = ORDER_EDGE_FEEDBACK;
+					changed = 1;
+				}
+		}
+	} while (changed);
+}
+
+/* delay added by connections to patches placed before producer, loops are not counted */
+static void ld10k1_order_latency(ld10k1_order_graph_t *graph)
+{
+	int p, c, changed;
+	unsigned int lat;
+
+	memset(graph->latency, 0, sizeof(graph->latency));
+	do {
+		changed = 0;
+		for (c = 0; c < graph->count; c++)
+			for (p = 0; p < graph->count; p++)
+				if (graph->edge[p][c] == ORDER_EDGE) {
+					lat = graph->latency[p] + (p > c ? 1 : 0);
+					if (lat > graph->latency[c]) {
+						graph->latency[c] = lat;
+						changed = 1;
+					}
+				}
+	} while (changed);
+}
+
+int ld10k1_order_graph_get(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_order_graph_t **graph)
+{
+	ld10k1_order_graph_t *g;
+
+	g = (ld10k1_order_graph_t *)malloc(sizeof(ld10k1_order_graph_t));
+	if (!g)
+		return LD10K1_ERR_NO_MEM;
+
+	ld10k1_order_edges(dsp_mgr, g);
+	ld10k1_order_break_loops(dsp_mgr, g);
+	ld10k1_order_latency(g);
+
+	*graph = g;
+	return 0;
+}
+
+void ld10k1_order_graph_free(ld10k1_order_graph_t *graph)
+{
+	free(graph);
+}
+
+int ld10k1_dsp_mgr_auto_order(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_order_graph_t *graph;
+	ld10k1_conn_point_t *point;
+	unsigned int new_order[EMU10K1_PATCH_MAX];
+	int indeg[EMU10K1_PATCH_MAX];
+	int done[EMU10K1_PATCH_MAX];
+	int i, k, c, changed;
+	int err;
+
+	dsp_mgr->order_dirty = 0;
+
+	if ((err = ld10k1_order_graph_get(dsp_mgr, &graph)) < 0)
+		return err;
+
+	for (c = 0; c < graph->count; c++) {
+		indeg[c] = 0;
+		done[c] = 0;
+		for (i = 0; i < graph->count; i++)
+			if (graph->edge[i][c] == ORDER_EDGE)
+				indeg[c]++;
+	}
+
+	/* first ready patch in current order, graph is without loops */
+	changed = 0;
+	for (k = 0; k < graph->count; k++) {
+		for (i = 0; i < graph->count; i++)
+			if (!done[i] && !indeg[i])
+				break;
+
+		done[i] = 1;
+		new_order[k] = dsp_mgr->patch_order[i];
+		if (i != k)
+			changed = 1;
+
+		for (c = 0; c < graph->count; c++)
+			if (graph->edge[i][c] == ORDER_EDGE)
+				indeg[c]--;
+	}
+
+	if (changed) {
+		memcpy(dsp_mgr->patch_order, new_order, sizeof(unsigned int) * graph->count);
+		ld10k1_dsp_mgr_actualize_order(dsp_mgr);
+
+		/* instructions of points go before first reader or after last writer */
+		for (point = dsp_mgr->point_list; point; point = point->next)
+			if (!point->simple)
+				ld10k1_point_actualize_owner(dsp_mgr, point);
+	}
+
+	ld10k1_order_graph_free(graph);
+	return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __LD10K1_ORDER_H
+#define __LD10K1_ORDER_H
+
+#define ORDER_EDGE_NONE 0
+#define ORDER_EDGE 1
+/* edge closing feedback loop, ignored by ordering */
+#define ORDER_EDGE_FEEDBACK 2
+
+/* connections between patches, indexed by position in patch_order */
+typedef struct {
+	unsigned int count;
+	unsigned char edge[EMU10K1_PATCH_MAX][EMU10K1_PATCH_MAX];
+	/* samples of delay added on worst path from dsp inputs */
+	unsigned int latency[EMU10K1_PATCH_MAX];
+
+	/* strongly connected components */
+	int index[EMU10K1_PATCH_MAX];
+	int low[EMU10K1_PATCH_MAX];
+	int comp[EMU10K1_PATCH_MAX];
+	int on_stack[EMU10K1_PATCH_MAX];
+	int stack[EMU10K1_PATCH_MAX];
+	int sp;
+	int next_index;
+	int comp_count;
+} ld10k1_order_graph_t;
+
+int ld10k1_order_graph_get(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_order_graph_t **graph);
+void ld10k1_order_graph_free(ld10k1_order_graph_t *graph);
+
+int ld10k1_dsp_mgr_auto_order(ld10k1_dsp_mgr_t *dsp_mgr);
+
+#endif /* __LD10K1_ORDER_H */
@@ -0,0 +1,674 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <alsa/asoundlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "bitops.h"
+#include "ld10k1.h"
+#include "ld10k1_fnc.h"
+#include "ld10k1_fnc_int.h"
+#include "ld10k1_driver.h"
+#include "ld10k1_error.h"
+#include "ld10k1_snapshot.h"
+
+/*
+ * Snapshot layout after header:
+ *   dsp manager structure
+ *   fx, in, out names and point indexes
+ *   controls as they are (or will be) in driver
+ *   patches - slot, structure, name, ins, outs, arrays
+ *   points - structure, slots of connected patches and owner
+ * Names are stored with length (0 - no name), pointers as indexes.
+ */
+
+typedef struct {
+	char *data;
+	unsigned int size;
+	unsigned int max;
+	int err;
+} ld10k1_snap_buf_t;
+
+typedef struct {
+	const char *data;
+	unsigned int size;
+	unsigned int pos;
+} ld10k1_snap_rd_t;
+
+static unsigned int ld10k1_snapshot_checksum(const char *data, unsigned int size)
+{
+	unsigned int h = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void snap_put(ld10k1_snap_buf_t *buf, const void *data, unsigned int size)
+{
+	char *new_data;
+	unsigned int new_max;
+
+	if (buf->err || !size)
+		return;
+
+	if (buf->size + size > buf->max) {
+		new_max = buf->max ? buf->max : 0x10000;
+		while (new_max < buf->size + size)
+			new_max *= 2;
+		new_data = (char *)realloc(buf->data, new_max);
+		if (!new_data) {
+			buf->err = LD10K1_ERR_NO_MEM;
+			return;
+		}
+		buf->data = new_data;
+		buf->max = new_max;
+	}
+
+	memcpy(buf->data + buf->size, data, size);
+	buf->size += size;
+}
+
+static void snap_put_int(ld10k1_snap_buf_t *buf, int val)
+{
+	snap_put(buf, &val, sizeof(val));
+}
+
+static void snap_put_name(ld10k1_snap_buf_t *buf, const char *name)
+{
+	unsigned int len = name ? strlen(name) + 1 : 0;
+
+	snap_put(buf, &len, sizeof(len));
+	snap_put(buf, name, len);
+}
+
+static int snap_point_idx(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_conn_point_t *point)
+{
+	ld10k1_conn_point_t *tmp;
+	int i;
+
+	if (!point)
+		return -1;
+	for (tmp = dsp_mgr->point_list, i = 0; tmp; tmp = tmp->next, i++)
+		if (tmp == point)
+			return i;
+	return -1;
+}
+
+static int snap_patch_slot(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch)
+{
+	int i;
+
+	if (!patch)
+		return -1;
+	for (i = 0; i < EMU10K1_PATCH_MAX; i++)
+		if (dsp_mgr->patch_ptr[i] == patch)
+			return i;
+	return -1;
+}
+
+static void snap_put_io(ld10k1_snap_buf_t *buf, ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_p_in_out_t *io, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		snap_put_name(buf, io[i].name);
+		snap_put_int(buf, snap_point_idx(dsp_mgr, io[i].point));
+	}
+}
+
+static int ld10k1_snapshot_write(const char *path, ld10k1_snap_buf_t *buf)
+{
+	char *tmp_path;
+	unsigned int pos;
+	ssize_t res;
+	int fd;
+
+	tmp_path = (char *)malloc(strlen(path) + 5);
+	if (!tmp_path)
+		return LD10K1_ERR_NO_MEM;
+	strcpy(tmp_path, path);
+	strcat(tmp_path, ".tmp");
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto err;
+
+	for (pos = 0; pos < buf->size; pos += res) {
+		res = write(fd, buf->data + pos, buf->size - pos);
+		if (res < 0) {
+			if (errno == EINTR) {
+				res = 0;
+				continue;
+			}
+			close(fd);
+			goto err_unlink;
+		}
+	}
+
+	/* old snapshot is replaced only by complete new one */
+	if (fsync(fd) < 0) {
+		close(fd);
+		goto err_unlink;
+	}
+	if (close(fd) < 0)
+		goto err_unlink;
+	if (rename(tmp_path, path) < 0)
+		goto err_unlink;
+
+	free(tmp_path);
+	return 0;
+err_unlink:
+	unlink(tmp_path);
+err:
+	free(tmp_path);
+	return LD10K1_ERR_SNAPSHOT;
+}
+
+int ld10k1_snapshot_save(ld10k1_dsp_mgr_t *dsp_mgr, const char *path)
+{
+	ld10k1_snapshot_t header;
+	ld10k1_snap_buf_t buf;
+	ld10k1_ctl_list_item_t *item;
+	ld10k1_conn_point_t *point;
+	ld10k1_patch_t *patch;
+	int i, j, err;
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&header, 0, sizeof(header));
+
+	strcpy(header.signature, SNAPSHOT_SIGNATURE);
+	header.mgr_size = sizeof(ld10k1_dsp_mgr_t);
+	header.patch_size = sizeof(ld10k1_patch_t);
+	header.point_size = sizeof(ld10k1_conn_point_t);
+	header.audigy = dsp_mgr->audigy;
+
+	/* header is filled at end */
+	snap_put(&buf, &header, sizeof(header));
+	snap_put(&buf, dsp_mgr, sizeof(ld10k1_dsp_mgr_t));
+
+	snap_put_io(&buf, dsp_mgr, dsp_mgr->fxs, dsp_mgr->fx_count);
+	snap_put_io(&buf, dsp_mgr, dsp_mgr->ins, dsp_mgr->in_count);
+	snap_put_io(&buf, dsp_mgr, dsp_mgr->outs, dsp_mgr->out_count);
+
+	/* controls in driver without deleted, then added */
+	for (item = dsp_mgr->ctl_list.first; item != NULL; item = item->next)
+		if (!ld10k1_look_control_from_list(&(dsp_mgr->del_ctl_list), &(item->ctl)) &&
+			!ld10k1_look_control_from_list(&(dsp_mgr->add_ctl_list), &(item->ctl))) {
+			snap_put(&buf, &(item->ctl), sizeof(ld10k1_ctl_t));
+			header.ctl_count++;
+		}
+	for (item = dsp_mgr->add_ctl_list.first; item != NULL; item = item->next) {
+		snap_put(&buf, &(item->ctl), sizeof(ld10k1_ctl_t));
+		header.ctl_count++;
+	}
+
+	for (i = 0; i < EMU10K1_PATCH_MAX; i++) {
+		patch = dsp_mgr->patch_ptr[i];
+		if (!patch)
+			continue;
+
+		snap_put_int(&buf, i);
+		snap_put(&buf, patch, sizeof(ld10k1_patch_t));
+		snap_put_name(&buf, patch->patch_name);
+		snap_put_io(&buf, dsp_mgr, patch->ins, patch->in_count);
+		snap_put_io(&buf, dsp_mgr, patch->outs, patch->out_count);
+		snap_put(&buf, patch->consts, sizeof(ld10k1_p_const_sta_t) * patch->const_count);
+		snap_put(&buf, patch->stas, sizeof(ld10k1_p_const_sta_t) * patch->sta_count);
+		snap_put(&buf, patch->dyns, sizeof(ld10k1_p_dyn_t) * patch->dyn_count);
+		snap_put(&buf, patch->hws, sizeof(ld10k1_p_hw_t) * patch->hw_count);
+		snap_put(&buf, patch->tram_grp, sizeof(ld10k1_p_tram_grp_t) * patch->tram_count);
+		snap_put(&buf, patch->tram_acc, sizeof(ld10k1_p_tram_acc_t) * patch->tram_acc_count);
+		snap_put(&buf, patch->ctl, sizeof(ld10k1_ctl_t) * patch->ctl_count);
+		snap_put(&buf, patch->instr, sizeof(ld10k1_instr_t) * patch->instr_count);
+		header.patch_count++;
+	}
+
+	for (point = dsp_mgr->point_list; point != NULL; point = point->next) {
+		snap_put(&buf, point, sizeof(ld10k1_conn_point_t));
+		for (j = 0; j < MAX_CONN_PER_POINT; j++)
+			snap_put_int(&buf, snap_patch_slot(dsp_mgr, point->patch[j]));
+		snap_put_int(&buf, snap_patch_slot(dsp_mgr, point->owner));
+		header.point_count++;
+	}
+
+	if (buf.err) {
+		err = buf.err;
+		goto err;
+	}
+
+	header.size = buf.size;
+	header.checksum = ld10k1_snapshot_checksum(buf.data + sizeof(header), buf.size - sizeof(header));
+	memcpy(buf.data, &header, sizeof(header));
+
+	err = ld10k1_snapshot_write(path, &buf);
+err:
+	if (buf.data)
+		free(buf.data);
+	return err;
+}
+
+static int snap_get(ld10k1_snap_rd_t *rd, void *data, unsigned int size)
+{
+	if (size > rd->size - rd->pos)
+		return LD10K1_ERR_SNAPSHOT;
+	if (size)
+		memcpy(data, rd->data + rd->pos, size);
+	rd->pos += size;
+	return 0;
+}
+
+static int snap_get_int(ld10k1_snap_rd_t *rd, int *val)
+{
+	return snap_get(rd, val, sizeof(int));
+}
+
+static int snap_get_name(ld10k1_snap_rd_t *rd, char **name)
+{
+	unsigned int len;
+	int err;
+
+	*name = NULL;
+	if ((err = snap_get(rd, &len, sizeof(len))) < 0)
+		return err;
+	if (!len)
+		return 0;
+	if (len > rd->size - rd->pos || rd->data[rd->pos + len - 1] != '\0')
+		return LD10K1_ERR_SNAPSHOT;
+
+	*name = (char *)malloc(len);
+	if (!*name)
+		return LD10K1_ERR_NO_MEM;
+	return snap_get(rd, *name, len);
+}
+
+static int snap_get_io(ld10k1_snap_rd_t *rd, ld10k1_p_in_out_t *io, unsigned int count,
+	ld10k1_conn_point_t **points, unsigned int point_count)
+{
+	unsigned int i;
+	int idx, err;
+
+	for (i = 0; i < count; i++) {
+		if ((err = snap_get_name(rd, &(io[i].name))) < 0)
+			return err;
+		if ((err = snap_get_int(rd, &idx)) < 0)
+			return err;
+		if (idx < -1 || idx >= (int)point_count)
+			return LD10K1_ERR_SNAPSHOT;
+		io[i].point = idx < 0 ? NULL : points[idx];
+		io[i].instr_use_count = 0;
+		io[i].instr_use = NULL;
+		io[i].phys_gen = 0;
+	}
+	return 0;
+}
+
+/* patch from snapshot, in place of ld10k1_patch_fnc_check_patch - only sizes */
+static int snap_get_patch(ld10k1_snap_rd_t *rd, ld10k1_patch_t **new_patch,
+	ld10k1_conn_point_t **points, unsigned int point_count)
+{
+	ld10k1_patch_t raw;
+	ld10k1_patch_t *patch;
+	int err;
+
+	*new_patch = NULL;
+	if ((err = snap_get(rd, &raw, sizeof(raw))) < 0)
+		return err;
+
+	if (raw.in_count > 32 || raw.out_count > 32 ||
+		raw.const_count > 255 || raw.sta_count > 255 || raw.dyn_count > 255 ||
+		raw.hw_count > 255 || raw.tram_count > 255 || raw.tram_acc_count > 255 ||
+		raw.ctl_count > 255 || raw.instr_count > 512)
+		return LD10K1_ERR_SNAPSHOT;
+
+	patch = ld10k1_dsp_mgr_patch_new();
+	if (!patch)
+		return LD10K1_ERR_NO_MEM;
+	*new_patch = patch;
+
+	patch->order = raw.order;
+	patch->id = raw.id;
+	patch->loop_break = raw.loop_break;
+	patch->instr_offset = raw.instr_offset;
+	patch->instr_modified = 1;
+	patch->instr_removed = raw.instr_removed;
+
+	if ((err = snap_get_name(rd, &(patch->patch_name))) < 0)
+		return err;
+
+	if ((raw.in_count && !ld10k1_dsp_mgr_patch_in_new(patch, raw.in_count)) ||
+		(raw.out_count && !ld10k1_dsp_mgr_patch_out_new(patch, raw.out_count)) ||
+		(raw.const_count && !ld10k1_dsp_mgr_patch_const_new(patch, raw.const_count)) ||
+		(raw.sta_count && !ld10k1_dsp_mgr_patch_sta_new(patch, raw.sta_count)) ||
+		(raw.dyn_count && !ld10k1_dsp_mgr_patch_dyn_new(patch, raw.dyn_count)) ||
+		(raw.hw_count && !ld10k1_dsp_mgr_patch_hw_new(patch, raw.hw_count)) ||
+		(raw.tram_count && !ld10k1_dsp_mgr_patch_tram_new(patch, raw.tram_count)) ||
+		(raw.tram_acc_count && !ld10k1_dsp_mgr_patch_tram_acc_new(patch, raw.tram_acc_count)) ||
+		(raw.ctl_count && !ld10k1_dsp_mgr_patch_ctl_new(patch, raw.ctl_count)) ||
+		(raw.instr_count && !ld10k1_dsp_mgr_patch_instr_new(patch, raw.instr_count)))
+		return LD10K1_ERR_NO_MEM;
+
+	if ((err = snap_get_io(rd, patch->ins, patch->in_count, points, point_count)) < 0 ||
+		(err = snap_get_io(rd, patch->outs, patch->out_count, points, point_count)) < 0 ||
+		(err = snap_get(rd, patch->consts, sizeof(ld10k1_p_const_sta_t) * patch->const_count)) < 0 ||
+		(err = snap_get(rd, patch->stas, sizeof(ld10k1_p_const_sta_t) * patch->sta_count)) < 0 ||
+		(err = snap_get(rd, patch->dyns, sizeof(ld10k1_p_dyn_t) * patch->dyn_count)) < 0 ||
+		(err = snap_get(rd, patch->hws, sizeof(ld10k1_p_hw_t) * patch->hw_count)) < 0 ||
+		(err = snap_get(rd, patch->tram_grp, sizeof(ld10k1_p_tram_grp_t) * patch->tram_count)) < 0 ||
+		(err = snap_get(rd, patch->tram_acc, sizeof(ld10k1_p_tram_acc_t) * patch->tram_acc_count)) < 0 ||
+		(err = snap_get(rd, patch->ctl, sizeof(ld10k1_ctl_t) * patch->ctl_count)) < 0 ||
+		(err = snap_get(rd, patch->instr, sizeof(ld10k1_instr_t) * patch->instr_count)) < 0)
+		return err;
+
+	return ld10k1_dsp_mgr_patch_index_io(patch);
+}
+
+static int snap_io_count(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, int type)
+{
+	switch (type) {
+		case CON_IO_FX:
+			return dsp_mgr->fx_count;
+		case CON_IO_IN:
+			return dsp_mgr->in_count;
+		case CON_IO_OUT:
+			return dsp_mgr->out_count;
+		case CON_IO_PIN:
+			return patch ? patch->in_count : 0;
+		case CON_IO_POUT:
+			return patch ? patch->out_count : 0;
+		default:
+			return 0;
+	}
+}
+
+static int snap_get_point(ld10k1_snap_rd_t *rd, ld10k1_dsp_mgr_t *image, ld10k1_conn_point_t *point,
+	ld10k1_patch_t **patches)
+{
+	ld10k1_conn_point_t *next = point->next;
+	int i, slot, err;
+
+	if ((err = snap_get(rd, point, sizeof(ld10k1_conn_point_t))) < 0)
+		return err;
+	point->next = next;
+
+	for (i = 0; i < MAX_CONN_PER_POINT + 1; i++) {
+		if ((err = snap_get_int(rd, &slot)) < 0)
+			return err;
+		if (slot < -1 || slot >= EMU10K1_PATCH_MAX || (slot >= 0 && !patches[slot]))
+			return LD10K1_ERR_SNAPSHOT;
+		if (i == MAX_CONN_PER_POINT) {
+			point->owner = slot < 0 ? NULL : patches[slot];
+			break;
+		}
+
+		point->patch[i] = slot < 0 ? NULL : patches[slot];
+		if (point->type[i] == CON_IO_NORMAL)
+			continue;
+		if ((point->type[i] == CON_IO_PIN || point->type[i] == CON_IO_POUT) && slot < 0)
+			return LD10K1_ERR_SNAPSHOT;
+		if (point->io[i] < 0 || point->io[i] >= snap_io_count(image, point->patch[i], point->type[i]))
+			return LD10K1_ERR_SNAPSHOT;
+	}
+	return 0;
+}
+
+static void ld10k1_snapshot_mark_dirty(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	unsigned int i;
+
+	for (i = 0; i < dsp_mgr->regs_max_count; i++)
+		ld10k1_dsp_mgr_reg_modified(dsp_mgr, i);
+	for (i = 0; i < dsp_mgr->instr_count; i++)
+		ld10k1_dsp_mgr_instr_modified(dsp_mgr, i);
+	for (i = 0; i < dsp_mgr->max_itram_hwacc + dsp_mgr->max_etram_hwacc; i++)
+		ld10k1_dsp_mgr_tram_modified(dsp_mgr, i);
+}
+
+/*
+ * Loads snapshot into freshly initialized dsp manager. On error manager
+ * is left as it was.
+ */
+int ld10k1_snapshot_load(ld10k1_dsp_mgr_t *dsp_mgr, const char *path)
+{
+	ld10k1_snapshot_t header;
+	ld10k1_snap_rd_t rd;
+	ld10k1_dsp_mgr_t *image = NULL;
+	ld10k1_patch_t *patches[EMU10K1_PATCH_MAX];
+	ld10k1_conn_point_t **points = NULL;
+	ld10k1_ctl_t *ctls = NULL;
+	ld10k1_ctl_list_t ctl_list;
+	ld10k1_reserved_ctl_list_item_t *reserved_ctl_list;
+	const char *card_id;
+	struct ld10k1_driver_tag *driver;
+	int auto_order, optimize;
+	struct stat st;
+	void *map = MAP_FAILED;
+	unsigned int i, patch_count = 0;
+	int fd, slot, err;
+
+	memset(patches, 0, sizeof(patches));
+	ld10k1_init_control_list(&ctl_list);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return LD10K1_ERR_SNAPSHOT;
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(ld10k1_snapshot_t)) {
+		close(fd);
+		return LD10K1_ERR_SNAPSHOT;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return LD10K1_ERR_SNAPSHOT;
+
+	rd.data = (const char *)map;
+	rd.size = st.st_size;
+	rd.pos = 0;
+
+	err = LD10K1_ERR_SNAPSHOT;
+	snap_get(&rd, &header, sizeof(header));
+	if (strncmp(header.signature, SNAPSHOT_SIGNATURE, sizeof(header.signature)) != 0 ||
+		header.size != rd.size ||
+		header.mgr_size != sizeof(ld10k1_dsp_mgr_t) ||
+		header.patch_size != sizeof(ld10k1_patch_t) ||
+		header.point_size != sizeof(ld10k1_conn_point_t) ||
+		header.audigy != dsp_mgr->audigy ||
+		header.patch_count > EMU10K1_PATCH_MAX ||
+		header.point_count > rd.size / sizeof(ld10k1_conn_point_t) ||
+		header.ctl_count > rd.size / sizeof(ld10k1_ctl_t) ||
+		header.checksum != ld10k1_snapshot_checksum(rd.data + rd.pos, rd.size - rd.pos))
+		goto err;
+
+	image = (ld10k1_dsp_mgr_t *)calloc(1, sizeof(ld10k1_dsp_mgr_t));
+	if (!image) {
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+	if ((err = snap_get(&rd, image, sizeof(ld10k1_dsp_mgr_t))) < 0)
+		goto err;
+
+	/* names of image are not valid - replaced by loaded */
+	memset(image->fxs, 0, sizeof(image->fxs));
+	memset(image->ins, 0, sizeof(image->ins));
+	memset(image->outs, 0, sizeof(image->outs));
+
+	/* only for same card and tram setup */
+	err = LD10K1_ERR_SNAPSHOT;
+	if (image->fx_count != dsp_mgr->fx_count ||
+		image->in_count != dsp_mgr->in_count ||
+		image->out_count != dsp_mgr->out_count ||
+		image->regs_max_count != dsp_mgr->regs_max_count ||
+		image->instr_count != dsp_mgr->instr_count ||
+		image->i_tram.size != dsp_mgr->i_tram.size ||
+		image->e_tram.size != dsp_mgr->e_tram.size ||
+		image->max_itram_hwacc != dsp_mgr->max_itram_hwacc ||
+		image->max_etram_hwacc != dsp_mgr->max_etram_hwacc ||
+		image->patch_count != header.patch_count)
+		goto err;
+
+	/* points are allocated first - ios are linked to them */
+	points = (ld10k1_conn_point_t **)calloc(header.point_count + 1, sizeof(ld10k1_conn_point_t *));
+	if (!points) {
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+	for (i = 0; i < header.point_count; i++) {
+		points[i] = (ld10k1_conn_point_t *)malloc(sizeof(ld10k1_conn_point_t));
+		if (!points[i]) {
+			err = LD10K1_ERR_NO_MEM;
+			goto err;
+		}
+		points[i]->next = NULL;
+		if (i > 0)
+			points[i - 1]->next = points[i];
+	}
+
+	if ((err = snap_get_io(&rd, image->fxs, image->fx_count, points, header.point_count)) < 0 ||
+		(err = snap_get_io(&rd, image->ins, image->in_count, points, header.point_count)) < 0 ||
+		(err = snap_get_io(&rd, image->outs, image->out_count, points, header.point_count)) < 0)
+		goto err;
+
+	if (header.ctl_count) {
+		ctls = (ld10k1_ctl_t *)malloc(sizeof(ld10k1_ctl_t) * header.ctl_count);
+		if (!ctls) {
+			err = LD10K1_ERR_NO_MEM;
+			goto err;
+		}
+		if ((err = snap_get(&rd, ctls, sizeof(ld10k1_ctl_t) * header.ctl_count)) < 0)
+			goto err;
+		/* list is prepended - same order as in snapshot */
+		for (i = header.ctl_count; i > 0; i--)
+			if ((err = ld10k1_add_control_to_list(&ctl_list, &(ctls[i - 1]))) < 0)
+				goto err;
+	}
+
+	for (patch_count = 0; patch_count < header.patch_count; patch_count++) {
+		if ((err = snap_get_int(&rd, &slot)) < 0)
+			goto err;
+		if (slot < 0 || slot >= EMU10K1_PATCH_MAX || patches[slot] ||
+			!image->patch_ptr[slot]) {
+			err = LD10K1_ERR_SNAPSHOT;
+			goto err;
+		}
+		if ((err = snap_get_patch(&rd, &(patches[slot]), points, header.point_count)) < 0)
+			goto err;
+	}
+
+	for (i = 0; i < header.point_count; i++)
+		if ((err = snap_get_point(&rd, image, points[i], patches)) < 0)
+			goto err;
+
+	err = LD10K1_ERR_SNAPSHOT;
+	if (rd.pos != rd.size)
+		goto err;
+
+	for (i = 0; i < image->patch_count; i++) {
+		if (image->patch_order[i] >= EMU10K1_PATCH_MAX)
+			goto err;
+		slot = image->patch_order[i];
+		if (!patches[slot] || patches[slot]->order != i)
+			goto err;
+	}
+
+	/* replace manager, driver and card things are kept */
+	card_id = dsp_mgr->card_id;
+	driver = dsp_mgr->driver;
+	reserved_ctl_list = dsp_mgr->reserved_ctl_list;
+	auto_order = dsp_mgr->auto_order;
+	optimize = dsp_mgr->optimize;
+
+	ld10k1_dsp_mgr_free(dsp_mgr);
+	memcpy(dsp_mgr, image, sizeof(ld10k1_dsp_mgr_t));
+
+	dsp_mgr->card_id = card_id;
+	dsp_mgr->driver = driver;
+	dsp_mgr->reserved_ctl_list = reserved_ctl_list;
+	dsp_mgr->auto_order = auto_order;
+	dsp_mgr->optimize = optimize;
+	dsp_mgr->batch = NULL;
+	dsp_mgr->gpr_write_pending = 0;
+	dsp_mgr->i_tram.hwacc = dsp_mgr->itram_hwacc;
+	dsp_mgr->e_tram.hwacc = dsp_mgr->etram_hwacc;
+
+	for (i = 0; i < EMU10K1_PATCH_MAX; i++)
+		dsp_mgr->patch_ptr[i] = patches[i];
+	dsp_mgr->point_list = points[0];
+
+	/* controls were removed from driver by dsp init, add them again with values */
+	ld10k1_init_control_list(&(dsp_mgr->ctl_list));
+	ld10k1_init_control_list(&(dsp_mgr->del_ctl_list));
+	dsp_mgr->add_ctl_list = ctl_list;
+
+	/* everything goes to driver in one update */
+	memset(dsp_mgr->regs_dirty, 0, sizeof(dsp_mgr->regs_dirty));
+	memset(dsp_mgr->instr_dirty, 0, sizeof(dsp_mgr->instr_dirty));
+	memset(dsp_mgr->tram_dirty, 0, sizeof(dsp_mgr->tram_dirty));
+	ld10k1_snapshot_mark_dirty(dsp_mgr);
+
+	free(points);
+	if (ctls)
+		free(ctls);
+	free(image);
+	munmap(map, st.st_size);
+
+	return ld10k1_update_driver(dsp_mgr);
+err:
+	for (i = 0; i < EMU10K1_PATCH_MAX; i++)
+		if (patches[i])
+			ld10k1_dsp_mgr_patch_free(patches[i]);
+	if (points) {
+		for (i = 0; i < header.point_count; i++)
+			if (points[i])
+				free(points[i]);
+		free(points);
+	}
+	if (image) {
+		/* counts of image may be wrong, names are cleared after read */
+		for (i = 0; i < sizeof(image->fxs) / sizeof(ld10k1_p_in_out_t); i++)
+			if (image->fxs[i].name)
+				free(image->fxs[i].name);
+		for (i = 0; i < sizeof(image->ins) / sizeof(ld10k1_p_in_out_t); i++)
+			if (image->ins[i].name)
+				free(image->ins[i].name);
+		for (i = 0; i < sizeof(image->outs) / sizeof(ld10k1_p_in_out_t); i++)
+			if (image->outs[i].name)
+				free(image->outs[i].name);
+		free(image);
+	}
+	if (ctls)
+		free(ctls);
+	ld10k1_del_all_controls_from_list(&ctl_list);
+	munmap(map, st.st_size);
+	return err;
+}
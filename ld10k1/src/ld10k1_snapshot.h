@@ -0,0 +1,49 @@
+/*
+ *  EMU10k1 loader
+ *
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __LD10K1_SNAPSHOT_H
+#define __LD10K1_SNAPSHOT_H
+
+#define SNAPSHOT_SIGNATURE "LD10K1 SNAP 001"
+
+/*
+ * State snapshot - dsp manager with patches, points, names and controls.
+ * It is written in native layout and can be loaded only by same build,
+ * sizes of structures in header must match.
+ */
+typedef struct {
+	char signature[16];
+	unsigned int size;
+	/* FNV-1a of everything after header */
+	unsigned int checksum;
+	unsigned int mgr_size;
+	unsigned int patch_size;
+	unsigned int point_size;
+	int audigy;
+	unsigned int ctl_count;
+	unsigned int patch_count;
+	unsigned int point_count;
+} ld10k1_snapshot_t;
+
+int ld10k1_snapshot_save(ld10k1_dsp_mgr_t *dsp_mgr, const char *path);
+int ld10k1_snapshot_load(ld10k1_dsp_mgr_t *dsp_mgr, const char *path);
+
+#endif /* __LD10K1_SNAPSHOT_H */
@@ -21,12 +21,99 @@
 
 #include "ld10k1.h"
 #include "ld10k1_fnc.h"
+#include "ld10k1_fnc_int.h"
 #include "ld10k1_tram.h"
 #include "ld10k1_error.h"
 #include <stdlib.h>
+#include <string.h>
 
 int ld10k1_tram_res_alloc_hwacc(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res);
-int ld10k1_tram_realloc_space(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res);
+int ld10k1_tram_place_space(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res);
+
+/* free block list - blocks are sorted by offset and never adjacent */
+static int ld10k1_tram_ext_best_fit(ld10k1_tram_extent_t *ext, unsigned int count, unsigned int size)
+{
+	int i, best = -1;
+
+	for (i = 0; i < count; i++)
+		if (ext[i].size >= size && (best < 0 || ext[i].size < ext[best].size)) {
+			best = i;
+			if (ext[i].size == size)
+				break;
+		}
+	return best;
+}
+
+/* space is taken from end of block - same as groups were placed before */
+static unsigned int ld10k1_tram_ext_take(ld10k1_tram_extent_t *ext, unsigned int *count, int idx, unsigned int size)
+{
+	unsigned int offset;
+
+	ext[idx].size -= size;
+	offset = ext[idx].offset + ext[idx].size;
+	if (!ext[idx].size) {
+		memmove(&(ext[idx]), &(ext[idx + 1]), sizeof(ld10k1_tram_extent_t) * (*count - idx - 1));
+		(*count)--;
+	}
+	return offset;
+}
+
+static void ld10k1_tram_ext_put(ld10k1_tram_extent_t *ext, unsigned int *count, unsigned int offset, unsigned int size)
+{
+	int i;
+
+	if (!size)
+		return;
+
+	for (i = 0; i < *count; i++)
+		if (ext[i].offset > offset)
+			break;
+
+	/* join with previous and next block */
+	if (i > 0 && ext[i - 1].offset + ext[i - 1].size == offset) {
+		ext[i - 1].size += size;
+		if (i < *count && offset + size == ext[i].offset) {
+			ext[i - 1].size += ext[i].size;
+			memmove(&(ext[i]), &(ext[i + 1]), sizeof(ld10k1_tram_extent_t) * (*count - i - 1));
+			(*count)--;
+		}
+	} else if (i < *count && offset + size == ext[i].offset) {
+		ext[i].offset = offset;
+		ext[i].size += size;
+	} else {
+		memmove(&(ext[i + 1]), &(ext[i]), sizeof(ld10k1_tram_extent_t) * (*count - i));
+		ext[i].offset = offset;
+		ext[i].size = size;
+		(*count)++;
+	}
+}
+
+static void ld10k1_tram_init_ext(ld10k1_tram_t *tram)
+{
+	tram->ext_count = 0;
+	ld10k1_tram_ext_put(tram->ext, &(tram->ext_count), 0, tram->size);
+}
+
+void ld10k1_tram_init_space(ld10k1_dsp_mgr_t *dsp_mgr)
+{
+	ld10k1_tram_init_ext(&(dsp_mgr->i_tram));
+	dsp_mgr->i_tram.compactions = 0;
+	ld10k1_tram_init_ext(&(dsp_mgr->e_tram));
+	dsp_mgr->e_tram.compactions = 0;
+}
+
+void ld10k1_tram_space_info(ld10k1_tram_t *tram, unsigned int *free, unsigned int *largest)
+{
+	int i;
+
+	*free = 0;
+	*largest = 0;
+	for (i = 0; i < tram->ext_count; i++) {
+		*free += tram->ext[i].size;
+		if (tram->ext[i].size > *largest)
+			*largest = tram->ext[i].size;
+	}
+}
 
 void ld10k1_tram_init_res(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res)
 {
@@ -34,11 +121,17 @@ void ld10k1_tram_init_res(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *
 	res->ifree = dsp_mgr->i_tram.size;
 	res->iacc_count = dsp_mgr->i_tram.max_hwacc;
 	res->iacc_free_count = dsp_mgr->i_tram.max_hwacc;
+	res->icompact = 0;
+	res->iext_count = dsp_mgr->i_tram.ext_count;
+	memcpy(res->iext, dsp_mgr->i_tram.ext, sizeof(ld10k1_tram_extent_t) * res->iext_count);
 
 	res->esize = dsp_mgr->e_tram.size;
 	res->efree = dsp_mgr->e_tram.size;
 	res->eacc_count = dsp_mgr->e_tram.max_hwacc;
 	res->eacc_free_count = dsp_mgr->e_tram.max_hwacc;
+	res->ecompact = 0;
+	res->eext_count = dsp_mgr->e_tram.ext_count;
+	memcpy(res->eext, dsp_mgr->e_tram.ext, sizeof(ld10k1_tram_extent_t) * res->eext_count);
 
 	res->grp_free = res->iacc_free_count + res->eacc_free_count;
 
@@ -47,23 +140,12 @@ void ld10k1_tram_init_res(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *
 
 void ld10k1_tram_init_res_from_dsp_mgr(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res)
 {
-	/* throught all groups */
+	/* throught all groups - placed groups are not moved */
 	int i;
 	for (i = 0; i < dsp_mgr->max_tram_grp; i++) {
 		if (dsp_mgr->tram_grp[i].used) {
-			/* get position */
 			res->grp_free--;
-			switch (dsp_mgr->tram_grp[i].req_pos) {
-				case TRAM_POS_NONE:
-				case TRAM_POS_AUTO:
-					/* add to res */
-					res->items[res->item_count].grp_idx = i;
-					res->items[res->item_count].grp_size = dsp_mgr->tram_grp[i].size;
-					res->items[res->item_count].grp_acc_count = dsp_mgr->tram_grp[i].acc_count;
-					res->items[res->item_count].res_value = 0;
-					res->items[res->item_count].pos = TRAM_POS_NONE;
-					res->item_count++;
-					break;
+			switch (dsp_mgr->tram_grp[i].pos) {
 				case TRAM_POS_INTERNAL:
 					/* decrease resources */
 					res->ifree -= dsp_mgr->tram_grp[i].size;
@@ -102,61 +184,18 @@ int ld10k1_tram_init_res_from_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_r
 		acc_count = ld10k1_tram_acc_count_from_patch(patch, i);
 		if (acc_count <= 0)
 			continue;
-			/* get position */
-		switch (patch->tram_grp[i].grp_pos) {
-			case TRAM_POS_NONE:
-			case TRAM_POS_AUTO:
-				/* add to res */
-				res->items[res->item_count].grp_idx = -i - 1;
-				res->items[res->item_count].grp_size = patch->tram_grp[i].grp_size;
-				res->items[res->item_count].grp_acc_count = acc_count;
-				res->items[res->item_count].res_value = 0;
-				res->items[res->item_count].pos = TRAM_POS_NONE;
-				res->item_count++;
-				break;
-			case TRAM_POS_INTERNAL:
-				/* decrease resources */
-				if (res->ifree < patch->tram_grp[i].grp_size)
-					return LD10K1_ERR_ITRAM_FULL;
-				if (res->iacc_free_count < acc_count)
-					return LD10K1_ERR_ITRAM_FULL_ACC;
-				res->ifree -= patch->tram_grp[i].grp_size;
-				res->iacc_free_count -= acc_count;
-				break;
-			case TRAM_POS_EXTERNAL:
-				/* decrease resources */
-				if (res->efree < patch->tram_grp[i].grp_size)
-					return LD10K1_ERR_ETRAM_FULL;
-				if (res->eacc_free_count < acc_count)
-					return LD10K1_ERR_ETRAM_FULL_ACC;
-				res->efree -= patch->tram_grp[i].grp_size;
-				res->eacc_free_count -= acc_count;
-				break;
-		}
-	}
-	return 0;
-}
-
-int ld10k1_tram_init_res_from_patch_copy(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res, ld10k1_patch_t *patch)
-{
-	/* throught all groups */
-	int i;
-	int acc_count;
-
-	for (i = 0; i < patch->tram_count; i++) {
-		/* get acc count */
-		acc_count = ld10k1_tram_acc_count_from_patch(patch, i);
-			/* get position */
+		/* add to res - requested position is kept */
+		res->items[res->item_count].grp_idx = -i - 1;
+		res->items[res->item_count].grp_size = patch->tram_grp[i].grp_size;
+		res->items[res->item_count].grp_acc_count = acc_count;
+		res->items[res->item_count].res_value = 0;
+		res->items[res->item_count].offset = -1;
 		if (patch->tram_grp[i].grp_pos == TRAM_POS_INTERNAL ||
-			patch->tram_grp[i].grp_pos == TRAM_POS_EXTERNAL) {
-
-			res->items[res->item_count].grp_idx = -i - 1;
-			res->items[res->item_count].grp_size = patch->tram_grp[i].grp_size;
-			res->items[res->item_count].grp_acc_count = acc_count;
+			patch->tram_grp[i].grp_pos == TRAM_POS_EXTERNAL)
 			res->items[res->item_count].pos = patch->tram_grp[i].grp_pos;
-			res->items[res->item_count].res_value = 0;
-			res->item_count++;
-		}
+		else
+			res->items[res->item_count].pos = TRAM_POS_NONE;
+		res->item_count++;
 	}
 	return 0;
 }
@@ -189,24 +228,73 @@ int ld10k1_tram_sort_res(ld10k1_dsp_tram_resolve_t *res)
 	return 0;
 }
 
+/* returns 1 if item was placed into given tram */
+static int ld10k1_tram_place_res(ld10k1_dsp_tram_resolve_t *res, ld10k1_dsp_tram_resolve_item_t *item, int external, int compact)
+{
+	int *free = external ? &(res->efree) : &(res->ifree);
+	int *acc_free = external ? &(res->eacc_free_count) : &(res->iacc_free_count);
+	ld10k1_tram_extent_t *ext = external ? res->eext : res->iext;
+	unsigned int *ext_count = external ? &(res->eext_count) : &(res->iext_count);
+	int idx;
+
+	if (item->grp_size > *free || item->grp_acc_count > *acc_free)
+		return 0;
+
+	if (!item->grp_size)
+		item->offset = 0;
+	else {
+		idx = ld10k1_tram_ext_best_fit(ext, *ext_count, item->grp_size);
+		if (idx >= 0)
+			item->offset = ld10k1_tram_ext_take(ext, ext_count, idx, item->grp_size);
+		else if (compact) {
+			/* there is enough space, but not in one block */
+			item->offset = -1;
+			if (external)
+				res->ecompact = 1;
+			else
+				res->icompact = 1;
+		} else
+			return 0;
+	}
+
+	*free -= item->grp_size;
+	*acc_free -= item->grp_acc_count;
+	item->pos = external ? TRAM_POS_EXTERNAL : TRAM_POS_INTERNAL;
+	return 1;
+}
+
 int ld10k1_tram_resolve_res(ld10k1_dsp_tram_resolve_t *res)
 {
 	int i;
+	ld10k1_dsp_tram_resolve_item_t *item;
+
+	/* groups with requested position first */
 	for (i = 0; i < res->item_count; i++) {
-		/* first try internal tram then external tram */
-		if (res->items[i].grp_size <= res->ifree &&
-			res->items[i].grp_acc_count <= res->iacc_free_count) {
-			/* put it into itram */
-			res->ifree -= res->items[i].grp_size;
-			res->iacc_free_count -= res->items[i].grp_acc_count;
-			res->items[i].pos = TRAM_POS_INTERNAL;
-		} else if (res->items[i].grp_size <= res->efree &&
-			res->items[i].grp_acc_count <= res->eacc_free_count) {
-			/* put it into etram */
-			res->efree -= res->items[i].grp_size;
-			res->eacc_free_count -= res->items[i].grp_acc_count;
-			res->items[i].pos = TRAM_POS_EXTERNAL;
-		} else
+		item = &(res->items[i]);
+		if (item->pos == TRAM_POS_INTERNAL) {
+			if (item->grp_size > res->ifree)
+				return LD10K1_ERR_ITRAM_FULL;
+			if (item->grp_acc_count > res->iacc_free_count)
+				return LD10K1_ERR_ITRAM_FULL_ACC;
+			ld10k1_tram_place_res(res, item, 0, 1);
+		} else if (item->pos == TRAM_POS_EXTERNAL) {
+			if (item->grp_size > res->efree)
+				return LD10K1_ERR_ETRAM_FULL;
+			if (item->grp_acc_count > res->eacc_free_count)
+				return LD10K1_ERR_ETRAM_FULL_ACC;
+			ld10k1_tram_place_res(res, item, 1, 1);
+		}
+	}
+
+	for (i = 0; i < res->item_count; i++) {
+		item = &(res->items[i]);
+		if (item->pos != TRAM_POS_NONE)
+			continue;
+		/* first try internal tram then external tram, compact only if nothing else helps */
+		if (!ld10k1_tram_place_res(res, item, 0, 0) &&
+			!ld10k1_tram_place_res(res, item, 1, 0) &&
+			!ld10k1_tram_place_res(res, item, 0, 1) &&
+			!ld10k1_tram_place_res(res, item, 1, 1))
 			return LD10K1_ERR_TRAM_FULL;
 	}
 	return 0;
@@ -226,7 +314,20 @@ int ld10k1_tram_grp_alloc(ld10k1_dsp_mgr_t *dsp_mgr)
 
 void ld10k1_tram_grp_free(ld10k1_dsp_mgr_t *dsp_mgr, int grp)
 {
+	ld10k1_tram_t *tram = NULL;
+
+	if (dsp_mgr->tram_grp[grp].pos == TRAM_POS_INTERNAL)
+		tram = &(dsp_mgr->i_tram);
+	else if (dsp_mgr->tram_grp[grp].pos == TRAM_POS_EXTERNAL)
+		tram = &(dsp_mgr->e_tram);
+
+	/* return space */
+	if (tram)
+		ld10k1_tram_ext_put(tram->ext, &(tram->ext_count), dsp_mgr->tram_grp[grp].offset, dsp_mgr->tram_grp[grp].size);
+
 	dsp_mgr->tram_grp[grp].used = 0;
+	dsp_mgr->tram_grp[grp].pos = TRAM_POS_NONE;
+	dsp_mgr->tram_grp[grp].req_pos = TRAM_POS_NONE;
 }
 
 int ld10k1_tram_acc_alloc(ld10k1_dsp_mgr_t *dsp_mgr)
@@ -262,8 +363,6 @@ int ld10k1_tram_reserve_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *pat
 	if ((err = ld10k1_tram_resolve_res(res)) < 0)
 		return err;
 
-	ld10k1_tram_init_res_from_patch_copy(dsp_mgr, res, patch);
-
 	return 0;
 }
 
@@ -278,7 +377,9 @@ int ld10k1_tram_alloc_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch
 		grp = ld10k1_tram_grp_alloc(dsp_mgr);
 		patch->tram_grp[i].grp_idx = grp;
 		dsp_mgr->tram_grp[grp].type = patch->tram_grp[i].grp_type;
+		dsp_mgr->tram_grp[grp].req_pos = patch->tram_grp[i].grp_pos;
 		dsp_mgr->tram_grp[grp].size = patch->tram_grp[i].grp_size;
+		dsp_mgr->tram_grp[grp].offset = 0;
 	}
 
 	for (i = 0; i < res->item_count; i++) {
@@ -298,8 +399,7 @@ int ld10k1_tram_alloc_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch
 	}
 
 	ld10k1_tram_res_alloc_hwacc(dsp_mgr, res);
-	ld10k1_tram_realloc_space(dsp_mgr, res);
-	return 0;
+	return ld10k1_tram_place_space(dsp_mgr, res);
 }
 
 int ld10k1_tram_hwacc_alloc(ld10k1_dsp_mgr_t *dsp_mgr, int external)
@@ -332,7 +432,7 @@ void ld10k1_tram_hwacc_free(ld10k1_dsp_mgr_t *dsp_mgr, int acc)
 		dsp_mgr->itram_hwacc[acc].used = 0;
 		dsp_mgr->itram_hwacc[acc].addr_val = 0;
 		dsp_mgr->itram_hwacc[acc].data_val = 0;
-		dsp_mgr->itram_hwacc[acc].modified = 1;
+		ld10k1_dsp_mgr_tram_modified(dsp_mgr, acc);
 		dsp_mgr->i_tram.used_hwacc--;
 	} else {
 		int nacc = acc - dsp_mgr->max_itram_hwacc;
@@ -340,7 +440,7 @@ void ld10k1_tram_hwacc_free(ld10k1_dsp_mgr_t *dsp_mgr, int acc)
 		dsp_mgr->etram_hwacc[nacc].used = 0;
 		dsp_mgr->etram_hwacc[nacc].addr_val = 0;
 		dsp_mgr->etram_hwacc[nacc].data_val = 0;
-		dsp_mgr->etram_hwacc[nacc].modified = 1;
+		ld10k1_dsp_mgr_tram_modified(dsp_mgr, acc);
 		dsp_mgr->e_tram.used_hwacc--;
 	}
 }
@@ -351,13 +451,13 @@ void ld10k1_tram_actualize_hwacc(ld10k1_dsp_mgr_t *dsp_mgr, int acc, unsigned in
 		dsp_mgr->itram_hwacc[acc].op = op;
 		dsp_mgr->itram_hwacc[acc].addr_val = addr;
 		dsp_mgr->itram_hwacc[acc].data_val = data;
-		dsp_mgr->itram_hwacc[acc].modified = 1;
+		ld10k1_dsp_mgr_tram_modified(dsp_mgr, acc);
 	} else {
 		int nacc = acc - dsp_mgr->max_itram_hwacc;
 		dsp_mgr->etram_hwacc[nacc].op = op;
 		dsp_mgr->etram_hwacc[nacc].addr_val = addr;
 		dsp_mgr->etram_hwacc[nacc].data_val = data;
-		dsp_mgr->etram_hwacc[nacc].modified = 1;
+		ld10k1_dsp_mgr_tram_modified(dsp_mgr, acc);
 	}
 }
 
@@ -411,27 +511,89 @@ int ld10k1_tram_res_alloc_hwacc(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resol
 	return 0;
 }
 
-int ld10k1_tram_realloc_space(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res)
+static int ld10k1_tram_compact_compare(const void *item1, const void *item2)
 {
-	int itram_size = res->isize;
-	int etram_size = res->esize;
-	int i;
+	const ld10k1_tram_grp_t *g1 = *(const ld10k1_tram_grp_t **)item1;
+	const ld10k1_tram_grp_t *g2 = *(const ld10k1_tram_grp_t **)item2;
 
-	/* allocate from end */
-	for (i = 0; i < dsp_mgr->max_tram_grp; i++)
-		if (dsp_mgr->tram_grp[i].used) {
-			if (dsp_mgr->tram_grp[i].pos == TRAM_POS_INTERNAL) {
-				itram_size -= dsp_mgr->tram_grp[i].size;
-				dsp_mgr->tram_grp[i].offset = itram_size;
-			} else if (dsp_mgr->tram_grp[i].pos == TRAM_POS_EXTERNAL) {
-				etram_size -= dsp_mgr->tram_grp[i].size;
-				dsp_mgr->tram_grp[i].offset = etram_size;
-			}
-		}
-	
-	return 0;
+	/* highest offset first */
+	if (g1->offset == g2->offset)
+		return 0;
+	else if (g1->offset < g2->offset)
+		return 1;
+	else
+		return -1;
+}
+
+/* move all placed groups to end of tram - order of groups is kept */
+static void ld10k1_tram_compact(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res, int external)
+{
+	ld10k1_tram_t *tram = external ? &(dsp_mgr->e_tram) : &(dsp_mgr->i_tram);
+	unsigned int pos = external ? TRAM_POS_EXTERNAL : TRAM_POS_INTERNAL;
+	ld10k1_tram_grp_t *grps[MAX_TRAM_COUNT];
+	char deferred[MAX_TRAM_COUNT];
+	unsigned int top = tram->size;
+	int i, count;
+
+	memset(deferred, 0, sizeof(deferred));
+	for (i = 0; i < res->item_count; i++)
+		if (res->items[i].offset < 0)
+			deferred[res->items[i].grp_idx] = 1;
+
+	for (i = 0, count = 0; i < dsp_mgr->max_tram_grp; i++)
+		if (dsp_mgr->tram_grp[i].used && dsp_mgr->tram_grp[i].pos == pos && !deferred[i])
+			grps[count++] = &(dsp_mgr->tram_grp[i]);
+
+	qsort(grps, count, sizeof(ld10k1_tram_grp_t *), ld10k1_tram_compact_compare);
+
+	for (i = 0; i < count; i++) {
+		top -= grps[i]->size;
+		grps[i]->offset = top;
+	}
+
+	tram->ext_count = 0;
+	ld10k1_tram_ext_put(tram->ext, &(tram->ext_count), 0, top);
+	tram->compactions++;
 }
 
+int ld10k1_tram_place_space(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_dsp_tram_resolve_t *res)
+{
+	ld10k1_dsp_tram_resolve_item_t *item;
+	ld10k1_tram_t *tram;
+	int i, idx;
+
+	/* free blocks are same as in resolve */
+	dsp_mgr->i_tram.ext_count = res->iext_count;
+	memcpy(dsp_mgr->i_tram.ext, res->iext, sizeof(ld10k1_tram_extent_t) * res->iext_count);
+	dsp_mgr->e_tram.ext_count = res->eext_count;
+	memcpy(dsp_mgr->e_tram.ext, res->eext, sizeof(ld10k1_tram_extent_t) * res->eext_count);
+
+	for (i = 0; i < res->item_count; i++) {
+		item = &(res->items[i]);
+		if (item->offset >= 0)
+			dsp_mgr->tram_grp[item->grp_idx].offset = item->offset;
+	}
+
+	if (res->icompact)
+		ld10k1_tram_compact(dsp_mgr, res, 0);
+	if (res->ecompact)
+		ld10k1_tram_compact(dsp_mgr, res, 1);
+
+	/* place rest of groups */
+	for (i = 0; i < res->item_count; i++) {
+		item = &(res->items[i]);
+		if (item->offset >= 0)
+			continue;
+		tram = item->pos == TRAM_POS_EXTERNAL ? &(dsp_mgr->e_tram) : &(dsp_mgr->i_tram);
+		idx = ld10k1_tram_ext_best_fit(tram->ext, tram->ext_count, item->grp_size);
+		if (idx < 0)
+			return LD10K1_ERR_TRAM_FULL;
+		item->offset = ld10k1_tram_ext_take(tram->ext, &(tram->ext_count), idx, item->grp_size);
+		dsp_mgr->tram_grp[item->grp_idx].offset = item->offset;
+	}
+
+	return 0;
+}
 
 int ld10k1_tram_actualize_tram_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch)
 {
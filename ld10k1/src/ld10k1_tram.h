@@ -28,6 +28,8 @@ typedef struct {
 	unsigned int grp_acc_count;
 	unsigned int res_value;
 	unsigned int pos;
+	/* -1 - placed after compaction */
+	int offset;
 } ld10k1_dsp_tram_resolve_item_t;
 
 typedef struct {
@@ -35,15 +37,23 @@ typedef struct {
 	int ifree;
 	int iacc_count;
 	int iacc_free_count;
+	int icompact;
+	unsigned int iext_count;
+	ld10k1_tram_extent_t iext[MAX_TRAM_COUNT + 1];
 	int esize;
 	int efree;
 	int eacc_count;
 	int eacc_free_count;
+	int ecompact;
+	unsigned int eext_count;
+	ld10k1_tram_extent_t eext[MAX_TRAM_COUNT + 1];
 	int grp_free;
 	int item_count;
 	ld10k1_dsp_tram_resolve_item_t items[MAX_TRAM_COUNT];
 } ld10k1_dsp_tram_resolve_t;
 
+void ld10k1_tram_init_space(ld10k1_dsp_mgr_t *dsp_mgr);
+void ld10k1_tram_space_info(ld10k1_tram_t *tram, unsigned int *free, unsigned int *largest);
 int ld10k1_tram_reserve_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, ld10k1_dsp_tram_resolve_t *res);
 int ld10k1_tram_alloc_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch, ld10k1_dsp_tram_resolve_t *res);
 int ld10k1_tram_actualize_tram_for_patch(ld10k1_dsp_mgr_t *dsp_mgr, ld10k1_patch_t *patch);
@@ -21,6 +21,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "comm.h"
 #include "ld10k1_fnc.h"
 #include "ld10k1_error.h"
@@ -81,6 +82,44 @@ int receive_response_data_check(int conn_num, void *data, int idata_size)
 	return 0;
 }
 
+/* wire protocol negotiated by liblo10k1_check_version, indexed by connection */
+static int *conn_proto = NULL;
+static int conn_proto_count = 0;
+
+static void liblo10k1_set_proto(int conn, int proto)
+{
+	int *new_proto;
+	int new_count;
+	int i;
+
+	if (conn < 0)
+		return;
+
+	if (conn >= conn_proto_count) {
+		/* v1 is used when table can't grow */
+		if (proto == LD10K1_PROTO_V1)
+			return;
+		new_count = conn_proto_count ? conn_proto_count : 16;
+		while (new_count <= conn)
+			new_count *= 2;
+		new_proto = (int *)realloc(conn_proto, sizeof(int) * new_count);
+		if (!new_proto)
+			return;
+		for (i = conn_proto_count; i < new_count; i++)
+			new_proto[i] = LD10K1_PROTO_V1;
+		conn_proto = new_proto;
+		conn_proto_count = new_count;
+	}
+	conn_proto[conn] = proto;
+}
+
+int liblo10k1_get_proto(liblo10k1_connection_t *conn)
+{
+	if (*conn < 0 || *conn >= conn_proto_count)
+		return LD10K1_PROTO_V1;
+	return conn_proto[*conn];
+}
+
 void liblo10k1_connection_init(liblo10k1_connection_t *conn)
 {
 	*conn = 0;
@@ -105,6 +144,7 @@ int liblo10k1_connect(liblo10k1_param *param, liblo10k1_connection_t *conn)
 int liblo10k1_disconnect(liblo10k1_connection_t *conn)
 {
 	send_request(*conn, FNC_CLOSE_CONN, NULL, 0);
+	liblo10k1_set_proto(*conn, LD10K1_PROTO_V1);
 	free_comm(*conn);
 	*conn = 0;
 	return 0;
@@ -345,6 +385,48 @@ void liblo10k1_patch_free(liblo10k1_dsp_patch_t *patch)
 	free(patch);
 }
 
+/* whole patch is sent in one request */
+static int liblo10k1_patch_load_v2(liblo10k1_connection_t *conn, liblo10k1_dsp_patch_t *patch, ld10k1_fnc_patch_add_t *patch_fnc, int *loaded, int *loaded_id)
+{
+	struct iovec sect[PATCH_ADD_SECT_COUNT];
+	int tmpres[2];
+	int err;
+
+	sect[PATCH_ADD_SECT_INFO].iov_base = patch_fnc;
+	sect[PATCH_ADD_SECT_INFO].iov_len = sizeof(ld10k1_fnc_patch_add_t);
+	sect[PATCH_ADD_SECT_IN].iov_base = patch->ins;
+	sect[PATCH_ADD_SECT_IN].iov_len = sizeof(ld10k1_dsp_p_in_out_t) * patch->in_count;
+	sect[PATCH_ADD_SECT_OUT].iov_base = patch->outs;
+	sect[PATCH_ADD_SECT_OUT].iov_len = sizeof(ld10k1_dsp_p_in_out_t) * patch->out_count;
+	sect[PATCH_ADD_SECT_CONST].iov_base = patch->consts;
+	sect[PATCH_ADD_SECT_CONST].iov_len = sizeof(ld10k1_dsp_p_const_static_t) * patch->const_count;
+	sect[PATCH_ADD_SECT_STA].iov_base = patch->stas;
+	sect[PATCH_ADD_SECT_STA].iov_len = sizeof(ld10k1_dsp_p_const_static_t) * patch->sta_count;
+	sect[PATCH_ADD_SECT_HW].iov_base = patch->hws;
+	sect[PATCH_ADD_SECT_HW].iov_len = sizeof(ld10k1_dsp_p_hw_t) * patch->hw_count;
+	sect[PATCH_ADD_SECT_TRAM_GRP].iov_base = patch->tram;
+	sect[PATCH_ADD_SECT_TRAM_GRP].iov_len = sizeof(ld10k1_dsp_tram_grp_t) * patch->tram_count;
+	sect[PATCH_ADD_SECT_TRAM_ACC].iov_base = patch->tram_acc;
+	sect[PATCH_ADD_SECT_TRAM_ACC].iov_len = sizeof(ld10k1_dsp_tram_acc_t) * patch->tram_acc_count;
+	sect[PATCH_ADD_SECT_CTL].iov_base = patch->ctl;
+	sect[PATCH_ADD_SECT_CTL].iov_len = sizeof(ld10k1_dsp_ctl_t) * patch->ctl_count;
+	sect[PATCH_ADD_SECT_INSTR].iov_base = patch->instr;
+	sect[PATCH_ADD_SECT_INSTR].iov_len = sizeof(ld10k1_dsp_instr_t) * patch->instr_count;
+
+	if ((err = send_request_v2(*conn, FNC_PATCH_ADD, sect, PATCH_ADD_SECT_COUNT)) < 0)
+		return err;
+
+	if ((err = receive_response_v2(*conn, tmpres, sizeof(tmpres))) < 0)
+		return err;
+
+	if (loaded)
+		*loaded = tmpres[0];
+	if (loaded_id)
+		*loaded_id = tmpres[1];
+
+	return 0;
+}
+
 int liblo10k1_patch_load(liblo10k1_connection_t *conn, liblo10k1_dsp_patch_t *patch, int before, int *loaded, int *loaded_id)
 {
 	int err;
@@ -368,6 +450,10 @@ int liblo10k1_patch_load(liblo10k1_connection_t *conn, liblo10k1_dsp_patch_t *pa
 	/* patch */
 	/* add */
 	patch_fnc.where = before;
+
+	if (liblo10k1_get_proto(conn) >= LD10K1_PROTO_V2)
+		return liblo10k1_patch_load_v2(conn, patch, &patch_fnc, loaded, loaded_id);
+
 	if ((err = send_request_check(*conn, FNC_PATCH_ADD, &patch_fnc, sizeof(ld10k1_fnc_patch_add_t))) < 0)
 		return err;
 
@@ -467,11 +553,96 @@ int liblo10k1_patch_unload(liblo10k1_connection_t *conn, int patch_num)
 	return send_request_check(*conn, FNC_PATCH_DEL, &patch_fnc, sizeof(ld10k1_fnc_patch_del_t));
 }
 
+int liblo10k1_patch_loop_break(liblo10k1_connection_t *conn, int patch_num, int loop_break)
+{
+	ld10k1_fnc_patch_loop_break_t loop_fnc;
+
+	loop_fnc.patch_num = patch_num;
+	loop_fnc.loop_break = loop_break;
+
+	return send_request_check(*conn, FNC_PATCH_LOOP_BREAK, &loop_fnc, sizeof(ld10k1_fnc_patch_loop_break_t));
+}
+
+int liblo10k1_patch_gpr_write(liblo10k1_connection_t *conn, int patch_id, int count, unsigned int *regs, unsigned int *vals)
+{
+	char req[sizeof(ld10k1_fnc_gpr_write_t) + GPR_WRITE_MAX * sizeof(ld10k1_fnc_gpr_value_t)];
+	ld10k1_fnc_gpr_write_t *gpr_write;
+	ld10k1_fnc_gpr_value_t *values;
+	int i, done;
+	int err = 0;
+
+	gpr_write = (ld10k1_fnc_gpr_write_t *)req;
+	values = (ld10k1_fnc_gpr_value_t *)(gpr_write + 1);
+	gpr_write->patch_id = patch_id;
+
+	/* split into requests daemon accepts */
+	for (done = 0; done < count; done += gpr_write->count) {
+		gpr_write->count = count - done > GPR_WRITE_MAX ? GPR_WRITE_MAX : count - done;
+		for (i = 0; i < gpr_write->count; i++) {
+			values[i].reg = regs[done + i];
+			values[i].val = vals[done + i];
+		}
+		if ((err = send_request_check(*conn, FNC_PATCH_GPR_WRITE, req,
+			sizeof(ld10k1_fnc_gpr_write_t) + gpr_write->count * sizeof(ld10k1_fnc_gpr_value_t))) < 0)
+			break;
+	}
+
+	return err < 0 ? err : 0;
+}
+
+/* static register is staN, control register is control name with optional [index] */
+int liblo10k1_patch_find_gpr(liblo10k1_dsp_patch_t *patch, char *name, unsigned int *reg)
+{
+	unsigned int i, idx, len;
+	char *end;
+
+	if (strncmp(name, "sta", 3) == 0 && isdigit(name[3])) {
+		idx = strtoul(name + 3, &end, 10);
+		if (*end == '\0' && idx < patch->sta_count) {
+			*reg = EMU10K1_PREG_STA(idx);
+			return 0;
+		}
+	}
+
+	idx = 0;
+	len = strlen(name);
+	end = strchr(name, '[');
+	if (end && name[len - 1] == ']') {
+		idx = atoi(end + 1);
+		len = end - name;
+	}
+
+	for (i = 0; i < patch->ctl_count; i++)
+		if (strlen(patch->ctl[i].name) == len && strncmp(patch->ctl[i].name, name, len) == 0) {
+			if (idx >= patch->ctl[i].count)
+				break;
+			*reg = EMU10K1_PREG_CTL(i, idx);
+			return 0;
+		}
+
+	return LD10K1_ERR_UNKNOWN_PATCH_REG_NUM;
+}
+
 int liblo10k1_dsp_init(liblo10k1_connection_t *conn)
 {
 	return send_request_check(*conn, FNC_DSP_INIT, NULL, 0);
 }
 
+int liblo10k1_batch_begin(liblo10k1_connection_t *conn)
+{
+	return send_request_check(*conn, FNC_BATCH_BEGIN, NULL, 0);
+}
+
+int liblo10k1_batch_commit(liblo10k1_connection_t *conn)
+{
+	return send_request_check(*conn, FNC_BATCH_COMMIT, NULL, 0);
+}
+
+int liblo10k1_batch_abort(liblo10k1_connection_t *conn)
+{
+	return send_request_check(*conn, FNC_BATCH_ABORT, NULL, 0);
+}
+
 static int liblo10k1_find_any(liblo10k1_connection_t *conn, int op, int patch, char *name, int *out)
 {
 	ld10k1_fnc_name_t name_info;
@@ -952,6 +1123,66 @@ int liblo10k1_dump(liblo10k1_connection_t *conn, void **out, int *size)
 	return 0;
 }
 
+int liblo10k1_emu_run(liblo10k1_connection_t *conn, int frames,
+	int in_count, int *in_regs, int *in,
+	int out_count, int *out_regs, int *out)
+{
+	int opr, sizer;
+	int err = 0;
+	int max_frames, count, done;
+	int req_size;
+	char *req;
+	ld10k1_fnc_emu_run_t *run;
+
+	if (in_count < 0 || in_count > EMU_RUN_IO_MAX ||
+		out_count < 0 || out_count > EMU_RUN_IO_MAX)
+		return LD10K1_ERR_EMU_REG;
+
+	/* split into requests daemon accepts */
+	max_frames = (COMM_BUF_MAX_OUT - sizeof(ld10k1_fnc_emu_run_t) - (in_count + out_count) * sizeof(int)) /
+		(sizeof(int) * (in_count > out_count ? (in_count ? in_count : 1) : out_count));
+	if (max_frames > frames)
+		max_frames = frames;
+
+	req = (char *)malloc(sizeof(ld10k1_fnc_emu_run_t) + (in_count + out_count) * sizeof(int) +
+		max_frames * in_count * sizeof(int));
+	if (!req)
+		return LD10K1_ERR_NO_MEM;
+
+	run = (ld10k1_fnc_emu_run_t *)req;
+	run->in_count = in_count;
+	run->out_count = out_count;
+	memcpy(run + 1, in_regs, in_count * sizeof(int));
+	memcpy((int *)(run + 1) + in_count, out_regs, out_count * sizeof(int));
+
+	for (done = 0; done < frames; done += count) {
+		count = frames - done > max_frames ? max_frames : frames - done;
+		run->frames = count;
+		memcpy((int *)(run + 1) + in_count + out_count, in + done * in_count, count * in_count * sizeof(int));
+		req_size = sizeof(ld10k1_fnc_emu_run_t) + (in_count + out_count + count * in_count) * sizeof(int);
+
+		if ((err = send_request(*conn, FNC_EMU_RUN, req, req_size)) < 0)
+			break;
+
+		if ((err = receive_response(*conn, &opr, &sizer)) < 0)
+			break;
+
+		if (sizer != count * out_count * sizeof(int)) {
+			err = LD10K1_ERR_PROTOCOL;
+			break;
+		}
+
+		if (sizer > 0 && (err = receive_msg_data(*conn, out + done * out_count, sizer)) < 0)
+			break;
+
+		if ((err = receive_response(*conn, &opr, &sizer)) < 0)
+			break;
+	}
+
+	free(req);
+	return err < 0 ? err : 0;
+}
+
 int liblo10k1_check_version(liblo10k1_connection_t *conn)
 {
 	int opr, sizer;
@@ -974,10 +1205,16 @@ int liblo10k1_check_version(liblo10k1_connection_t *conn)
 	if ((err = receive_response(*conn, &opr, &sizer)) < 0)
 		return err;
 
-	if (strcmp(ver.ld10k1_version, VERSION) == 0)
-		return 0;
-	else
+	if (strcmp(ver.ld10k1_version, VERSION) != 0)
 		return LD10K1_ERR_WRONG_VER;
+
+	if (ver.proto_magic == LD10K1_PROTO_MAGIC && ver.proto >= LD10K1_PROTO_V3)
+		liblo10k1_set_proto(*conn, LD10K1_PROTO_V3);
+	else if (ver.proto_magic == LD10K1_PROTO_MAGIC && ver.proto >= LD10K1_PROTO_V2)
+		liblo10k1_set_proto(*conn, LD10K1_PROTO_V2);
+	else
+		liblo10k1_set_proto(*conn, LD10K1_PROTO_V1);
+	return 0;
 }
 
 int liblo10k1_get_points_info(liblo10k1_connection_t *conn, int **out, int *count)
@@ -1045,6 +1282,11 @@ int liblo10k1_get_dsp_info(liblo10k1_connection_t *conn, liblo10k1_dsp_info_t *i
 	return 0;
 }
 
+int liblo10k1_card_select(liblo10k1_connection_t *conn, int card)
+{
+	return send_request_check(*conn, FNC_CARD_SELECT, &card, sizeof(card));
+}
+
 struct errmsg_t
 {
 	int errnum;
@@ -1131,6 +1373,17 @@ struct errmsg_t error_text[] =
 	{LD10K1_ERR_REG_RENAME, "Couldn't rename register"},
 	{LD10K1_ERR_WRONG_VER, "Wrong ld10k1 version"},
 	{LD10K1_ERR_UNKNOWN_POINT, "Unknown point"},
+	{LD10K1_ERR_BATCH_ACTIVE, "Batch already started"},
+	{LD10K1_ERR_BATCH_NOT_ACTIVE, "Batch not started"},
+	{LD10K1_ERR_BATCH_OP, "Operation not allowed in batch"},
+	{LD10K1_ERR_BATCH_FAILED, "Previous operation in batch failed"},
+	{LD10K1_ERR_ASYNC_UNKNOWN_REQ, "Unknown asynchronous request"},
+	{LD10K1_ERR_EMU_NOT_ACTIVE, "DSP emulator not active"},
+	{LD10K1_ERR_EMU_REG, "Wrong emulator input or output register"},
+	{LD10K1_ERR_UNKNOWN_CARD, "Unknown card"},
+	{LD10K1_ERR_SNAPSHOT, "Wrong or damaged DSP state snapshot"},
+	{LD10K1_ERR_DRIVER_CTL_WRITE, "Unable to write control value"},
+	{LD10K1_ERR_EMU_INEXACT, "DSP emulator can not run LOG, EXP or bass/treble control exactly"},
 	
 	/* errors from liblo10k1ef */
 	{LD10K1_EF_ERR_OPEN, "Can not open file"},
@@ -0,0 +1,550 @@
+/*
+ *  EMU10k1 loader lib
+ *  Copyright (c) 2003,2004 by Peter Zubaj
+ *
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "version.h"
+#include "comm.h"
+#include "ld10k1_fnc.h"
+#include "ld10k1_error.h"
+#include "liblo10k1.h"
+#include "liblo10k1async.h"
+
+typedef struct liblo10k1_async_req_tag {
+	int id;
+	liblo10k1_async_cb_t cb;
+	void *user;
+	int err;
+	char *data;
+	int data_size;
+	int data_alloc;
+	/* result is not kept for liblo10k1_async_wait */
+	int discard;
+	struct liblo10k1_async_req_tag *next;
+} liblo10k1_async_req_t;
+
+struct liblo10k1_async_tag {
+	int conn;
+	int flags;
+	int next_id;
+
+	/* sent requests in order in which responses come */
+	liblo10k1_async_req_t *head;
+	liblo10k1_async_req_t *tail;
+	int pending;
+	/* finished requests without callback */
+	liblo10k1_async_req_t *done;
+	/* only result of last subscribe and peek request is kept */
+	int subscribe_id;
+	int peek_id;
+
+	char *out;
+	int out_pos;
+	int out_len;
+	int out_alloc;
+
+	char *in;
+	int in_len;
+	int in_alloc;
+
+	/* error after which connection can't be used */
+	int broken;
+
+	int events;
+	liblo10k1_async_event_cb_t event_cb;
+	void *event_user;
+
+	int peeking;
+	liblo10k1_async_peek_cb_t peek_cb;
+	void *peek_user;
+};
+
+static int liblo10k1_async_reserve(char **buf, int *alloc, int need)
+{
+	char *tmp;
+	int new_alloc;
+
+	if (need <= *alloc)
+		return 0;
+
+	new_alloc = *alloc ? *alloc : 4096;
+	while (new_alloc < need)
+		new_alloc *= 2;
+
+	tmp = (char *)realloc(*buf, new_alloc);
+	if (!tmp)
+		return LD10K1_ERR_NO_MEM;
+	*buf = tmp;
+	*alloc = new_alloc;
+	return 0;
+}
+
+static void liblo10k1_async_req_free(liblo10k1_async_req_t *req)
+{
+	if (req->data)
+		free(req->data);
+	free(req);
+}
+
+/* remove first request from queue and pass result to owner */
+static void liblo10k1_async_complete(liblo10k1_async_t *async, int err)
+{
+	liblo10k1_async_req_t *req;
+
+	req = async->head;
+	async->head = req->next;
+	if (!async->head)
+		async->tail = NULL;
+	async->pending--;
+
+	req->err = err;
+	req->next = NULL;
+	if (req->cb) {
+		req->cb(async, req->id, err, req->data, req->data_size, req->user);
+		liblo10k1_async_req_free(req);
+	} else if (req->discard)
+		liblo10k1_async_req_free(req);
+	else {
+		req->next = async->done;
+		async->done = req;
+	}
+}
+
+/* result of request will not be collected, it is freed now or when it finishes */
+static void liblo10k1_async_forget(liblo10k1_async_t *async, int req_id)
+{
+	liblo10k1_async_req_t *req, *prev;
+
+	for (req = async->done, prev = NULL; req; prev = req, req = req->next) {
+		if (req->id == req_id) {
+			if (prev)
+				prev->next = req->next;
+			else
+				async->done = req->next;
+			liblo10k1_async_req_free(req);
+			return;
+		}
+	}
+
+	for (req = async->head; req; req = req->next) {
+		if (req->id == req_id) {
+			req->discard = 1;
+			return;
+		}
+	}
+}
+
+/* all pending requests end with error */
+static int liblo10k1_async_fail(liblo10k1_async_t *async, int err)
+{
+	async->broken = err;
+	while (async->head)
+		liblo10k1_async_complete(async, err);
+	return err;
+}
+
+static int liblo10k1_async_flush(liblo10k1_async_t *async)
+{
+	int writed;
+
+	while (async->out_pos < async->out_len) {
+		writed = write(async->conn, async->out + async->out_pos, async->out_len - async->out_pos);
+		if (writed < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return LD10K1_ERR_COMM_WRITE;
+		}
+		async->out_pos += writed;
+	}
+
+	async->out_pos = 0;
+	async->out_len = 0;
+	return 0;
+}
+
+/* process complete responses in input buffer, returns number of finished requests */
+static int liblo10k1_async_parse(liblo10k1_async_t *async)
+{
+	struct msg_resp header;
+	ld10k1_fnc_event_t event;
+	ld10k1_fnc_peek_data_t peek;
+	liblo10k1_async_req_t *req;
+	int offset;
+	int finished;
+	int err;
+
+	offset = 0;
+	finished = 0;
+	while (async->in_len - offset >= (int)sizeof(struct msg_resp)) {
+		memcpy(&header, async->in + offset, sizeof(struct msg_resp));
+		if (header.size < 0 || header.size > COMM_BUF_MAX_OUT)
+			return LD10K1_ERR_PROTOCOL;
+		if (async->in_len - offset < (int)sizeof(struct msg_resp) + header.size)
+			break;
+
+		/* pushed event */
+		if (header.op == FNC_EVENT) {
+			if (header.size != sizeof(ld10k1_fnc_event_t))
+				return LD10K1_ERR_PROTOCOL;
+			memcpy(&event, async->in + offset + sizeof(struct msg_resp), sizeof(event));
+			if (async->event_cb)
+				async->event_cb(async, &event, async->event_user);
+			offset += sizeof(struct msg_resp) + header.size;
+			continue;
+		}
+
+		/* pushed register values */
+		if (header.op == FNC_PEEK_DATA) {
+			if (header.size < (int)sizeof(ld10k1_fnc_peek_data_t))
+				return LD10K1_ERR_PROTOCOL;
+			memcpy(&peek, async->in + offset + sizeof(struct msg_resp), sizeof(peek));
+			if (peek.count > PEEK_REG_MAX ||
+				header.size != sizeof(ld10k1_fnc_peek_data_t) + peek.count * sizeof(unsigned int))
+				return LD10K1_ERR_PROTOCOL;
+			if (async->peek_cb)
+				async->peek_cb(async, peek.seq, peek.count,
+					(unsigned int *)(async->in + offset + sizeof(struct msg_resp) + sizeof(peek)),
+					async->peek_user);
+			offset += sizeof(struct msg_resp) + header.size;
+			continue;
+		}
+
+		req = async->head;
+		if (!req)
+			return LD10K1_ERR_PROTOCOL;
+
+		if (header.op == FNC_CONTINUE && header.err >= 0) {
+			if ((err = liblo10k1_async_reserve(&(req->data), &(req->data_alloc), req->data_size + header.size)) < 0)
+				return err;
+			memcpy(req->data + req->data_size, async->in + offset + sizeof(struct msg_resp), header.size);
+			req->data_size += header.size;
+		} else {
+			if (header.err < 0)
+				err = header.err;
+			else if (header.op != FNC_OK)
+				err = LD10K1_ERR_PROTOCOL;
+			else
+				err = 0;
+			liblo10k1_async_complete(async, err);
+			finished++;
+		}
+		offset += sizeof(struct msg_resp) + header.size;
+	}
+
+	if (offset) {
+		memmove(async->in, async->in + offset, async->in_len - offset);
+		async->in_len -= offset;
+	}
+	return finished;
+}
+
+static int liblo10k1_async_read(liblo10k1_async_t *async)
+{
+	int readed;
+	int err;
+
+	while (1) {
+		if ((err = liblo10k1_async_reserve(&(async->in), &(async->in_alloc), async->in_len + 4096)) < 0)
+			return err;
+
+		readed = read(async->conn, async->in + async->in_len, async->in_alloc - async->in_len);
+		if (readed < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return LD10K1_ERR_COMM_READ;
+		}
+		/* ld10k1 closed connection */
+		if (readed == 0)
+			return LD10K1_ERR_COMM_READ;
+		async->in_len += readed;
+	}
+}
+
+int liblo10k1_async_open(liblo10k1_connection_t *conn, liblo10k1_async_t **async)
+{
+	liblo10k1_async_t *tmp;
+
+	tmp = (liblo10k1_async_t *)malloc(sizeof(liblo10k1_async_t));
+	if (!tmp)
+		return LD10K1_ERR_NO_MEM;
+	memset(tmp, 0, sizeof(liblo10k1_async_t));
+
+	tmp->conn = *conn;
+	tmp->next_id = 1;
+	tmp->flags = fcntl(tmp->conn, F_GETFL, 0);
+	if (tmp->flags < 0 || fcntl(tmp->conn, F_SETFL, tmp->flags | O_NONBLOCK) < 0) {
+		free(tmp);
+		return LD10K1_ERR_COMM_CONN;
+	}
+
+	*async = tmp;
+	return 0;
+}
+
+/* ends subscription and peek feed and waits for pending requests, so connection can be used by blocking functions again */
+void liblo10k1_async_close(liblo10k1_async_t *async)
+{
+	liblo10k1_async_req_t *req;
+
+	/* blocking functions don't expect events */
+	if (async->events && !async->broken)
+		liblo10k1_async_subscribe(async, 0, NULL, NULL);
+	if (async->peeking && !async->broken)
+		liblo10k1_async_peek(async, 0, 0, NULL, NULL, NULL, NULL);
+
+	while (async->pending && !async->broken)
+		liblo10k1_async_wait(async, async->tail->id, NULL, NULL);
+	liblo10k1_async_fail(async, LD10K1_ERR_COMM_CONN);
+
+	while (async->done) {
+		req = async->done;
+		async->done = req->next;
+		liblo10k1_async_req_free(req);
+	}
+
+	fcntl(async->conn, F_SETFL, async->flags);
+
+	if (async->out)
+		free(async->out);
+	if (async->in)
+		free(async->in);
+	free(async);
+}
+
+int liblo10k1_async_fd(liblo10k1_async_t *async)
+{
+	return async->conn;
+}
+
+/* poll events needed by connection */
+int liblo10k1_async_events(liblo10k1_async_t *async)
+{
+	if (async->out_len > async->out_pos)
+		return POLLIN | POLLOUT;
+	return POLLIN;
+}
+
+int liblo10k1_async_pending(liblo10k1_async_t *async)
+{
+	return async->pending;
+}
+
+/* returns request id, request must be complete in one message */
+int liblo10k1_async_submit(liblo10k1_async_t *async, int op, void *data, int data_size, liblo10k1_async_cb_t cb, void *user)
+{
+	liblo10k1_async_req_t *req;
+	struct msg_req header;
+	int err;
+
+	if (async->broken)
+		return async->broken;
+
+	/* no response comes */
+	if (op == FNC_CLOSE_CONN || data_size < 0)
+		return LD10K1_ERR_PROTOCOL;
+
+	req = (liblo10k1_async_req_t *)malloc(sizeof(liblo10k1_async_req_t));
+	if (!req)
+		return LD10K1_ERR_NO_MEM;
+	memset(req, 0, sizeof(liblo10k1_async_req_t));
+
+	if ((err = liblo10k1_async_reserve(&(async->out), &(async->out_alloc), async->out_len + sizeof(header) + data_size)) < 0) {
+		free(req);
+		return err;
+	}
+
+	header.op = op;
+	header.size = data_size;
+	memcpy(async->out + async->out_len, &header, sizeof(header));
+	async->out_len += sizeof(header);
+	if (data_size > 0) {
+		memcpy(async->out + async->out_len, data, data_size);
+		async->out_len += data_size;
+	}
+
+	req->id = async->next_id++;
+	req->cb = cb;
+	req->user = user;
+	if (async->tail)
+		async->tail->next = req;
+	else
+		async->head = req;
+	async->tail = req;
+	async->pending++;
+
+	if ((err = liblo10k1_async_flush(async)) < 0)
+		return liblo10k1_async_fail(async, err);
+	return req->id;
+}
+
+/* handle revents from poll, returns number of finished requests */
+int liblo10k1_async_dispatch(liblo10k1_async_t *async, int revents)
+{
+	int err;
+
+	if (async->broken)
+		return async->broken;
+
+	if (revents & POLLOUT) {
+		if ((err = liblo10k1_async_flush(async)) < 0)
+			return liblo10k1_async_fail(async, err);
+	}
+
+	if (revents & (POLLIN | POLLHUP | POLLERR)) {
+		err = liblo10k1_async_read(async);
+		/* responses received before close are still valid */
+		if (err < 0) {
+			liblo10k1_async_parse(async);
+			return liblo10k1_async_fail(async, err);
+		}
+		if ((err = liblo10k1_async_parse(async)) < 0)
+			return liblo10k1_async_fail(async, err);
+		return err;
+	}
+	return 0;
+}
+
+/*
+ * block until request is finished, returns its result, data must be freed
+ * by caller. Result of request with callback is passed only to callback.
+ */
+int liblo10k1_async_wait(liblo10k1_async_t *async, int req_id, void **data, int *data_size)
+{
+	liblo10k1_async_req_t *req, *prev;
+	struct pollfd pfd;
+	int queued;
+	int err;
+
+	if (data)
+		*data = NULL;
+	if (data_size)
+		*data_size = 0;
+
+	if (req_id <= 0 || req_id >= async->next_id)
+		return LD10K1_ERR_ASYNC_UNKNOWN_REQ;
+
+	while (1) {
+		for (req = async->done, prev = NULL; req; prev = req, req = req->next) {
+			if (req->id == req_id) {
+				if (prev)
+					prev->next = req->next;
+				else
+					async->done = req->next;
+				err = req->err;
+				if (data) {
+					*data = req->data;
+					req->data = NULL;
+				}
+				if (data_size)
+					*data_size = req->data_size;
+				liblo10k1_async_req_free(req);
+				return err;
+			}
+		}
+
+		queued = 0;
+		for (req = async->head; req; req = req->next) {
+			if (req->id == req_id) {
+				queued = 1;
+				break;
+			}
+		}
+		/* finished by callback or collected before */
+		if (!queued)
+			return 0;
+
+		if (async->broken)
+			return async->broken;
+
+		pfd.fd = async->conn;
+		pfd.events = liblo10k1_async_events(async);
+		pfd.revents = 0;
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return liblo10k1_async_fail(async, LD10K1_ERR_COMM_READ);
+		}
+
+		/* on error request is finished with it */
+		liblo10k1_async_dispatch(async, pfd.revents);
+	}
+}
+
+/*
+ * events are mask of EVENT_*, 0 ends subscription, returns request id.
+ * Result can be collected by liblo10k1_async_wait until next subscribe.
+ */
+int liblo10k1_async_subscribe(liblo10k1_async_t *async, int events, liblo10k1_async_event_cb_t cb, void *user)
+{
+	int req_id;
+
+	async->events = events;
+	async->event_cb = cb;
+	async->event_user = user;
+	liblo10k1_async_forget(async, async->subscribe_id);
+	req_id = liblo10k1_async_submit(async, FNC_SUBSCRIBE, &events, sizeof(events), NULL, NULL);
+	async->subscribe_id = req_id > 0 ? req_id : 0;
+	return req_id;
+}
+
+/*
+ * values of count patch registers every interval ms, count 0 ends feed, returns request id.
+ * Result can be collected by liblo10k1_async_wait until next peek.
+ */
+int liblo10k1_async_peek(liblo10k1_async_t *async, unsigned int interval, int count, int *patch_ids, unsigned int *regs,
+	liblo10k1_async_peek_cb_t cb, void *user)
+{
+	char req[sizeof(ld10k1_fnc_peek_t) + PEEK_REG_MAX * sizeof(ld10k1_fnc_peek_reg_t)];
+	ld10k1_fnc_peek_t *peek;
+	ld10k1_fnc_peek_reg_t *peek_regs;
+	int req_id;
+	int i;
+
+	if (count < 0 || count > PEEK_REG_MAX)
+		return LD10K1_ERR_PROTOCOL;
+
+	peek = (ld10k1_fnc_peek_t *)req;
+	peek_regs = (ld10k1_fnc_peek_reg_t *)(peek + 1);
+	peek->interval = interval;
+	peek->count = count;
+	for (i = 0; i < count; i++) {
+		peek_regs[i].patch_id = patch_ids[i];
+		peek_regs[i].reg = regs[i];
+	}
+
+	async->peeking = count > 0;
+	async->peek_cb = cb;
+	async->peek_user = user;
+	liblo10k1_async_forget(async, async->peek_id);
+	req_id = liblo10k1_async_submit(async, FNC_PEEK_SUBSCRIBE, req,
+		sizeof(ld10k1_fnc_peek_t) + count * sizeof(ld10k1_fnc_peek_reg_t), NULL, NULL);
+	async->peek_id = req_id > 0 ? req_id : 0;
+	return req_id;
+}
@@ -22,6 +22,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "version.h"
 #include "ld10k1.h"
@@ -52,15 +57,20 @@ int liblo10k1lf_save_file_info(FILE *file, liblo10k1_file_info_t *fi);
 int liblo10k1lf_save_part(FILE *file, unsigned int part_type, unsigned int part_id, unsigned int part_length, void *data);
 int liblo10k1lf_find_part(FILE *file, unsigned int part_type, unsigned int part_id, unsigned int part_length, liblo10k1_file_part_t *part);
 int liblo10k1lf_find_part_il(FILE *file, unsigned int part_type, unsigned int part_id, unsigned int part_length, int il, liblo10k1_file_part_t *part);
+static int liblo10k1lf_save_toc(FILE *file, char **data, size_t *size);
+static int liblo10k1lf_write_file(char *file_name, char *data, size_t size);
 
 int liblo10k1lf_save_dsp_config(liblo10k1_file_dsp_setup_t *c, char *file_name, liblo10k1_file_info_t *fi)
 {
 	FILE *file = NULL;
+	char *data = NULL;
+	size_t size = 0;
 	int err;
 	
-	file = fopen(file_name, "w");
+	/* whole file is created in memory and then written at once */
+	file = open_memstream(&data, &size);
 	if (!file)
-		return LD10K1_LF_ERR_OPEN;
+		return LD10K1_ERR_NO_MEM;
 		
 	if ((err = liblo10k1lf_save_file_header(file, LD10K1_FP_INFO_FILE_TYPE_DSP_SETUP)) < 0)
 		goto err;
@@ -71,10 +81,18 @@ int liblo10k1lf_save_dsp_config(liblo10k1_file_dsp_setup_t *c, char *file_name,
 	if ((err =  liblo10k1lf_save_dsp_setup(c, file)) < 0)
 		goto err;
 		
-	fclose(file);
-	return 0;
+	if ((err = liblo10k1lf_save_toc(file, &data, &size)) < 0)
+		goto err;
+		
+	if (fclose(file) != 0)
+		err = LD10K1_LF_ERR_WRITE;
+	else
+		err = liblo10k1lf_write_file(file_name, data, size);
+	free(data);
+	return err;
 err:
 	fclose(file);
+	free(data);
 	return err;
 }
 
@@ -619,6 +637,187 @@ int liblo10k1lf_dsp_config_set_point_count(liblo10k1_file_dsp_setup_t *c, int co
 	return 0;	
 }
 
+/* section must hold exactly count items */
+static int liblo10k1lf_state_sect_check(struct iovec *sect, unsigned int count, unsigned int size)
+{
+	if (count > sect->iov_len / size || sect->iov_len != count * size)
+		return LD10K1_ERR_PROTOCOL;
+	return 0;
+}
+
+static int liblo10k1lf_state_part(char **ptr, unsigned int *left, void *part, unsigned int count, unsigned int size)
+{
+	if (count > *left / size)
+		return LD10K1_ERR_PROTOCOL;
+	if (count)
+		memcpy(part, *ptr, count * size);
+	*ptr += count * size;
+	*left -= count * size;
+	return 0;
+}
+
+/* one patch from patch section of state, counts are checked before alloc */
+static int liblo10k1lf_state_patch(char **ptr, unsigned int *left, liblo10k1_dsp_patch_t **opatch)
+{
+	ld10k1_dsp_patch_t info;
+	liblo10k1_dsp_patch_t *patch;
+	unsigned long long need;
+	int err;
+
+	if (*left < sizeof(info))
+		return LD10K1_ERR_PROTOCOL;
+	memcpy(&info, *ptr, sizeof(info));
+	*ptr += sizeof(info);
+	*left -= sizeof(info);
+
+	need = (unsigned long long)sizeof(liblo10k1_dsp_pio_t) * ((unsigned long long)info.in_count + info.out_count) +
+		(unsigned long long)sizeof(liblo10k1_dsp_cs_t) * ((unsigned long long)info.const_count + info.static_count) +
+		(unsigned long long)sizeof(liblo10k1_dsp_hw_t) * info.hw_count +
+		(unsigned long long)sizeof(liblo10k1_dsp_tram_grp_t) * info.tram_count +
+		(unsigned long long)sizeof(liblo10k1_dsp_tram_acc_t) * info.tram_acc_count +
+		(unsigned long long)sizeof(liblo10k1_dsp_ctl_t) * info.ctl_count +
+		(unsigned long long)sizeof(liblo10k1_dsp_instr_t) * info.instr_count;
+	if (need > *left)
+		return LD10K1_ERR_PROTOCOL;
+
+	patch = liblo10k1_patch_alloc(info.in_count, info.out_count, info.const_count, info.static_count, info.dynamic_count, info.hw_count, info.tram_count, info.tram_acc_count, info.ctl_count, info.instr_count);
+	if (!patch)
+		return LD10K1_ERR_NO_MEM;
+
+	info.patch_name[MAX_NAME_LEN - 1] = '\0';
+	strcpy(patch->patch_name, info.patch_name);
+
+	if ((err = liblo10k1lf_state_part(ptr, left, patch->ins, patch->in_count, sizeof(liblo10k1_dsp_pio_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->outs, patch->out_count, sizeof(liblo10k1_dsp_pio_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->consts, patch->const_count, sizeof(liblo10k1_dsp_cs_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->stas, patch->sta_count, sizeof(liblo10k1_dsp_cs_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->hws, patch->hw_count, sizeof(liblo10k1_dsp_hw_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->tram, patch->tram_count, sizeof(liblo10k1_dsp_tram_grp_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->tram_acc, patch->tram_acc_count, sizeof(liblo10k1_dsp_tram_acc_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->ctl, patch->ctl_count, sizeof(liblo10k1_dsp_ctl_t))) < 0 ||
+		(err = liblo10k1lf_state_part(ptr, left, patch->instr, patch->instr_count, sizeof(liblo10k1_dsp_instr_t))) < 0) {
+		liblo10k1_patch_free(patch);
+		return err;
+	}
+
+	*opatch = patch;
+	return 0;
+}
+
+/* whole dsp setup with one FNC_GET_STATE request, needs LD10K1_PROTO_V3 */
+int liblo10k1lf_get_dsp_state(liblo10k1_connection_t *conn, liblo10k1_file_dsp_setup_t **setup)
+{
+	ld10k1_fnc_state_t state;
+	struct iovec sect[STATE_SECT_COUNT];
+	void *arena;
+	liblo10k1_file_dsp_setup_t *s;
+	char *ptr;
+	unsigned int left;
+	int opr, sizer;
+	int err;
+	int i, j;
+
+	arena = NULL;
+	s = liblo10k1lf_dsp_config_alloc();
+	if (!s)
+		return LD10K1_ERR_NO_MEM;
+
+	if ((err = send_request(*conn, FNC_GET_STATE, NULL, 0)) < 0)
+		goto err;
+
+	if ((err = receive_response(*conn, &opr, &sizer)) < 0)
+		goto err;
+
+	if (opr != FNC_CONTINUE) {
+		err = LD10K1_ERR_PROTOCOL;
+		goto err;
+	}
+
+	if ((err = receive_msg_v2(*conn, sizer, &arena, sect, STATE_SECT_COUNT)) < 0)
+		goto err;
+
+	if (err != STATE_SECT_COUNT) {
+		err = LD10K1_ERR_PROTOCOL;
+		goto err;
+	}
+
+	/* final response */
+	if ((err = receive_response(*conn, &opr, &sizer)) < 0)
+		goto err;
+
+	err = LD10K1_ERR_PROTOCOL;
+	if (sect[STATE_SECT_INFO].iov_len != sizeof(state))
+		goto err;
+	memcpy(&state, sect[STATE_SECT_INFO].iov_base, sizeof(state));
+
+	s->dsp_type = LD10K1_FP_INFO_DSP_TYPE_EMU10K1;
+	if (state.chip_type == CHIP_AUDIGY)
+		s->dsp_type = LD10K1_FP_INFO_DSP_TYPE_EMU10K2;
+
+	if (liblo10k1lf_state_sect_check(&sect[STATE_SECT_FX], state.fx_count, sizeof(liblo10k1_get_io_t)) < 0 ||
+		liblo10k1lf_state_sect_check(&sect[STATE_SECT_IN], state.in_count, sizeof(liblo10k1_get_io_t)) < 0 ||
+		liblo10k1lf_state_sect_check(&sect[STATE_SECT_OUT], state.out_count, sizeof(liblo10k1_get_io_t)) < 0 ||
+		liblo10k1lf_state_sect_check(&sect[STATE_SECT_POINT], state.point_count, sizeof(liblo10k1_point_info_t)) < 0)
+		goto err;
+
+	/* every patch has at least its info */
+	if (state.patch_count > sect[STATE_SECT_PATCH].iov_len / sizeof(ld10k1_dsp_patch_t))
+		goto err;
+
+	if ((err = liblo10k1lf_dsp_config_set_fx_count(s, state.fx_count)) < 0)
+		goto err;
+	if (s->fx_count)
+		memcpy(s->fxs, sect[STATE_SECT_FX].iov_base, sect[STATE_SECT_FX].iov_len);
+
+	if ((err = liblo10k1lf_dsp_config_set_in_count(s, state.in_count)) < 0)
+		goto err;
+	if (s->in_count)
+		memcpy(s->ins, sect[STATE_SECT_IN].iov_base, sect[STATE_SECT_IN].iov_len);
+
+	if ((err = liblo10k1lf_dsp_config_set_out_count(s, state.out_count)) < 0)
+		goto err;
+	if (s->out_count)
+		memcpy(s->outs, sect[STATE_SECT_OUT].iov_base, sect[STATE_SECT_OUT].iov_len);
+
+	if ((err = liblo10k1lf_dsp_config_set_patch_count(s, state.patch_count)) < 0)
+		goto err;
+
+	ptr = (char *)sect[STATE_SECT_PATCH].iov_base;
+	left = sect[STATE_SECT_PATCH].iov_len;
+	for (i = 0; i < s->patch_count; i++) {
+		if ((err = liblo10k1lf_state_patch(&ptr, &left, &(s->patches[i]))) < 0)
+			goto err;
+	}
+
+	err = LD10K1_ERR_PROTOCOL;
+	if (left)
+		goto err;
+
+	if ((err = liblo10k1lf_dsp_config_set_point_count(s, state.point_count)) < 0)
+		goto err;
+	if (s->point_count)
+		memcpy(s->points, sect[STATE_SECT_POINT].iov_base, sect[STATE_SECT_POINT].iov_len);
+
+	/* points already have patch index */
+	err = LD10K1_ERR_PROTOCOL;
+	for (i = 0; i < s->point_count; i++) {
+		if (s->points[i].conn_count > POINT_MAX_CONN_PER_POINT)
+			goto err;
+		for (j = 0; j < s->points[i].conn_count; j++)
+			if (s->points[i].patch[j] >= s->patch_count)
+				goto err;
+	}
+
+	free(arena);
+	*setup = s;
+	return 0;
+err:
+	if (arena)
+		free(arena);
+	liblo10k1lf_dsp_config_free(s);
+	return err;
+}
+
 int liblo10k1lf_get_dsp_config(liblo10k1_connection_t *conn, liblo10k1_file_dsp_setup_t **setup)
 {
 	liblo10k1_dsp_info_t info;
@@ -632,6 +831,9 @@ int liblo10k1lf_get_dsp_config(liblo10k1_connection_t *conn, liblo10k1_file_dsp_
 	
 	int *points;
 
+	if (liblo10k1_get_proto(conn) >= LD10K1_PROTO_V3)
+		return liblo10k1lf_get_dsp_state(conn, setup);
+
 	plist = NULL;
 	points = NULL;
 	s = liblo10k1lf_dsp_config_alloc();
@@ -786,10 +988,14 @@ int liblo10k1lf_put_dsp_config(liblo10k1_connection_t *conn, liblo10k1_file_dsp_
 	
 	memset(trans_nums, 0, sizeof(int) * setup->patch_count);
 	
+	/* patches and connections are uploaded to dsp at once */
+	if ((err = liblo10k1_batch_begin(conn)) < 0)
+		goto err;
+
 	/* load all patches - remember ids */
 	for (i = 0; i < setup->patch_count; i++) {
 		if ((err = liblo10k1_patch_load(conn, setup->patches[i], -1, &loaded, &loaded_id)) < 0)
-			goto err;
+			goto err_batch;
 		trans_nums[i] = loaded;
 	}
 	
@@ -826,12 +1032,12 @@ int liblo10k1lf_put_dsp_config(liblo10k1_connection_t *conn, liblo10k1_file_dsp_
 					if ((err = liblo10k1_con_add(conn, j == 0 ? 0 : setup->points[i].multi,
 						setup->points[i].simple, CON_IO_PIN, pnum, setup->points[i].io[j],
 						tout_type, tpout, tout, NULL)) < 0)
-						goto err;
+						goto err_batch;
 				} else {
 					if ((err = liblo10k1_con_add(conn, j == 0 ? 0 : setup->points[i].multi,
 						setup->points[i].simple, CON_IO_POUT, pnum, setup->points[i].io[j],
 						tin_type, tpin, tin, NULL)) < 0)
-						goto err;
+						goto err_batch;
 				}
 			}
 		} else {
@@ -846,12 +1052,16 @@ int liblo10k1lf_put_dsp_config(liblo10k1_connection_t *conn, liblo10k1_file_dsp_
 				if ((err = liblo10k1_con_add(conn, j == 0 ? 0 : setup->points[i].multi,
 					setup->points[i].simple, setup->points[i].io_type[j] ? CON_IO_POUT : CON_IO_PIN, pnum, setup->points[i].io[j],
 					tin_type, tpin, tin, NULL)) < 0)
-					goto err;
+					goto err_batch;
 			}
 		}
 	}
 	
-	return 0;
+	err = liblo10k1_batch_commit(conn);
+	free(trans_nums);
+	return err;
+err_batch:
+	liblo10k1_batch_abort(conn);
 err:
 	if (trans_nums)
 		free(trans_nums);
@@ -1278,33 +1488,542 @@ err:
 	return err;
 }
 
+/*
+ * Reader of mapped file. Table of all parts is taken from end of file
+ * or built in one pass, part lookups walk this table - nested parts are
+ * skipped at once.
+ */
+typedef struct {
+	char *data;
+	unsigned int size;
+	liblo10k1_file_toc_entry_t *toc;
+	unsigned int toc_count;
+	/* index of next part to read */
+	unsigned int pos;
+} liblo10k1lf_map_t;
+
+static int liblo10k1lf_map_build_toc(liblo10k1lf_map_t *map)
+{
+	liblo10k1_file_part_t part;
+	liblo10k1_file_toc_entry_t *tmp;
+	liblo10k1_file_toc_entry_t *entry;
+	unsigned int *tmp_starts;
+	unsigned int *starts = NULL;
+	unsigned int start_count = 0, toc_max = 0;
+	unsigned int offset;
+	
+	for (offset = sizeof(liblo10k1_file_header_t); map->size - offset >= sizeof(liblo10k1_file_part_t);) {
+		memcpy(&part, map->data + offset, sizeof(liblo10k1_file_part_t));
+		offset += sizeof(liblo10k1_file_part_t);
+		
+		/* truncated part ends file */
+		if (part.part_type == LD10K1_FP_TYPE_NORMAL && part.part_length > map->size - offset)
+			break;
+		
+		if (map->toc_count >= toc_max) {
+			toc_max = toc_max ? toc_max * 2 : 256;
+			tmp = (liblo10k1_file_toc_entry_t *)realloc(map->toc, sizeof(liblo10k1_file_toc_entry_t) * toc_max);
+			if (!tmp)
+				goto err;
+			map->toc = tmp;
+			/* every start part can be open */
+			tmp_starts = (unsigned int *)realloc(starts, sizeof(unsigned int) * toc_max);
+			if (!tmp_starts)
+				goto err;
+			starts = tmp_starts;
+		}
+		
+		entry = &(map->toc[map->toc_count]);
+		entry->part_type = part.part_type;
+		entry->part_id = part.part_id;
+		entry->part_length = part.part_length;
+		entry->offset = offset;
+		entry->next = map->toc_count + 1;
+		
+		if (part.part_type == LD10K1_FP_TYPE_NORMAL)
+			offset += part.part_length;
+		else if (part.part_type == LD10K1_FP_TYPE_END) {
+			if (start_count > 0)
+				map->toc[starts[--start_count]].next = map->toc_count + 1;
+		} else
+			starts[start_count++] = map->toc_count;
+		map->toc_count++;
+	}
+	
+	/* start parts without end part are skipped to end of file */
+	while (start_count > 0)
+		map->toc[starts[--start_count]].next = map->toc_count;
+	
+	if (starts)
+		free(starts);
+	return 0;
+err:
+	if (starts)
+		free(starts);
+	return LD10K1_ERR_NO_MEM;
+}
+
+/* table of contents written by saving, damaged one is not used */
+static int liblo10k1lf_map_load_toc(liblo10k1lf_map_t *map)
+{
+	liblo10k1_file_toc_end_t toc_end;
+	liblo10k1_file_part_t part;
+	liblo10k1_file_toc_entry_t *entry;
+	unsigned int toc_length, toc_offset;
+	unsigned int i;
+	
+	if (map->size - sizeof(liblo10k1_file_header_t) < sizeof(liblo10k1_file_part_t) + sizeof(toc_end))
+		return LD10K1_LF_ERR_READ;
+	
+	memcpy(&toc_end, map->data + map->size - sizeof(toc_end), sizeof(toc_end));
+	if (strncmp(toc_end.signature, LD10K1_FILE_TOC_SIGNATURE, sizeof(toc_end.signature)) != 0)
+		return LD10K1_LF_ERR_SIGNATURE;
+	
+	/* toc part must fill rest of file */
+	if (toc_end.entry_count > (map->size - sizeof(liblo10k1_file_header_t) - sizeof(liblo10k1_file_part_t) - sizeof(toc_end)) / sizeof(liblo10k1_file_toc_entry_t))
+		return LD10K1_LF_ERR_PART_SIZE;
+	
+	toc_length = toc_end.entry_count * sizeof(liblo10k1_file_toc_entry_t) + sizeof(toc_end);
+	toc_offset = map->size - toc_length;
+	memcpy(&part, map->data + toc_offset - sizeof(liblo10k1_file_part_t), sizeof(liblo10k1_file_part_t));
+	if (part.part_type != LD10K1_FP_TYPE_NORMAL || part.part_id != LD10K1_FP_TOC || part.part_length != toc_length)
+		return LD10K1_LF_ERR_PART_SIZE;
+	
+	if (toc_end.entry_count > 0) {
+		map->toc = (liblo10k1_file_toc_entry_t *)malloc(toc_end.entry_count * sizeof(liblo10k1_file_toc_entry_t));
+		if (!map->toc)
+			return LD10K1_ERR_NO_MEM;
+		memcpy(map->toc, map->data + toc_offset, toc_end.entry_count * sizeof(liblo10k1_file_toc_entry_t));
+	}
+	map->toc_count = toc_end.entry_count;
+	
+	/* all parts must be inside of file before toc */
+	for (i = 0; i < map->toc_count; i++) {
+		entry = &(map->toc[i]);
+		if (entry->next <= i || entry->next > map->toc_count ||
+			entry->offset < sizeof(liblo10k1_file_header_t) + sizeof(liblo10k1_file_part_t) ||
+			entry->offset > toc_offset)
+			goto err;
+		if (entry->part_type == LD10K1_FP_TYPE_NORMAL) {
+			if (entry->part_length > toc_offset - entry->offset)
+				goto err;
+		} else if (entry->part_type != LD10K1_FP_TYPE_START && entry->part_type != LD10K1_FP_TYPE_END)
+			goto err;
+	}
+	return 0;
+err:
+	if (map->toc)
+		free(map->toc);
+	map->toc = NULL;
+	map->toc_count = 0;
+	return LD10K1_LF_ERR_PART_TYPE;
+}
+
+static void liblo10k1lf_map_close(liblo10k1lf_map_t *map)
+{
+	if (map->toc)
+		free(map->toc);
+	if (map->data)
+		munmap(map->data, map->size);
+	memset(map, 0, sizeof(liblo10k1lf_map_t));
+}
+
+static int liblo10k1lf_map_open(liblo10k1lf_map_t *map, char *file_name)
+{
+	struct stat file_stat;
+	void *data;
+	int fd;
+	int err;
+	
+	memset(map, 0, sizeof(liblo10k1lf_map_t));
+	
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+		return LD10K1_LF_ERR_OPEN;
+	
+	if (fstat(fd, &file_stat) < 0) {
+		close(fd);
+		return LD10K1_LF_ERR_OPEN;
+	}
+	
+	if (file_stat.st_size < sizeof(liblo10k1_file_header_t)) {
+		close(fd);
+		return LD10K1_LF_ERR_READ;
+	}
+	
+	data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return LD10K1_LF_ERR_READ;
+	
+	map->data = (char *)data;
+	map->size = file_stat.st_size;
+	
+	if (liblo10k1lf_map_load_toc(map) >= 0)
+		return 0;
+	
+	if ((err = liblo10k1lf_map_build_toc(map)) < 0) {
+		liblo10k1lf_map_close(map);
+		return err;
+	}
+	return 0;
+}
+
+/* append table of contents of data written to memory file */
+static int liblo10k1lf_save_toc(FILE *file, char **data, size_t *size)
+{
+	liblo10k1lf_map_t map;
+	liblo10k1_file_toc_end_t toc_end;
+	char *toc_data;
+	unsigned int toc_length;
+	int err;
+	
+	/* data and size are valid after flush */
+	if (fflush(file) != 0)
+		return LD10K1_LF_ERR_WRITE;
+	
+	memset(&map, 0, sizeof(liblo10k1lf_map_t));
+	map.data = *data;
+	map.size = *size;
+	if ((err = liblo10k1lf_map_build_toc(&map)) < 0)
+		return err;
+	
+	toc_length = map.toc_count * sizeof(liblo10k1_file_toc_entry_t) + sizeof(toc_end);
+	toc_data = (char *)malloc(toc_length);
+	if (!toc_data) {
+		err = LD10K1_ERR_NO_MEM;
+		goto err;
+	}
+	
+	if (map.toc_count > 0)
+		memcpy(toc_data, map.toc, map.toc_count * sizeof(liblo10k1_file_toc_entry_t));
+	toc_end.entry_count = map.toc_count;
+	memcpy(toc_end.signature, LD10K1_FILE_TOC_SIGNATURE, sizeof(toc_end.signature));
+	memcpy(toc_data + toc_length - sizeof(toc_end), &toc_end, sizeof(toc_end));
+	
+	err = liblo10k1lf_save_part(file, LD10K1_FP_TYPE_NORMAL, LD10K1_FP_TOC, toc_length, toc_data);
+	free(toc_data);
+err:
+	if (map.toc)
+		free(map.toc);
+	return err;
+}
+
+/* old file is replaced only by completely written new file */
+static int liblo10k1lf_write_file(char *file_name, char *data, size_t size)
+{
+	char *tmp_name;
+	ssize_t written;
+	size_t pos;
+	int fd;
+	
+	tmp_name = (char *)malloc(strlen(file_name) + 5);
+	if (!tmp_name)
+		return LD10K1_ERR_NO_MEM;
+	sprintf(tmp_name, "%s.tmp", file_name);
+	
+	fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		free(tmp_name);
+		return LD10K1_LF_ERR_OPEN;
+	}
+	
+	/* whole file at once, more writes only if it is cut */
+	for (pos = 0; pos < size; pos += written) {
+		written = write(fd, data + pos, size - pos);
+		if (written < 0) {
+			if (errno != EINTR)
+				goto err;
+			written = 0;
+		}
+	}
+	
+	if (fsync(fd) < 0)
+		goto err;
+	
+	if (close(fd) < 0) {
+		fd = -1;
+		goto err;
+	}
+	fd = -1;
+	
+	if (rename(tmp_name, file_name) < 0)
+		goto err;
+	
+	free(tmp_name);
+	return 0;
+err:
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp_name);
+	free(tmp_name);
+	return LD10K1_LF_ERR_WRITE;
+}
+
+/* same as liblo10k1lf_find_part_il - other parts on the way are skipped */
+static int liblo10k1lf_map_find_part(liblo10k1lf_map_t *map, unsigned int part_type, unsigned int part_id, unsigned int part_length, int il, liblo10k1_file_toc_entry_t **part)
+{
+	liblo10k1_file_toc_entry_t *entry;
+	
+	while (map->pos < map->toc_count) {
+		entry = &(map->toc[map->pos]);
+		if (entry->part_type == part_type && entry->part_id == part_id) {
+			map->pos++;
+			if (entry->part_type == LD10K1_FP_TYPE_NORMAL) {
+				if (!il && entry->part_length != part_length)
+					return LD10K1_LF_ERR_PART_SIZE;
+			} else if (entry->part_length != 0)
+				return LD10K1_LF_ERR_PART_SIZE;
+			*part = entry;
+			return 0;
+		}
+		map->pos = entry->next;
+	}
+	return LD10K1_LF_ERR_READ;
+}
+
+static int liblo10k1lf_map_load_part_ws(liblo10k1lf_map_t *map, unsigned int part_id, unsigned int part_length, void *where)
+{
+	liblo10k1_file_toc_entry_t *part;
+	int err;
+	
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_NORMAL, part_id, part_length, 0, &part)) < 0)
+		return err;
+	
+	memcpy(where, map->data + part->offset, part_length);
+	return 0;
+}
+
+/* list of count parts with same size between start and end part */
+static int liblo10k1lf_map_load_list(liblo10k1lf_map_t *map, unsigned int ptl, unsigned int pt, unsigned int size, void *where, int count)
+{
+	liblo10k1_file_toc_entry_t *part;
+	int i, err;
+	
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_START, ptl, 0, 0, &part)) < 0)
+		return err;
+	
+	for (i = 0; i < count; i++) {
+		if ((err = liblo10k1lf_map_load_part_ws(map, pt, size, (char *)where + i * size)) < 0)
+			return err;
+	}
+	
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_END, ptl, 0, 0, &part)) < 0)
+		return err;
+	return 0;
+}
+
+static int liblo10k1lf_map_can_load_file(liblo10k1lf_map_t *map, unsigned int ft)
+{
+	liblo10k1_file_header_t fhdr;
+	liblo10k1_file_part_info_t file_info;
+	int err;
+	
+	memcpy(&fhdr, map->data, sizeof(liblo10k1_file_header_t));
+	
+	/* check signature */
+	if (strncmp(fhdr.signature, LD10K1_FILE_SIGNATURE, sizeof(fhdr.signature)) != 0)
+		return LD10K1_LF_ERR_SIGNATURE;
+	
+	/* now load file info part & check version */
+	if ((err = liblo10k1lf_map_load_part_ws(map, LD10K1_FP_INFO, sizeof(file_info), &file_info)) < 0)
+		return err;
+	
+	if (file_info.minimal_reader_version_major > CREATER_MAJOR)
+		return LD10K1_LF_ERR_VERSION;
+	
+	if (file_info.minimal_reader_version_major == CREATER_MAJOR &&
+		file_info.minimal_reader_version_minor > CREATER_MINOR)
+		return LD10K1_LF_ERR_VERSION;
+	
+	if (file_info.minimal_reader_version_major == CREATER_MAJOR &&
+		file_info.minimal_reader_version_minor == CREATER_MINOR &&
+		file_info.minimal_reader_version_subminor > CREATER_SUBMINOR)
+		return LD10K1_LF_ERR_VERSION;
+	
+	/* check file type */
+	if (file_info.file_type != ft)
+		return LD10K1_LF_ERR_FILE_TYPE;
+	
+	return 0;
+}
+
+static int liblo10k1lf_map_load_string_info(liblo10k1lf_map_t *map, int id, char **str)
+{
+	liblo10k1_file_toc_entry_t *part;
+	char *tmp;
+	int err;
+	
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_NORMAL, id, 0, 1, &part)) < 0)
+		return err;
+	
+	tmp = NULL;
+	if (part->part_length > 0) {
+		tmp = (char *)malloc(part->part_length);
+		if (!tmp)
+			return LD10K1_ERR_NO_MEM;
+		memcpy(tmp, map->data + part->offset, part->part_length);
+		/* string is not terminated in damaged file */
+		tmp[part->part_length - 1] = '\0';
+	}
+	
+	if (*str)
+		free(*str);
+	*str = tmp;
+	return 0;
+}
+
+static int liblo10k1lf_map_load_file_info(liblo10k1lf_map_t *map, liblo10k1_file_info_t **fi)
+{
+	int err;
+	
+	liblo10k1_file_info_t *i = liblo10k1lf_file_info_alloc();
+	
+	if (!i)
+		return LD10K1_ERR_NO_MEM;
+	
+	if ((err = liblo10k1lf_map_load_string_info(map, LD10K1_FP_FILE_INFO_NAME, &(i->name))) < 0)
+		goto err;
+	if ((err = liblo10k1lf_map_load_string_info(map, LD10K1_FP_FILE_INFO_DESC, &(i->desc))) < 0)
+		goto err;
+	if ((err = liblo10k1lf_map_load_string_info(map, LD10K1_FP_FILE_INFO_CREATER, &(i->creater))) < 0)
+		goto err;
+	if ((err = liblo10k1lf_map_load_string_info(map, LD10K1_FP_FILE_INFO_AUTHOR, &(i->author))) < 0)
+		goto err;
+	if ((err = liblo10k1lf_map_load_string_info(map, LD10K1_FP_FILE_INFO_COPYRIGHT, &(i->copyright))) < 0)
+		goto err;
+	if ((err = liblo10k1lf_map_load_string_info(map, LD10K1_FP_FILE_INFO_LICENCE, &(i->license))) < 0)
+		goto err;
+	
+	*fi = i;
+	return 0;
+err:
+	liblo10k1lf_file_info_free(i);
+	return err;
+}
+
+static int liblo10k1lf_map_load_patch(liblo10k1lf_map_t *map, liblo10k1_dsp_patch_t **p)
+{
+	liblo10k1_file_toc_entry_t *part;
+	liblo10k1_file_patch_info_t pinfo;
+	liblo10k1_dsp_patch_t *patch = NULL;
+	int err;
+	
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_START, LD10K1_FP_PATCH, 0, 0, &part)) < 0)
+		return err;
+	
+	/* patch info */
+	if ((err = liblo10k1lf_map_load_part_ws(map, LD10K1_FP_PATCH_INFO, sizeof(liblo10k1_file_patch_info_t), &pinfo)) < 0)
+		return err;
+	
+	patch = liblo10k1_patch_alloc(pinfo.in_count, pinfo.out_count, pinfo.const_count, pinfo.sta_count, pinfo.dyn_count, 
+		pinfo.hw_count, pinfo.tram_count, pinfo.tram_acc_count, pinfo.ctl_count, pinfo.instr_count);
+	if (!patch)
+		return LD10K1_ERR_NO_MEM;
+	
+	strncpy(patch->patch_name, pinfo.patch_name, MAX_NAME_LEN - 1);
+	patch->patch_name[MAX_NAME_LEN - 1] = '\0';
+	
+	if ((err = liblo10k1lf_map_load_list(map, LD10K1_FP_PIN_LIST, LD10K1_FP_PIO, sizeof(liblo10k1_dsp_pio_t), patch->ins, patch->in_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_POUT_LIST, LD10K1_FP_PIO, sizeof(liblo10k1_dsp_pio_t), patch->outs, patch->out_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_CONST_LIST, LD10K1_FP_CS, sizeof(liblo10k1_dsp_cs_t), patch->consts, patch->const_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_STA_LIST, LD10K1_FP_CS, sizeof(liblo10k1_dsp_cs_t), patch->stas, patch->sta_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_HW_LIST, LD10K1_FP_HW, sizeof(liblo10k1_dsp_hw_t), patch->hws, patch->hw_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_TRAM_LIST, LD10K1_FP_TRAM, sizeof(liblo10k1_dsp_tram_grp_t), patch->tram, patch->tram_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_TRAM_ACC_LIST, LD10K1_FP_TRAM_ACC, sizeof(liblo10k1_dsp_tram_acc_t), patch->tram_acc, patch->tram_acc_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_CTL_LIST, LD10K1_FP_CTL, sizeof(liblo10k1_dsp_ctl_t), patch->ctl, patch->ctl_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_INSTR_LIST, LD10K1_FP_INSTR, sizeof(liblo10k1_dsp_instr_t), patch->instr, patch->instr_count)) < 0)
+		goto err;
+	
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_END, LD10K1_FP_PATCH, 0, 0, &part)) < 0)
+		goto err;
+	
+	*p = patch;
+	return 0;
+err:
+	liblo10k1_patch_free(patch);
+	return err;
+}
+
+static int liblo10k1lf_map_load_dsp_setup(liblo10k1lf_map_t *map, liblo10k1_file_dsp_setup_t **c)
+{
+	liblo10k1_file_toc_entry_t *part;
+	liblo10k1_file_part_dsp_setup_t setup;
+	liblo10k1_file_dsp_setup_t *cfg;
+	int err;
+	int i;
+	
+	if ((err = liblo10k1lf_map_load_part_ws(map, LD10K1_FP_DSP_SETUP, sizeof(setup), &setup)) < 0)
+		return err;
+	
+	cfg = liblo10k1lf_dsp_config_alloc();
+	if (!cfg)
+		return LD10K1_ERR_NO_MEM;
+	
+	cfg->dsp_type = setup.dsp_type;
+	
+	/* alloc space */
+	if ((err = liblo10k1lf_dsp_config_set_fx_count(cfg, setup.fx_count)) < 0 ||
+		(err = liblo10k1lf_dsp_config_set_in_count(cfg, setup.in_count)) < 0 ||
+		(err = liblo10k1lf_dsp_config_set_out_count(cfg, setup.out_count)) < 0 ||
+		(err = liblo10k1lf_dsp_config_set_patch_count(cfg, setup.patch_count)) < 0 ||
+		(err = liblo10k1lf_dsp_config_set_point_count(cfg, setup.point_count)) < 0)
+		goto err;
+	
+	if ((err = liblo10k1lf_map_load_list(map, LD10K1_FP_FX_LIST, LD10K1_FP_FX, sizeof(liblo10k1_get_io_t), cfg->fxs, cfg->fx_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_IN_LIST, LD10K1_FP_IN, sizeof(liblo10k1_get_io_t), cfg->ins, cfg->in_count)) < 0 ||
+		(err = liblo10k1lf_map_load_list(map, LD10K1_FP_OUT_LIST, LD10K1_FP_OUT, sizeof(liblo10k1_get_io_t), cfg->outs, cfg->out_count)) < 0)
+		goto err;
+	
+	/* load patches */
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_START, LD10K1_FP_PATCH_LIST, 0, 0, &part)) < 0)
+		goto err;
+	
+	for (i = 0; i < cfg->patch_count; i++) {
+		if ((err = liblo10k1lf_map_load_patch(map, &(cfg->patches[i]))) < 0)
+			goto err;
+	}
+	
+	if ((err = liblo10k1lf_map_find_part(map, LD10K1_FP_TYPE_END, LD10K1_FP_PATCH_LIST, 0, 0, &part)) < 0)
+		goto err;
+	
+	/* load points */
+	if ((err = liblo10k1lf_map_load_list(map, LD10K1_FP_POINT_LIST, LD10K1_FP_POINT, sizeof(liblo10k1_point_info_t), cfg->points, cfg->point_count)) < 0)
+		goto err;
+	
+	*c = cfg;
+	return 0;
+err:
+	liblo10k1lf_dsp_config_free(cfg);
+	return err;
+}
+
 int liblo10k1lf_load_dsp_config(liblo10k1_file_dsp_setup_t **c, char *file_name, liblo10k1_file_info_t **fi)
 {
-	FILE *file = NULL;
+	liblo10k1lf_map_t map;
 	int err;
 	
 	liblo10k1_file_info_t *i = NULL;
 	
-	file = fopen(file_name, "r");
-	if (!file)
-		return LD10K1_LF_ERR_OPEN;
+	if ((err = liblo10k1lf_map_open(&map, file_name)) < 0)
+		return err;
 		
-	if ((err = liblo10k1lf_can_load_file(file, LD10K1_FP_INFO_FILE_TYPE_DSP_SETUP)) < 0)
+	if ((err = liblo10k1lf_map_can_load_file(&map, LD10K1_FP_INFO_FILE_TYPE_DSP_SETUP)) < 0)
 		goto err;
 		
-	if ((err =  liblo10k1lf_load_file_info(file, &i)) < 0)
+	if ((err = liblo10k1lf_map_load_file_info(&map, &i)) < 0)
 		goto err;
 		
-	if ((err =  liblo10k1lf_load_dsp_setup(c, file)) < 0)
+	if ((err = liblo10k1lf_map_load_dsp_setup(&map, c)) < 0)
 		goto err;
 		
 	*fi = i;
-	fclose(file);
+	liblo10k1lf_map_close(&map);
 	return 0;
 err:
 	if (i)
 		liblo10k1lf_file_info_free(i);
-	fclose(file);
+	liblo10k1lf_map_close(&map);
 	return err;
 }
 
@@ -1335,11 +2054,14 @@ void liblo10k1lf_file_info_free(liblo10k1_file_info_t *fi)
 int liblo10k1lf_save_dsp_patch(liblo10k1_dsp_patch_t *p, char *file_name, liblo10k1_file_info_t *fi)
 {
 	FILE *file = NULL;
+	char *data = NULL;
+	size_t size = 0;
 	int err;
 	
-	file = fopen(file_name, "w");
+	/* whole file is created in memory and then written at once */
+	file = open_memstream(&data, &size);
 	if (!file)
-		return LD10K1_LF_ERR_OPEN;
+		return LD10K1_ERR_NO_MEM;
 		
 	if ((err = liblo10k1lf_save_file_header(file, LD10K1_FP_INFO_FILE_TYPE_PATCH)) < 0)
 		goto err;
@@ -1350,39 +2072,46 @@ int liblo10k1lf_save_dsp_patch(liblo10k1_dsp_patch_t *p, char *file_name, liblo1
 	if ((err =  liblo10k1lf_save_patch(p, file)) < 0)
 		goto err;
 		
-	fclose(file);
-	return 0;
+	if ((err = liblo10k1lf_save_toc(file, &data, &size)) < 0)
+		goto err;
+		
+	if (fclose(file) != 0)
+		err = LD10K1_LF_ERR_WRITE;
+	else
+		err = liblo10k1lf_write_file(file_name, data, size);
+	free(data);
+	return err;
 err:
 	fclose(file);
+	free(data);
 	return err;
 }
 
 int liblo10k1lf_load_dsp_patch(liblo10k1_dsp_patch_t **p, char *file_name, liblo10k1_file_info_t **fi)
 {
-	FILE *file = NULL;
+	liblo10k1lf_map_t map;
 	int err;
 	
 	liblo10k1_file_info_t *i = NULL;
 	
-	file = fopen(file_name, "r");
-	if (!file)
-		return LD10K1_LF_ERR_OPEN;
+	if ((err = liblo10k1lf_map_open(&map, file_name)) < 0)
+		return err;
 		
-	if ((err = liblo10k1lf_can_load_file(file, LD10K1_FP_INFO_FILE_TYPE_PATCH)) < 0)
+	if ((err = liblo10k1lf_map_can_load_file(&map, LD10K1_FP_INFO_FILE_TYPE_PATCH)) < 0)
 		goto err;
 		
-	if ((err =  liblo10k1lf_load_file_info(file, &i)) < 0)
+	if ((err = liblo10k1lf_map_load_file_info(&map, &i)) < 0)
 		goto err;
 		
-	if ((err =  liblo10k1lf_load_patch(p, file)) < 0)
+	if ((err = liblo10k1lf_map_load_patch(&map, p)) < 0)
 		goto err;
 		
 	*fi = i;
-	fclose(file);
+	liblo10k1lf_map_close(&map);
 	return 0;
 err:
 	if (i)
 		liblo10k1lf_file_info_free(i);
-	fclose(file);
+	liblo10k1lf_map_close(&map);
 	return err;
 }
@@ -26,6 +26,8 @@
 #include <ctype.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -41,6 +43,7 @@
 #include "liblo10k1.h"
 #include "liblo10k1ef.h"
 #include "liblo10k1lf.h"
+#include "liblo10k1async.h"
 
 char comm_pipe[256];
 liblo10k1_connection_t conn;
@@ -63,6 +66,7 @@ static void help(char *command)
 		"\nAvailable options:\n"
 		"  -h, --help           this help\n"
 		"  -p, --pipe_name      connect to this, default = /tmp/.ld10k1_port\n"
+		"      --card           index of card in ld10k1 command line, default = 0\n"
 		"  -l, --list           dump lkoaded patch\n"
 		"  -i, --info           print some info\n"
 		"  -s, --setup          setup DSP\n"
@@ -81,6 +85,12 @@ static void help(char *command)
 		"  -P, --path           include path\n"
 		"      --store          store DSP setup\n"
 		"      --restore        restore DSP setup\n"
+		"      --emu_run        run 16 bit wav or raw file through emulated DSP (infile:outfile)\n"
+		"      --emu_io         emulator inputs and outputs, default = fx0,fx1:out0,out1\n"
+		"      --loop_break     break feedback loops at patch (num or num:0 to clear)\n"
+		"      --gpr_write      set registers of patch without reload (id:sta0=val,ctl_name[1]=val)\n"
+		"      --peek           print registers of patch periodically (id:sta0,ctl_name[1],out_name)\n"
+		"      --peek_interval  peek interval in ms and count of printed frames, default = 100:0 (forever)\n"
 		, command);
 }
 
@@ -895,6 +905,223 @@ static int del_patch(char *file_name)
 	return 0;
 }
 
+static int loop_break(char *arg)
+{
+	int err;
+	char *tmp;
+	int on = 1;
+
+	tmp = strchr(arg, ':');
+	if (tmp)
+		on = atoi(tmp + 1);
+
+	if ((err = liblo10k1_patch_loop_break(&conn, atoi(arg), on)) < 0) {
+		error("unable to set loop break (ld10k1 error:%s)", liblo10k1_error_str(err));
+		return err;
+	}
+
+	return 0;
+}
+
+#define GPR_WRITE_ARG_MAX 256
+
+/* register names are resolved in patch read from ld10k1 */
+static int get_patch_by_id(int patch_id, liblo10k1_dsp_patch_t **p)
+{
+	int err;
+	int i, patch_num, pcount;
+	liblo10k1_patches_info_t *plist = NULL;
+
+	if ((err = liblo10k1_get_patches_info(&conn, &plist, &pcount)) < 0) {
+		error("unable to get patches info (ld10k1 error:%s)", liblo10k1_error_str(err));
+		return err;
+	}
+	patch_num = -1;
+	for (i = 0; i < pcount; i++)
+		if (plist[i].id == patch_id)
+			patch_num = plist[i].patch_num;
+	if (plist)
+		free(plist);
+	if (patch_num < 0) {
+		error("patch with id %d not found", patch_id);
+		return 1;
+	}
+
+	if ((err = liblo10k1_patch_get(&conn, patch_num, p)) < 0) {
+		error("unable to get dsp patch (ld10k1 error:%s)", liblo10k1_error_str(err));
+		return err;
+	}
+	return 0;
+}
+
+static int gpr_write(char *arg)
+{
+	int err;
+	char *str, *item, *val, *next;
+	int patch_id, count;
+	unsigned int regs[GPR_WRITE_ARG_MAX];
+	unsigned int vals[GPR_WRITE_ARG_MAX];
+	liblo10k1_dsp_patch_t *p = NULL;
+
+	str = strdup(arg);
+	if (!str) {
+		error("no mem");
+		return 1;
+	}
+
+	err = 1;
+	item = strchr(str, ':');
+	if (!item) {
+		error("wrong gpr write argument - %s", arg);
+		goto err;
+	}
+	*item++ = '\0';
+	patch_id = atoi(str);
+
+	if ((err = get_patch_by_id(patch_id, &p)))
+		goto err;
+
+	for (count = 0; item && *item; item = next) {
+		next = strchr(item, ',');
+		if (next)
+			*next++ = '\0';
+		val = strchr(item, '=');
+		if (!val || count >= GPR_WRITE_ARG_MAX) {
+			error("wrong gpr write argument - %s", item);
+			err = 1;
+			goto err;
+		}
+		*val++ = '\0';
+		if ((err = liblo10k1_patch_find_gpr(p, item, &(regs[count]))) < 0) {
+			error("unknown register %s", item);
+			goto err;
+		}
+		vals[count++] = strtoul(val, NULL, 0);
+	}
+
+	if ((err = liblo10k1_patch_gpr_write(&conn, patch_id, count, regs, vals)) < 0) {
+		error("unable to write registers (ld10k1 error:%s)", liblo10k1_error_str(err));
+		goto err;
+	}
+
+	err = 0;
+err:
+	if (p)
+		liblo10k1_patch_free(p);
+	free(str);
+	return err;
+}
+
+static void peek_print(liblo10k1_async_t *async, unsigned int seq, unsigned int count, unsigned int *values, void *user)
+{
+	unsigned int i;
+
+	printf("%6u", seq);
+	for (i = 0; i < count; i++)
+		printf(" 0x%08x", values[i]);
+	printf("\n");
+	fflush(stdout);
+	(*(int *)user)++;
+}
+
+static int peek(char *arg, char *interval_arg)
+{
+	int err;
+	char *str, *item, *next, *tmp;
+	int patch_id, count, i;
+	int patch_ids[PEEK_REG_MAX];
+	unsigned int regs[PEEK_REG_MAX];
+	unsigned int interval = 100;
+	int frames = 0, received = 0;
+	liblo10k1_dsp_patch_t *p = NULL;
+	liblo10k1_async_t *async = NULL;
+	struct pollfd pfd;
+
+	if (interval_arg) {
+		interval = atoi(interval_arg);
+		tmp = strchr(interval_arg, ':');
+		if (tmp)
+			frames = atoi(tmp + 1);
+	}
+
+	str = strdup(arg);
+	if (!str) {
+		error("no mem");
+		return 1;
+	}
+
+	err = 1;
+	item = strchr(str, ':');
+	if (!item) {
+		error("wrong peek argument - %s", arg);
+		goto err;
+	}
+	*item++ = '\0';
+	patch_id = atoi(str);
+
+	if ((err = get_patch_by_id(patch_id, &p)))
+		goto err;
+
+	for (count = 0; item && *item; item = next) {
+		next = strchr(item, ',');
+		if (next)
+			*next++ = '\0';
+		if (count >= PEEK_REG_MAX) {
+			error("too many registers");
+			err = 1;
+			goto err;
+		}
+		/* outputs can be peeked too */
+		for (i = 0; i < p->out_count; i++)
+			if (strcmp(p->outs[i].name, item) == 0)
+				break;
+		if (i < p->out_count)
+			regs[count] = EMU10K1_PREG_OUT(i);
+		else if ((err = liblo10k1_patch_find_gpr(p, item, &(regs[count]))) < 0) {
+			error("unknown register %s", item);
+			goto err;
+		}
+		patch_ids[count++] = patch_id;
+	}
+
+	if ((err = liblo10k1_async_open(&conn, &async)) < 0) {
+		error("unable to switch connection to async mode (ld10k1 error:%s)", liblo10k1_error_str(err));
+		goto err;
+	}
+
+	if ((err = liblo10k1_async_peek(async, interval, count, patch_ids, regs, peek_print, &received)) < 0 ||
+		(err = liblo10k1_async_wait(async, err, NULL, NULL)) < 0) {
+		error("unable to start peek feed (ld10k1 error:%s)", liblo10k1_error_str(err));
+		goto err;
+	}
+
+	while (!frames || received < frames) {
+		pfd.fd = liblo10k1_async_fd(async);
+		pfd.events = liblo10k1_async_events(async);
+		pfd.revents = 0;
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error("peek feed ended");
+			err = 1;
+			goto err;
+		}
+		if ((err = liblo10k1_async_dispatch(async, pfd.revents)) < 0) {
+			error("peek feed ended (ld10k1 error:%s)", liblo10k1_error_str(err));
+			goto err;
+		}
+	}
+
+	err = 0;
+err:
+	if (async)
+		liblo10k1_async_close(async);
+	if (p)
+		liblo10k1_patch_free(p);
+	free(str);
+	return err;
+}
+
 static int setup_dsp()
 {
 	int err;
@@ -1399,6 +1626,206 @@ static int dump(char *file_name)
 	return 0;
 }
 
+#define EMU_RUN_CHUNK 4096
+
+static unsigned int emu_get_le(unsigned char *buf, int size)
+{
+	unsigned int val = 0;
+
+	while (size--)
+		val = (val << 8) | buf[size];
+	return val;
+}
+
+static void emu_put_le(unsigned char *buf, unsigned int val, int size)
+{
+	while (size--) {
+		*buf++ = val & 0xFF;
+		val >>= 8;
+	}
+}
+
+/* parse list like fx0,in2,out1 */
+static int emu_parse_regs(char *list, int *regs)
+{
+	int count = 0;
+	char *reg;
+
+	for (reg = strtok(list, ","); reg; reg = strtok(NULL, ",")) {
+		if (count >= EMU_RUN_IO_MAX)
+			return -1;
+		if (strncmp(reg, "fx", 2) == 0)
+			regs[count] = EMU10K1_REG_FX(atoi(reg + 2));
+		else if (strncmp(reg, "out", 3) == 0)
+			regs[count] = EMU10K1_REG_OUT(atoi(reg + 3));
+		else if (strncmp(reg, "in", 2) == 0)
+			regs[count] = EMU10K1_REG_IN(atoi(reg + 2));
+		else
+			return -1;
+		count++;
+	}
+	return count;
+}
+
+/* skip wav header - returns channel count, 0 for raw file */
+static int emu_read_wav_header(FILE *file, unsigned int *rate)
+{
+	unsigned char hdr[12];
+	unsigned char fmt[16];
+	unsigned int len;
+	int channels = 0;
+
+	if (fread(hdr, 1, 12, file) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) {
+		rewind(file);
+		return 0;
+	}
+
+	while (fread(hdr, 1, 8, file) == 8) {
+		len = emu_get_le(hdr + 4, 4);
+		if (!memcmp(hdr, "data", 4))
+			return channels ? channels : -1;
+		if (!memcmp(hdr, "fmt ", 4) && len >= 16) {
+			if (fread(fmt, 1, 16, file) != 16)
+				return -1;
+			/* only 16 bit pcm */
+			if (emu_get_le(fmt, 2) != 1 || emu_get_le(fmt + 14, 2) != 16)
+				return -1;
+			channels = emu_get_le(fmt + 2, 2);
+			*rate = emu_get_le(fmt + 4, 4);
+			len -= 16;
+		}
+		if (fseek(file, len + (len & 1), SEEK_CUR) < 0)
+			return -1;
+	}
+	return -1;
+}
+
+static int emu_write_wav_header(FILE *file, int channels, unsigned int rate, unsigned int frames)
+{
+	unsigned char hdr[44];
+	unsigned int data_size = frames * channels * 2;
+
+	memcpy(hdr, "RIFF", 4);
+	emu_put_le(hdr + 4, 36 + data_size, 4);
+	memcpy(hdr + 8, "WAVEfmt ", 8);
+	emu_put_le(hdr + 16, 16, 4);
+	emu_put_le(hdr + 20, 1, 2);
+	emu_put_le(hdr + 22, channels, 2);
+	emu_put_le(hdr + 24, rate, 4);
+	emu_put_le(hdr + 28, rate * channels * 2, 4);
+	emu_put_le(hdr + 32, channels * 2, 2);
+	emu_put_le(hdr + 34, 16, 2);
+	memcpy(hdr + 36, "data", 4);
+	emu_put_le(hdr + 40, data_size, 4);
+
+	return fwrite(hdr, 1, sizeof(hdr), file) == sizeof(hdr) ? 0 : -1;
+}
+
+static int emu_run(char *files, char *io)
+{
+	int err = 1;
+	char *out_name, *out_io;
+	char io_buf[256];
+	int in_regs[EMU_RUN_IO_MAX], out_regs[EMU_RUN_IO_MAX];
+	int in_count, out_count;
+	int channels;
+	unsigned int rate = 48000;
+	unsigned int total = 0;
+	int frames, i;
+
+	FILE *in_file = NULL;
+	FILE *out_file = NULL;
+	unsigned char *in_buf = NULL, *out_buf = NULL;
+	int *in_val = NULL, *out_val = NULL;
+
+	strncpy(io_buf, io ? io : "fx0,fx1:out0,out1", sizeof(io_buf) - 1);
+	io_buf[sizeof(io_buf) - 1] = '\0';
+	out_io = strchr(io_buf, ':');
+	out_name = strchr(files, ':');
+	if (!out_io || !out_name) {
+		error("wrong emu_run or emu_io argument");
+		return 1;
+	}
+	*out_io++ = '\0';
+	*out_name++ = '\0';
+
+	in_count = emu_parse_regs(io_buf, in_regs);
+	out_count = emu_parse_regs(out_io, out_regs);
+	if (in_count <= 0 || out_count <= 0) {
+		error("wrong emu_io argument");
+		return 1;
+	}
+
+	in_file = fopen(files, "r");
+	if (!in_file) {
+		error("unable to open %s", files);
+		goto err;
+	}
+
+	channels = emu_read_wav_header(in_file, &rate);
+	if (channels < 0 || (channels > 0 && channels != in_count)) {
+		error("wrong wav file or channel count does not match inputs");
+		goto err;
+	}
+
+	out_file = fopen(out_name, "w");
+	if (!out_file) {
+		error("unable to open %s", out_name);
+		goto err;
+	}
+
+	/* space for header, rewritten at end */
+	if (channels && emu_write_wav_header(out_file, out_count, rate, 0) < 0)
+		goto e_write;
+
+	in_buf = (unsigned char *)malloc(EMU_RUN_CHUNK * in_count * 2);
+	out_buf = (unsigned char *)malloc(EMU_RUN_CHUNK * out_count * 2);
+	in_val = (int *)malloc(EMU_RUN_CHUNK * in_count * sizeof(int));
+	out_val = (int *)malloc(EMU_RUN_CHUNK * out_count * sizeof(int));
+	if (!in_buf || !out_buf || !in_val || !out_val) {
+		error("no mem");
+		goto err;
+	}
+
+	while ((frames = fread(in_buf, in_count * 2, EMU_RUN_CHUNK, in_file)) > 0) {
+		/* 16 bit samples are high bits of dsp registers */
+		for (i = 0; i < frames * in_count; i++)
+			in_val[i] = (int)(short)emu_get_le(in_buf + i * 2, 2) * 65536;
+
+		if ((err = liblo10k1_emu_run(&conn, frames, in_count, in_regs, in_val, out_count, out_regs, out_val)) < 0) {
+			error("unable to run emulator (ld10k1 error:%s)", liblo10k1_error_str(err));
+			goto err;
+		}
+
+		for (i = 0; i < frames * out_count; i++)
+			emu_put_le(out_buf + i * 2, (unsigned int)(out_val[i] >> 16), 2);
+
+		if (fwrite(out_buf, out_count * 2, frames, out_file) != frames)
+			goto e_write;
+		total += frames;
+	}
+
+	if (channels && (fseek(out_file, 0, SEEK_SET) < 0 ||
+		emu_write_wav_header(out_file, out_count, rate, total) < 0))
+		goto e_write;
+
+	err = 0;
+	goto err;
+e_write:
+	error("unable to write %s", out_name);
+	err = 1;
+err:
+	free(in_buf);
+	free(out_buf);
+	free(in_val);
+	free(out_val);
+	if (in_file)
+		fclose(in_file);
+	if (out_file)
+		fclose(out_file);
+	return err;
+}
+
 static int store_dsp(char *file_name)
 {
 	int err;
@@ -1481,6 +1908,13 @@ int main(int argc, char *argv[])
 	int option_index = 0;
 	char *opt_dump_name;
 	char *opt_host;
+	char *opt_emu_run;
+	char *opt_emu_io;
+	char *opt_loop_break;
+	char *opt_gpr_write;
+	char *opt_peek;
+	char *opt_peek_interval;
+	int opt_card;
 	char *tmp = NULL;
 	
 	int opt_store;
@@ -1519,6 +1953,13 @@ int main(int argc, char *argv[])
 				{"load_patch", 1, 0, 0},
 				{"save_patch", 1, 0, 0},
 				{"wait", 1, 0, 0},
+				{"emu_run", 1, 0, 0},
+				{"emu_io", 1, 0, 0},
+				{"loop_break", 1, 0, 0},
+				{"gpr_write", 1, 0, 0},
+				{"peek", 1, 0, 0},
+				{"peek_interval", 1, 0, 0},
+				{"card", 1, 0, 0},
 				{0, 0, 0, 0}
 	};
 
@@ -1538,6 +1979,13 @@ int main(int argc, char *argv[])
 	opt_setup = 0;
 	opt_dump_name = NULL;
 	opt_host = NULL;
+	opt_emu_run = NULL;
+	opt_emu_io = NULL;
+	opt_loop_break = NULL;
+	opt_gpr_write = NULL;
+	opt_peek = NULL;
+	opt_peek_interval = NULL;
+	opt_card = -1;
 	
 	opt_store = 0;
 	opt_restore = 0;
@@ -1578,6 +2026,20 @@ int main(int argc, char *argv[])
 				opt_dump_name = optarg;
 			else if (strcmp(long_options[option_index].name, "host") == 0)
 				opt_host = optarg;
+			else if (strcmp(long_options[option_index].name, "emu_run") == 0)
+				opt_emu_run = optarg;
+			else if (strcmp(long_options[option_index].name, "emu_io") == 0)
+				opt_emu_io = optarg;
+			else if (strcmp(long_options[option_index].name, "loop_break") == 0)
+				opt_loop_break = optarg;
+			else if (strcmp(long_options[option_index].name, "gpr_write") == 0)
+				opt_gpr_write = optarg;
+			else if (strcmp(long_options[option_index].name, "peek") == 0)
+				opt_peek = optarg;
+			else if (strcmp(long_options[option_index].name, "peek_interval") == 0)
+				opt_peek_interval = optarg;
+			else if (strcmp(long_options[option_index].name, "card") == 0)
+				opt_card = atoi(optarg);
 			else if (strcmp(long_options[option_index].name, "wait") == 0) {
 				opt_wait_for_conn = atoi(optarg);
 				if (opt_wait_for_conn < 0)
@@ -1672,6 +2134,11 @@ int main(int argc, char *argv[])
 			error("Wrong ld10k1 version");
 			break;
 		}
+
+		if (opt_card >= 0 && (err = liblo10k1_card_select(&conn, opt_card))) {
+			error("unable to select card %i", opt_card);
+			break;
+		}
 		
 		if (opt_store || opt_restore) {
 			if (opt_store) {
@@ -1724,6 +2191,22 @@ int main(int argc, char *argv[])
 			if (opt_dump_name)
 				if ((err = dump(opt_dump_name)))
 					break;
+
+			if (opt_emu_run)
+				if ((err = emu_run(opt_emu_run, opt_emu_io)))
+					break;
+
+			if (opt_loop_break)
+				if ((err = loop_break(opt_loop_break)))
+					break;
+
+			if (opt_gpr_write)
+				if ((err = gpr_write(opt_gpr_write)))
+					break;
+
+			if (opt_peek)
+				if ((err = peek(opt_peek, opt_peek_interval)))
+					break;
 		}
 		break;
 	}	